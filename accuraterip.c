@@ -0,0 +1,482 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libretro.h>
+#include <streams/file_stream.h>
+#include <file/file_path.h>
+#include <encodings/crc32.h>
+#include <retro_miscellaneous.h>
+
+#include "accuraterip.h"
+#include "simd.h"
+
+/* the gap between the audio and the data session of an enhanced CD, which belongs to neither */
+#define ACCURATERIP_SESSION_GAP 11400
+
+/* a track as the checksums see it, from its index 1 to that of the next track */
+typedef struct
+{
+   int64_t start;          /* frames from LBA 0 */
+   int64_t end;
+   int64_t audio_start;    /* frames of audio tracks before it */
+   int64_t check_start;    /* the frames of the track that are summed up */
+   int64_t check_end;
+   int64_t checked;        /* of those, how many were added */
+   uint32_t lo;            /* sum of the low halves of the products, which is v1 */
+   uint32_t hi;            /* and of the high ones, v2 is both */
+   bool audio;
+} accuraterip_extent_t;
+
+struct accuraterip
+{
+   accuraterip_extent_t track[99];
+   unsigned num_tracks;
+   int read_offset;
+   int64_t audio_frames;
+   uint32_t crc;
+   int64_t crc_next;       /* audio frame the CRC goes on with */
+   bool crc_broken;
+};
+
+/* Adds every frame, left in the low half and right in the high half of a 32 bit word, times its
+ * multiplier to lo and hi, which receive the low and high 32 bits of the 64 bit products. The
+ * multiplier of the first frame is given and grows by one per frame. */
+typedef void (*accuraterip_sum_t)(const int16_t *samples, size_t frames, uint32_t multiplier, uint32_t *lo, uint32_t *hi);
+
+static void accuraterip_sum_c(const int16_t *samples, size_t frames, uint32_t multiplier, uint32_t *lo, uint32_t *hi)
+{
+   uint32_t sum_lo = *lo;
+   uint32_t sum_hi = *hi;
+   size_t i;
+
+   for (i = 0; i < frames; i++)
+   {
+      uint32_t value = (uint32_t)(uint16_t)samples[(i * 2) + 0] | ((uint32_t)(uint16_t)samples[(i * 2) + 1] << 16);
+      uint64_t product = (uint64_t)value * (uint32_t)(multiplier + i);
+
+      sum_lo += (uint32_t)product;
+      sum_hi += (uint32_t)(product >> 32);
+   }
+
+   *lo = sum_lo;
+   *hi = sum_hi;
+}
+
+#ifdef SIMD_HAVE_SSE2
+static void accuraterip_sum_sse2(const int16_t *samples, size_t frames, uint32_t multiplier, uint32_t *lo, uint32_t *hi)
+{
+   size_t i;
+   __m128i mult = _mm_setr_epi32((int)multiplier, (int)(multiplier + 1), (int)(multiplier + 2), (int)(multiplier + 3));
+   __m128i inc = _mm_set1_epi32(4);
+   /* the 64 bit products added up 32 bits at a time, even lanes hold the low halves and odd ones the high */
+   __m128i sum = _mm_setzero_si128();
+   uint32_t lanes[4];
+
+   for (i = 0; i + 4 <= frames; i += 4)
+   {
+      __m128i value = _mm_loadu_si128((const __m128i*)(samples + i * 2));
+
+      sum = _mm_add_epi32(sum, _mm_mul_epu32(value, mult));
+      sum = _mm_add_epi32(sum, _mm_mul_epu32(_mm_srli_epi64(value, 32), _mm_srli_epi64(mult, 32)));
+
+      mult = _mm_add_epi32(mult, inc);
+   }
+
+   _mm_storeu_si128((__m128i*)lanes, sum);
+
+   *lo += lanes[0] + lanes[2];
+   *hi += lanes[1] + lanes[3];
+
+   accuraterip_sum_c(samples + i * 2, frames - i, (uint32_t)(multiplier + i), lo, hi);
+}
+#endif
+
+#ifdef SIMD_HAVE_NEON
+static void accuraterip_sum_neon(const int16_t *samples, size_t frames, uint32_t multiplier, uint32_t *lo, uint32_t *hi)
+{
+   size_t i;
+   uint32_t init[4];
+   uint32x4_t mult;
+   uint32x4_t inc = vdupq_n_u32(4);
+   /* like the SSE2 kernel, even lanes hold the low halves of the products and odd ones the high */
+   uint32x4_t sum = vdupq_n_u32(0);
+   uint32_t lanes[4];
+
+   init[0] = multiplier;
+   init[1] = multiplier + 1;
+   init[2] = multiplier + 2;
+   init[3] = multiplier + 3;
+   mult = vld1q_u32(init);
+
+   for (i = 0; i + 4 <= frames; i += 4)
+   {
+      uint32x4_t value = vreinterpretq_u32_s16(vld1q_s16(samples + i * 2));
+
+      sum = vaddq_u32(sum, vreinterpretq_u32_u64(vmull_u32(vget_low_u32(value), vget_low_u32(mult))));
+      sum = vaddq_u32(sum, vreinterpretq_u32_u64(vmull_u32(vget_high_u32(value), vget_high_u32(mult))));
+
+      mult = vaddq_u32(mult, inc);
+   }
+
+   vst1q_u32(lanes, sum);
+
+   *lo += lanes[0] + lanes[2];
+   *hi += lanes[1] + lanes[3];
+
+   accuraterip_sum_c(samples + i * 2, frames - i, (uint32_t)(multiplier + i), lo, hi);
+}
+#endif
+
+static accuraterip_sum_t accuraterip_kernel = accuraterip_sum_c;
+static const char *accuraterip_kernel_name = "C";
+
+void accuraterip_init(uint64_t cpu_features)
+{
+   accuraterip_sum_t kernel = accuraterip_sum_c;
+   const char *name = "C";
+
+#ifdef SIMD_HAVE_SSE2
+   if (cpu_features & RETRO_SIMD_SSE2)
+   {
+      kernel = accuraterip_sum_sse2;
+      name = "SSE2";
+   }
+#endif
+
+#ifdef SIMD_HAVE_NEON
+   if (cpu_features & (RETRO_SIMD_NEON | RETRO_SIMD_ASIMD))
+   {
+      kernel = accuraterip_sum_neon;
+      name = "NEON";
+   }
+#endif
+
+   (void)cpu_features;
+
+   accuraterip_kernel = kernel;
+   accuraterip_kernel_name = name;
+}
+
+const char* accuraterip_get_kernel_name(void)
+{
+   return accuraterip_kernel_name;
+}
+
+/* the lead-out as an LBA, 0 while the size of the last track is not known */
+static unsigned accuraterip_get_leadout(const cdrom_toc_t *toc)
+{
+   const cdrom_track_t *last;
+
+   if (!toc || !toc->num_tracks || toc->num_tracks > ARRAY_SIZE(toc->track))
+      return 0;
+
+   last = &toc->track[toc->num_tracks - 1];
+
+   if (!last->track_size)
+      return 0;
+
+   return last->lba_start + last->track_size;
+}
+
+bool accuraterip_get_disc_id(const cdrom_toc_t *toc, accuraterip_disc_id_t *id)
+{
+   unsigned leadout = accuraterip_get_leadout(toc);
+   unsigned audio_leadout = 0;
+   unsigned digits = 0;
+   unsigned i;
+
+   if (!leadout)
+      return false;
+
+   memset(id, 0, sizeof(*id));
+
+   for (i = 0; i < toc->num_tracks; i++)
+   {
+      /* the TOC has MSF addresses, which start at 00:02:00 */
+      unsigned offset = toc->track[i].lba - 150;
+      unsigned seconds = toc->track[i].lba / 75;
+      bool next_data = i + 1 < toc->num_tracks && !toc->track[i + 1].audio;
+
+      /* the freedb id is of every track, the AccurateRip ones only of the audio tracks */
+      while (seconds)
+      {
+         digits += seconds % 10;
+         seconds /= 10;
+      }
+
+      if (!toc->track[i].audio)
+         continue;
+
+      id->num_tracks++;
+      id->id1 += offset;
+      id->id2 += (offset ? offset : 1) * (i + 1);
+
+      /* the audio ends where the next track starts, or for an enhanced CD at the gap before its data */
+      audio_leadout = i + 1 < toc->num_tracks ? toc->track[i + 1].lba - 150 : leadout;
+
+      if (next_data && audio_leadout - ACCURATERIP_SESSION_GAP > offset)
+         audio_leadout -= ACCURATERIP_SESSION_GAP;
+   }
+
+   if (!id->num_tracks)
+      return false;
+
+   id->id1 += audio_leadout;
+   id->id2 += audio_leadout * (id->num_tracks + 1);
+   id->cddb = ((digits % 255) << 24) | ((((leadout + 150) / 75) - (toc->track[0].lba / 75)) << 8) | toc->num_tracks;
+
+   return true;
+}
+
+accuraterip_t* accuraterip_new(const cdrom_toc_t *toc, int read_offset)
+{
+   unsigned leadout = accuraterip_get_leadout(toc);
+   accuraterip_t *ar;
+   int first_audio = -1;
+   int last_audio = -1;
+   int i;
+
+   if (!leadout)
+      return NULL;
+
+   ar = (accuraterip_t*)calloc(1, sizeof(*ar));
+
+   if (!ar)
+      return NULL;
+
+   ar->num_tracks = toc->num_tracks;
+   ar->read_offset = read_offset;
+
+   for (i = 0; i < toc->num_tracks; i++)
+   {
+      accuraterip_extent_t *track = &ar->track[i];
+      bool next_data = i + 1 < toc->num_tracks && !toc->track[i + 1].audio;
+
+      track->audio = toc->track[i].audio;
+      track->start = (int64_t)(toc->track[i].lba - 150) * 588;
+      track->end = (int64_t)(i + 1 < toc->num_tracks ? toc->track[i + 1].lba - 150 : leadout) * 588;
+
+      /* an audio track followed by the data of an enhanced CD ends at the gap between its sessions */
+      if (track->audio && next_data && track->end - ACCURATERIP_SESSION_GAP * 588 > track->start)
+         track->end -= ACCURATERIP_SESSION_GAP * 588;
+
+      if (track->end < track->start)
+         track->end = track->start;
+
+      if (!track->audio)
+         continue;
+
+      track->audio_start = ar->audio_frames;
+      track->check_end = track->end - track->start;
+      ar->audio_frames += track->end - track->start;
+
+      if (first_audio < 0)
+         first_audio = i;
+      last_audio = i;
+   }
+
+   if (first_audio >= 0)
+   {
+      accuraterip_extent_t *first = &ar->track[first_audio];
+      accuraterip_extent_t *last = &ar->track[last_audio];
+
+      /* the multiplier of a frame is its index in the track plus one, the first frame summed up on the
+       * disc has ACCURATERIP_SKIP_FRAMES */
+      first->check_start = MIN(ACCURATERIP_SKIP_FRAMES - 1, first->check_end);
+      last->check_end = MAX(last->check_end - ACCURATERIP_SKIP_FRAMES, last->check_start);
+   }
+
+   ar->crc_next = ACCURATERIP_DISC_SKIP_FRAMES;
+
+   return ar;
+}
+
+void accuraterip_free(accuraterip_t *ar)
+{
+   free(ar);
+}
+
+/* adds frames of a single audio track, the first of them is at index of it */
+static void accuraterip_add_track(accuraterip_t *ar, accuraterip_extent_t *track, const int16_t *samples, size_t frames, int64_t index)
+{
+   int64_t start = MAX(index, track->check_start);
+   int64_t end = MIN(index + (int64_t)frames, track->check_end);
+   int64_t crc_start = MAX(track->audio_start + index, ACCURATERIP_DISC_SKIP_FRAMES);
+   int64_t crc_end = MIN(track->audio_start + index + (int64_t)frames, ar->audio_frames - ACCURATERIP_DISC_SKIP_FRAMES);
+
+   if (end > start)
+   {
+      accuraterip_kernel(samples + (start - index) * 2, (size_t)(end - start), (uint32_t)(start + 1), &track->lo, &track->hi);
+      track->checked += end - start;
+   }
+
+   if (crc_end > crc_start)
+   {
+      /* the CRC only holds for the disc if its audio was added in order and without gaps */
+      if (crc_start != ar->crc_next)
+         ar->crc_broken = true;
+
+      ar->crc = encoding_crc32(ar->crc, (const uint8_t*)(samples + (crc_start - track->audio_start - index) * 2),
+            (size_t)(crc_end - crc_start) * 4);
+      ar->crc_next = crc_end;
+   }
+}
+
+void accuraterip_add(accuraterip_t *ar, const int16_t *samples, size_t frames, int64_t frame)
+{
+   int64_t pos = frame - ar->read_offset;
+   unsigned i = 0;
+
+   while (frames)
+   {
+      accuraterip_extent_t *track;
+      size_t count;
+
+      /* the tracks are in order, so the one pos is in is the first that ends after it */
+      while (i < ar->num_tracks && ar->track[i].end <= pos)
+         i++;
+
+      if (i == ar->num_tracks)
+         break;
+
+      track = &ar->track[i];
+
+      if (pos < track->start)
+         count = (size_t)MIN((int64_t)frames, track->start - pos);
+      else
+      {
+         count = (size_t)MIN((int64_t)frames, track->end - pos);
+
+         if (track->audio)
+            accuraterip_add_track(ar, track, samples, count, pos - track->start);
+      }
+
+      samples += count * 2;
+      frames -= count;
+      pos += (int64_t)count;
+   }
+}
+
+void accuraterip_get_track(const accuraterip_t *ar, unsigned char track, accuraterip_track_t *result)
+{
+   const accuraterip_extent_t *extent;
+
+   memset(result, 0, sizeof(*result));
+
+   if (!track || track > ar->num_tracks || !ar->track[track - 1].audio)
+      return;
+
+   extent = &ar->track[track - 1];
+
+   result->audio = true;
+   result->complete = extent->checked == extent->check_end - extent->check_start;
+   result->v1 = extent->lo;
+   result->v2 = extent->lo + extent->hi;
+}
+
+bool accuraterip_get_track_frames(const accuraterip_t *ar, unsigned char track, int64_t *start, int64_t *end)
+{
+   if (!track || track > ar->num_tracks || !ar->track[track - 1].audio)
+      return false;
+
+   *start = ar->track[track - 1].start;
+   *end = ar->track[track - 1].end;
+
+   return true;
+}
+
+bool accuraterip_get_disc_crc(const accuraterip_t *ar, uint32_t *crc)
+{
+   if (ar->crc_broken || ar->crc_next != MAX(ar->audio_frames - ACCURATERIP_DISC_SKIP_FRAMES, ACCURATERIP_DISC_SKIP_FRAMES))
+      return false;
+
+   *crc = ar->crc;
+
+   return true;
+}
+
+static uint32_t accuraterip_read_le32(const uint8_t *p)
+{
+   return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool accuraterip_verify(const char *dir, const accuraterip_disc_id_t *id, accuraterip_track_t *tracks, unsigned num_tracks)
+{
+   char name[64];
+   char path[PATH_MAX_LENGTH];
+   void *buf = NULL;
+   int64_t len = 0;
+   const uint8_t *p;
+   const uint8_t *end;
+
+   snprintf(name, sizeof(name), "dBAR-%03u-%08x-%08x-%08x.bin",
+         (unsigned)id->num_tracks, (unsigned)id->id1, (unsigned)id->id2, (unsigned)id->cddb);
+   fill_pathname_join(path, dir, name, sizeof(path));
+
+   if (!path_is_valid(path) || !filestream_read_file(path, &buf, &len))
+      return false;
+
+   /* one or more submissions of pressings of the disc, each a header of the track count and the three
+    * ids followed by the confidence, checksum and that of frame 450 of every track */
+   p = (const uint8_t*)buf;
+   end = p + len;
+
+   while (end - p >= 13)
+   {
+      unsigned count = p[0];
+      bool same = count == id->num_tracks && accuraterip_read_le32(p + 1) == id->id1 &&
+            accuraterip_read_le32(p + 5) == id->id2 && accuraterip_read_le32(p + 9) == id->cddb;
+      unsigned i;
+      unsigned t = 0;
+
+      p += 13;
+
+      if (end - p < (ptrdiff_t)count * 9)
+         break;
+
+      for (i = 0; i < count; i++, p += 9, t++)
+      {
+         accuraterip_track_t *track;
+         uint32_t crc = accuraterip_read_le32(p + 1);
+
+         /* the entries are of the audio tracks alone, a data track before or between them is skipped */
+         while (t < num_tracks && !tracks[t].audio)
+            t++;
+
+         if (!same || t >= num_tracks || !tracks[t].complete)
+            continue;
+
+         track = &tracks[t];
+
+         track->submissions += p[0];
+
+         if (crc == track->v2)
+         {
+            track->confidence += p[0];
+            track->matched_v2 = true;
+         }
+         else if (crc == track->v1)
+            track->confidence += p[0];
+      }
+   }
+
+   free(buf);
+
+   return true;
+}
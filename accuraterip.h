@@ -0,0 +1,89 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef ACCURATERIP_H__
+#define ACCURATERIP_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <boolean.h>
+#include <cdrom/cdrom.h>
+
+/* Frames at the start of the first and the end of the last audio track that the AccurateRip checksums
+ * leave out, as drives with different offsets cannot all read them. */
+#define ACCURATERIP_SKIP_FRAMES (5 * 588)
+
+/* The same for the CTDB-style CRC of the whole disc. */
+#define ACCURATERIP_DISC_SKIP_FRAMES (10 * 588)
+
+/* what the AccurateRip database knows the disc by, also the name of its file there */
+typedef struct
+{
+   unsigned char num_tracks;
+   uint32_t id1;
+   uint32_t id2;
+   uint32_t cddb;
+} accuraterip_disc_id_t;
+
+typedef struct
+{
+   bool audio;             /* the database only has audio tracks, data tracks are left out */
+   bool complete;          /* every frame of the track was added */
+   uint32_t v1;
+   uint32_t v2;
+   unsigned confidence;    /* submissions the database has with the same checksum, 0 if none */
+   unsigned submissions;   /* with any checksum for the track, 0 if the database does not have the disc */
+   bool matched_v2;
+} accuraterip_track_t;
+
+/* The checksums of every audio track of a disc, summed up as it is read in any order. */
+typedef struct accuraterip accuraterip_t;
+
+/* Picks the fastest checksum kernel for the given RETRO_SIMD_* feature mask. */
+void accuraterip_init(uint64_t cpu_features);
+
+const char* accuraterip_get_kernel_name(void);
+
+/* False if the TOC is not complete yet or the disc has no audio tracks. */
+bool accuraterip_get_disc_id(const cdrom_toc_t *toc, accuraterip_disc_id_t *id);
+
+/* For a disc with a complete TOC. read_offset is the offset correction of the drive in frames, the
+ * frame read at p is the one at p - read_offset on the disc. */
+accuraterip_t* accuraterip_new(const cdrom_toc_t *toc, int read_offset);
+
+void accuraterip_free(accuraterip_t *ar);
+
+/* Adds interleaved stereo frames as they were read, the first at frame of the disc counted from LBA 0.
+ * Frames that do not belong to an audio track once the offset is corrected are left out. */
+void accuraterip_add(accuraterip_t *ar, const int16_t *samples, size_t frames, int64_t frame);
+
+/* The checksums of track, which are only right if it is complete. */
+void accuraterip_get_track(const accuraterip_t *ar, unsigned char track, accuraterip_track_t *result);
+
+/* The frames of the disc an audio track spans as the checksums see it, from its index 1 on. False if it is
+ * not an audio track. */
+bool accuraterip_get_track_frames(const accuraterip_t *ar, unsigned char track, int64_t *start, int64_t *end);
+
+/* CRC-32 of the audio of the whole disc less ACCURATERIP_DISC_SKIP_FRAMES at either end, like the
+ * CUETools database keeps. False unless all of it was added in order. */
+bool accuraterip_get_disc_crc(const accuraterip_t *ar, uint32_t *crc);
+
+/* Looks the checksums of every track up in dir/dBAR-<tracks>-<id1>-<id2>-<cddb>.bin, a file from the
+ * AccurateRip database, and fills in confidence and submissions. tracks is every track of the disc in TOC
+ * order, the database has the audio ones alone. False if there is no such file. */
+bool accuraterip_verify(const char *dir, const accuraterip_disc_id_t *id, accuraterip_track_t *tracks, unsigned num_tracks);
+
+#endif /* ACCURATERIP_H__ */
@@ -0,0 +1,215 @@
+/* Copyright 2019 Brad Parker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+/* Measures optical drive enumeration against a fake /dev and sysfs tree whose probes sleep like slow drives do.
+ *
+ * usage: drive_enum [nodes] [drives] [probe_ms] [hung]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <cdrom/cdrom.h>
+#include <lists/string_list.h>
+#include <rthreads/rthreads.h>
+#include <features/features_cpu.h>
+#include <retro_timers.h>
+#include <retro_miscellaneous.h>
+#include <compat/strl.h>
+
+#define PROBE_TIMEOUT_MS 500
+
+static char root[64];
+static unsigned probe_ms = 100;
+static unsigned hung_node = ~0u;
+static unsigned probes = 0;
+static slock_t *probes_lock = NULL;
+
+static bool fake_probe(const char *path, char *model, size_t len)
+{
+   unsigned index = 0;
+   const char *name = strrchr(path, '/');
+
+   sscanf(name + strlen("/sg"), "%u", &index);
+
+   slock_lock(probes_lock);
+   probes++;
+   slock_unlock(probes_lock);
+
+   retro_sleep(index == hung_node ? PROBE_TIMEOUT_MS * 10 : probe_ms);
+
+   snprintf(model, len, "FAKE DRIVE %u", index);
+
+   return true;
+}
+
+static void write_file(const char *path, const char *contents)
+{
+   FILE *fp = fopen(path, "w");
+
+   if (!fp)
+      return;
+
+   fputs(contents, fp);
+   fclose(fp);
+}
+
+static void add_node(unsigned index, bool is_cdrom)
+{
+   char path[256];
+
+   snprintf(path, sizeof(path), "%s/sys/sg%u", root, index);
+   mkdir(path, 0755);
+   snprintf(path, sizeof(path), "%s/sys/sg%u/device", root, index);
+   mkdir(path, 0755);
+
+   snprintf(path, sizeof(path), "%s/sys/sg%u/device/type", root, index);
+   write_file(path, is_cdrom ? "5\n" : "0\n");
+   snprintf(path, sizeof(path), "%s/sys/sg%u/device/vendor", root, index);
+   write_file(path, "FAKE    \n");
+   snprintf(path, sizeof(path), "%s/sys/sg%u/device/model", root, index);
+   write_file(path, "DRIVE           \n");
+
+   /* the /dev node last, like udev does once the device is ready */
+   snprintf(path, sizeof(path), "%s/dev/sg%u", root, index);
+   write_file(path, "");
+}
+
+static void remove_node(unsigned index)
+{
+   char path[256];
+
+   snprintf(path, sizeof(path), "%s/dev/sg%u", root, index);
+   unlink(path);
+}
+
+static void cleanup(void)
+{
+   char cmd[128];
+
+   snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+
+   if (system(cmd))
+      fprintf(stderr, "could not remove %s\n", root);
+}
+
+static double enumerate(const char *name, size_t *found)
+{
+   struct string_list *list;
+   retro_time_t start;
+   double ms;
+   unsigned probed;
+
+   slock_lock(probes_lock);
+   probes = 0;
+   slock_unlock(probes_lock);
+
+   start = cpu_features_get_time_usec();
+   list = cdrom_get_available_drives();
+   ms = (cpu_features_get_time_usec() - start) / 1000.0;
+
+   slock_lock(probes_lock);
+   probed = probes;
+   slock_unlock(probes_lock);
+
+   *found = list ? list->size : 0;
+
+   printf("%-12s %10.1f ms  %4u probes  %4u drives\n", name, ms, probed, (unsigned)*found);
+
+   string_list_free(list);
+
+   return ms;
+}
+
+int main(int argc, char *argv[])
+{
+   unsigned nodes = argc > 1 ? atoi(argv[1]) : 32;
+   unsigned drives = argc > 2 ? atoi(argv[2]) : 4;
+   bool hung = argc > 4 ? atoi(argv[4]) != 0 : true;
+   char dev_root[128];
+   char sys_root[128];
+   char path[256];
+   char model[32];
+   retro_time_t start;
+   double serial_ms;
+   size_t found;
+   unsigned stride;
+   unsigned i;
+
+   if (argc > 3)
+      probe_ms = atoi(argv[3]);
+
+   if (drives > nodes)
+      drives = nodes;
+
+   strlcpy(root, "/tmp/redbook_enumXXXXXX", sizeof(root));
+
+   if (!mkdtemp(root))
+   {
+      fprintf(stderr, "mkdtemp failed\n");
+      return 1;
+   }
+
+   snprintf(dev_root, sizeof(dev_root), "%s/dev", root);
+   snprintf(sys_root, sizeof(sys_root), "%s/sys", root);
+   mkdir(dev_root, 0755);
+   mkdir(sys_root, 0755);
+
+   probes_lock = slock_new();
+
+   stride = MAX(nodes / MAX(drives, 1), 1);
+
+   /* optical drives are spread between disks, the last one never answers */
+   for (i = 0; i < nodes; i++)
+      add_node(i, i % stride == 0 && i / stride < drives);
+
+   if (hung && drives)
+      hung_node = (drives - 1) * stride;
+
+   printf("%u nodes, %u drives, %u ms per probe, %s\n\n", nodes, drives, probe_ms, hung ? "one hung drive" : "no hung drive");
+
+   /* what enumeration used to do: open and INQUIRY every node in turn, waiting on each */
+   start = cpu_features_get_time_usec();
+
+   for (i = 0; i < nodes; i++)
+   {
+      snprintf(path, sizeof(path), "%s/sg%u", dev_root, i);
+      fake_probe(path, model, sizeof(model));
+   }
+
+   serial_ms = (cpu_features_get_time_usec() - start) / 1000.0;
+   printf("%-12s %10.1f ms  %4u probes\n", "serial", serial_ms, nodes);
+
+   cdrom_drive_list_configure(dev_root, sys_root, fake_probe, PROBE_TIMEOUT_MS);
+
+   enumerate("cold", &found);
+   enumerate("warm", &found);
+
+   add_node(nodes, true);
+   enumerate("hotplug", &found);
+
+   remove_node(nodes);
+   enumerate("unplug", &found);
+
+   cdrom_drive_list_reset();
+   cdrom_drive_list_configure(NULL, NULL, NULL, 0);
+
+   cleanup();
+
+   return 0;
+}
@@ -0,0 +1,872 @@
+/* Copyright 2019 Brad Parker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+/* Runs the core without a frontend: loads it, feeds it content and calls retro_run as fast as possible,
+ * then reports frames/s, the cost of retro_run and of each of its stages, and heap allocations per frame.
+ *
+ * usage: headless [-c core] [-n frames] [-w warmup] [-j json] [-o key=value]... [-v] [content]
+ *        headless -s hours [-r refresh] [-J jitter_usec] [-B buffer_ms] [-i interval_s] [-D max_drift_ms] [-M max_growth_kb] ... [content]
+ *
+ * Content is a .cue/.bin image, played through the simulated drive, or a cdrom:// path for a real one.
+ * Without content a two track image of sine tones is generated and used.
+ *
+ * Soak mode (-s) plays hours of simulated time as fast as possible. A simulated frontend calls retro_run
+ * at the refresh rate, with optional vsync jitter, and an audio device drains the delivered samples at the
+ * core's sample rate. Drift between the two, buffer fill, underruns, resident memory and live allocations
+ * are logged every interval. The run fails if the drift or the memory growth exceed their bounds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+#include <libretro.h>
+#include <features/features_cpu.h>
+
+#define MAX_COUNTERS 32
+#define MAX_OPTIONS 16
+#define IMAGE_TRACK_SECONDS 30
+
+/* live allocations may vary a little with the point in playback the samples are taken at */
+#define SOAK_MAX_ALLOC_GROWTH 16
+
+struct core
+{
+   void *handle;
+   void (*init)(void);
+   void (*deinit)(void);
+   void (*set_environment)(retro_environment_t);
+   void (*set_video_refresh)(retro_video_refresh_t);
+   void (*set_audio_sample)(retro_audio_sample_t);
+   void (*set_audio_sample_batch)(retro_audio_sample_batch_t);
+   void (*set_input_poll)(retro_input_poll_t);
+   void (*set_input_state)(retro_input_state_t);
+   bool (*load_game)(const struct retro_game_info*);
+   void (*unload_game)(void);
+   void (*run)(void);
+   void (*get_system_av_info)(struct retro_system_av_info*);
+};
+
+struct soak_config
+{
+   double hours;
+   double refresh;         /* 0 uses the core's frame rate */
+   unsigned jitter_usec;   /* each frame lasts 1 / refresh plus or minus up to this much */
+   unsigned buffer_ms;     /* audio device buffer, playback starts once it is half full */
+   unsigned interval_sec;  /* simulated time between samples */
+   double max_drift_ms;
+   unsigned max_growth_kb;
+};
+
+struct soak_sample
+{
+   double time_sec;        /* simulated wall clock */
+   uint64_t delivered;     /* audio frames the core has produced */
+   double drift_ms;        /* delivered audio minus elapsed time */
+   double fill_ms;
+   uint64_t underruns;
+   uint64_t overruns;
+   uint64_t rss_bytes;
+   int64_t live_allocs;
+   double frames_per_sec;  /* retro_run calls per second of real time over the interval */
+};
+
+struct option
+{
+   char key[64];
+   char value[64];
+};
+
+static struct retro_perf_counter *counters[MAX_COUNTERS];
+static retro_perf_tick_t counter_base[MAX_COUNTERS];
+static uint64_t counter_calls_base[MAX_COUNTERS];
+static unsigned num_counters = 0;
+static struct option options[MAX_OPTIONS];
+static unsigned num_options = 0;
+static bool verbose = false;
+static uint64_t video_frames = 0;
+static uint64_t audio_frames = 0;
+static struct retro_frame_time_callback frame_time = {0};
+
+/* heap activity of everything in the process while counting is set, the core and its threads included */
+static volatile int alloc_counting = 0;
+static uint64_t alloc_count = 0;
+static uint64_t alloc_bytes = 0;
+static uint64_t free_count = 0;
+static int64_t live_allocs = 0;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static void count_alloc(size_t size)
+{
+   if (!alloc_counting)
+      return;
+
+   __sync_fetch_and_add(&alloc_count, 1);
+   __sync_fetch_and_add(&alloc_bytes, size);
+}
+
+void *malloc(size_t size)
+{
+   count_alloc(size);
+
+   if (alloc_counting)
+      __sync_fetch_and_add(&live_allocs, 1);
+
+   return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+   count_alloc(nmemb * size);
+
+   if (alloc_counting)
+      __sync_fetch_and_add(&live_allocs, 1);
+
+   return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+   count_alloc(size);
+
+   if (!ptr && alloc_counting)
+      __sync_fetch_and_add(&live_allocs, 1);
+
+   return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+   if (ptr && alloc_counting)
+   {
+      __sync_fetch_and_add(&free_count, 1);
+      __sync_fetch_and_sub(&live_allocs, 1);
+   }
+
+   __libc_free(ptr);
+}
+#endif
+
+static uint64_t now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* perf interface, ticks are nanoseconds */
+static retro_time_t RETRO_CALLCONV perf_get_time_usec(void)
+{
+   return (retro_time_t)(now_ns() / 1000);
+}
+
+static retro_perf_tick_t RETRO_CALLCONV perf_get_counter(void)
+{
+   return (retro_perf_tick_t)now_ns();
+}
+
+static uint64_t RETRO_CALLCONV perf_get_cpu_features(void)
+{
+   return cpu_features_get();
+}
+
+static void RETRO_CALLCONV perf_log(void)
+{
+}
+
+static void RETRO_CALLCONV perf_register(struct retro_perf_counter *counter)
+{
+   if (counter->registered || num_counters >= MAX_COUNTERS)
+      return;
+
+   counter->registered = true;
+   counters[num_counters++] = counter;
+}
+
+static void RETRO_CALLCONV perf_start(struct retro_perf_counter *counter)
+{
+   counter->start = now_ns();
+}
+
+static void RETRO_CALLCONV perf_stop(struct retro_perf_counter *counter)
+{
+   counter->total += now_ns() - counter->start;
+   counter->call_cnt++;
+}
+
+static void RETRO_CALLCONV core_log(enum retro_log_level level, const char *fmt, ...)
+{
+   va_list ap;
+
+   if (!verbose && level < RETRO_LOG_WARN)
+      return;
+
+   va_start(ap, fmt);
+   vfprintf(stderr, fmt, ap);
+   va_end(ap);
+}
+
+static bool environment(unsigned cmd, void *data)
+{
+   unsigned i;
+
+   switch (cmd)
+   {
+      case RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK:
+         frame_time = *(const struct retro_frame_time_callback*)data;
+         return true;
+      case RETRO_ENVIRONMENT_GET_LOG_INTERFACE:
+         ((struct retro_log_callback*)data)->log = core_log;
+         return true;
+      case RETRO_ENVIRONMENT_GET_PERF_INTERFACE:
+      {
+         struct retro_perf_callback *perf = (struct retro_perf_callback*)data;
+
+         perf->get_time_usec = perf_get_time_usec;
+         perf->get_cpu_features = perf_get_cpu_features;
+         perf->get_perf_counter = perf_get_counter;
+         perf->perf_register = perf_register;
+         perf->perf_start = perf_start;
+         perf->perf_stop = perf_stop;
+         perf->perf_log = perf_log;
+         return true;
+      }
+      case RETRO_ENVIRONMENT_GET_VARIABLE:
+      {
+         struct retro_variable *var = (struct retro_variable*)data;
+
+         for (i = 0; i < num_options; i++)
+         {
+            if (!strcmp(options[i].key, var->key))
+            {
+               var->value = options[i].value;
+               return true;
+            }
+         }
+
+         return false;
+      }
+      case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT:
+         return *(const enum retro_pixel_format*)data == RETRO_PIXEL_FORMAT_XRGB8888;
+      case RETRO_ENVIRONMENT_SET_VARIABLES:
+      case RETRO_ENVIRONMENT_SET_CONTROLLER_INFO:
+      case RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME:
+      case RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS:
+         return true;
+      default:
+         return false;
+   }
+}
+
+static void video_refresh(const void *data, unsigned width, unsigned height, size_t pitch)
+{
+   video_frames++;
+}
+
+static void audio_sample(int16_t left, int16_t right)
+{
+   audio_frames++;
+}
+
+static size_t audio_sample_batch(const int16_t *data, size_t frames)
+{
+   audio_frames += frames;
+   return frames;
+}
+
+static void input_poll(void)
+{
+}
+
+static int16_t input_state(unsigned port, unsigned device, unsigned index, unsigned id)
+{
+   return 0;
+}
+
+static bool load_core(struct core *core, const char *path)
+{
+   core->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+   if (!core->handle)
+   {
+      fprintf(stderr, "could not load %s: %s\n", path, dlerror());
+      return false;
+   }
+
+#define LOAD_SYMBOL(field, name) \
+   *(void**)&core->field = dlsym(core->handle, name); \
+   if (!core->field) \
+   { \
+      fprintf(stderr, "%s does not export %s\n", path, name); \
+      return false; \
+   }
+
+   LOAD_SYMBOL(init, "retro_init");
+   LOAD_SYMBOL(deinit, "retro_deinit");
+   LOAD_SYMBOL(set_environment, "retro_set_environment");
+   LOAD_SYMBOL(set_video_refresh, "retro_set_video_refresh");
+   LOAD_SYMBOL(set_audio_sample, "retro_set_audio_sample");
+   LOAD_SYMBOL(set_audio_sample_batch, "retro_set_audio_sample_batch");
+   LOAD_SYMBOL(set_input_poll, "retro_set_input_poll");
+   LOAD_SYMBOL(set_input_state, "retro_set_input_state");
+   LOAD_SYMBOL(load_game, "retro_load_game");
+   LOAD_SYMBOL(unload_game, "retro_unload_game");
+   LOAD_SYMBOL(run, "retro_run");
+   LOAD_SYMBOL(get_system_av_info, "retro_get_system_av_info");
+
+#undef LOAD_SYMBOL
+
+   return true;
+}
+
+/* two audio tracks of sine tones in one file, the second one after a two second pregap */
+static bool write_image(const char *dir, char *cue_path, size_t len)
+{
+   char bin_path[256];
+   unsigned sectors = IMAGE_TRACK_SECONDS * 75;
+   unsigned frames_per_sector = 2352 / 4;
+   int16_t sector[2352 / 2];
+   FILE *fp;
+   unsigned track, i, j;
+
+   snprintf(bin_path, sizeof(bin_path), "%s/tones.bin", dir);
+   snprintf(cue_path, len, "%s/tones.cue", dir);
+
+   fp = fopen(bin_path, "wb");
+
+   if (!fp)
+      return false;
+
+   for (track = 0; track < 2; track++)
+   {
+      double step = 2.0 * M_PI * (track ? 880.0 : 440.0) / 44100.0;
+
+      for (i = 0; i < sectors; i++)
+      {
+         for (j = 0; j < frames_per_sector; j++)
+         {
+            int16_t sample = (int16_t)(sin((i * frames_per_sector + j) * step) * 16000.0);
+
+            sector[j * 2] = sample;
+            sector[j * 2 + 1] = sample;
+         }
+
+         if (fwrite(sector, sizeof(sector), 1, fp) != 1)
+         {
+            fclose(fp);
+            return false;
+         }
+      }
+   }
+
+   fclose(fp);
+
+   fp = fopen(cue_path, "w");
+
+   if (!fp)
+      return false;
+
+   fprintf(fp, "FILE \"tones.bin\" BINARY\n");
+   fprintf(fp, "  TRACK 01 AUDIO\n");
+   fprintf(fp, "    INDEX 01 00:00:00\n");
+   fprintf(fp, "  TRACK 02 AUDIO\n");
+   fprintf(fp, "    PREGAP 00:02:00\n");
+   fprintf(fp, "    INDEX 01 %02u:%02u:00\n", IMAGE_TRACK_SECONDS / 60, IMAGE_TRACK_SECONDS % 60);
+   fclose(fp);
+
+   return true;
+}
+
+static void remove_image(const char *dir)
+{
+   char path[256];
+
+   snprintf(path, sizeof(path), "%s/tones.bin", dir);
+   unlink(path);
+   snprintf(path, sizeof(path), "%s/tones.cue", dir);
+   unlink(path);
+   rmdir(dir);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+   uint64_t x = *(const uint64_t*)a;
+   uint64_t y = *(const uint64_t*)b;
+
+   return x < y ? -1 : x > y;
+}
+
+static uint64_t resident_bytes(void)
+{
+   unsigned long pages = 0;
+   unsigned long resident = 0;
+   FILE *fp = fopen("/proc/self/statm", "r");
+
+   if (!fp)
+      return 0;
+
+   if (fscanf(fp, "%lu %lu", &pages, &resident) != 2)
+      resident = 0;
+
+   fclose(fp);
+
+   return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+static void print_soak_sample(const struct soak_sample *sample)
+{
+   printf("%9.0f s %12llu audio frames  drift %+9.1f ms  fill %6.1f ms  %6llu underruns %6llu overruns  rss %8llu KiB  %6lld live allocs  %7.0f frames/s\n",
+         sample->time_sec, (unsigned long long)sample->delivered, sample->drift_ms, sample->fill_ms,
+         (unsigned long long)sample->underruns, (unsigned long long)sample->overruns,
+         (unsigned long long)(sample->rss_bytes / 1024), (long long)sample->live_allocs, sample->frames_per_sec);
+   fflush(stdout);
+}
+
+static void write_soak_json(const char *path, const struct soak_config *config, double refresh, const struct soak_sample *samples, size_t num_samples, bool failed)
+{
+   FILE *json = strcmp(path, "-") ? fopen(path, "w") : stdout;
+   size_t i;
+
+   if (!json)
+   {
+      fprintf(stderr, "could not write %s\n", path);
+      return;
+   }
+
+   fprintf(json, "{\n  \"hours\": %.3f,\n  \"refresh\": %.3f,\n  \"jitter_usec\": %u,\n  \"buffer_ms\": %u,\n  \"passed\": %s,\n  \"samples\": [\n",
+         config->hours, refresh, config->jitter_usec, config->buffer_ms, failed ? "false" : "true");
+
+   for (i = 0; i < num_samples; i++)
+      fprintf(json, "    {\"time_sec\": %.1f, \"audio_frames\": %llu, \"drift_ms\": %.2f, \"fill_ms\": %.2f, \"underruns\": %llu, \"overruns\": %llu, \"rss_bytes\": %llu, \"live_allocs\": %lld, \"frames_per_sec\": %.0f}%s\n",
+            samples[i].time_sec, (unsigned long long)samples[i].delivered, samples[i].drift_ms, samples[i].fill_ms,
+            (unsigned long long)samples[i].underruns, (unsigned long long)samples[i].overruns,
+            (unsigned long long)samples[i].rss_bytes, (long long)samples[i].live_allocs, samples[i].frames_per_sec,
+            i + 1 < num_samples ? "," : "");
+
+   fprintf(json, "  ]\n}\n");
+
+   if (json != stdout)
+      fclose(json);
+}
+
+/* returns the exit code, 1 if drift or memory growth went past their bounds */
+static int run_soak(struct core *core, const struct soak_config *config, const char *json_path)
+{
+   struct retro_system_av_info av_info;
+   struct soak_sample *samples = NULL;
+   size_t num_samples = 0;
+   size_t max_samples;
+   double refresh, rate, frame_usec, buffer_frames;
+   double fill = 0;
+   int64_t time_usec = 0;
+   double next_sample_usec;
+   double max_drift_ms = 0;
+   uint64_t delivered_start = audio_frames;
+   uint64_t underruns = 0;
+   uint64_t overruns = 0;
+   uint64_t interval_start_ns;
+   uint64_t interval_start_frame = 0;
+   uint64_t frames, frame;
+   uint32_t seed = 1;
+   bool playing = false;
+   bool failed = false;
+
+   memset(&av_info, 0, sizeof(av_info));
+   core->get_system_av_info(&av_info);
+
+   rate = av_info.timing.sample_rate;
+   refresh = config->refresh > 0 ? config->refresh : av_info.timing.fps;
+
+   if (rate <= 0 || refresh <= 0 || !config->interval_sec)
+   {
+      fprintf(stderr, "no usable frame rate, sample rate or interval\n");
+      return 1;
+   }
+
+   frame_usec = 1000000.0 / refresh;
+   buffer_frames = config->buffer_ms * rate / 1000.0;
+   frames = (uint64_t)(config->hours * 3600.0 * refresh);
+   max_samples = (size_t)(config->hours * 3600.0 / config->interval_sec) + 2;
+   samples = (struct soak_sample*)calloc(max_samples, sizeof(*samples));
+
+   if (!samples)
+      return 1;
+
+   printf("soak: %.2f hours at %.3f Hz, %.0f Hz audio, %u ms buffer, %u us jitter\n",
+         config->hours, refresh, rate, config->buffer_ms, config->jitter_usec);
+
+   next_sample_usec = config->interval_sec * 1000000.0;
+   alloc_counting = 1;
+   interval_start_ns = now_ns();
+
+   for (frame = 0; frame < frames; frame++)
+   {
+      uint64_t before = audio_frames;
+      double jitter = 0;
+      int64_t end_usec;
+      int64_t duration;
+
+      /* frames end on the refresh grid give or take the jitter, and are timed in whole microseconds like a frontend would */
+      if (config->jitter_usec)
+      {
+         seed = seed * 1103515245 + 12345;
+         jitter = ((double)((seed >> 16) & 0x7FFF) / 16383.5 - 1.0) * config->jitter_usec;
+      }
+
+      end_usec = (int64_t)((frame + 1) * frame_usec + jitter + 0.5);
+      duration = end_usec - time_usec;
+      time_usec = end_usec;
+
+      if (frame_time.callback)
+         frame_time.callback(duration);
+
+      core->run();
+
+      fill += (double)(audio_frames - before);
+
+      /* the device starts once half its buffer is filled, then drains at the sample rate whatever was delivered */
+      if (!playing && fill >= buffer_frames / 2)
+         playing = true;
+
+      if (playing)
+      {
+         double drain = duration * rate / 1000000.0;
+
+         if (fill < drain)
+         {
+            underruns++;
+            fill = 0;
+         }
+         else
+            fill -= drain;
+
+         if (fill > buffer_frames)
+         {
+            overruns++;
+            fill = buffer_frames;
+         }
+      }
+
+      if ((time_usec >= next_sample_usec || frame + 1 == frames) && num_samples < max_samples)
+      {
+         struct soak_sample *sample = &samples[num_samples++];
+         uint64_t now = now_ns();
+
+         sample->time_sec = time_usec / 1000000.0;
+         sample->delivered = audio_frames - delivered_start;
+         sample->drift_ms = (sample->delivered / rate - sample->time_sec) * 1000.0;
+         sample->fill_ms = fill / rate * 1000.0;
+         sample->underruns = underruns;
+         sample->overruns = overruns;
+         sample->rss_bytes = resident_bytes();
+         sample->live_allocs = live_allocs;
+         sample->frames_per_sec = (frame + 1 - interval_start_frame) / ((now - interval_start_ns) / 1e9);
+
+         print_soak_sample(sample);
+
+         if (fabs(sample->drift_ms) > max_drift_ms)
+            max_drift_ms = fabs(sample->drift_ms);
+
+         next_sample_usec += config->interval_sec * 1000000.0;
+         interval_start_frame = frame + 1;
+         interval_start_ns = now_ns();
+      }
+   }
+
+   alloc_counting = 0;
+
+   if (max_drift_ms > config->max_drift_ms)
+   {
+      printf("FAIL: audio drifted %.1f ms from the wall clock, the bound is %.1f ms\n", max_drift_ms, config->max_drift_ms);
+      failed = true;
+   }
+
+   /* growth is measured from the first sample, once buffers and caches have been filled */
+   if (num_samples >= 2)
+   {
+      const struct soak_sample *first = &samples[0];
+      const struct soak_sample *last = &samples[num_samples - 1];
+
+      if (last->rss_bytes > first->rss_bytes + config->max_growth_kb * 1024ull)
+      {
+         printf("FAIL: resident memory grew by %llu KiB, the bound is %u KiB\n",
+               (unsigned long long)((last->rss_bytes - first->rss_bytes) / 1024), config->max_growth_kb);
+         failed = true;
+      }
+
+      if (last->live_allocs > first->live_allocs + SOAK_MAX_ALLOC_GROWTH)
+      {
+         printf("FAIL: %lld more live allocations than after the first interval\n", (long long)(last->live_allocs - first->live_allocs));
+         failed = true;
+      }
+   }
+
+   if (!failed)
+      printf("PASS: max drift %.1f ms, %llu underruns, %llu overruns\n", max_drift_ms, (unsigned long long)underruns, (unsigned long long)overruns);
+
+   if (json_path)
+      write_soak_json(json_path, config, refresh, samples, num_samples, failed);
+
+   free(samples);
+
+   return failed ? 1 : 0;
+}
+
+static void run_benchmark(struct core *core, const char *content, unsigned frames, uint64_t *run_ns, const char *json_path)
+{
+   uint64_t start, elapsed, total = 0;
+   uint64_t audio_start, video_start;
+   FILE *json = NULL;
+   unsigned i;
+
+   for (i = 0; i < num_counters; i++)
+   {
+      counter_base[i] = counters[i]->total;
+      counter_calls_base[i] = counters[i]->call_cnt;
+   }
+
+   audio_start = audio_frames;
+   video_start = video_frames;
+   alloc_counting = 1;
+   start = now_ns();
+
+   for (i = 0; i < frames; i++)
+   {
+      uint64_t frame_start = now_ns();
+
+      if (frame_time.callback)
+         frame_time.callback(frame_time.reference);
+
+      core->run();
+
+      run_ns[i] = now_ns() - frame_start;
+   }
+
+   elapsed = now_ns() - start;
+   alloc_counting = 0;
+
+   for (i = 0; i < frames; i++)
+      total += run_ns[i];
+
+   qsort(run_ns, frames, sizeof(*run_ns), compare_u64);
+
+   printf("%s: %u frames in %.1f ms, %.0f frames/s, %llu video frames, %.1f s of audio\n",
+         content, frames, elapsed / 1e6, frames / (elapsed / 1e9),
+         (unsigned long long)(video_frames - video_start), (audio_frames - audio_start) / 44100.0);
+   printf("retro_run      %10.0f ns mean %10llu p50 %10llu p99 %10llu max\n",
+         (double)total / frames, (unsigned long long)run_ns[frames / 2],
+         (unsigned long long)run_ns[(size_t)(frames * 0.99)], (unsigned long long)run_ns[frames - 1]);
+
+   for (i = 0; i < num_counters; i++)
+   {
+      uint64_t calls = counters[i]->call_cnt - counter_calls_base[i];
+      uint64_t ticks = counters[i]->total - counter_base[i];
+
+      printf("  %-20s %10.0f ns/frame %10.0f ns/call %8llu calls\n", counters[i]->ident,
+            (double)ticks / frames, calls ? (double)ticks / calls : 0.0, (unsigned long long)calls);
+   }
+
+   printf("allocations    %10.2f per frame %10.0f bytes/frame %10.2f frees/frame\n",
+         (double)alloc_count / frames, (double)alloc_bytes / frames, (double)free_count / frames);
+
+   if (json_path)
+   {
+      json = strcmp(json_path, "-") ? fopen(json_path, "w") : stdout;
+
+      if (json)
+      {
+         fprintf(json, "{\n  \"content\": \"%s\",\n  \"frames\": %u,\n  \"frames_per_second\": %.1f,\n", content, frames, frames / (elapsed / 1e9));
+         fprintf(json, "  \"run_ns\": {\"mean\": %.0f, \"p50\": %llu, \"p99\": %llu, \"max\": %llu},\n",
+               (double)total / frames, (unsigned long long)run_ns[frames / 2],
+               (unsigned long long)run_ns[(size_t)(frames * 0.99)], (unsigned long long)run_ns[frames - 1]);
+         fprintf(json, "  \"stages_ns_per_frame\": {");
+
+         for (i = 0; i < num_counters; i++)
+            fprintf(json, "%s\"%s\": %.0f", i ? ", " : "", counters[i]->ident, (double)(counters[i]->total - counter_base[i]) / frames);
+
+         fprintf(json, "},\n  \"allocations_per_frame\": %.2f,\n  \"allocated_bytes_per_frame\": %.0f\n}\n",
+               (double)alloc_count / frames, (double)alloc_bytes / frames);
+
+         if (json != stdout)
+            fclose(json);
+      }
+      else
+         fprintf(stderr, "could not write %s\n", json_path);
+   }
+}
+
+static void usage(void)
+{
+   fprintf(stderr, "usage: headless [-c core] [-n frames] [-w warmup] [-j json] [-o key=value]... [-v] [content]\n");
+   fprintf(stderr, "       headless -s hours [-r refresh] [-J jitter_usec] [-B buffer_ms] [-i interval_s] [-D max_drift_ms] [-M max_growth_kb] ... [content]\n");
+}
+
+int main(int argc, char *argv[])
+{
+   const char *core_path = "./redbook_libretro.so";
+   const char *json_path = NULL;
+   const char *content = NULL;
+   unsigned frames = 6000;
+   unsigned warmup = 60;
+   char image_dir[64] = {0};
+   char image_path[256] = {0};
+   struct retro_game_info info = {0};
+   struct core core = {0};
+   uint64_t *run_ns = NULL;
+   struct soak_config soak = {0, 0, 0, 64, 600, 100.0, 1024};
+   int rv = 0;
+   int opt;
+   unsigned i;
+
+   while ((opt = getopt(argc, argv, "c:n:w:j:o:s:r:J:B:i:D:M:vh")) != -1)
+   {
+      switch (opt)
+      {
+         case 'c':
+            core_path = optarg;
+            break;
+         case 'n':
+            frames = (unsigned)atoi(optarg);
+            break;
+         case 'w':
+            warmup = (unsigned)atoi(optarg);
+            break;
+         case 'j':
+            json_path = optarg;
+            break;
+         case 'o':
+         {
+            const char *eq = strchr(optarg, '=');
+
+            if (!eq || num_options >= MAX_OPTIONS)
+            {
+               usage();
+               return 1;
+            }
+
+            snprintf(options[num_options].key, sizeof(options[num_options].key), "%.*s", (int)(eq - optarg), optarg);
+            snprintf(options[num_options].value, sizeof(options[num_options].value), "%s", eq + 1);
+            num_options++;
+            break;
+         }
+         case 's':
+            soak.hours = atof(optarg);
+            break;
+         case 'r':
+            soak.refresh = atof(optarg);
+            break;
+         case 'J':
+            soak.jitter_usec = (unsigned)atoi(optarg);
+            break;
+         case 'B':
+            soak.buffer_ms = (unsigned)atoi(optarg);
+            break;
+         case 'i':
+            soak.interval_sec = (unsigned)atoi(optarg);
+            break;
+         case 'D':
+            soak.max_drift_ms = atof(optarg);
+            break;
+         case 'M':
+            soak.max_growth_kb = (unsigned)atoi(optarg);
+            break;
+         case 'v':
+            verbose = true;
+            break;
+         default:
+            usage();
+            return 1;
+      }
+   }
+
+   if (optind < argc)
+      content = argv[optind];
+
+   if (!frames)
+   {
+      usage();
+      return 1;
+   }
+
+   if (!content)
+   {
+      snprintf(image_dir, sizeof(image_dir), "/tmp/redbook_headlessXXXXXX");
+
+      if (!mkdtemp(image_dir) || !write_image(image_dir, image_path, sizeof(image_path)))
+      {
+         fprintf(stderr, "could not write a test image\n");
+         return 1;
+      }
+
+      content = image_path;
+   }
+
+   run_ns = (uint64_t*)calloc(frames, sizeof(*run_ns));
+
+   if (!run_ns || !load_core(&core, core_path))
+      return 1;
+
+   core.set_environment(environment);
+   core.set_video_refresh(video_refresh);
+   core.set_audio_sample(audio_sample);
+   core.set_audio_sample_batch(audio_sample_batch);
+   core.set_input_poll(input_poll);
+   core.set_input_state(input_state);
+   core.init();
+
+   info.path = content;
+
+   if (!core.load_game(&info))
+   {
+      fprintf(stderr, "the core could not load %s\n", content);
+      return 1;
+   }
+
+   for (i = 0; i < warmup; i++)
+   {
+      if (frame_time.callback)
+         frame_time.callback(frame_time.reference);
+
+      core.run();
+   }
+
+   if (soak.hours > 0)
+      rv = run_soak(&core, &soak, json_path);
+   else
+      run_benchmark(&core, content, frames, run_ns, json_path);
+
+   core.unload_game();
+   core.deinit();
+   dlclose(core.handle);
+
+   free(run_ns);
+
+   if (*image_dir)
+      remove_image(image_dir);
+
+   return rv;
+}
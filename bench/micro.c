@@ -0,0 +1,1055 @@
+/* Copyright 2019 Brad Parker
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+/* Microbenchmarks for the code that runs once per frame or per sector.
+ *
+ * usage: micro [-j results.json] [-b baseline.json] [-t threshold%] [-f filter] [-m min_ms]
+ *
+ * Each benchmark is repeated until a run takes at least min_ms, and the median of nine such runs is kept.
+ * With a baseline, a benchmark that got slower by more than the threshold is measured again up to twice and the
+ * fastest median kept, and if it is still slower it is flagged and the exit code is 1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include <cdrom/cdrom.h>
+#include <audio/conversion/s16_to_float.h>
+#include <audio/conversion/float_to_s16.h>
+#include <audio/audio_resampler.h>
+#include <streams/chd_stream.h>
+#include <libchdr/chd.h>
+#include <encodings/crc32.h>
+#include <rhash.h>
+#include <features/features_cpu.h>
+#include <retro_miscellaneous.h>
+#include <compat/strl.h>
+
+#include "../meter.h"
+#include "../crossfade.h"
+#include "../deemphasis.h"
+#include "../loudness.h"
+#include "../silence.h"
+#include "../stretch.h"
+#include "../fingerprint.h"
+#include "../accuraterip.h"
+#include "../ugui_tools.h"
+
+#define MAX_RESULTS 64
+#define REPEATS 9
+/* more measurements of a benchmark that looks slower than the baseline, before it counts as a regression */
+#define RETRIES 2
+
+/* one video frame of audio, as the core reads and meters it */
+#define FRAME_SAMPLES ((2352 * 75 / 60) / 2)
+#define FRAME_FRAMES (FRAME_SAMPLES / 2)
+
+/* a chunk of audio as the reader reads it ahead, 4 CD frames */
+#define CHUNK_FRAMES (2352 * 4 / 4)
+
+#define CHD_FRAME_BYTES 2448
+#define CHD_FRAMES_PER_HUNK 8
+#define CHD_TRACK_FRAMES (75 * 20)
+
+typedef struct
+{
+   char name[64];
+   double ns_per_op;
+   double mb_per_s;
+   uint64_t ops;
+} result_t;
+
+static result_t results[MAX_RESULTS];
+static unsigned num_results = 0;
+static result_t baseline[MAX_RESULTS];
+static unsigned num_baseline = 0;
+static double threshold = 50.0;
+static unsigned min_ms = 20;
+static const char *filter = NULL;
+static volatile uint64_t sink = 0;
+
+static int16_t samples[FRAME_SAMPLES];
+static float samples_float[FRAME_SAMPLES];
+static float resampled[FRAME_SAMPLES * 2];
+static int16_t mixed[FRAME_SAMPLES];
+static int16_t quiet[CHUNK_FRAMES * 2];
+static unsigned char sector[2352];
+/* a second of audio from each of several tracks, for hashing them one by one or side by side */
+static unsigned char tracks[4][2352 * 75];
+static char chd_dir[64];
+
+static uint64_t now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+   double x = *(const double*)a;
+   double y = *(const double*)b;
+
+   return (x > y) - (x < y);
+}
+
+/* ns per op of the benchmark in the baseline, 0 if it is not in there */
+static double baseline_get(const char *name)
+{
+   unsigned i;
+
+   for (i = 0; i < num_baseline; i++)
+   {
+      if (!strcmp(baseline[i].name, name))
+         return baseline[i].ns_per_op;
+   }
+
+   return 0;
+}
+
+/* ns per op of batches of ops */
+static double measure(void (*fn)(void *data, uint64_t ops), void *data, uint64_t ops)
+{
+   double times[REPEATS];
+   unsigned i;
+
+   for (i = 0; i < REPEATS; i++)
+   {
+      uint64_t start = now_ns();
+
+      fn(data, ops);
+      times[i] = (double)(now_ns() - start) / ops;
+   }
+
+   /* the median, the fastest run moves as much as the slowest with the clock speed and whatever else runs */
+   qsort(times, REPEATS, sizeof(times[0]), compare_double);
+
+   return times[REPEATS / 2];
+}
+
+static void run(const char *name, size_t bytes_per_op, void (*fn)(void *data, uint64_t ops), void *data)
+{
+   result_t *result = NULL;
+   uint64_t ops = 1;
+   double best;
+   double base;
+   unsigned i;
+
+   if (filter && !strstr(name, filter))
+      return;
+
+   if (num_results >= MAX_RESULTS)
+      return;
+
+   /* grow the batch until it takes long enough to time reliably */
+   for (;;)
+   {
+      uint64_t start = now_ns();
+      uint64_t elapsed;
+
+      fn(data, ops);
+      elapsed = now_ns() - start;
+
+      if (elapsed >= min_ms * 1000000ull)
+         break;
+
+      ops = elapsed ? ops * MAX(2, (min_ms * 1000000ull) / elapsed) : ops * 100;
+   }
+
+   best = measure(fn, data, ops);
+
+   if ((base = baseline_get(name)) > 0)
+   {
+      for (i = 0; i < RETRIES && (best - base) / base * 100.0 > threshold; i++)
+         best = MIN(best, measure(fn, data, ops));
+   }
+
+   result = &results[num_results++];
+   strlcpy(result->name, name, sizeof(result->name));
+   result->ns_per_op = best;
+   result->mb_per_s = bytes_per_op ? bytes_per_op / best * 1000.0 : 0;
+   result->ops = ops;
+
+   if (bytes_per_op)
+      printf("%-28s %12.1f ns/op %10.1f MB/s\n", name, best, result->mb_per_s);
+   else
+      printf("%-28s %12.1f ns/op\n", name, best);
+
+   fflush(stdout);
+}
+
+static void bench_lba_to_msf(void *data, uint64_t ops)
+{
+   unsigned char min, sec, frame;
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+   {
+      cdrom_lba_to_msf((unsigned)(i % 360000), &min, &sec, &frame);
+      sink += frame;
+   }
+}
+
+static void bench_msf_to_lba(void *data, uint64_t ops)
+{
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+      sink += cdrom_msf_to_lba((unsigned char)(i % 80), (unsigned char)(i % 60), (unsigned char)(i % 75));
+}
+
+static void bench_increment_msf(void *data, uint64_t ops)
+{
+   unsigned char min = 0, sec = 0, frame = 0;
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+   {
+      increment_msf(&min, &sec, &frame);
+
+      if (min >= 80)
+         min = 0;
+   }
+
+   sink += min + sec + frame;
+}
+
+static void bench_meter(void *data, uint64_t ops)
+{
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+   {
+      uint64_t left = 0;
+      uint64_t right = 0;
+
+      meter_sum(samples, FRAME_FRAMES, &left, &right);
+      sink += left + right;
+   }
+}
+
+/* a frame at a time through a 3 s crossfade */
+static void bench_crossfade(void *data, uint64_t ops)
+{
+   const size_t len = 44100 * 3;
+   size_t pos = 0;
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+   {
+      crossfade_mix(mixed, samples, samples, FRAME_FRAMES, pos, len);
+      sink += mixed[0];
+
+      pos += FRAME_FRAMES;
+
+      if (pos >= len)
+         pos = 0;
+   }
+}
+
+static void bench_deemphasis(void *data, uint64_t ops)
+{
+   deemphasis_t *filter = (deemphasis_t*)data;
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+   {
+      memcpy(mixed, samples, sizeof(mixed));
+      deemphasis_run(filter, mixed, FRAME_FRAMES);
+      sink += mixed[0];
+   }
+}
+
+static void bench_loudness(void *data, uint64_t ops)
+{
+   loudness_t *loudness = (loudness_t*)data;
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+      loudness_add(loudness, samples, FRAME_FRAMES);
+}
+
+static void bench_silence(void *data, uint64_t ops)
+{
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+      sink += silence_leading(quiet, CHUNK_FRAMES, SILENCE_THRESHOLD);
+}
+
+/* loops the test frame as the input of the stretch */
+static size_t read_samples(void *data, int16_t *buf, size_t frames)
+{
+   size_t *pos = (size_t*)data;
+   size_t count = MIN(frames, FRAME_FRAMES - *pos);
+
+   memcpy(buf, samples + *pos * 2, count * 2 * sizeof(int16_t));
+   *pos = (*pos + count) % FRAME_FRAMES;
+
+   return count;
+}
+
+/* a video frame of audio at twice the speed, the most input a frame takes */
+static void bench_stretch(void *data, uint64_t ops)
+{
+   stretch_t *stretch = (stretch_t*)data;
+   size_t pos = 0;
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+   {
+      sink += stretch_process(stretch, mixed, FRAME_FRAMES, STRETCH_MAX_SPEED, read_samples, &pos);
+      sink += mixed[0];
+   }
+}
+
+/* a new track before the first FINGERPRINT_LEN sub-fingerprints are done, after which adding costs nothing */
+static void bench_fingerprint(void *data, uint64_t ops)
+{
+   fingerprint_t *fingerprint = (fingerprint_t*)data;
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+   {
+      if (i % 700 == 0)
+         fingerprint_begin_track(fingerprint);
+
+      fingerprint_add(fingerprint, samples, FRAME_FRAMES);
+   }
+}
+
+/* scan reads into a disc of a single 74 minute track, past the frames the checksums leave out */
+static void bench_accuraterip(void *data, uint64_t ops)
+{
+   accuraterip_t *ar = (accuraterip_t*)data;
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+      accuraterip_add(ar, quiet, CHUNK_FRAMES, ACCURATERIP_DISC_SKIP_FRAMES + (int64_t)(i % 1000) * CHUNK_FRAMES);
+}
+
+static void bench_s16_to_float(void *data, uint64_t ops)
+{
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+      convert_s16_to_float(samples_float, samples, FRAME_SAMPLES, 1.0f);
+
+   sink += (uint64_t)samples_float[1];
+}
+
+static void bench_float_to_s16(void *data, uint64_t ops)
+{
+   static int16_t out[FRAME_SAMPLES];
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+      convert_float_to_s16(out, samples_float, FRAME_SAMPLES);
+
+   sink += out[1];
+}
+
+static void bench_sinc(void *data, uint64_t ops)
+{
+   struct resampler_data rdata;
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+   {
+      rdata.data_in = samples_float;
+      rdata.data_out = resampled;
+      rdata.input_frames = FRAME_FRAMES;
+      rdata.output_frames = 0;
+      rdata.ratio = 48000.0 / 44100.0;
+
+      sinc_resampler.process(data, &rdata);
+      sink += rdata.output_frames;
+   }
+}
+
+static void bench_chdstream_read(void *data, uint64_t ops)
+{
+   chdstream_t *stream = (chdstream_t*)data;
+   char buf[FRAME_SAMPLES * 2];
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+   {
+      if (chdstream_read(stream, buf, sizeof(buf)) < (ssize_t)sizeof(buf))
+         chdstream_rewind(stream);
+
+      sink += buf[0];
+   }
+}
+
+static void bench_crc32(void *data, uint64_t ops)
+{
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+      sink += encoding_crc32(0, sector, sizeof(sector));
+}
+
+static void bench_crc32_calculate(void *data, uint64_t ops)
+{
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+      sink += crc32_calculate(sector, sizeof(sector));
+}
+
+static void bench_sha256(void *data, uint64_t ops)
+{
+   char out[65];
+   uint64_t i;
+   unsigned j;
+
+   for (i = 0; i < ops; i++)
+   {
+      for (j = 0; j < ARRAY_SIZE(tracks); j++)
+      {
+         sha256_hash(out, tracks[j], sizeof(tracks[j]));
+         sink += out[0];
+      }
+   }
+}
+
+static void bench_sha256_multi(void *data, uint64_t ops)
+{
+   char outs[ARRAY_SIZE(tracks)][65];
+   char *out[ARRAY_SIZE(tracks)];
+   const uint8_t *in[ARRAY_SIZE(tracks)];
+   size_t size[ARRAY_SIZE(tracks)];
+   uint64_t i;
+   unsigned j;
+
+   for (j = 0; j < ARRAY_SIZE(tracks); j++)
+   {
+      out[j] = outs[j];
+      in[j] = tracks[j];
+      size[j] = sizeof(tracks[j]);
+   }
+
+   for (i = 0; i < ops; i++)
+   {
+      sha256_hash_multi(out, in, size, ARRAY_SIZE(tracks));
+      sink += outs[0][0];
+   }
+}
+
+static void bench_gui(void *data, uint64_t ops)
+{
+   gui_t *gui = (gui_t*)data;
+   uint64_t i;
+
+   for (i = 0; i < ops; i++)
+   {
+      gui_set_message(gui, i & 1 ? "Track 03 of 12\n\nPlaying: 01:23 / 04:56" : "Track 03 of 12\n\nPlaying: 01:24 / 04:56");
+      gui_draw(gui);
+   }
+
+   sink += gui_get_framebuffer(gui)[0];
+}
+
+static void put_be32(unsigned char *p, uint32_t v)
+{
+   p[0] = (v >> 24) & 0xFF;
+   p[1] = (v >> 16) & 0xFF;
+   p[2] = (v >> 8) & 0xFF;
+   p[3] = v & 0xFF;
+}
+
+static void put_be64(unsigned char *p, uint64_t v)
+{
+   put_be32(p, (uint32_t)(v >> 32));
+   put_be32(p + 4, (uint32_t)v);
+}
+
+/* A V4 CHD holding one audio track, the newest version whose map is simple enough to write here.
+ * compression is CHDCOMPRESSION_NONE or CHDCOMPRESSION_ZLIB. */
+static bool write_chd(const char *path, uint32_t compression)
+{
+   uint32_t hunkbytes = CHD_FRAME_BYTES * CHD_FRAMES_PER_HUNK;
+   uint32_t hunks = (CHD_TRACK_FRAMES + CHD_FRAMES_PER_HUNK - 1) / CHD_FRAMES_PER_HUNK;
+   char meta[256];
+   size_t meta_len = snprintf(meta, sizeof(meta), CDROM_TRACK_METADATA2_FORMAT, 1u, "AUDIO", "NONE", (unsigned)CHD_TRACK_FRAMES, 0u, "VAUDIO", "RW", 0u) + 1;
+   size_t map_offset = CHD_V4_HEADER_SIZE;
+   size_t meta_offset = map_offset + hunks * 16 + 16;
+   size_t data_offset = meta_offset + 16 + meta_len;
+   unsigned char header[CHD_V4_HEADER_SIZE] = {0};
+   unsigned char meta_header[16] = {0};
+   unsigned char *map = (unsigned char*)calloc(hunks, 16);
+   unsigned char *hunk = (unsigned char*)calloc(1, hunkbytes);
+   unsigned char *packed = (unsigned char*)malloc(compressBound(hunkbytes));
+   uint32_t seed = 1;
+   uint32_t frame = 0;
+   FILE *fp = fopen(path, "wb");
+   uint32_t i, j;
+
+   if (!fp || !map || !hunk || !packed)
+      goto error;
+
+   memcpy(header, "MComprHD", 8);
+   put_be32(header + 8, CHD_V4_HEADER_SIZE);
+   put_be32(header + 12, 4);
+   put_be32(header + 20, compression);
+   put_be32(header + 24, hunks);
+   put_be64(header + 28, (uint64_t)hunks * hunkbytes);
+   put_be64(header + 36, meta_offset);
+   put_be32(header + 44, hunkbytes);
+
+   put_be32(meta_header, CDROM_TRACK_METADATA2_TAG);
+   put_be32(meta_header + 4, (uint32_t)meta_len);
+
+   if (fseek(fp, (long)data_offset, SEEK_SET))
+      goto error;
+
+   for (i = 0; i < hunks; i++)
+   {
+      unsigned char *entry = map + i * 16;
+      uint32_t length = hunkbytes;
+      const unsigned char *out = hunk;
+      unsigned char flags = 2; /* uncompressed */
+
+      memset(hunk, 0, hunkbytes);
+
+      /* a tone with some noise on top, audio is stored big endian */
+      for (j = 0; j < CHD_FRAMES_PER_HUNK && frame < CHD_TRACK_FRAMES; j++, frame++)
+      {
+         unsigned k;
+
+         for (k = 0; k < 2352 / 2; k++)
+         {
+            int16_t value;
+
+            seed = seed * 1103515245 + 12345;
+            value = (int16_t)(sin((frame * 588 + k / 2) * 2.0 * M_PI * 440.0 / 44100.0) * 12000.0) + (int16_t)((seed >> 16) & 0x3FF);
+
+            hunk[j * CHD_FRAME_BYTES + k * 2] = (value >> 8) & 0xFF;
+            hunk[j * CHD_FRAME_BYTES + k * 2 + 1] = value & 0xFF;
+         }
+      }
+
+      if (compression == CHDCOMPRESSION_ZLIB)
+      {
+         z_stream z;
+
+         memset(&z, 0, sizeof(z));
+
+         /* raw deflate, the way libchdr inflates it */
+         if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            goto error;
+
+         z.next_in = hunk;
+         z.avail_in = hunkbytes;
+         z.next_out = packed;
+         z.avail_out = compressBound(hunkbytes);
+
+         if (deflate(&z, Z_FINISH) == Z_STREAM_END && z.total_out < hunkbytes)
+         {
+            length = (uint32_t)z.total_out;
+            out = packed;
+            flags = 1; /* compressed */
+         }
+
+         deflateEnd(&z);
+      }
+
+      put_be64(entry, (uint64_t)ftell(fp));
+      put_be32(entry + 8, (uint32_t)crc32(0, hunk, hunkbytes));
+      entry[12] = (length >> 8) & 0xFF;
+      entry[13] = length & 0xFF;
+      entry[14] = (length >> 16) & 0xFF;
+      entry[15] = flags;
+
+      if (fwrite(out, 1, length, fp) != length)
+         goto error;
+   }
+
+   rewind(fp);
+
+   if (fwrite(header, 1, sizeof(header), fp) != sizeof(header) ||
+         fwrite(map, 16, hunks, fp) != hunks ||
+         fwrite("EndOfListCookie", 1, 16, fp) != 16 ||
+         fwrite(meta_header, 1, sizeof(meta_header), fp) != sizeof(meta_header) ||
+         fwrite(meta, 1, meta_len, fp) != meta_len)
+      goto error;
+
+   fclose(fp);
+   free(map);
+   free(hunk);
+   free(packed);
+
+   return true;
+
+error:
+   if (fp)
+      fclose(fp);
+
+   free(map);
+   free(hunk);
+   free(packed);
+
+   return false;
+}
+
+static void run_chd(const char *codec, uint32_t compression)
+{
+   char name[64];
+   char path[128];
+   chdstream_t *stream = NULL;
+
+   snprintf(name, sizeof(name), "chdstream_read_%s", codec);
+
+   if (filter && !strstr(name, filter))
+      return;
+
+   snprintf(path, sizeof(path), "%s/%s.chd", chd_dir, codec);
+
+   if (!write_chd(path, compression) || !(stream = chdstream_open(path, 1)))
+   {
+      fprintf(stderr, "could not create a %s CHD, skipping %s\n", codec, name);
+      unlink(path);
+      return;
+   }
+
+   run(name, FRAME_SAMPLES * 2, bench_chdstream_read, stream);
+
+   chdstream_close(stream);
+   unlink(path);
+}
+
+static bool write_json(const char *path)
+{
+   FILE *fp = strcmp(path, "-") ? fopen(path, "w") : stdout;
+   char model[64] = {0};
+   unsigned i;
+
+   if (!fp)
+      return false;
+
+   cpu_features_get_model_name(model, sizeof(model));
+
+   fprintf(fp, "{\n  \"cpu\": \"%s\",\n  \"benchmarks\": [\n", model);
+
+   /* one benchmark per line, which is what read_baseline() expects */
+   for (i = 0; i < num_results; i++)
+      fprintf(fp, "    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"mb_per_s\": %.1f, \"ops\": %llu}%s\n",
+            results[i].name, results[i].ns_per_op, results[i].mb_per_s,
+            (unsigned long long)results[i].ops, i + 1 < num_results ? "," : "");
+
+   fprintf(fp, "  ]\n}\n");
+
+   if (fp != stdout)
+      fclose(fp);
+
+   return true;
+}
+
+/* reads a file written by write_json() */
+static bool read_baseline(const char *path)
+{
+   FILE *fp = fopen(path, "r");
+   char line[512];
+
+   if (!fp)
+      return false;
+
+   while (fgets(line, sizeof(line), fp) && num_baseline < MAX_RESULTS)
+   {
+      result_t *entry = &baseline[num_baseline];
+      const char *field = strstr(line, "\"name\": \"");
+      const char *ns = strstr(line, "\"ns_per_op\": ");
+
+      if (!field || !ns || sscanf(field + strlen("\"name\": \""), "%63[^\"]", entry->name) != 1 ||
+            sscanf(ns + strlen("\"ns_per_op\": "), "%lf", &entry->ns_per_op) != 1 || entry->ns_per_op <= 0)
+         continue;
+
+      num_baseline++;
+   }
+
+   fclose(fp);
+
+   return true;
+}
+
+/* compares against the baseline, returns the number of regressions */
+static int compare_baseline(void)
+{
+   int regressions = 0;
+   unsigned i;
+
+   printf("\n%-28s %12s %12s %9s\n", "benchmark", "baseline", "current", "change");
+
+   for (i = 0; i < num_results; i++)
+   {
+      double base = baseline_get(results[i].name);
+      double change;
+
+      if (base <= 0)
+         continue;
+
+      change = (results[i].ns_per_op - base) / base * 100.0;
+
+      printf("%-28s %9.1f ns %9.1f ns %+8.1f%%%s\n", results[i].name, base, results[i].ns_per_op, change,
+            change > threshold ? "  REGRESSION" : "");
+
+      if (change > threshold)
+         regressions++;
+   }
+
+   return regressions;
+}
+
+static void usage(void)
+{
+   fprintf(stderr, "usage: micro [-j results.json] [-b baseline.json] [-t threshold%%] [-f filter] [-m min_ms]\n");
+}
+
+int main(int argc, char *argv[])
+{
+   const char *json_path = NULL;
+   const char *baseline_path = NULL;
+   uint64_t cpu_features = cpu_features_get();
+   void *sinc = NULL;
+   char name[64];
+   int regressions = 0;
+   int opt;
+   gui_t *gui = NULL;
+   unsigned i;
+
+   while ((opt = getopt(argc, argv, "j:b:t:f:m:h")) != -1)
+   {
+      switch (opt)
+      {
+         case 'j':
+            json_path = optarg;
+            break;
+         case 'b':
+            baseline_path = optarg;
+            break;
+         case 't':
+            threshold = atof(optarg);
+            break;
+         case 'f':
+            filter = optarg;
+            break;
+         case 'm':
+            min_ms = (unsigned)MAX(1, atoi(optarg));
+            break;
+         default:
+            usage();
+            return 1;
+      }
+   }
+
+   /* read first, so a benchmark that looks slower can be measured again while it is set up */
+   if (baseline_path && !read_baseline(baseline_path))
+   {
+      fprintf(stderr, "could not read the baseline %s\n", baseline_path);
+      baseline_path = NULL;
+   }
+
+   for (i = 0; i < FRAME_SAMPLES; i++)
+      samples[i] = (int16_t)(sin(i * 2.0 * M_PI * 440.0 / 44100.0) * 12000.0);
+
+   /* dither below the silence threshold, so the whole chunk is scanned */
+   for (i = 0; i < ARRAY_SIZE(quiet); i++)
+      quiet[i] = (int16_t)((int)((i * 7919) % 5) - 2);
+
+   for (i = 0; i < sizeof(sector); i++)
+      sector[i] = (unsigned char)(i * 7);
+
+   for (i = 0; i < sizeof(tracks); i++)
+      tracks[i / sizeof(tracks[0])][i % sizeof(tracks[0])] = (unsigned char)(i * 13 + (i >> 11));
+
+   convert_s16_to_float_init_simd();
+   convert_float_to_s16_init_simd();
+   convert_s16_to_float(samples_float, samples, FRAME_SAMPLES, 1.0f);
+
+   run("cdrom_lba_to_msf", 0, bench_lba_to_msf, NULL);
+   run("cdrom_msf_to_lba", 0, bench_msf_to_lba, NULL);
+   run("increment_msf", 0, bench_increment_msf, NULL);
+
+   /* the plain C kernel, and the one the core would pick on this CPU if it is a different one */
+   meter_init(0);
+   run("meter_sum_c", FRAME_SAMPLES * 2, bench_meter, NULL);
+
+   meter_init(cpu_features);
+
+   if (strcmp(meter_get_kernel_name(), "C"))
+   {
+      char kernel[16];
+      size_t j;
+
+      strlcpy(kernel, meter_get_kernel_name(), sizeof(kernel));
+
+      for (j = 0; kernel[j]; j++)
+         kernel[j] = (char)tolower((unsigned char)kernel[j]);
+
+      snprintf(name, sizeof(name), "meter_sum_%s", kernel);
+      run(name, FRAME_SAMPLES * 2, bench_meter, NULL);
+   }
+
+   crossfade_init(0);
+   run("crossfade_mix_c", FRAME_SAMPLES * 2 * 2, bench_crossfade, NULL);
+
+   crossfade_init(cpu_features);
+
+   if (strcmp(crossfade_get_kernel_name(), "C"))
+   {
+      char kernel[16];
+      size_t j;
+
+      strlcpy(kernel, crossfade_get_kernel_name(), sizeof(kernel));
+
+      for (j = 0; kernel[j]; j++)
+         kernel[j] = (char)tolower((unsigned char)kernel[j]);
+
+      snprintf(name, sizeof(name), "crossfade_mix_%s", kernel);
+      run(name, FRAME_SAMPLES * 2 * 2, bench_crossfade, NULL);
+   }
+
+   {
+      deemphasis_t filter;
+
+      deemphasis_setup(&filter);
+
+      deemphasis_init(0);
+      run("deemphasis_c", FRAME_SAMPLES * 2, bench_deemphasis, &filter);
+
+      deemphasis_init(cpu_features);
+
+      if (strcmp(deemphasis_get_kernel_name(), "C"))
+      {
+         char kernel[16];
+         size_t j;
+
+         strlcpy(kernel, deemphasis_get_kernel_name(), sizeof(kernel));
+
+         for (j = 0; kernel[j]; j++)
+            kernel[j] = (char)tolower((unsigned char)kernel[j]);
+
+         snprintf(name, sizeof(name), "deemphasis_%s", kernel);
+         run(name, FRAME_SAMPLES * 2, bench_deemphasis, &filter);
+      }
+   }
+
+   {
+      loudness_t *loudness = loudness_new();
+
+      loudness_init(0);
+      run("loudness_add_c", FRAME_SAMPLES * 2, bench_loudness, loudness);
+
+      loudness_init(cpu_features);
+
+      if (strcmp(loudness_get_kernel_name(), "C"))
+      {
+         char kernel[16];
+         size_t j;
+
+         strlcpy(kernel, loudness_get_kernel_name(), sizeof(kernel));
+
+         for (j = 0; kernel[j]; j++)
+            kernel[j] = (char)tolower((unsigned char)kernel[j]);
+
+         snprintf(name, sizeof(name), "loudness_add_%s", kernel);
+         run(name, FRAME_SAMPLES * 2, bench_loudness, loudness);
+      }
+
+      loudness_free(loudness);
+   }
+
+   silence_init(0);
+   run("silence_leading_c", sizeof(quiet), bench_silence, NULL);
+
+   silence_init(cpu_features);
+
+   if (strcmp(silence_get_kernel_name(), "C"))
+   {
+      char kernel[16];
+      size_t j;
+
+      strlcpy(kernel, silence_get_kernel_name(), sizeof(kernel));
+
+      for (j = 0; kernel[j]; j++)
+         kernel[j] = (char)tolower((unsigned char)kernel[j]);
+
+      snprintf(name, sizeof(name), "silence_leading_%s", kernel);
+      run(name, sizeof(quiet), bench_silence, NULL);
+   }
+
+   {
+      stretch_t *stretch = stretch_new();
+
+      if (stretch)
+      {
+         stretch_init(0);
+         run("stretch_2x_c", FRAME_SAMPLES * 2, bench_stretch, stretch);
+
+         stretch_init(cpu_features);
+
+         if (strcmp(stretch_get_kernel_name(), "C"))
+         {
+            char kernel[16];
+            size_t j;
+
+            strlcpy(kernel, stretch_get_kernel_name(), sizeof(kernel));
+
+            for (j = 0; kernel[j]; j++)
+               kernel[j] = (char)tolower((unsigned char)kernel[j]);
+
+            snprintf(name, sizeof(name), "stretch_2x_%s", kernel);
+            run(name, FRAME_SAMPLES * 2, bench_stretch, stretch);
+         }
+
+         stretch_free(stretch);
+      }
+   }
+
+   {
+      fingerprint_t *fingerprint = fingerprint_new();
+
+      if (fingerprint)
+      {
+         run("fingerprint_add", FRAME_SAMPLES * 2, bench_fingerprint, fingerprint);
+         fingerprint_free(fingerprint);
+      }
+   }
+
+   {
+      cdrom_toc_t toc;
+      accuraterip_t *ar;
+
+      memset(&toc, 0, sizeof(toc));
+      toc.num_tracks = 1;
+      toc.track[0].lba = 150;
+      toc.track[0].track_size = 74 * 60 * 75;
+      toc.track[0].audio = true;
+
+      ar = accuraterip_new(&toc, 0);
+
+      if (ar)
+      {
+         accuraterip_init(0);
+         run("accuraterip_add_c", sizeof(quiet), bench_accuraterip, ar);
+
+         accuraterip_init(cpu_features);
+
+         if (strcmp(accuraterip_get_kernel_name(), "C"))
+         {
+            char kernel[16];
+            size_t j;
+
+            strlcpy(kernel, accuraterip_get_kernel_name(), sizeof(kernel));
+
+            for (j = 0; kernel[j]; j++)
+               kernel[j] = (char)tolower((unsigned char)kernel[j]);
+
+            snprintf(name, sizeof(name), "accuraterip_add_%s", kernel);
+            run(name, sizeof(quiet), bench_accuraterip, ar);
+         }
+
+         accuraterip_free(ar);
+      }
+   }
+
+   run("convert_s16_to_float", FRAME_SAMPLES * 2, bench_s16_to_float, NULL);
+   run("convert_float_to_s16", FRAME_SAMPLES * sizeof(float), bench_float_to_s16, NULL);
+
+   sinc = sinc_resampler.init(NULL, 1.0, RESAMPLER_QUALITY_NORMAL, (resampler_simd_mask_t)cpu_features);
+
+   if (sinc)
+   {
+      run("sinc_resample_44k_48k", FRAME_FRAMES * 2 * sizeof(float), bench_sinc, sinc);
+      sinc_resampler.free(sinc);
+   }
+
+   strlcpy(chd_dir, "/tmp/redbook_microXXXXXX", sizeof(chd_dir));
+
+   if (mkdtemp(chd_dir))
+   {
+      /* the CD codecs (cdzl, cdlz, cdfl) need a V5 map and the LZMA/FLAC decoders, which this tree does not build */
+      run_chd("none", CHDCOMPRESSION_NONE);
+      run_chd("zlib", CHDCOMPRESSION_ZLIB);
+      rmdir(chd_dir);
+   }
+
+   run("encoding_crc32_sector", sizeof(sector), bench_crc32, NULL);
+   run("crc32_calculate_sector", sizeof(sector), bench_crc32_calculate, NULL);
+
+   {
+      enum encoding_crc32_impl impl = encoding_crc32_get_impl();
+      int j;
+
+      /* every variant the CPU has, the last one is left as it was picked */
+      for (j = ENCODING_CRC32_BYTEWISE; j <= ENCODING_CRC32_ARMV8; j++)
+      {
+         if (!encoding_crc32_set_impl((enum encoding_crc32_impl)j))
+            continue;
+
+         snprintf(name, sizeof(name), "encoding_crc32_%s", encoding_crc32_get_impl_name((enum encoding_crc32_impl)j));
+         run(name, sizeof(sector), bench_crc32, NULL);
+      }
+
+      encoding_crc32_set_impl(impl);
+   }
+
+   {
+      enum sha256_impl impl = sha256_get_impl();
+      int j;
+
+      /* every variant the CPU has, one track after another and then all at once */
+      for (j = SHA256_IMPL_SCALAR; j <= SHA256_IMPL_ARMV8; j++)
+      {
+         if (!sha256_set_impl((enum sha256_impl)j))
+            continue;
+
+         snprintf(name, sizeof(name), "sha256_%s", sha256_get_impl_name((enum sha256_impl)j));
+         run(name, sizeof(tracks), bench_sha256, NULL);
+         snprintf(name, sizeof(name), "sha256_multi_%s", sha256_get_impl_name((enum sha256_impl)j));
+         run(name, sizeof(tracks), bench_sha256_multi, NULL);
+      }
+
+      sha256_set_impl(impl);
+   }
+
+   gui = gui_new(320, 240, sizeof(unsigned));
+
+   if (gui)
+   {
+      gui_set_window_title(gui, "Audio Player");
+      gui_set_footer(gui, "Left/Right = Previous/Next, B = Pause");
+      run("ugui_redraw", 0, bench_gui, gui);
+      gui_free(gui);
+   }
+
+   if (json_path && !write_json(json_path))
+      fprintf(stderr, "could not write %s\n", json_path);
+
+   if (baseline_path && (regressions = compare_baseline()))
+      printf("\n%d benchmark(s) regressed by more than %.1f%%\n", regressions, threshold);
+
+   return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,191 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <string.h>
+#include <math.h>
+#include <libretro.h>
+#include "crossfade.h"
+#include "simd.h"
+
+/* The equal-power curve is evaluated every this many frames of the fade and followed linearly in between.
+ * Blocks are counted from the start of the fade, so how the fade is split into calls changes the result by rounding at most. */
+#define CROSSFADE_BLOCK_FRAMES 64
+
+#define CROSSFADE_HALF_PI 1.57079632679489661923
+
+/* mixes frames with gains that change by a fixed step every frame */
+typedef void (*crossfade_ramp_t)(int16_t *out, const int16_t *from, const int16_t *to, size_t frames,
+      float from_gain, float from_step, float to_gain, float to_step);
+
+static void crossfade_ramp_c(int16_t *out, const int16_t *from, const int16_t *to, size_t frames,
+      float from_gain, float from_step, float to_gain, float to_step)
+{
+   size_t i;
+
+   for (i = 0; i < frames; i++)
+   {
+      float f = from_gain + from_step * (float)i;
+      float t = to_gain + to_step * (float)i;
+
+      out[(i * 2) + 0] = simd_to_int16(from[(i * 2) + 0] * f + to[(i * 2) + 0] * t);
+      out[(i * 2) + 1] = simd_to_int16(from[(i * 2) + 1] * f + to[(i * 2) + 1] * t);
+   }
+}
+
+#ifdef SIMD_HAVE_SSE2
+static void crossfade_ramp_sse2(int16_t *out, const int16_t *from, const int16_t *to, size_t frames,
+      float from_gain, float from_step, float to_gain, float to_step)
+{
+   size_t i;
+   /* the gains of 4 frames, each frame is two samples so a register holds two of them */
+   __m128 from_lo = _mm_setr_ps(from_gain, from_gain, from_gain + from_step, from_gain + from_step);
+   __m128 from_hi = _mm_add_ps(from_lo, _mm_set1_ps(from_step * 2));
+   __m128 to_lo = _mm_setr_ps(to_gain, to_gain, to_gain + to_step, to_gain + to_step);
+   __m128 to_hi = _mm_add_ps(to_lo, _mm_set1_ps(to_step * 2));
+   __m128 from_inc = _mm_set1_ps(from_step * 4);
+   __m128 to_inc = _mm_set1_ps(to_step * 4);
+
+   for (i = 0; i + 4 <= frames; i += 4)
+   {
+      __m128i f = _mm_loadu_si128((const __m128i*)(from + i * 2));
+      __m128i t = _mm_loadu_si128((const __m128i*)(to + i * 2));
+      __m128 f_lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(f, f), 16));
+      __m128 f_hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(f, f), 16));
+      __m128 t_lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(t, t), 16));
+      __m128 t_hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(t, t), 16));
+      __m128 lo = _mm_add_ps(_mm_mul_ps(f_lo, from_lo), _mm_mul_ps(t_lo, to_lo));
+      __m128 hi = _mm_add_ps(_mm_mul_ps(f_hi, from_hi), _mm_mul_ps(t_hi, to_hi));
+
+      _mm_storeu_si128((__m128i*)(out + i * 2), simd_to_int16_sse2(lo, hi));
+
+      from_lo = _mm_add_ps(from_lo, from_inc);
+      from_hi = _mm_add_ps(from_hi, from_inc);
+      to_lo = _mm_add_ps(to_lo, to_inc);
+      to_hi = _mm_add_ps(to_hi, to_inc);
+   }
+
+   crossfade_ramp_c(out + i * 2, from + i * 2, to + i * 2, frames - i,
+         from_gain + from_step * (float)i, from_step, to_gain + to_step * (float)i, to_step);
+}
+#endif
+
+#ifdef SIMD_HAVE_NEON
+static void crossfade_ramp_neon(int16_t *out, const int16_t *from, const int16_t *to, size_t frames,
+      float from_gain, float from_step, float to_gain, float to_step)
+{
+   size_t i;
+   float from_init[4];
+   float to_init[4];
+   float32x4_t from_lo, from_hi, to_lo, to_hi;
+   float32x4_t from_inc = vdupq_n_f32(from_step * 4);
+   float32x4_t to_inc = vdupq_n_f32(to_step * 4);
+
+   from_init[0] = from_init[1] = from_gain;
+   from_init[2] = from_init[3] = from_gain + from_step;
+   to_init[0] = to_init[1] = to_gain;
+   to_init[2] = to_init[3] = to_gain + to_step;
+
+   from_lo = vld1q_f32(from_init);
+   from_hi = vaddq_f32(from_lo, vdupq_n_f32(from_step * 2));
+   to_lo = vld1q_f32(to_init);
+   to_hi = vaddq_f32(to_lo, vdupq_n_f32(to_step * 2));
+
+   for (i = 0; i + 4 <= frames; i += 4)
+   {
+      int16x8_t f = vld1q_s16(from + i * 2);
+      int16x8_t t = vld1q_s16(to + i * 2);
+      float32x4_t lo = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(f))), from_lo);
+      float32x4_t hi = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(f))), from_hi);
+
+      lo = vmlaq_f32(lo, vcvtq_f32_s32(vmovl_s16(vget_low_s16(t))), to_lo);
+      hi = vmlaq_f32(hi, vcvtq_f32_s32(vmovl_s16(vget_high_s16(t))), to_hi);
+
+      vst1q_s16(out + i * 2, simd_to_int16_neon(lo, hi));
+
+      from_lo = vaddq_f32(from_lo, from_inc);
+      from_hi = vaddq_f32(from_hi, from_inc);
+      to_lo = vaddq_f32(to_lo, to_inc);
+      to_hi = vaddq_f32(to_hi, to_inc);
+   }
+
+   crossfade_ramp_c(out + i * 2, from + i * 2, to + i * 2, frames - i,
+         from_gain + from_step * (float)i, from_step, to_gain + to_step * (float)i, to_step);
+}
+#endif
+
+static crossfade_ramp_t crossfade_kernel = crossfade_ramp_c;
+static const char *crossfade_kernel_name = "C";
+
+void crossfade_init(uint64_t cpu_features)
+{
+   crossfade_ramp_t kernel = crossfade_ramp_c;
+   const char *name = "C";
+
+#ifdef SIMD_HAVE_SSE2
+   if (cpu_features & RETRO_SIMD_SSE2)
+   {
+      kernel = crossfade_ramp_sse2;
+      name = "SSE2";
+   }
+#endif
+
+#ifdef SIMD_HAVE_NEON
+   if (cpu_features & (RETRO_SIMD_NEON | RETRO_SIMD_ASIMD))
+   {
+      kernel = crossfade_ramp_neon;
+      name = "NEON";
+   }
+#endif
+
+   (void)cpu_features;
+
+   crossfade_kernel = kernel;
+   crossfade_kernel_name = name;
+}
+
+const char* crossfade_get_kernel_name(void)
+{
+   return crossfade_kernel_name;
+}
+
+void crossfade_mix(int16_t *out, const int16_t *from, const int16_t *to, size_t frames, size_t pos, size_t len)
+{
+   while (frames && pos < len)
+   {
+      size_t block_start = pos - pos % CROSSFADE_BLOCK_FRAMES;
+      size_t block_end = block_start + CROSSFADE_BLOCK_FRAMES < len ? block_start + CROSSFADE_BLOCK_FRAMES : len;
+      size_t count = block_end - pos < frames ? block_end - pos : frames;
+      double start = CROSSFADE_HALF_PI * block_start / len;
+      double end = CROSSFADE_HALF_PI * block_end / len;
+      double from_step = (cos(end) - cos(start)) / (block_end - block_start);
+      double to_step = (sin(end) - sin(start)) / (block_end - block_start);
+      size_t offset = pos - block_start;
+
+      crossfade_kernel(out, from, to, count,
+            (float)(cos(start) + from_step * offset), (float)from_step,
+            (float)(sin(start) + to_step * offset), (float)to_step);
+
+      out += count * 2;
+      from += count * 2;
+      to += count * 2;
+      frames -= count;
+      pos += count;
+   }
+
+   /* past the end of the fade only the incoming audio is left */
+   if (frames && out != to)
+      memmove(out, to, frames * 2 * sizeof(int16_t));
+}
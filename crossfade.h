@@ -0,0 +1,32 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef CROSSFADE_H__
+#define CROSSFADE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Picks the fastest mixing kernel for the given RETRO_SIMD_* feature mask. */
+void crossfade_init(uint64_t cpu_features);
+
+const char* crossfade_get_kernel_name(void);
+
+/* Mixes frame pos to pos + frames of an equal-power crossfade that is len frames long.
+ * from is the outgoing audio, to the incoming one, both interleaved stereo. out may be the same as to. */
+void crossfade_mix(int16_t *out, const int16_t *from, const int16_t *to, size_t frames, size_t pos, size_t len);
+
+#endif /* CROSSFADE_H__ */
@@ -0,0 +1,201 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <string.h>
+#include <math.h>
+#include <libretro.h>
+#include "deemphasis.h"
+#include "simd.h"
+
+/* A high shelf that follows the analog 50/15 us de-emphasis curve at 44.1 kHz to within 0.1 dB
+ * from 20 Hz to 20 kHz. A bilinear transform of the analog filter is off by over 2 dB at the top. */
+#define DEEMPHASIS_GAIN_DB -9.42
+#define DEEMPHASIS_FREQ_HZ 5220.0
+#define DEEMPHASIS_SLOPE 0.485
+#define DEEMPHASIS_RATE 44100.0
+
+#define DEEMPHASIS_PI 3.14159265358979323846
+
+typedef void (*deemphasis_run_t)(deemphasis_t *filter, int16_t *samples, size_t frames);
+
+static void deemphasis_run_c(deemphasis_t *filter, int16_t *samples, size_t frames)
+{
+   size_t i;
+   int c;
+
+   for (c = 0; c < 2; c++)
+   {
+      float z1 = filter->z1[c];
+      float z2 = filter->z2[c];
+
+      for (i = 0; i < frames; i++)
+      {
+         float x = samples[(i * 2) + c];
+         float y = filter->b0 * x + z1;
+
+         z1 = filter->b1 * x - filter->a1 * y + z2;
+         z2 = filter->b2 * x - filter->a2 * y;
+
+         samples[(i * 2) + c] = simd_to_int16(y);
+      }
+
+      filter->z1[c] = z1;
+      filter->z2[c] = z2;
+   }
+}
+
+#ifdef SIMD_HAVE_SSE2
+/* Both channels go through the filter together in the low two lanes. Each sample depends on the
+ * one before, so a frame at a time is as wide as it gets. */
+static void deemphasis_run_sse2(deemphasis_t *filter, int16_t *samples, size_t frames)
+{
+   __m128 b0 = _mm_set1_ps(filter->b0);
+   __m128 b1 = _mm_set1_ps(filter->b1);
+   __m128 b2 = _mm_set1_ps(filter->b2);
+   __m128 a1 = _mm_set1_ps(filter->a1);
+   __m128 a2 = _mm_set1_ps(filter->a2);
+   __m128 z1 = _mm_setr_ps(filter->z1[0], filter->z1[1], 0.0f, 0.0f);
+   __m128 z2 = _mm_setr_ps(filter->z2[0], filter->z2[1], 0.0f, 0.0f);
+   float out[4];
+   size_t i;
+
+   for (i = 0; i < frames; i++)
+   {
+      int32_t frame;
+      __m128i in;
+      __m128 x, y;
+
+      memcpy(&frame, samples + i * 2, sizeof(frame));
+
+      in = _mm_cvtsi32_si128(frame);
+      x = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(in, in), 16));
+      y = _mm_add_ps(_mm_mul_ps(b0, x), z1);
+
+      z1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), z2);
+      z2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+
+      frame = _mm_cvtsi128_si32(simd_to_int16_sse2(y, y));
+
+      memcpy(samples + i * 2, &frame, sizeof(frame));
+   }
+
+   _mm_storeu_ps(out, z1);
+   filter->z1[0] = out[0];
+   filter->z1[1] = out[1];
+
+   _mm_storeu_ps(out, z2);
+   filter->z2[0] = out[0];
+   filter->z2[1] = out[1];
+}
+#endif
+
+#ifdef SIMD_HAVE_NEON
+static void deemphasis_run_neon(deemphasis_t *filter, int16_t *samples, size_t frames)
+{
+   float32x2_t b0 = vdup_n_f32(filter->b0);
+   float32x2_t b1 = vdup_n_f32(filter->b1);
+   float32x2_t b2 = vdup_n_f32(filter->b2);
+   float32x2_t a1 = vdup_n_f32(filter->a1);
+   float32x2_t a2 = vdup_n_f32(filter->a2);
+   float32x2_t z1 = vld1_f32(filter->z1);
+   float32x2_t z2 = vld1_f32(filter->z2);
+   size_t i;
+
+   for (i = 0; i < frames; i++)
+   {
+      int16x4_t in = vld1_lane_s16(samples + i * 2 + 1, vld1_lane_s16(samples + i * 2, vdup_n_s16(0), 0), 1);
+      float32x2_t x = vcvt_f32_s32(vget_low_s32(vmovl_s16(in)));
+      float32x2_t y = vadd_f32(vmul_f32(b0, x), z1);
+      int16x4_t out;
+
+      z1 = vadd_f32(vsub_f32(vmul_f32(b1, x), vmul_f32(a1, y)), z2);
+      z2 = vsub_f32(vmul_f32(b2, x), vmul_f32(a2, y));
+
+      out = vqmovn_s32(simd_round_neon(vcombine_f32(y, vdup_n_f32(0.0f))));
+
+      vst1_lane_s16(samples + i * 2, out, 0);
+      vst1_lane_s16(samples + i * 2 + 1, out, 1);
+   }
+
+   vst1_f32(filter->z1, z1);
+   vst1_f32(filter->z2, z2);
+}
+#endif
+
+static deemphasis_run_t deemphasis_kernel = deemphasis_run_c;
+static const char *deemphasis_kernel_name = "C";
+
+void deemphasis_init(uint64_t cpu_features)
+{
+   deemphasis_run_t kernel = deemphasis_run_c;
+   const char *name = "C";
+
+#ifdef SIMD_HAVE_SSE2
+   if (cpu_features & RETRO_SIMD_SSE2)
+   {
+      kernel = deemphasis_run_sse2;
+      name = "SSE2";
+   }
+#endif
+
+#ifdef SIMD_HAVE_NEON
+   if (cpu_features & (RETRO_SIMD_NEON | RETRO_SIMD_ASIMD))
+   {
+      kernel = deemphasis_run_neon;
+      name = "NEON";
+   }
+#endif
+
+   (void)cpu_features;
+
+   deemphasis_kernel = kernel;
+   deemphasis_kernel_name = name;
+}
+
+const char* deemphasis_get_kernel_name(void)
+{
+   return deemphasis_kernel_name;
+}
+
+/* the high shelf of the Audio EQ Cookbook */
+void deemphasis_setup(deemphasis_t *filter)
+{
+   double a = pow(10.0, DEEMPHASIS_GAIN_DB / 40.0);
+   double w0 = 2.0 * DEEMPHASIS_PI * DEEMPHASIS_FREQ_HZ / DEEMPHASIS_RATE;
+   double cos_w0 = cos(w0);
+   double alpha = sin(w0) / 2.0 * sqrt((a + 1.0 / a) * (1.0 / DEEMPHASIS_SLOPE - 1.0) + 2.0);
+   double beta = 2.0 * sqrt(a) * alpha;
+   double a0 = (a + 1.0) - (a - 1.0) * cos_w0 + beta;
+
+   filter->b0 = (float)(a * ((a + 1.0) + (a - 1.0) * cos_w0 + beta) / a0);
+   filter->b1 = (float)(-2.0 * a * ((a - 1.0) + (a + 1.0) * cos_w0) / a0);
+   filter->b2 = (float)(a * ((a + 1.0) + (a - 1.0) * cos_w0 - beta) / a0);
+   filter->a1 = (float)(2.0 * ((a - 1.0) - (a + 1.0) * cos_w0) / a0);
+   filter->a2 = (float)(((a + 1.0) - (a - 1.0) * cos_w0 - beta) / a0);
+
+   deemphasis_clear(filter);
+}
+
+void deemphasis_clear(deemphasis_t *filter)
+{
+   filter->z1[0] = filter->z1[1] = 0.0f;
+   filter->z2[0] = filter->z2[1] = 0.0f;
+}
+
+void deemphasis_run(deemphasis_t *filter, int16_t *samples, size_t frames)
+{
+   deemphasis_kernel(filter, samples, frames);
+}
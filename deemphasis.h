@@ -0,0 +1,47 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef DEEMPHASIS_H__
+#define DEEMPHASIS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* A biquad that undoes the 50/15 us pre-emphasis some CDs were mastered with, for interleaved stereo.
+ * The history is kept per channel in transposed direct form II. */
+typedef struct
+{
+   float b0, b1, b2;
+   float a1, a2;
+   float z1[2];
+   float z2[2];
+} deemphasis_t;
+
+/* Picks the fastest filter kernel for the given RETRO_SIMD_* feature mask. */
+void deemphasis_init(uint64_t cpu_features);
+
+const char* deemphasis_get_kernel_name(void);
+
+/* Works out the filter for 44.1 kHz and clears its history. */
+void deemphasis_setup(deemphasis_t *filter);
+
+/* Forgets the previous samples, for audio that does not follow on from them. */
+void deemphasis_clear(deemphasis_t *filter);
+
+/* Filters interleaved stereo frames in place. */
+void deemphasis_run(deemphasis_t *filter, int16_t *samples, size_t frames);
+
+#endif /* DEEMPHASIS_H__ */
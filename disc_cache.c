@@ -0,0 +1,234 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <streams/file_stream.h>
+#include <file/file_path.h>
+#include <encodings/crc32.h>
+#include <compat/strl.h>
+#include <retro_miscellaneous.h>
+
+#include "disc_cache.h"
+#include "text_file.h"
+
+/* longest line written, a line that is longer than this was not written by us */
+#define DISC_CACHE_LINE_BYTES 64
+
+uint32_t disc_cache_get_id(const cdrom_toc_t *toc)
+{
+   uint32_t crc = 0;
+   int i;
+
+   if (!toc || !toc->num_tracks)
+      return 0;
+
+   crc = encoding_crc32(crc, &toc->num_tracks, 1);
+
+   for (i = 0; i < toc->num_tracks; i++)
+   {
+      uint8_t start[5];
+
+      start[0] = (uint8_t)toc->track[i].audio;
+      start[1] = (uint8_t)(toc->track[i].lba >> 24);
+      start[2] = (uint8_t)(toc->track[i].lba >> 16);
+      start[3] = (uint8_t)(toc->track[i].lba >> 8);
+      start[4] = (uint8_t)toc->track[i].lba;
+
+      crc = encoding_crc32(crc, start, sizeof(start));
+   }
+
+   return crc ? crc : 1;
+}
+
+/* the whole file as a string, NULL if there is none yet */
+static char* disc_cache_read(const char *path)
+{
+   void *buf = NULL;
+   int64_t len = 0;
+
+   if (!path_is_valid(path) || !filestream_read_file(path, &buf, &len))
+      return NULL;
+
+   return (char*)buf;
+}
+
+/* the values of track in entry, NULL if track is out of range */
+static disc_cache_loudness_t* disc_cache_get_loudness(disc_cache_entry_t *entry, unsigned track)
+{
+   if (!track)
+      return &entry->album;
+
+   if (track > sizeof(entry->track) / sizeof(entry->track[0]))
+      return NULL;
+
+   return &entry->track[track - 1];
+}
+
+bool disc_cache_load(const char *path, uint32_t disc_id, disc_cache_entry_t *entry)
+{
+   char *buf;
+   char *line;
+   char *next;
+   bool found = false;
+
+   memset(entry, 0, sizeof(*entry));
+   entry->disc_id = disc_id;
+
+   /* not while another player is halfway through replacing it */
+   text_file_lock();
+   buf = disc_cache_read(path);
+   text_file_unlock();
+
+   if (!buf)
+      return false;
+
+   for (line = buf; line; line = next)
+   {
+      disc_cache_loudness_t *loudness;
+      disc_cache_audible_t *audible;
+      unsigned id = 0;
+      unsigned track = 0;
+      char name[16];
+      char value[24];
+
+      next = text_file_split_line(line);
+
+      if (sscanf(line, "%8x %u %15[^=]=%23s", &id, &track, name, value) != 4 || id != disc_id)
+         continue;
+
+      loudness = disc_cache_get_loudness(entry, track);
+      audible = track && loudness ? &entry->audible[track - 1] : NULL;
+
+      if (!loudness)
+         continue;
+
+      /* names that are not known here are from a newer version and left alone */
+      if (!track && !strcmp(name, "indexed"))
+         entry->indexed = atoi(value) != 0;
+      else if (!strcmp(name, "loudness"))
+      {
+         loudness->loudness = (float)atof(value);
+         loudness->analyzed = true;
+         found = true;
+      }
+      else if (!strcmp(name, "peak"))
+         loudness->peak = (float)atof(value);
+      else if (audible && !strcmp(name, "start"))
+      {
+         audible->start = (uint32_t)strtoul(value, NULL, 10);
+         audible->analyzed = true;
+         found = true;
+      }
+      else if (audible && !strcmp(name, "end"))
+         audible->end = (uint32_t)strtoul(value, NULL, 10);
+   }
+
+   free(buf);
+
+   return found;
+}
+
+static size_t disc_cache_print(char *out, size_t size, uint32_t disc_id, unsigned track, const disc_cache_loudness_t *loudness)
+{
+   if (!loudness->analyzed)
+      return 0;
+
+   return (size_t)snprintf(out, size, "%08x %u loudness=%.2f\n%08x %u peak=%.5f\n",
+         (unsigned)disc_id, track, loudness->loudness, (unsigned)disc_id, track, loudness->peak);
+}
+
+static size_t disc_cache_print_audible(char *out, size_t size, uint32_t disc_id, unsigned track, const disc_cache_audible_t *audible)
+{
+   if (!audible->analyzed)
+      return 0;
+
+   return (size_t)snprintf(out, size, "%08x %u start=%u\n%08x %u end=%u\n",
+         (unsigned)disc_id, track, (unsigned)audible->start, (unsigned)disc_id, track, (unsigned)audible->end);
+}
+
+/* path with the lines of entry replaced */
+static bool disc_cache_rewrite(const char *path, const disc_cache_entry_t *entry)
+{
+   char *old = disc_cache_read(path);
+   size_t num_tracks = sizeof(entry->track) / sizeof(entry->track[0]);
+   size_t size = (old ? strlen(old) : 0) + (num_tracks + 2) * DISC_CACHE_LINE_BYTES * 4 + 1;
+   char *out = (char*)malloc(size);
+   size_t len = 0;
+   size_t i;
+   bool ok;
+
+   if (!out)
+   {
+      free(old);
+      return false;
+   }
+
+   /* the other discs stay as they are */
+   if (old)
+   {
+      char *line;
+      char *next;
+
+      for (line = old; line; line = next)
+      {
+         unsigned id = 0;
+
+         next = text_file_split_line(line);
+
+         if (!*line)
+            continue;
+
+         if (sscanf(line, "%8x", &id) == 1 && id == entry->disc_id)
+            continue;
+
+         len += strlcpy(out + len, line, size - len);
+         len += strlcpy(out + len, "\n", size - len);
+      }
+
+      free(old);
+   }
+
+   len += disc_cache_print(out + len, size - len, entry->disc_id, 0, &entry->album);
+
+   if (entry->indexed)
+      len += (size_t)snprintf(out + len, size - len, "%08x 0 indexed=1\n", (unsigned)entry->disc_id);
+
+   for (i = 0; i < num_tracks; i++)
+   {
+      len += disc_cache_print(out + len, size - len, entry->disc_id, (unsigned)(i + 1), &entry->track[i]);
+      len += disc_cache_print_audible(out + len, size - len, entry->disc_id, (unsigned)(i + 1), &entry->audible[i]);
+   }
+
+   ok = text_file_replace(path, out, len);
+
+   free(out);
+
+   return ok;
+}
+
+bool disc_cache_store(const char *path, const disc_cache_entry_t *entry)
+{
+   bool ok;
+
+   /* read and written back in one go, so what another player stored in between is kept */
+   text_file_lock();
+   ok = disc_cache_rewrite(path, entry);
+   text_file_unlock();
+
+   return ok;
+}
@@ -0,0 +1,61 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef DISC_CACHE_H__
+#define DISC_CACHE_H__
+
+#include <stdint.h>
+#include <boolean.h>
+#include <cdrom/cdrom.h>
+
+/* What was found out about a disc by reading all of it, kept in a text file so it is only done once.
+ * Every value is on a line of its own, "<disc id> <track> <name>=<value>", with track 0 for the disc. */
+
+typedef struct
+{
+   bool analyzed;
+   float loudness;   /* integrated loudness in LUFS */
+   float peak;       /* true peak, 1.0 is full scale */
+} disc_cache_loudness_t;
+
+/* where the audio of a track starts and ends once the silence around it is left out */
+typedef struct
+{
+   bool analyzed;
+   uint32_t start;   /* byte offset into the track of the first frame that is not silent */
+   uint32_t end;     /* just past the last one, start = end = 0 for a silent track */
+} disc_cache_audible_t;
+
+typedef struct
+{
+   uint32_t disc_id;
+   bool indexed;     /* every audio track is in the content index */
+   disc_cache_loudness_t album;
+   disc_cache_loudness_t track[99];
+   disc_cache_audible_t audible[99];
+} disc_cache_entry_t;
+
+/* Identifies a disc by where its tracks start, which the raw TOC gives before the rest of it is built.
+ * 0 without a disc. */
+uint32_t disc_cache_get_id(const cdrom_toc_t *toc);
+
+/* Fills entry with what the cache at path has on the disc, false if it has nothing. */
+bool disc_cache_load(const char *path, uint32_t disc_id, disc_cache_entry_t *entry);
+
+/* Replaces what the cache at path has on the disc of entry, the file is swapped in whole. */
+bool disc_cache_store(const char *path, const disc_cache_entry_t *entry);
+
+#endif /* DISC_CACHE_H__ */
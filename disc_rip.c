@@ -0,0 +1,844 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libretro.h>
+#include <cdrom/cdrom.h>
+#include <streams/file_stream.h>
+#include <rthreads/rthreads.h>
+#include <vfs/vfs_implementation_cdrom.h>
+#include <formats/rwav.h>
+#include <file/file_path.h>
+#include <compat/strl.h>
+#include <retro_miscellaneous.h>
+
+#include "disc_rip.h"
+#include "accuraterip.h"
+
+/* Sectors of each read, at most. A read is a single command, so it is fewer for drives that transfer less at
+ * once, a read split in several commands could be shifted differently in each part. */
+#define DISC_RIP_READ_SECTORS 32
+#define DISC_RIP_READ_BYTES (DISC_RIP_READ_SECTORS * 2352)
+
+/* sectors before the new audio that each read also takes, to find where the read landed by what was ripped before */
+#define DISC_RIP_OVERLAP_SECTORS 2
+
+/* reads may come back this far off in either direction, which the overlap leaves room for */
+#define DISC_RIP_MAX_JITTER_FRAMES 256
+
+/* what a read that is all silence leaves to the next one, it has silence at pos for that much less with the
+ * furthest shift it could be found at and the furthest it could really have */
+#define DISC_RIP_SILENT_SLACK (DISC_RIP_MAX_JITTER_FRAMES * 4 * 2)
+
+/* bytes at the end of what was ripped that a read has to have in it */
+#define DISC_RIP_TAIL_BYTES 2352
+
+/* reads under way or waiting to be checked */
+#define DISC_RIP_SLOTS 4
+
+/* reads of the same audio without two agreeing, before a sector of what the last one had is taken */
+#define DISC_RIP_MAX_READS 16
+
+/* sectors read far away before a re-read, when the cache of the drive cannot be turned off */
+#define DISC_RIP_FLUSH_SECTORS 75
+
+typedef struct
+{
+   uint32_t generation;
+   unsigned lba;              /* of the first sector, as in the TOC */
+   unsigned sectors;
+   unsigned c2_errors;
+   bool failed;               /* some sectors could not be read at all and are left zero */
+   bool last;                 /* of its request, the reader waits for a new one after it */
+   uint8_t data[DISC_RIP_READ_BYTES];
+} disc_rip_read_t;
+
+struct disc_rip
+{
+   sthread_t *reader;
+   sthread_t *verifier;
+   slock_t *lock;
+   scond_t *cond;
+   char drive;
+   bool idle;
+   bool quit;
+   bool done;
+   bool finished;             /* the verifier needs no more reads */
+   bool reader_failed;
+   bool read_cache_disabled;
+   char dir[PATH_MAX_LENGTH];
+   char accuraterip_dir[PATH_MAX_LENGTH];
+   uint32_t disc_id;
+   int read_offset;
+
+   /* set up by the verifier before its first request */
+   const cdrom_toc_t *toc;
+   unsigned char first_track;
+   unsigned passes;           /* reads of each chunk, two unless the drive flags C2 errors */
+   unsigned chunk_sectors;    /* that each read moves on by */
+
+   /* What the reader is to read next, set by the verifier. A new generation starts over at request_lba,
+    * reads made for an older one are dropped. */
+   uint32_t generation;
+   unsigned request_lba;
+   unsigned request_end;
+   bool request_flush;
+
+   /* reads in the order they were made, the reader fills them and the verifier takes them */
+   disc_rip_read_t slots[DISC_RIP_SLOTS];
+   unsigned first;
+   unsigned filled;
+
+   /* only touched by the verifier until done is set */
+   disc_rip_result_t result;
+   accuraterip_t *accuraterip;
+   rwav_writer_t *wav;
+   char disc_dir[PATH_MAX_LENGTH];
+   char wav_path[PATH_MAX_LENGTH];
+   unsigned char track;       /* being written, 0 once there are no more */
+   bool c2;
+   int64_t pos;               /* next byte to write, as read from LBA 0 */
+   int64_t track_end;
+   int64_t readable_end;      /* the end of the last audio track, nothing after it is read */
+   unsigned reads;            /* of the audio at pos so far */
+   uint8_t tail[DISC_RIP_TAIL_BYTES];
+   size_t tail_len;
+   uint8_t candidate[DISC_RIP_READ_BYTES];   /* the audio from pos on as one read had it, until another agrees */
+   size_t candidate_len;
+};
+
+static const uint8_t disc_rip_zeros[2352];
+
+/* reads as far from lba as the audio allows, so a re-read of lba cannot come from the cache of the drive */
+static void disc_rip_flush(libretro_vfs_implementation_file *stream, unsigned lba, unsigned end)
+{
+   if (end < 150 + DISC_RIP_FLUSH_SECTORS * 2)
+      return;
+
+   stream->cdrom.last_frame_valid = false;
+   retro_vfs_file_cdrom_read_lba(stream, lba - 150 < (end - 150) / 2 ? end - DISC_RIP_FLUSH_SECTORS : 150,
+         NULL, DISC_RIP_FLUSH_SECTORS * 2352, 0, false);
+}
+
+static void disc_rip_read(libretro_vfs_implementation_file *stream, disc_rip_read_t *slot)
+{
+   unsigned c2_errors = stream->cdrom.c2_errors;
+   unsigned i;
+
+   slot->failed = false;
+
+   /* the stream keeps the last sector it read, which would not be a read of the disc */
+   stream->cdrom.last_frame_valid = false;
+
+   /* the drive layer does not retry, reading again is up to the rip */
+   if (retro_vfs_file_cdrom_read_lba(stream, slot->lba, slot->data, slot->sectors * 2352, 0, false))
+   {
+      /* sector by sector, so one that cannot be read does not take the others with it */
+      for (i = 0; i < slot->sectors; i++)
+      {
+         stream->cdrom.last_frame_valid = false;
+
+         if (retro_vfs_file_cdrom_read_lba(stream, slot->lba + i, slot->data + i * 2352, 2352, 0, false))
+         {
+            memset(slot->data + i * 2352, 0, 2352);
+            slot->failed = true;
+         }
+      }
+   }
+
+   slot->c2_errors = stream->cdrom.c2_errors - c2_errors;
+}
+
+static void disc_rip_reader(void *data)
+{
+   disc_rip_t *rip = (disc_rip_t*)data;
+   libretro_vfs_implementation_file *stream;
+   RFILE *file = NULL;
+   char path[64];
+   uint32_t generation = 0;
+   unsigned next = 0;
+   unsigned end = 0;
+   unsigned pass = 0;
+   bool flush = false;
+   bool cache_disabled;
+
+   slock_lock(rip->lock);
+
+   while (!rip->generation && !rip->quit && !rip->finished)
+      scond_wait(rip->cond, rip->lock);
+
+   if (!rip->quit && !rip->finished)
+   {
+      cdrom_device_fillpath(path, sizeof(path), rip->drive, rip->first_track, false);
+      file = filestream_open(path, RETRO_VFS_FILE_ACCESS_READ, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+   }
+
+   if (!file)
+   {
+      rip->reader_failed = true;
+      scond_broadcast(rip->cond);
+      slock_unlock(rip->lock);
+      return;
+   }
+
+   slock_unlock(rip->lock);
+
+   stream = filestream_get_vfs_handle(file);
+   cache_disabled = cdrom_set_read_cache(stream, false);
+
+   slock_lock(rip->lock);
+   rip->read_cache_disabled = cache_disabled;
+   slock_unlock(rip->lock);
+
+   for (;;)
+   {
+      disc_rip_read_t *slot;
+      unsigned lba;
+
+      slock_lock(rip->lock);
+
+      for (;;)
+      {
+         if (rip->quit || rip->finished)
+            break;
+
+         if (rip->generation != generation)
+         {
+            generation = rip->generation;
+            next = rip->request_lba;
+            end = rip->request_end;
+            flush = rip->request_flush;
+            pass = 0;
+         }
+
+         if (rip->idle && rip->filled < DISC_RIP_SLOTS && next < end)
+            break;
+
+         scond_wait(rip->cond, rip->lock);
+      }
+
+      if (rip->quit || rip->finished)
+      {
+         slock_unlock(rip->lock);
+         break;
+      }
+
+      slot = &rip->slots[(rip->first + rip->filled) % DISC_RIP_SLOTS];
+
+      slock_unlock(rip->lock);
+
+      lba = next >= 150 + DISC_RIP_OVERLAP_SECTORS ? next - DISC_RIP_OVERLAP_SECTORS : 150;
+
+      /* a second read of the same audio has to come from the disc */
+      if (!cache_disabled && (flush || pass))
+         disc_rip_flush(stream, lba, end);
+
+      slot->generation = generation;
+      slot->lba = lba;
+      slot->sectors = MIN(next + rip->chunk_sectors, end) - lba;
+      slot->last = next + rip->chunk_sectors >= end && pass + 1 >= rip->passes;
+      disc_rip_read(stream, slot);
+
+      flush = false;
+
+      if (++pass >= rip->passes)
+      {
+         pass = 0;
+         next += rip->chunk_sectors;
+      }
+
+      slock_lock(rip->lock);
+      rip->filled++;
+      scond_broadcast(rip->cond);
+      slock_unlock(rip->lock);
+   }
+
+   if (cache_disabled)
+      cdrom_set_read_cache(stream, true);
+
+   filestream_close(file);
+}
+
+/* has the reader start over at the sector pos is in */
+static void disc_rip_request(disc_rip_t *rip, bool flush)
+{
+   int64_t sector = rip->pos > 0 ? rip->pos / 2352 : 0;
+
+   slock_lock(rip->lock);
+   rip->generation++;
+   rip->request_lba = (unsigned)sector + 150;
+   rip->request_end = (unsigned)(rip->readable_end / 2352) + 150;
+   rip->request_flush = flush;
+   scond_broadcast(rip->cond);
+   slock_unlock(rip->lock);
+}
+
+/* waits for the next read made for the current request, NULL if the rip is to stop */
+static const disc_rip_read_t* disc_rip_take(disc_rip_t *rip)
+{
+   const disc_rip_read_t *slot = NULL;
+
+   slock_lock(rip->lock);
+
+   for (;;)
+   {
+      while (!rip->filled && !rip->quit && !rip->reader_failed)
+         scond_wait(rip->cond, rip->lock);
+
+      if (rip->quit || !rip->filled)
+         break;
+
+      if (rip->slots[rip->first].generation == rip->generation)
+      {
+         slot = &rip->slots[rip->first];
+         break;
+      }
+
+      rip->first = (rip->first + 1) % DISC_RIP_SLOTS;
+      rip->filled--;
+      scond_broadcast(rip->cond);
+   }
+
+   slock_unlock(rip->lock);
+
+   return slot;
+}
+
+static void disc_rip_release(disc_rip_t *rip)
+{
+   slock_lock(rip->lock);
+   rip->first = (rip->first + 1) % DISC_RIP_SLOTS;
+   rip->filled--;
+   scond_broadcast(rip->cond);
+   slock_unlock(rip->lock);
+}
+
+static void disc_rip_keep_tail(disc_rip_t *rip, const uint8_t *data, size_t len)
+{
+   size_t keep;
+
+   if (len >= DISC_RIP_TAIL_BYTES)
+   {
+      memcpy(rip->tail, data + len - DISC_RIP_TAIL_BYTES, DISC_RIP_TAIL_BYTES);
+      rip->tail_len = DISC_RIP_TAIL_BYTES;
+      return;
+   }
+
+   keep = MIN(rip->tail_len, DISC_RIP_TAIL_BYTES - len);
+   memmove(rip->tail, rip->tail + rip->tail_len - keep, keep);
+   memcpy(rip->tail + keep, data, len);
+   rip->tail_len = keep + len;
+}
+
+/* Opens the file of the next audio track, or sets track to 0 if there is none. Unless the track starts where
+ * the last one ended, what was ripped before no longer helps and reading starts over there. */
+static bool disc_rip_next_track(disc_rip_t *rip)
+{
+   unsigned char track;
+   char name[16];
+   int64_t start = 0;
+   int64_t end = 0;
+
+   for (track = rip->track + 1; track <= rip->toc->num_tracks; track++)
+   {
+      if (accuraterip_get_track_frames(rip->accuraterip, track, &start, &end))
+         break;
+   }
+
+   if (track > rip->toc->num_tracks)
+   {
+      rip->track = 0;
+      return true;
+   }
+
+   snprintf(name, sizeof(name), "track%02u.wav", (unsigned)track);
+   fill_pathname_join(rip->wav_path, rip->disc_dir, name, sizeof(rip->wav_path));
+
+   if (!(rip->wav = rwav_writer_open(rip->wav_path, 44100, 2, 16)))
+      return false;
+
+   rip->track = track;
+   rip->track_end = (end + rip->read_offset) * 4;
+
+   if ((start + rip->read_offset) * 4 != rip->pos)
+   {
+      rip->pos = (start + rip->read_offset) * 4;
+      rip->tail_len = 0;
+      rip->candidate_len = 0;
+      rip->reads = 0;
+      disc_rip_request(rip, false);
+   }
+
+   return true;
+}
+
+/* Writes audio that was verified, which goes on into the next track where a track ends. False if a file could
+ * not be written. */
+static bool disc_rip_write(disc_rip_t *rip, const uint8_t *data, size_t len)
+{
+   while (len && rip->track)
+   {
+      size_t n = (size_t)MIN((int64_t)len, rip->track_end - rip->pos);
+      int64_t end;
+
+      if (!rwav_writer_write(rip->wav, data, n))
+         return false;
+
+      accuraterip_add(rip->accuraterip, (const int16_t*)data, n / 4, rip->pos / 4);
+      disc_rip_keep_tail(rip, data, n);
+
+      rip->pos += n;
+      rip->reads = 0;
+      data += n;
+      len -= n;
+
+      if (rip->pos < rip->track_end)
+         continue;
+
+      end = rip->pos;
+
+      if (!rwav_writer_close(rip->wav))
+      {
+         rip->wav = NULL;
+         return false;
+      }
+
+      rip->wav = NULL;
+      rip->result.track[rip->track - 1].ripped = true;
+
+      if (!disc_rip_next_track(rip))
+         return false;
+
+      /* the rest is only of use if the next track starts right here */
+      if (rip->pos != end)
+         break;
+   }
+
+   return true;
+}
+
+/* Asks for the audio at pos to be read again. Once it was read too often without two reads agreeing, a sector of
+ * what the last read had is taken as it is, or silence if nothing could be read. False if a write failed. */
+static bool disc_rip_retry(disc_rip_t *rip)
+{
+   if (++rip->reads >= DISC_RIP_MAX_READS)
+   {
+      uint8_t sector[2352];
+      size_t n = (size_t)MIN((int64_t)sizeof(sector), rip->track_end - rip->pos);
+
+      if (rip->candidate_len)
+      {
+         n = MIN(n, rip->candidate_len);
+         memcpy(sector, rip->candidate, n);
+         memmove(rip->candidate, rip->candidate + n, rip->candidate_len - n);
+         rip->candidate_len -= n;
+      }
+      else
+         memset(sector, 0, n);
+
+      rip->result.track[rip->track - 1].suspect_sectors++;
+
+      if (!disc_rip_write(rip, sector, n))
+         return false;
+   }
+
+   if (rip->track)
+      disc_rip_request(rip, true);
+
+   return true;
+}
+
+/* Finds pos in a read by the audio ripped right before it, which the read has to have anywhere up to
+ * DISC_RIP_MAX_JITTER_FRAMES from where it should be. The read is taken as it is where there is nothing ripped
+ * before pos yet. That, or audio like silence that is found in more than one place, leaves the read ambiguous. */
+static bool disc_rip_align(disc_rip_t *rip, const disc_rip_read_t *slot, const uint8_t **data, size_t *len,
+      bool *ambiguous)
+{
+   int64_t start = ((int64_t)slot->lba - 150) * 2352;
+   int64_t size = (int64_t)slot->sectors * 2352;
+   int64_t found = 0;
+   bool matched = false;
+   int i;
+
+   *ambiguous = !rip->tail_len;
+
+   for (i = 0; i <= DISC_RIP_MAX_JITTER_FRAMES * 2; i++)
+   {
+      /* 0, +1, -1, +2, -2... frames, where the read has the byte the disc has at pos */
+      int64_t shift = (int64_t)((i + 1) / 2) * ((i & 1) ? 4 : -4);
+      int64_t at = rip->pos - start - shift;
+
+      if (shift && !rip->tail_len)
+         break;
+
+      if (at - (int64_t)rip->tail_len < 0 || at >= size)
+         continue;
+
+      if (rip->tail_len && memcmp(slot->data + at - rip->tail_len, rip->tail, rip->tail_len))
+         continue;
+
+      if (matched)
+      {
+         *ambiguous = true;
+         break;
+      }
+
+      matched = true;
+      found = shift;
+   }
+
+   if (!matched)
+      return false;
+
+   if (found)
+      rip->result.track[rip->track - 1].jitter++;
+
+   *data = slot->data + rip->pos - start - found;
+   *len = (size_t)(size - (rip->pos - start - found));
+
+   return true;
+}
+
+/* bytes at the start of a and b that are the same, in whole frames */
+static size_t disc_rip_same(const uint8_t *a, const uint8_t *b, size_t len)
+{
+   size_t i;
+
+   if (!memcmp(a, b, len))
+      return len;
+
+   for (i = 0; i < len && a[i] == b[i]; i++);
+
+   return i & ~(size_t)3;
+}
+
+/* true if all of data is digital silence */
+static bool disc_rip_silent(const uint8_t *data, size_t len)
+{
+   size_t i;
+
+   for (i = 0; i < len; i += sizeof(disc_rip_zeros))
+   {
+      if (memcmp(data + i, disc_rip_zeros, MIN(len - i, sizeof(disc_rip_zeros))))
+         return false;
+   }
+
+   return true;
+}
+
+/* Writes what a read has from pos on once it is verified: when the drive flagged no C2 errors in it and it was
+ * found in one place only or is all silence, or as far as an earlier read of the same audio agrees with it. False
+ * if a write failed. */
+static bool disc_rip_check(disc_rip_t *rip, const disc_rip_read_t *slot)
+{
+   disc_rip_track_t *track = &rip->result.track[rip->track - 1];
+   const uint8_t *data;
+   size_t len;
+   size_t common;
+   size_t same;
+   bool ambiguous;
+
+   track->c2_errors += slot->c2_errors;
+
+   /* already ripped, a second read of a chunk that the first one covered */
+   if (((int64_t)slot->lba - 150 + slot->sectors) * 2352 <= rip->pos)
+      return true;
+
+   if (slot->failed || !disc_rip_align(rip, slot, &data, &len, &ambiguous))
+   {
+      track->rereads++;
+      return disc_rip_retry(rip);
+   }
+
+   if (rip->c2 && !slot->c2_errors && !ambiguous)
+   {
+      rip->candidate_len = 0;
+      return disc_rip_write(rip, data, len);
+   }
+
+   /* silence is found everywhere, but where in a silent read it is found makes no difference */
+   if (rip->c2 && !slot->c2_errors && len > DISC_RIP_SILENT_SLACK && disc_rip_silent(slot->data, (size_t)slot->sectors * 2352))
+   {
+      rip->candidate_len = 0;
+      return disc_rip_write(rip, data, len - DISC_RIP_SILENT_SLACK);
+   }
+
+   if (!rip->candidate_len)
+   {
+      memcpy(rip->candidate, data, len);
+      rip->candidate_len = len;
+
+      /* without C2 the reader reads every chunk twice anyway */
+      if (!rip->c2)
+      {
+         rip->reads++;
+         return true;
+      }
+
+      track->rereads++;
+      return disc_rip_retry(rip);
+   }
+
+   common = MIN(rip->candidate_len, len);
+   same = disc_rip_same(rip->candidate, data, common);
+
+   if (same == common)
+   {
+      /* what is left of the longer one is only from one read */
+      if (len > rip->candidate_len)
+         memcpy(rip->candidate, data + common, len - common);
+      else
+         memmove(rip->candidate, rip->candidate + common, rip->candidate_len - common);
+
+      rip->candidate_len = MAX(len, rip->candidate_len) - common;
+
+      return disc_rip_write(rip, data, common);
+   }
+
+   /* the reads agree up to same, the rest needs another one */
+   memcpy(rip->candidate, data + same, len - same);
+   rip->candidate_len = len - same;
+   track->rereads++;
+
+   if (same && !disc_rip_write(rip, data, same))
+      return false;
+
+   return disc_rip_retry(rip);
+}
+
+/* rips every audio track, false if the rip was stopped or could not be written */
+static bool disc_rip_run(disc_rip_t *rip)
+{
+   const disc_rip_read_t *slot;
+   cdrom_drive_caps_t caps;
+   char name[16];
+   unsigned char track;
+   int64_t start = 0;
+   int64_t end = 0;
+
+   snprintf(name, sizeof(name), "%08x", (unsigned)rip->disc_id);
+   fill_pathname_join(rip->disc_dir, rip->dir, name, sizeof(rip->disc_dir));
+
+   if (!path_is_directory(rip->disc_dir) && !path_mkdir(rip->disc_dir))
+      return false;
+
+   for (track = 1; track <= rip->toc->num_tracks; track++)
+   {
+      if (!accuraterip_get_track_frames(rip->accuraterip, track, &start, &end))
+         continue;
+
+      if (!rip->first_track)
+         rip->first_track = track;
+
+      rip->readable_end = end * 4;
+   }
+
+   if (!rip->first_track)
+      return false;
+
+   retro_vfs_file_cdrom_get_caps(rip->drive, &caps);
+
+   rip->c2 = caps.valid && caps.c2_pointers;
+   rip->passes = rip->c2 ? 1 : 2;
+   rip->chunk_sectors = (caps.valid ? MIN(DISC_RIP_READ_SECTORS, MAX(caps.batch_frames,
+         DISC_RIP_OVERLAP_SECTORS + 1)) : DISC_RIP_READ_SECTORS) - DISC_RIP_OVERLAP_SECTORS;
+   rip->pos = -1;
+
+   if (!disc_rip_next_track(rip))
+      return false;
+
+   while (rip->track)
+   {
+      uint32_t generation;
+      bool last;
+
+      /* the offset correction can move the ends of the disc to where nothing can be read, which is silence */
+      if (rip->pos < 0 || rip->pos >= rip->readable_end)
+      {
+         int64_t stop = rip->pos < 0 ? MIN(0, rip->track_end) : rip->track_end;
+
+         if (!disc_rip_write(rip, disc_rip_zeros, (size_t)MIN((int64_t)sizeof(disc_rip_zeros), stop - rip->pos)))
+            return false;
+
+         /* not on the disc, so reads cannot be found by it */
+         rip->tail_len = 0;
+         continue;
+      }
+
+      if (!(slot = disc_rip_take(rip)))
+         return false;
+
+      generation = rip->generation;
+      last = slot->last;
+
+      if (!disc_rip_check(rip, slot))
+      {
+         disc_rip_release(rip);
+         return false;
+      }
+
+      disc_rip_release(rip);
+
+      /* a read that came back shifted can end short of the audio, with none after it to make up for that */
+      if (last && rip->track && rip->generation == generation && !disc_rip_retry(rip))
+         return false;
+   }
+
+   return true;
+}
+
+static void disc_rip_verifier(void *data)
+{
+   disc_rip_t *rip = (disc_rip_t*)data;
+   const cdrom_toc_t *toc = retro_vfs_file_get_cdrom_toc(rip->drive);
+   accuraterip_track_t tracks[99];
+   bool complete = false;
+   bool stopped;
+   unsigned i;
+
+   /* the disc id and the end of the last track need the whole TOC */
+   if (toc && toc->num_tracks && retro_vfs_file_cdrom_toc_wait_track(rip->drive, toc->num_tracks) &&
+         accuraterip_get_disc_id(toc, &rip->result.id))
+      rip->accuraterip = accuraterip_new(toc, rip->read_offset);
+
+   rip->toc = toc;
+
+   if (rip->accuraterip)
+      complete = disc_rip_run(rip);
+
+   /* a track that was not finished is not left looking like one that was */
+   if (rip->wav)
+   {
+      rwav_writer_close(rip->wav);
+      filestream_delete(rip->wav_path);
+      rip->wav = NULL;
+   }
+
+   slock_lock(rip->lock);
+   rip->finished = true;
+   stopped = rip->quit;
+   scond_broadcast(rip->cond);
+   slock_unlock(rip->lock);
+
+   if (rip->accuraterip && !stopped)
+   {
+      for (i = 0; i < toc->num_tracks && i < ARRAY_SIZE(tracks); i++)
+         accuraterip_get_track(rip->accuraterip, i + 1, &tracks[i]);
+
+      rip->result.in_database = *rip->accuraterip_dir && accuraterip_verify(rip->accuraterip_dir, &rip->result.id, tracks, i);
+
+      while (i--)
+         rip->result.track[i].accuraterip = tracks[i];
+   }
+
+   rip->result.complete = complete;
+
+   slock_lock(rip->lock);
+   rip->result.read_cache_disabled = rip->read_cache_disabled;
+   rip->done = true;
+   slock_unlock(rip->lock);
+}
+
+disc_rip_t* disc_rip_new(char drive, uint32_t disc_id, bool idle, const char *dir, const char *accuraterip_dir,
+      int read_offset)
+{
+   disc_rip_t *rip = (disc_rip_t*)calloc(1, sizeof(*rip));
+
+   if (!rip)
+      return NULL;
+
+   rip->drive = drive;
+   rip->disc_id = disc_id;
+   rip->idle = idle;
+   rip->read_offset = read_offset;
+   strlcpy(rip->dir, dir, sizeof(rip->dir));
+
+   if (accuraterip_dir)
+      strlcpy(rip->accuraterip_dir, accuraterip_dir, sizeof(rip->accuraterip_dir));
+
+   rip->lock = slock_new();
+   rip->cond = scond_new();
+
+   if (rip->lock && rip->cond)
+   {
+      rip->reader = sthread_create(disc_rip_reader, rip);
+
+      if (rip->reader)
+         rip->verifier = sthread_create(disc_rip_verifier, rip);
+   }
+
+   if (!rip->verifier)
+   {
+      disc_rip_free(rip);
+      return NULL;
+   }
+
+   return rip;
+}
+
+void disc_rip_free(disc_rip_t *rip)
+{
+   if (!rip)
+      return;
+
+   if (rip->reader)
+   {
+      slock_lock(rip->lock);
+      rip->quit = true;
+      scond_broadcast(rip->cond);
+      slock_unlock(rip->lock);
+
+      sthread_join(rip->reader);
+
+      if (rip->verifier)
+         sthread_join(rip->verifier);
+   }
+
+   accuraterip_free(rip->accuraterip);
+   scond_free(rip->cond);
+   slock_free(rip->lock);
+   free(rip);
+}
+
+void disc_rip_set_idle(disc_rip_t *rip, bool idle)
+{
+   slock_lock(rip->lock);
+
+   if (rip->idle != idle)
+   {
+      rip->idle = idle;
+      scond_broadcast(rip->cond);
+   }
+
+   slock_unlock(rip->lock);
+}
+
+bool disc_rip_get_result(disc_rip_t *rip, disc_rip_result_t *result)
+{
+   bool done;
+
+   slock_lock(rip->lock);
+   done = rip->done;
+   slock_unlock(rip->lock);
+
+   if (done)
+      memcpy(result, &rip->result, sizeof(*result));
+
+   return done;
+}
@@ -0,0 +1,65 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef DISC_RIP_H__
+#define DISC_RIP_H__
+
+#include <stdint.h>
+#include <boolean.h>
+
+#include "accuraterip.h"
+
+/* Rips every audio track of a disc to WAV files, like a secure ripper would. The drive cache is turned
+ * off and each read overlaps the audio before it, so a read that came back shifted is found and put back
+ * in place. Reads the drive flagged with C2 errors, and every read of drives that cannot report them, are
+ * only taken once another read agrees. One thread reads while another checks and writes what was read,
+ * and like a scan the drive is only read while it is idle. */
+typedef struct disc_rip disc_rip_t;
+
+typedef struct
+{
+   bool ripped;                     /* written to the end */
+   unsigned rereads;                /* reads that had to be done again */
+   unsigned jitter;                 /* reads that came back shifted and were put back in place */
+   unsigned c2_errors;              /* errors the drive flagged, over all reads */
+   unsigned suspect_sectors;        /* no two reads agreed on them, they were written as last read */
+   accuraterip_track_t accuraterip;
+} disc_rip_track_t;
+
+typedef struct
+{
+   bool complete;                   /* every audio track was ripped */
+   bool read_cache_disabled;        /* otherwise the drive may have answered re-reads from its cache */
+   bool in_database;                /* the AccurateRip database has the disc */
+   accuraterip_disc_id_t id;
+   disc_rip_track_t track[99];
+} disc_rip_result_t;
+
+/* The tracks are written to dir/<disc_id>/trackNN.wav. read_offset is the offset correction of the drive
+ * in frames, which the files are corrected by. With an accuraterip_dir the tracks are looked up in the
+ * AccurateRip database file in that directory. */
+disc_rip_t* disc_rip_new(char drive, uint32_t disc_id, bool idle, const char *dir, const char *accuraterip_dir,
+      int read_offset);
+
+/* Stops the rip, returns once the drive is no longer read from. A track that was not finished is deleted. */
+void disc_rip_free(disc_rip_t *rip);
+
+void disc_rip_set_idle(disc_rip_t *rip, bool idle);
+
+/* True once the rip is over. */
+bool disc_rip_get_result(disc_rip_t *rip, disc_rip_result_t *result);
+
+#endif /* DISC_RIP_H__ */
@@ -0,0 +1,422 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libretro.h>
+#include <cdrom/cdrom.h>
+#include <streams/file_stream.h>
+#include <rthreads/rthreads.h>
+#include <vfs/vfs_implementation_cdrom.h>
+#include <encodings/crc32.h>
+#include <compat/strl.h>
+#include <retro_miscellaneous.h>
+
+#include "disc_scan.h"
+#include "loudness.h"
+#include "deemphasis.h"
+#include "silence.h"
+#include "fingerprint.h"
+#include "track_index.h"
+#include "accuraterip.h"
+#include "text_file.h"
+
+/* CD frames read at a time, a little over 1/5 s of audio */
+#define DISC_SCAN_CHUNK_FRAMES 16
+#define DISC_SCAN_CHUNK_BYTES (DISC_SCAN_CHUNK_FRAMES * 2352)
+
+struct disc_scan
+{
+   sthread_t *thread;
+   slock_t *lock;
+   scond_t *cond;
+   char drive;
+   bool idle;
+   bool quit;
+   bool done;
+   char index_path[PATH_MAX_LENGTH];
+   char accuraterip_dir[PATH_MAX_LENGTH];
+   bool verify;
+   int read_offset;
+
+   /* only touched by the thread until done is set */
+   disc_cache_entry_t entry;
+   track_index_entry_t content[99];
+   disc_scan_duplicate_t duplicate[99];
+   disc_scan_verify_t verify_result;
+   accuraterip_t *accuraterip;
+   loudness_t *loudness;
+   fingerprint_t *fingerprint;
+   deemphasis_t deemphasis;
+   int16_t buf[DISC_SCAN_CHUNK_BYTES / 2];
+};
+
+/* waits until the drive may be read, false if the scan is to stop */
+static bool disc_scan_wait_idle(disc_scan_t *scan)
+{
+   bool quit;
+
+   slock_lock(scan->lock);
+
+   while (!scan->idle && !scan->quit)
+      scond_wait(scan->cond, scan->lock);
+
+   quit = scan->quit;
+
+   slock_unlock(scan->lock);
+
+   return !quit;
+}
+
+static bool disc_scan_stopped(disc_scan_t *scan)
+{
+   bool quit;
+
+   slock_lock(scan->lock);
+   quit = scan->quit;
+   slock_unlock(scan->lock);
+
+   return quit;
+}
+
+/* measures one track, false if it could not be read to the end */
+static bool disc_scan_track(disc_scan_t *scan, const cdrom_track_t *info, unsigned char track, disc_cache_audible_t *audible,
+      track_index_entry_t *content)
+{
+   char path[64];
+   RFILE *file;
+   int64_t pos = 0;
+
+   cdrom_device_fillpath(path, sizeof(path), scan->drive, track, false);
+
+   file = filestream_open(path, RETRO_VFS_FILE_ACCESS_READ, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+
+   if (!file)
+      return false;
+
+   loudness_begin_track(scan->loudness);
+   fingerprint_begin_track(scan->fingerprint);
+   deemphasis_clear(&scan->deemphasis);
+   content->crc = 0;
+
+   while (pos < info->track_bytes && disc_scan_wait_idle(scan))
+   {
+      int64_t bytes_read = filestream_read(file, scan->buf, MIN(DISC_SCAN_CHUNK_BYTES, info->track_bytes - pos));
+
+      if (bytes_read <= 0)
+         break;
+
+      /* the content is identified and verified by what is on the disc, everything else is measured as it is heard */
+      content->crc = encoding_crc32(content->crc, (const uint8_t*)scan->buf, (size_t)bytes_read);
+
+      if (scan->accuraterip)
+         accuraterip_add(scan->accuraterip, scan->buf, (size_t)bytes_read / 4, (int64_t)(info->lba - 150) * 588 + pos / 4);
+
+      if (info->pre_emphasis)
+         deemphasis_run(&scan->deemphasis, scan->buf, (size_t)bytes_read / 4);
+
+      if (!loudness_add(scan->loudness, scan->buf, (size_t)bytes_read / 4))
+         break;
+
+      fingerprint_add(scan->fingerprint, scan->buf, (size_t)bytes_read / 4);
+
+      {
+         size_t frames = (size_t)bytes_read / 4;
+         size_t leading = silence_leading(scan->buf, frames, SILENCE_THRESHOLD);
+
+         if (leading < frames)
+         {
+            if (!audible->end)
+               audible->start = (uint32_t)(pos + leading * 4);
+
+            audible->end = (uint32_t)(pos + (frames - silence_trailing(scan->buf, frames, SILENCE_THRESHOLD)) * 4);
+         }
+      }
+
+      pos += bytes_read;
+   }
+
+   filestream_close(file);
+
+   content->frames = (uint32_t)(pos / 4);
+   content->fingerprint_len = (unsigned)fingerprint_get(scan->fingerprint, content->fingerprint);
+
+   return pos >= info->track_bytes;
+}
+
+/* the first disc and track entry is listed for that is not track of this disc, false if there is none */
+static bool disc_scan_other_disc(const disc_scan_t *scan, const track_index_entry_t *entry, unsigned char track,
+      disc_scan_duplicate_t *duplicate)
+{
+   unsigned i;
+
+   for (i = 0; i < entry->num_discs; i++)
+   {
+      if (entry->discs[i].disc_id == scan->entry.disc_id && entry->discs[i].track == track)
+         continue;
+
+      duplicate->disc_id = entry->discs[i].disc_id;
+      duplicate->track = entry->discs[i].track;
+      return true;
+   }
+
+   return false;
+}
+
+/* Looks every track that was read up in the content index and adds it there, false if the index could
+ * not be written. Tracks are added one after another, so a track also matches an earlier one of the same disc. */
+static bool disc_scan_index(disc_scan_t *scan, unsigned num_tracks)
+{
+   track_index_t *index;
+   unsigned i;
+   bool ok;
+
+   /* held until it is written back, so the tracks another player adds in between are not lost */
+   text_file_lock();
+
+   if (!(index = track_index_load(scan->index_path)))
+   {
+      text_file_unlock();
+      return false;
+   }
+
+   for (i = 0; i < num_tracks; i++)
+   {
+      const track_index_entry_t *content = &scan->content[i];
+      disc_scan_duplicate_t *duplicate = &scan->duplicate[i];
+      const track_index_entry_t *other;
+
+      if (!content->frames)
+         continue;
+
+      if ((other = track_index_find(index, content->crc, content->frames)) && disc_scan_other_disc(scan, other, i + 1, duplicate))
+      {
+         duplicate->found = true;
+         duplicate->same_crc = true;
+      }
+      else if ((other = track_index_find_similar(index, content, &duplicate->distance)) &&
+            disc_scan_other_disc(scan, other, i + 1, duplicate))
+         duplicate->found = true;
+
+      if (!track_index_add(index, content, scan->entry.disc_id, i + 1))
+         break;
+   }
+
+   ok = i == num_tracks && track_index_save(index, scan->index_path);
+
+   track_index_free(index);
+
+   text_file_unlock();
+
+   return ok;
+}
+
+/* the AccurateRip checksums of every track that was read, looked up in the database if there is one */
+static void disc_scan_verify(disc_scan_t *scan, unsigned num_tracks)
+{
+   disc_scan_verify_t *result = &scan->verify_result;
+   unsigned i;
+
+   for (i = 0; i < num_tracks && i < ARRAY_SIZE(result->track); i++)
+      accuraterip_get_track(scan->accuraterip, i + 1, &result->track[i]);
+
+   result->disc_crc_valid = accuraterip_get_disc_crc(scan->accuraterip, &result->disc_crc);
+   result->in_database = *scan->accuraterip_dir && accuraterip_verify(scan->accuraterip_dir, &result->id, result->track, i);
+   result->verified = true;
+}
+
+static void disc_scan_thread(void *data)
+{
+   disc_scan_t *scan = (disc_scan_t*)data;
+   const cdrom_toc_t *toc = retro_vfs_file_get_cdrom_toc(scan->drive);
+   bool complete = true;
+   unsigned char track;
+
+   /* the disc id needs the size of the last track */
+   if (scan->verify && toc && toc->num_tracks && retro_vfs_file_cdrom_toc_wait_track(scan->drive, toc->num_tracks) &&
+         accuraterip_get_disc_id(toc, &scan->verify_result.id))
+      scan->accuraterip = accuraterip_new(toc, scan->read_offset);
+
+   for (track = 1; toc && track <= toc->num_tracks && track <= ARRAY_SIZE(scan->entry.track); track++)
+   {
+      disc_cache_loudness_t *result = &scan->entry.track[track - 1];
+
+      if (!retro_vfs_file_cdrom_toc_wait_track(scan->drive, track) || !disc_scan_wait_idle(scan))
+      {
+         complete = false;
+         break;
+      }
+
+      if (!toc->track[track - 1].audio)
+         continue;
+
+      if (!disc_scan_track(scan, &toc->track[track - 1], track, &scan->entry.audible[track - 1], &scan->content[track - 1]))
+      {
+         memset(&scan->entry.audible[track - 1], 0, sizeof(scan->entry.audible[track - 1]));
+         memset(&scan->content[track - 1], 0, sizeof(scan->content[track - 1]));
+         complete = false;
+         continue;
+      }
+
+      loudness_get_track(scan->loudness, &result->loudness, &result->peak);
+      result->analyzed = true;
+      scan->entry.audible[track - 1].analyzed = true;
+
+      scan->content[track - 1].loudness = *result;
+      scan->content[track - 1].audible = scan->entry.audible[track - 1];
+   }
+
+   /* a scan that was stopped leaves the index alone, the disc is scanned again next time anyway */
+   if (*scan->index_path && track > 1 && !disc_scan_stopped(scan))
+      scan->entry.indexed = disc_scan_index(scan, track - 1) && complete;
+
+   if (scan->accuraterip && !disc_scan_stopped(scan))
+      disc_scan_verify(scan, toc->num_tracks);
+
+   if (complete)
+   {
+      loudness_get_album(scan->loudness, &scan->entry.album.loudness, &scan->entry.album.peak);
+      scan->entry.album.analyzed = true;
+   }
+
+   slock_lock(scan->lock);
+   scan->done = true;
+   slock_unlock(scan->lock);
+}
+
+disc_scan_t* disc_scan_new(char drive, uint32_t disc_id, bool idle, const char *index_path,
+      const char *accuraterip_dir, int read_offset)
+{
+   disc_scan_t *scan = (disc_scan_t*)calloc(1, sizeof(*scan));
+
+   if (!scan)
+      return NULL;
+
+   scan->drive = drive;
+   scan->idle = idle;
+   scan->entry.disc_id = disc_id;
+
+   if (index_path)
+      strlcpy(scan->index_path, index_path, sizeof(scan->index_path));
+
+   if (accuraterip_dir)
+   {
+      strlcpy(scan->accuraterip_dir, accuraterip_dir, sizeof(scan->accuraterip_dir));
+      scan->verify = true;
+      scan->read_offset = read_offset;
+   }
+
+   deemphasis_setup(&scan->deemphasis);
+
+   scan->loudness = loudness_new();
+   scan->fingerprint = fingerprint_new();
+   scan->lock = slock_new();
+   scan->cond = scond_new();
+
+   if (scan->loudness && scan->fingerprint && scan->lock && scan->cond)
+      scan->thread = sthread_create(disc_scan_thread, scan);
+
+   if (!scan->thread)
+   {
+      disc_scan_free(scan);
+      return NULL;
+   }
+
+   return scan;
+}
+
+void disc_scan_free(disc_scan_t *scan)
+{
+   if (!scan)
+      return;
+
+   if (scan->thread)
+   {
+      slock_lock(scan->lock);
+      scan->quit = true;
+      scond_signal(scan->cond);
+      slock_unlock(scan->lock);
+
+      sthread_join(scan->thread);
+   }
+
+   accuraterip_free(scan->accuraterip);
+   loudness_free(scan->loudness);
+   fingerprint_free(scan->fingerprint);
+   scond_free(scan->cond);
+   slock_free(scan->lock);
+   free(scan);
+}
+
+void disc_scan_set_idle(disc_scan_t *scan, bool idle)
+{
+   slock_lock(scan->lock);
+
+   if (scan->idle != idle)
+   {
+      scan->idle = idle;
+      scond_signal(scan->cond);
+   }
+
+   slock_unlock(scan->lock);
+}
+
+bool disc_scan_get_result(disc_scan_t *scan, disc_cache_entry_t *entry)
+{
+   bool done;
+
+   slock_lock(scan->lock);
+   done = scan->done;
+   slock_unlock(scan->lock);
+
+   if (done)
+      memcpy(entry, &scan->entry, sizeof(*entry));
+
+   return done;
+}
+
+bool disc_scan_get_duplicate(disc_scan_t *scan, unsigned char track, disc_scan_duplicate_t *duplicate)
+{
+   bool done;
+
+   slock_lock(scan->lock);
+   done = scan->done;
+   slock_unlock(scan->lock);
+
+   if (!done || !track || track > ARRAY_SIZE(scan->duplicate) || !scan->duplicate[track - 1].found)
+      return false;
+
+   memcpy(duplicate, &scan->duplicate[track - 1], sizeof(*duplicate));
+
+   return true;
+}
+
+bool disc_scan_get_verify(disc_scan_t *scan, disc_scan_verify_t *result)
+{
+   bool done;
+
+   slock_lock(scan->lock);
+   done = scan->done;
+   slock_unlock(scan->lock);
+
+   if (!done || !scan->verify_result.verified)
+      return false;
+
+   memcpy(result, &scan->verify_result, sizeof(*result));
+
+   return true;
+}
@@ -0,0 +1,75 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef DISC_SCAN_H__
+#define DISC_SCAN_H__
+
+#include <stdint.h>
+#include <boolean.h>
+
+#include "disc_cache.h"
+#include "accuraterip.h"
+
+/* Reads every audio track of a disc on its own thread, measures its loudness and finds where the silence
+ * around its audio ends. A drive is only read while it is idle, so the scan never takes the drive away
+ * from playback; images can be read any time. */
+typedef struct disc_scan disc_scan_t;
+
+/* another track found in the content index that has the same audio */
+typedef struct
+{
+   bool found;
+   bool same_crc;       /* same CRC-32 and length, so most likely bit for bit, otherwise it only sounds the same */
+   uint32_t disc_id;
+   unsigned char track;
+   float distance;      /* of the fingerprints if it is not the same CRC */
+} disc_scan_duplicate_t;
+
+/* whether the audio read off the disc is what others read off the same disc */
+typedef struct
+{
+   bool verified;                   /* the checksums were taken, which needs the whole TOC */
+   bool in_database;                /* the AccurateRip database has the disc */
+   bool disc_crc_valid;
+   uint32_t disc_crc;               /* CTDB-style CRC of the whole disc */
+   accuraterip_disc_id_t id;
+   accuraterip_track_t track[99];   /* data tracks and those not read in full are not complete */
+} disc_scan_verify_t;
+
+/* With an index_path every track is also hashed and fingerprinted, and added to the content index there
+ * once the disc was read. NULL or empty for no index.
+ * With an accuraterip_dir the AccurateRip checksums of every track are taken with the offset of the drive
+ * corrected by read_offset frames, and looked up in the database file in that directory. NULL to not
+ * verify, empty to take the checksums without a database. */
+disc_scan_t* disc_scan_new(char drive, uint32_t disc_id, bool idle, const char *index_path,
+      const char *accuraterip_dir, int read_offset);
+
+/* Stops the scan, returns once the drive is no longer read from. */
+void disc_scan_free(disc_scan_t *scan);
+
+void disc_scan_set_idle(disc_scan_t *scan, bool idle);
+
+/* True once the scan is over, entry then has every track that could be read, and the album if all of
+ * them could. */
+bool disc_scan_get_result(disc_scan_t *scan, disc_cache_entry_t *entry);
+
+/* True if the scan is over and found track elsewhere in the content index. */
+bool disc_scan_get_duplicate(disc_scan_t *scan, unsigned char track, disc_scan_duplicate_t *duplicate);
+
+/* True if the scan is over and verified the disc. */
+bool disc_scan_get_verify(disc_scan_t *scan, disc_scan_verify_t *result);
+
+#endif /* DISC_SCAN_H__ */
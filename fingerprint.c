@@ -0,0 +1,249 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <retro_miscellaneous.h>
+#include "libretro-common/audio/dsp_filters/fft/fft.h"
+#include "fingerprint.h"
+#include "silence.h"
+
+/* Both channels are summed and averaged down to 5512.5 Hz, which still holds the highest band. */
+#define FINGERPRINT_DECIMATION 8
+#define FINGERPRINT_RATE (44100.0 / FINGERPRINT_DECIMATION)
+
+/* 186 ms windows half a window apart */
+#define FINGERPRINT_FRAME_LOG2 10
+#define FINGERPRINT_FRAME (1 << FINGERPRINT_FRAME_LOG2)
+#define FINGERPRINT_HOP (FINGERPRINT_FRAME / 2)
+
+/* spaced evenly in pitch, one more than there are bits */
+#define FINGERPRINT_BANDS 33
+#define FINGERPRINT_LOW_HZ 300.0
+#define FINGERPRINT_HIGH_HZ 2000.0
+
+/* the furthest fingerprints are moved against each other to line them up, about 0.75 s */
+#define FINGERPRINT_MAX_SHIFT 8
+
+/* sub-fingerprints that have to overlap to compare them, about 3 s */
+#define FINGERPRINT_MIN_OVERLAP 32
+
+#define FINGERPRINT_PI 3.14159265358979323846
+
+struct fingerprint
+{
+   fft_t *fft;
+   float window[FINGERPRINT_FRAME];
+   unsigned band_start[FINGERPRINT_BANDS + 1];  /* FFT bins, the last one is where the last band ends */
+
+   float samples[FINGERPRINT_FRAME];
+   size_t count;
+   int32_t sum;                                 /* of the samples averaged into the next one */
+   unsigned sum_frames;
+
+   float frame[FINGERPRINT_FRAME];
+   fft_complex_t spectrum[FINGERPRINT_FRAME];
+   float energy[FINGERPRINT_BANDS];
+   float previous[FINGERPRINT_BANDS];
+   bool have_previous;
+   bool started;                                /* past the silence at the start of the track */
+
+   uint32_t prints[FINGERPRINT_LEN];
+   size_t len;
+};
+
+static unsigned fingerprint_popcount(uint32_t v)
+{
+   v = v - ((v >> 1) & 0x55555555u);
+   v = (v & 0x33333333u) + ((v >> 2) & 0x33333333u);
+   v = (v + (v >> 4)) & 0x0f0f0f0fu;
+
+   return (v * 0x01010101u) >> 24;
+}
+
+fingerprint_t* fingerprint_new(void)
+{
+   fingerprint_t *fingerprint = (fingerprint_t*)calloc(1, sizeof(*fingerprint));
+   unsigned i;
+
+   if (!fingerprint)
+      return NULL;
+
+   fingerprint->fft = fft_new(FINGERPRINT_FRAME_LOG2);
+
+   if (!fingerprint->fft)
+   {
+      free(fingerprint);
+      return NULL;
+   }
+
+   for (i = 0; i < FINGERPRINT_FRAME; i++)
+      fingerprint->window[i] = (float)(0.5 - 0.5 * cos(2.0 * FINGERPRINT_PI * i / FINGERPRINT_FRAME));
+
+   for (i = 0; i <= FINGERPRINT_BANDS; i++)
+   {
+      double hz = FINGERPRINT_LOW_HZ * pow(FINGERPRINT_HIGH_HZ / FINGERPRINT_LOW_HZ, (double)i / FINGERPRINT_BANDS);
+      unsigned bin = (unsigned)(hz * FINGERPRINT_FRAME / FINGERPRINT_RATE + 0.5);
+
+      /* every band has at least one bin */
+      fingerprint->band_start[i] = i ? MAX(bin, fingerprint->band_start[i - 1] + 1) : bin;
+   }
+
+   return fingerprint;
+}
+
+void fingerprint_free(fingerprint_t *fingerprint)
+{
+   if (!fingerprint)
+      return;
+
+   fft_free(fingerprint->fft);
+   free(fingerprint);
+}
+
+void fingerprint_begin_track(fingerprint_t *fingerprint)
+{
+   fingerprint->count = 0;
+   fingerprint->sum = 0;
+   fingerprint->sum_frames = 0;
+   fingerprint->have_previous = false;
+   fingerprint->started = false;
+   fingerprint->len = 0;
+}
+
+/* adds the sub-fingerprint of the window that samples holds */
+static void fingerprint_frame(fingerprint_t *fingerprint)
+{
+   uint32_t print = 0;
+   unsigned i;
+
+   for (i = 0; i < FINGERPRINT_FRAME; i++)
+      fingerprint->frame[i] = fingerprint->samples[i] * fingerprint->window[i];
+
+   fft_process_forward(fingerprint->fft, fingerprint->spectrum, fingerprint->frame, 1);
+
+   for (i = 0; i < FINGERPRINT_BANDS; i++)
+   {
+      float energy = 0.0f;
+      unsigned bin;
+
+      for (bin = fingerprint->band_start[i]; bin < fingerprint->band_start[i + 1]; bin++)
+         energy += fingerprint->spectrum[bin].real * fingerprint->spectrum[bin].real +
+               fingerprint->spectrum[bin].imag * fingerprint->spectrum[bin].imag;
+
+      fingerprint->energy[i] = energy;
+   }
+
+   if (fingerprint->have_previous)
+   {
+      for (i = 0; i + 1 < FINGERPRINT_BANDS; i++)
+      {
+         float now = fingerprint->energy[i] - fingerprint->energy[i + 1];
+         float before = fingerprint->previous[i] - fingerprint->previous[i + 1];
+
+         if (now - before > 0.0f)
+            print |= 1u << i;
+      }
+
+      fingerprint->prints[fingerprint->len++] = print;
+   }
+
+   memcpy(fingerprint->previous, fingerprint->energy, sizeof(fingerprint->previous));
+   fingerprint->have_previous = true;
+}
+
+void fingerprint_add(fingerprint_t *fingerprint, const int16_t *samples, size_t frames)
+{
+   size_t i;
+
+   if (fingerprint->len >= FINGERPRINT_LEN)
+      return;
+
+   if (!fingerprint->started)
+   {
+      size_t leading = silence_leading(samples, frames, SILENCE_THRESHOLD);
+
+      samples += leading * 2;
+      frames -= leading;
+
+      if (!frames)
+         return;
+
+      fingerprint->started = true;
+   }
+
+   for (i = 0; i < frames; i++)
+   {
+      fingerprint->sum += samples[i * 2] + samples[i * 2 + 1];
+
+      if (++fingerprint->sum_frames < FINGERPRINT_DECIMATION)
+         continue;
+
+      fingerprint->samples[fingerprint->count++] = (float)fingerprint->sum;
+      fingerprint->sum = 0;
+      fingerprint->sum_frames = 0;
+
+      if (fingerprint->count < FINGERPRINT_FRAME)
+         continue;
+
+      fingerprint_frame(fingerprint);
+
+      if (fingerprint->len >= FINGERPRINT_LEN)
+         return;
+
+      memmove(fingerprint->samples, fingerprint->samples + FINGERPRINT_HOP, FINGERPRINT_HOP * sizeof(float));
+      fingerprint->count = FINGERPRINT_HOP;
+   }
+}
+
+size_t fingerprint_get(const fingerprint_t *fingerprint, uint32_t *out)
+{
+   memcpy(out, fingerprint->prints, fingerprint->len * sizeof(uint32_t));
+
+   return fingerprint->len;
+}
+
+float fingerprint_distance(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len)
+{
+   float best = 1.0f;
+   int shift;
+
+   for (shift = -FINGERPRINT_MAX_SHIFT; shift <= FINGERPRINT_MAX_SHIFT; shift++)
+   {
+      /* a[i] lines up with b[i + shift] */
+      size_t a_start = shift < 0 ? (size_t)-shift : 0;
+      size_t b_start = shift > 0 ? (size_t)shift : 0;
+      size_t len;
+      unsigned bits = 0;
+      size_t i;
+
+      if (a_start >= a_len || b_start >= b_len)
+         continue;
+
+      len = MIN(a_len - a_start, b_len - b_start);
+
+      if (len < FINGERPRINT_MIN_OVERLAP)
+         continue;
+
+      for (i = 0; i < len; i++)
+         bits += fingerprint_popcount(a[a_start + i] ^ b[b_start + i]);
+
+      best = MIN(best, (float)bits / (len * 32));
+   }
+
+   return best;
+}
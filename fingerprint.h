@@ -0,0 +1,49 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef FINGERPRINT_H__
+#define FINGERPRINT_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* sub-fingerprints kept of a track, about 12 s from where its audio starts */
+#define FINGERPRINT_LEN 128
+
+/* Acoustic fingerprint of 44.1 kHz stereo audio that survives small differences in level, offset and
+ * mastering. Every 93 ms of audio gives a 32 bit sub-fingerprint, one bit for whether each pair of
+ * neighbouring bands between 300 and 2000 Hz grew apart or closer since the one before. */
+typedef struct fingerprint fingerprint_t;
+
+fingerprint_t* fingerprint_new(void);
+
+void fingerprint_free(fingerprint_t *fingerprint);
+
+/* Starts a track, which does not follow on from the audio added before. */
+void fingerprint_begin_track(fingerprint_t *fingerprint);
+
+/* Adds interleaved stereo frames of the current track. The silence at its start is left out, and
+ * anything after the first FINGERPRINT_LEN sub-fingerprints costs nothing. */
+void fingerprint_add(fingerprint_t *fingerprint, const int16_t *samples, size_t frames);
+
+/* Copies the sub-fingerprints of the current track so far to out, returns how many there are. */
+size_t fingerprint_get(const fingerprint_t *fingerprint, uint32_t *out);
+
+/* Fraction of the bits that differ where a and b line up best, 0 for the same audio and about 0.5 for
+ * unrelated audio. 1 if they do not overlap by enough to tell. */
+float fingerprint_distance(const uint32_t *a, size_t a_len, const uint32_t *b, size_t b_len);
+
+#endif /* FINGERPRINT_H__ */
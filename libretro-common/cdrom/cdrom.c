@@ -25,20 +25,24 @@
 #endif
 
 #include <cdrom/cdrom.h>
+#include <cdrom/cdrom_trace.h>
 #include <libretro.h>
 #include <stdio.h>
 #include <string.h>
 #include <compat/strl.h>
 #include <retro_math.h>
 #include <retro_timers.h>
+#include <retro_atomic.h>
 #include <streams/file_stream.h>
 #include <retro_endianness.h>
 #include <retro_miscellaneous.h>
 #include <vfs/vfs_implementation.h>
 #include <lists/string_list.h>
 #include <lists/dir_list.h>
+#include <file/file_path.h>
 #include <string/stdstring.h>
 #include <memalign.h>
+#include <features/features_cpu.h>
 
 #include <math.h>
 #ifdef _WIN32
@@ -49,7 +53,13 @@
 
 #if defined(__linux__) && !defined(ANDROID)
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
 #include <scsi/sg.h>
+#include <sys/mount.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <rthreads/rthreads.h>
 #endif
 
 #if defined(_WIN32) && !defined(_XBOX)
@@ -58,16 +68,22 @@
 #include <ntddscsi.h>
 #endif
 
-#define CDROM_CUE_TRACK_BYTES 107
+#define CDROM_CUE_TRACK_BYTES 121
 #define CDROM_MAX_SENSE_BYTES 16
 #define CDROM_MAX_RETRIES 10
 
-typedef enum
-{
-   DIRECTION_NONE,
-   DIRECTION_IN,
-   DIRECTION_OUT
-} CDROM_CMD_Direction;
+/* one per drive name, 0-9 and A-Z */
+#define CDROM_MAX_TRANSPORTS 36
+
+/* a transport is only used once its slot is ready, which is after it was copied in whole */
+#define CDROM_TRANSPORT_FREE 0
+#define CDROM_TRANSPORT_CLAIMED 1
+#define CDROM_TRANSPORT_READY 2
+
+static cdrom_transport_t cdrom_transports[CDROM_MAX_TRANSPORTS];
+static volatile long cdrom_transports_set[CDROM_MAX_TRANSPORTS];
+static cdrom_command_observer_t cdrom_command_observer = NULL;
+static void *cdrom_command_observer_data = NULL;
 
 void cdrom_lba_to_msf(unsigned lba, unsigned char *min, unsigned char *sec, unsigned char *frame)
 {
@@ -99,7 +115,7 @@ void increment_msf(unsigned char *min, unsigned char *sec, unsigned char *frame)
 static void cdrom_print_sense_data(const unsigned char *sense, size_t len)
 {
    unsigned i;
-   const char *sense_key_text = NULL;
+   const char *sense_key_text = "UNKNOWN";
    unsigned char key;
    unsigned char asc;
    unsigned char ascq;
@@ -368,201 +384,340 @@ static int cdrom_send_command_linux(const libretro_vfs_implementation_file *stre
 }
 #endif
 
-static int cdrom_send_command(libretro_vfs_implementation_file *stream, CDROM_CMD_Direction dir, void *buf, size_t len, unsigned char *cmd, size_t cmd_len, size_t skip)
+static int cdrom_transport_index(char drive)
 {
-   unsigned char *xfer_buf = NULL;
-   unsigned char *xfer_buf_pos = xfer_buf;
-   unsigned char sense[CDROM_MAX_SENSE_BYTES] = {0};
-   unsigned char retries_left = CDROM_MAX_RETRIES;
-   int i, rv = 0;
-   int frames = 1;
-   size_t padded_req_bytes;
-   size_t copied_bytes = 0;
-   bool read_cd = false;
+   if (drive >= '0' && drive <= '9')
+      return drive - '0';
 
-   if (!cmd || cmd_len == 0)
-      return 1;
+   if (drive >= 'a' && drive <= 'z')
+      drive -= 'a' - 'A';
+
+   if (drive >= 'A' && drive <= 'Z')
+      return 10 + drive - 'A';
+
+   return -1;
+}
+
+bool cdrom_set_transport(char drive, const cdrom_transport_t *transport)
+{
+   int index = cdrom_transport_index(drive);
+
+   if (index < 0)
+      return false;
+
+   if (!transport)
+   {
+      /* taken out of use before it is wiped, the slot is only free again after that */
+      RETRO_ATOMIC_STORE_RELEASE(&cdrom_transports_set[index], CDROM_TRANSPORT_CLAIMED);
+      memset(&cdrom_transports[index], 0, sizeof(cdrom_transports[index]));
+      RETRO_ATOMIC_STORE_RELEASE(&cdrom_transports_set[index], CDROM_TRANSPORT_FREE);
+      return true;
+   }
+
+   /* claimed atomically, so players on different threads never end up on the same drive */
+   if (!RETRO_ATOMIC_CAS(&cdrom_transports_set[index], CDROM_TRANSPORT_FREE, CDROM_TRANSPORT_CLAIMED))
+      return false;
+
+   cdrom_transports[index] = *transport;
+   RETRO_ATOMIC_STORE_RELEASE(&cdrom_transports_set[index], CDROM_TRANSPORT_READY);
+
+   return true;
+}
+
+const cdrom_transport_t* cdrom_get_transport(char drive)
+{
+   int index = cdrom_transport_index(drive);
+
+   /* pairs with the release once the transport was copied in */
+   if (index < 0 || RETRO_ATOMIC_LOAD_ACQUIRE(&cdrom_transports_set[index]) != CDROM_TRANSPORT_READY)
+      return NULL;
+
+   return &cdrom_transports[index];
+}
+
+void cdrom_set_command_observer(cdrom_command_observer_t observer, void *data)
+{
+   /* commands on other threads that see the observer also see its data */
+   RETRO_ATOMIC_STORE_PTR_RELEASE(&cdrom_command_observer_data, data);
+   RETRO_ATOMIC_STORE_PTR_RELEASE(&cdrom_command_observer, observer);
+}
 
-   if (cmd[0] == 0xBE || cmd[0] == 0xB9)
+/* One attempt at a command, returns 0 on success. */
+static int cdrom_send_command_once(libretro_vfs_implementation_file *stream, CDROM_CMD_Direction dir, void *buf, size_t len, unsigned char *cmd, size_t cmd_len, unsigned char *sense, size_t sense_len)
+{
+   cdrom_command_observer_t observer = (cdrom_command_observer_t)RETRO_ATOMIC_LOAD_PTR_ACQUIRE(&cdrom_command_observer);
+   void *observer_data = RETRO_ATOMIC_LOAD_PTR_ACQUIRE(&cdrom_command_observer_data);
+   retro_time_t start = observer ? cpu_features_get_time_usec() : 0;
+   int rv = 1;
+
+   if (stream->cdrom.transport_handle)
    {
-      frames = ceil((len + skip) / 2352.0);
-      padded_req_bytes = 2352 * frames;
-      read_cd = true;
-      /* these will be incremented below */
-      cmd[6] = cmd[3];
-      cmd[7] = cmd[4];
-      cmd[8] = cmd[5];
+      const cdrom_transport_t *transport = cdrom_get_transport(stream->cdrom.drive);
+
+      if (transport)
+         rv = transport->send(transport->data, stream->cdrom.transport_handle, dir, buf, len, cmd, cmd_len, sense, sense_len);
    }
+#if defined(__linux__) && !defined(ANDROID)
    else
+      rv = cdrom_send_command_linux(stream, dir, buf, len, cmd, cmd_len, sense, sense_len);
+#elif defined(_WIN32) && !defined(_XBOX)
+   else
+      rv = cdrom_send_command_win32(stream, dir, buf, len, cmd, cmd_len, sense, sense_len);
+#endif
+
+   if (observer)
+      observer(observer_data, stream->cdrom.drive, dir, buf, len, cmd, cmd_len, sense, sense_len, rv, (uint64_t)(cpu_features_get_time_usec() - start));
+
+   return rv;
+}
+
+/* Issues a single command to the drive, retrying up to retries times on transient errors. */
+static int cdrom_send_command_retry(libretro_vfs_implementation_file *stream, CDROM_CMD_Direction dir, void *buf, size_t len, unsigned char *cmd, size_t cmd_len, unsigned char *sense, size_t sense_len, unsigned char retries)
+{
+   unsigned char retries_left = retries;
+   uint64_t trace_start = cdrom_trace_begin();
+
+retry:
+   memset(sense, 0, sense_len);
+
+   if (!cdrom_send_command_once(stream, dir, buf, len, cmd, cmd_len, sense, sense_len))
    {
-      padded_req_bytes = len + skip;
+      cdrom_trace_end(trace_start, stream->cdrom.drive, cmd, 0, sense, retries - retries_left);
+      stream->cdrom.sense_key = 0;
+      return 0;
    }
 
-   xfer_buf = (unsigned char*)memalign_alloc(4096, padded_req_bytes);
-   xfer_buf_pos = xfer_buf;
+   cdrom_print_sense_data(sense, sense_len);
 
-   if (!xfer_buf)
-      return 1;
+   /* INQUIRY/TEST/SENSE should never fail, don't retry. */
+   /* READ ATIP seems to fail outright on some drives with pressed discs, skip retries. */
+   /* GET EVENT STATUS NOTIFICATION is polled periodically anyway, a retry would only stall the poller. */
+   if (cmd[0] != 0x0 && cmd[0] != 0x12 && cmd[0] != 0x5A && cmd[0] != 0x4A && !(cmd[0] == 0x43 && cmd[2] == 0x4))
+   {
+      unsigned char key = sense[2] & 0xF;
 
-   memset(xfer_buf, 0, padded_req_bytes);
+      switch (key)
+      {
+         case 0:
+         case 2:
+         case 3:
+         case 4:
+         case 6:
+            if (retries_left)
+            {
 #ifdef CDROM_DEBUG
-   printf("Number of frames to read: %d\n", frames);
-   fflush(stdout);
+               printf("[CDROM] Read Retry...\n");
+               fflush(stdout);
+#endif
+               retries_left--;
+               retro_sleep(1000);
+               goto retry;
+            }
+#ifdef CDROM_DEBUG
+            printf("[CDROM] Read retries failed, giving up.\n");
+            fflush(stdout);
 #endif
-   for (i = 0; i < frames; i++)
+            break;
+         default:
+            break;
+      }
+   }
+
+   cdrom_trace_end(trace_start, stream->cdrom.drive, cmd, 1, sense_len >= 14 ? sense : NULL, retries - retries_left);
+
+   stream->cdrom.sense_key = sense_len >= 3 ? sense[2] & 0xF : 0;
+
+   return 1;
+}
+
+/* Reads whole frames starting at lba, batch_frames at a time, and copies len bytes starting skip bytes into the first frame to s.
+ * With c2 set, each frame is followed by 294 bytes of C2 error pointers which are stripped and counted.
+ * Without retry a command that fails is given up on at once. */
+static int cdrom_read_frames(libretro_vfs_implementation_file *stream, unsigned char opcode, unsigned batch_frames, bool c2, bool retry, unsigned lba, void *s, size_t len, size_t skip)
+{
+   unsigned char sense[CDROM_MAX_SENSE_BYTES] = {0};
+   unsigned frames = (unsigned)((len + skip + 2351) / 2352);
+   size_t sector_bytes = 2352 + (c2 ? 294 : 0);
+   unsigned char *xfer_buf = NULL;
+   unsigned char *c2_buf = NULL;
+   unsigned i = 0;
+   int rv = 0;
+
+   if (frames == 0)
+      return 0;
+
+   if (batch_frames < 1)
+      batch_frames = 1;
+
+   xfer_buf = (unsigned char*)memalign_alloc(4096, frames * 2352);
+
+   if (!xfer_buf)
+      return 1;
+
+   if (c2)
    {
-      size_t request_len = padded_req_bytes;
-      size_t copy_len = request_len;
-      bool cached_read = false;
+      c2_buf = (unsigned char*)memalign_alloc(4096, batch_frames * sector_bytes);
 
-      if (read_cd)
+      if (!c2_buf)
       {
-         unsigned lba_req = 0;
+         memalign_free(xfer_buf);
+         return 1;
+      }
+   }
 
-         request_len = 2352;
-         copy_len = request_len;
+   if (stream->cdrom.last_frame_valid && lba == stream->cdrom.last_frame_lba)
+   {
+      /* use cached frame */
+#ifdef CDROM_DEBUG
+      printf("[CDROM] Using cached frame\n");
+      fflush(stdout);
+#endif
+      memcpy(xfer_buf, stream->cdrom.last_frame, sizeof(stream->cdrom.last_frame));
+      i = 1;
+   }
 
-         increment_msf(&cmd[6], &cmd[7], &cmd[8]);
+   while (i < frames)
+   {
+      unsigned char cdb[12] = {0};
+      unsigned count = MIN(batch_frames, frames - i);
+      unsigned start = lba + i;
+      unsigned char *dst = c2 ? c2_buf : xfer_buf + i * 2352;
 
-         if (i > 0)
-         {
-            skip = 0;
-            increment_msf(&cmd[3], &cmd[4], &cmd[5]);
-         }
-         else
-         {
-            if (skip)
-               copy_len -= skip;
-         }
+      cdb[0] = opcode;
 
-         if (i == frames - 1)
-         {
-            copy_len = len - copied_bytes;
-         }
+      if (opcode == 0xBE)
+      {
+         /* MMC Command: READ CD, addressed by LBA which starts at MSF 00:02:00 */
+         unsigned start_lba = start >= 150 ? start - 150 : 0;
+
+         cdb[2] = (start_lba >> 24) & 0xFF;
+         cdb[3] = (start_lba >> 16) & 0xFF;
+         cdb[4] = (start_lba >> 8) & 0xFF;
+         cdb[5] = start_lba & 0xFF;
+         cdb[6] = (count >> 16) & 0xFF;
+         cdb[7] = (count >> 8) & 0xFF;
+         cdb[8] = count & 0xFF;
+      }
+      else
+      {
+         /* MMC Command: READ CD MSF, the ending address is exclusive */
+         cdrom_lba_to_msf(start, &cdb[3], &cdb[4], &cdb[5]);
+         cdrom_lba_to_msf(start + count, &cdb[6], &cdb[7], &cdb[8]);
+      }
 
-         lba_req = cdrom_msf_to_lba(cmd[3], cmd[4], cmd[5]);
+      cdb[9] = 0xF8 | (c2 ? 0x2 : 0);
 
-         if (stream->cdrom.last_frame_valid && lba_req == stream->cdrom.last_frame_lba)
-         {
-            /* use cached frame */
-            cached_read = true;
 #ifdef CDROM_DEBUG
-            printf("[CDROM] Using cached frame\n");
-            fflush(stdout);
+      printf("[CDROM] Read %u frames starting at LBA %u (opcode %02X%s)\n", count, start, opcode, c2 ? ", C2" : "");
+      fflush(stdout);
 #endif
-            /* assumes request_len is always equal to the size of last_frame */
-            memcpy(xfer_buf_pos, stream->cdrom.last_frame, sizeof(stream->cdrom.last_frame));
-         }
 
+      if (cdrom_send_command_retry(stream, DIRECTION_IN, dst, count * sector_bytes, cdb, sizeof(cdb), sense, sizeof(sense), retry ? CDROM_MAX_RETRIES : 0))
+      {
+         rv = 1;
+         break;
       }
 
-#ifdef CDROM_DEBUG
-      if (!cached_read)
+      if (c2)
       {
          unsigned j;
 
-         printf("[CDROM] Send Command: ");
-
-         for (j = 0; j < cmd_len / sizeof(*cmd); j++)
+         for (j = 0; j < count; j++)
          {
-            printf("%02X ", cmd[j]);
-         }
+            const unsigned char *c2_bits = c2_buf + j * sector_bytes + 2352;
+            unsigned k;
 
-         if (len)
-            printf("(buffer of size %" PRId64 " with skip bytes %" PRId64 " padded to %" PRId64 "), frame %d\n", len, skip, padded_req_bytes, i);
-         else
-            printf("\n");
+            memcpy(xfer_buf + (i + j) * 2352, c2_buf + j * sector_bytes, 2352);
 
-         fflush(stdout);
+            for (k = 0; k < 294; k++)
+            {
+               unsigned char bits = c2_bits[k];
+
+               while (bits)
+               {
+                  stream->cdrom.c2_errors++;
+                  bits &= bits - 1;
+               }
+            }
+         }
       }
-#endif
 
-retry:
-#if defined(__linux__) && !defined(ANDROID)
-      if (cached_read || !cdrom_send_command_linux(stream, dir, xfer_buf_pos, request_len, cmd, cmd_len, sense, sizeof(sense)))
-#else
-#if defined(_WIN32) && !defined(_XBOX)
-      if (cached_read || !cdrom_send_command_win32(stream, dir, xfer_buf_pos, request_len, cmd, cmd_len, sense, sizeof(sense)))
-#endif
-#endif
-      {
-         rv = 0;
+      i += count;
+   }
 
-         if (buf)
-         {
-#if 0
-            printf("offsetting %" PRId64 " from buf, copying at xfer_buf offset %" PRId64 ", copying %" PRId64 " bytes\n", copied_bytes, (xfer_buf_pos + skip) - xfer_buf, copy_len);
-            fflush(stdout);
-#endif
-            memcpy(buf + copied_bytes, xfer_buf_pos + skip, copy_len);
-            copied_bytes += copy_len;
+   if (!rv)
+   {
+      if (s)
+         memcpy(s, xfer_buf + skip, len);
 
-            if (read_cd && !cached_read && request_len >= 2352)
-            {
-               unsigned frame_end = cdrom_msf_to_lba(cmd[6], cmd[7], cmd[8]);
+      /* cache the last received frame */
+      memcpy(stream->cdrom.last_frame, xfer_buf + (frames - 1) * 2352, sizeof(stream->cdrom.last_frame));
+      stream->cdrom.last_frame_lba = lba + frames - 1;
+      stream->cdrom.last_frame_valid = true;
+   }
+   else
+      stream->cdrom.last_frame_valid = false;
 
-               /* cache the last received frame */
-               memcpy(stream->cdrom.last_frame, xfer_buf_pos, sizeof(stream->cdrom.last_frame));
-               stream->cdrom.last_frame_valid = true;
-               /* the ending frame is never actually read, so what we really just read is the one right before that */
-               stream->cdrom.last_frame_lba = frame_end - 1;
-            }
-            else
-               stream->cdrom.last_frame_valid = false;
+   if (c2_buf)
+      memalign_free(c2_buf);
 
-#if 0
-            printf("Frame %d, adding %" PRId64 " to buf_pos, is now %" PRId64 ". skip is %" PRId64 "\n", i, request_len, (xfer_buf_pos + request_len) - xfer_buf, skip);
-            fflush(stdout);
-#endif
-            xfer_buf_pos += request_len;
-         }
+   memalign_free(xfer_buf);
+
+   return rv;
+}
+
+static int cdrom_send_command(libretro_vfs_implementation_file *stream, CDROM_CMD_Direction dir, void *buf, size_t len, unsigned char *cmd, size_t cmd_len, size_t skip)
+{
+   unsigned char *xfer_buf = NULL;
+   unsigned char sense[CDROM_MAX_SENSE_BYTES] = {0};
+   size_t padded_req_bytes = len + skip;
+   int rv;
+
+   if (!cmd || cmd_len == 0)
+      return 1;
+
+   if (cmd[0] == 0xB9)
+      return cdrom_read_frames(stream, cmd[0], 1, false, true, cdrom_msf_to_lba(cmd[3], cmd[4], cmd[5]), buf, len, skip);
+
+#ifdef CDROM_DEBUG
+   {
+      unsigned j;
+
+      printf("[CDROM] Send Command: ");
+
+      for (j = 0; j < cmd_len / sizeof(*cmd); j++)
+      {
+         printf("%02X ", cmd[j]);
       }
+
+      if (len)
+         printf("(buffer of size %" PRId64 " with skip bytes %" PRId64 ")\n", len, skip);
       else
-      {
-         cdrom_print_sense_data(sense, sizeof(sense));
+         printf("\n");
 
-         /* INQUIRY/TEST/SENSE should never fail, don't retry. */
-         /* READ ATIP seems to fail outright on some drives with pressed discs, skip retries. */
-         if (cmd[0] != 0x0 && cmd[0] != 0x12 && cmd[0] != 0x5A && !(cmd[0] == 0x43 && cmd[2] == 0x4))
-         {
-            unsigned char key = sense[2] & 0xF;
+      fflush(stdout);
+   }
+#endif
 
-            switch (key)
-            {
-               case 0:
-               case 2:
-               case 3:
-               case 4:
-               case 6:
-                  if (retries_left)
-                  {
-   #ifdef CDROM_DEBUG
-                     printf("[CDROM] Read Retry...\n");
-                     fflush(stdout);
-   #endif
-                     retries_left--;
-                      retro_sleep(1000);
-                     goto retry;
-                  }
-                  else
-                  {
-                     rv = 1;
-   #ifdef CDROM_DEBUG
-                     printf("[CDROM] Read retries failed, giving up.\n");
-                     fflush(stdout);
-   #endif
-                  }
-
-                  break;
-               default:
-                  break;
-            }
-         }
+   if (padded_req_bytes)
+   {
+      xfer_buf = (unsigned char*)memalign_alloc(4096, padded_req_bytes);
 
-         rv = 1;
-      }
+      if (!xfer_buf)
+         return 1;
+
+      memset(xfer_buf, 0, padded_req_bytes);
+
+      /* parameter data for MODE SELECT and friends has to go out with the command */
+      if (dir == DIRECTION_OUT && buf)
+         memcpy(xfer_buf + skip, buf, len);
    }
 
+   rv = cdrom_send_command_retry(stream, dir, xfer_buf, padded_req_bytes, cmd, cmd_len, sense, sizeof(sense), CDROM_MAX_RETRIES);
+
+   if (!rv && buf && dir != DIRECTION_OUT)
+      memcpy(buf, xfer_buf + skip, len);
+
    if (xfer_buf)
       memalign_free(xfer_buf);
 
@@ -885,95 +1040,296 @@ void cdrom_get_current_config_core(libretro_vfs_implementation_file *stream)
    printf("[CDROM] Physical Interface Standard: %u (%s)\n", intf_std, intf_std_name);
 }
 
-int cdrom_read_subq(libretro_vfs_implementation_file *stream, unsigned char *buf, size_t len)
+static bool cdrom_read_cache_changeable(libretro_vfs_implementation_file *stream)
 {
-   /* MMC Command: READ TOC/PMA/ATIP */
-   unsigned char cdb[] = {0x43, 0x2, 0x2, 0, 0, 0, 0x1, 0x9, 0x30, 0};
+   /* MMC Command: MODE SENSE (10) */
+   unsigned char cdb[] = {0x5A, 0, 0x48, 0, 0, 0, 0, 0, 0x14, 0};
+   unsigned char buf[20] = {0};
+   int rv = cdrom_send_command(stream, DIRECTION_IN, buf, sizeof(buf), cdb, sizeof(cdb), 0);
+
 #ifdef CDROM_DEBUG
-   unsigned short data_len = 0;
-   unsigned char first_session = 0;
-   unsigned char last_session = 0;
-   int i;
+   printf("[CDROM] mode sense changeable status code %d\n", rv);
+   fflush(stdout);
 #endif
-   int rv;
-
-   if (!buf)
-      return 1;
-
-   rv = cdrom_send_command(stream, DIRECTION_IN, buf, len, cdb, sizeof(cdb), 0);
 
    if (rv)
-     return 1;
+      return false;
 
-#ifdef CDROM_DEBUG
-   data_len = buf[0] << 8 | buf[1];
-   first_session = buf[2];
-   last_session = buf[3];
+   /* RCD (read cache disable) bit */
+   return (buf[10] & 0x1) != 0;
+}
 
-   printf("[CDROM] Data Length: %d\n", data_len);
-   printf("[CDROM] First Session: %d\n", first_session);
-   printf("[CDROM] Last Session: %d\n", last_session);
+static int cdrom_get_serial(libretro_vfs_implementation_file *stream, char *serial, size_t len)
+{
+   /* MMC Command: INQUIRY, Unit Serial Number VPD page */
+   unsigned char cdb[] = {0x12, 0x1, 0x80, 0, 0xff, 0};
+   unsigned char buf[256] = {0};
+   size_t serial_len;
+   int rv = cdrom_send_command(stream, DIRECTION_IN, buf, sizeof(buf), cdb, sizeof(cdb), 0);
 
-   for (i = 0; i < (data_len - 2) / 11; i++)
-   {
-      unsigned char session_num = buf[4 + (i * 11) + 0];
-      unsigned char adr = (buf[4 + (i * 11) + 1] >> 4) & 0xF;
-      /*unsigned char control = buf[4 + (i * 11) + 1] & 0xF;*/
-      unsigned char tno = buf[4 + (i * 11) + 2];
-      unsigned char point = buf[4 + (i * 11) + 3];
-      unsigned char pmin = buf[4 + (i * 11) + 8];
-      unsigned char psec = buf[4 + (i * 11) + 9];
-      unsigned char pframe = buf[4 + (i * 11) + 10];
+   if (!serial || !len)
+      return 1;
 
-      /*printf("i %d control %d adr %d tno %d point %d: ", i, control, adr, tno, point);*/
-      /* why is control always 0? */
+   serial[0] = '\0';
 
-      if (/*(control == 4 || control == 6) && */adr == 1 && tno == 0 && point >= 1 && point <= 99)
-      {
-         printf("[CDROM] - Session#: %d TNO %d POINT %d ", session_num, tno, point);
-         printf("[CDROM] Track start time: (MSF %02u:%02u:%02u) ", (unsigned)pmin, (unsigned)psec, (unsigned)pframe);
-      }
-      else if (/*(control == 4 || control == 6) && */adr == 1 && tno == 0 && point == 0xA0)
-      {
-         printf("[CDROM] - Session#: %d TNO %d POINT %d ", session_num, tno, point);
-         printf("[CDROM] First Track Number: %d ", pmin);
-         printf("[CDROM] Disc Type: %d ", psec);
-      }
-      else if (/*(control == 4 || control == 6) && */adr == 1 && tno == 0 && point == 0xA1)
-      {
-         printf("[CDROM] - Session#: %d TNO %d POINT %d ", session_num, tno, point);
-         printf("[CDROM] Last Track Number: %d ", pmin);
-      }
-      else if (/*(control == 4 || control == 6) && */adr == 1 && tno == 0 && point == 0xA2)
-      {
-         printf("[CDROM] - Session#: %d TNO %d POINT %d ", session_num, tno, point);
-         printf("[CDROM] Lead-out runtime: (MSF %02u:%02u:%02u) ", (unsigned)pmin, (unsigned)psec, (unsigned)pframe);
-      }
+   if (rv || buf[1] != 0x80)
+      return 1;
 
-      printf("\n");
-   }
+   serial_len = MIN(buf[3], len - 1);
+
+   memcpy(serial, buf + 4, serial_len);
+   serial[serial_len] = '\0';
 
-   fflush(stdout);
-#endif
    return 0;
 }
 
-static int cdrom_read_track_info(libretro_vfs_implementation_file *stream, unsigned char track, cdrom_toc_t *toc)
+static unsigned cdrom_get_max_transfer_bytes(libretro_vfs_implementation_file *stream)
 {
-   /* MMC Command: READ TRACK INFORMATION */
-   unsigned char cdb[] = {0x52, 0x1, 0, 0, 0, 0, 0, 0x1, 0x80, 0};
-   unsigned char buf[384] = {0};
-   unsigned lba = 0;
-   unsigned track_size = 0;
-   int rv;
-   ssize_t pregap_lba_len;
+#if defined(__linux__) && !defined(ANDROID)
+   int max_bytes = 0;
 
-   cdb[5] = track;
+   if (stream->cdrom.transport_handle)
+      return cdrom_get_transport(stream->cdrom.drive)->max_transfer_bytes;
 
-   rv = cdrom_send_command(stream, DIRECTION_IN, buf, sizeof(buf), cdb, sizeof(cdb), 0);
+   /* sg reports the queue limit in bytes, fall back to the reserved buffer size */
+   if (ioctl(fileno(stream->fp), BLKSECTGET, &max_bytes) == 0 && max_bytes > 0)
+      return (unsigned)max_bytes;
 
-   if (rv)
-     return 1;
+   if (ioctl(fileno(stream->fp), SG_GET_RESERVED_SIZE, &max_bytes) == 0 && max_bytes > 0)
+      return (unsigned)max_bytes;
+#endif
+#if defined(_WIN32) && !defined(_XBOX)
+   IO_SCSI_CAPABILITIES scsi_caps;
+   DWORD ioctl_bytes = 0;
+
+   if (stream->cdrom.transport_handle)
+      return cdrom_get_transport(stream->cdrom.drive)->max_transfer_bytes;
+
+   memset(&scsi_caps, 0, sizeof(scsi_caps));
+
+   if (DeviceIoControl(stream->fh, IOCTL_SCSI_GET_CAPABILITIES, NULL, 0, &scsi_caps, sizeof(scsi_caps), &ioctl_bytes, NULL))
+      return scsi_caps.MaximumTransferLength;
+#endif
+   return 0;
+}
+
+static void cdrom_parse_features(cdrom_drive_caps_t *caps, const unsigned char *buf, size_t len)
+{
+   size_t data_len = (buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3]) + 4;
+   size_t pos = 8;
+
+   caps->current_profile = buf[6] << 8 | buf[7];
+
+   if (data_len > len)
+      data_len = len;
+
+   while (pos + 4 <= data_len)
+   {
+      unsigned short code = buf[pos] << 8 | buf[pos + 1];
+      bool current = (buf[pos + 2] & 0x1) != 0;
+      unsigned char add_len = buf[pos + 3];
+      const unsigned char *data = buf + pos + 4;
+
+      if (pos + 4 + add_len > data_len)
+         break;
+
+      if (current)
+      {
+         switch (code)
+         {
+            case 0x1D:
+               caps->multiread = true;
+               break;
+            case 0x1E:
+               caps->cd_read = true;
+
+               if (add_len >= 1)
+               {
+                  caps->cd_text = (data[0] & 0x1) != 0;
+                  caps->c2_pointers = (data[0] & 0x2) != 0;
+               }
+               break;
+            case 0x107:
+               caps->streaming = true;
+               break;
+            default:
+               break;
+         }
+      }
+
+      pos += 4 + add_len;
+   }
+}
+
+#define CDROM_CAPS_CACHE_SIZE 8
+#define CDROM_MAX_BATCH_FRAMES 32
+
+static cdrom_drive_caps_t cdrom_caps_cache[CDROM_CAPS_CACHE_SIZE];
+static unsigned cdrom_caps_cache_next = 0;
+/* drives can be opened from several threads at once, the cache is only held for a copy */
+static retro_spinlock_t cdrom_caps_cache_lock = 0;
+
+int cdrom_get_drive_caps(libretro_vfs_implementation_file *stream, cdrom_drive_caps_t *caps)
+{
+   /* MMC Command: GET CONFIGURATION, all features */
+   unsigned char cdb[] = {0x46, 0, 0, 0, 0, 0, 0, 0x8, 0, 0};
+   unsigned char *buf = NULL;
+   size_t buf_len = 0x800;
+   unsigned batch;
+   int i;
+
+   if (!caps)
+      return 1;
+
+   memset(caps, 0, sizeof(*caps));
+
+   if (cdrom_get_inquiry(stream, caps->model, sizeof(caps->model), NULL))
+      return 1;
+
+   cdrom_get_serial(stream, caps->serial, sizeof(caps->serial));
+
+   retro_spinlock_lock(&cdrom_caps_cache_lock);
+
+   for (i = 0; i < CDROM_CAPS_CACHE_SIZE; i++)
+   {
+      if (cdrom_caps_cache[i].valid && string_is_equal(cdrom_caps_cache[i].model, caps->model) && string_is_equal(cdrom_caps_cache[i].serial, caps->serial))
+      {
+         *caps = cdrom_caps_cache[i];
+         retro_spinlock_unlock(&cdrom_caps_cache_lock);
+#ifdef CDROM_DEBUG
+         printf("[CDROM] Using cached capabilities for %s (%s)\n", caps->model, caps->serial);
+         fflush(stdout);
+#endif
+         return 0;
+      }
+   }
+
+   retro_spinlock_unlock(&cdrom_caps_cache_lock);
+
+   buf = (unsigned char*)calloc(1, buf_len);
+
+   if (!buf)
+      return 1;
+
+   if (!cdrom_send_command(stream, DIRECTION_IN, buf, buf_len, cdb, sizeof(cdb), 0))
+      cdrom_parse_features(caps, buf, buf_len);
+
+   free(buf);
+
+   caps->read_cache_control = cdrom_read_cache_changeable(stream);
+   caps->max_transfer_bytes = cdrom_get_max_transfer_bytes(stream);
+
+   /* READ CD addresses by LBA and avoids MSF math per batch, older drives without
+    * the CD Read feature only get the READ CD MSF path that has always been used */
+   caps->read_command = caps->cd_read ? 0xBE : 0xB9;
+
+   batch = caps->max_transfer_bytes / (2352 + (caps->c2_pointers ? 294 : 0));
+   caps->batch_frames = (unsigned char)MAX(1, MIN(batch, CDROM_MAX_BATCH_FRAMES));
+   caps->valid = true;
+
+#ifdef CDROM_DEBUG
+   printf("[CDROM] Drive %s (%s): profile %04X, CD Read %d, C2 %d, CD-Text %d, Multi-Read %d, Streaming %d, RCD %d, max transfer %u, batch %u\n",
+         caps->model, caps->serial, caps->current_profile, caps->cd_read, caps->c2_pointers, caps->cd_text, caps->multiread,
+         caps->streaming, caps->read_cache_control, caps->max_transfer_bytes, (unsigned)caps->batch_frames);
+   fflush(stdout);
+#endif
+
+   retro_spinlock_lock(&cdrom_caps_cache_lock);
+   cdrom_caps_cache[cdrom_caps_cache_next] = *caps;
+   cdrom_caps_cache_next = (cdrom_caps_cache_next + 1) % CDROM_CAPS_CACHE_SIZE;
+   retro_spinlock_unlock(&cdrom_caps_cache_lock);
+
+   return 0;
+}
+
+int cdrom_read_subq(libretro_vfs_implementation_file *stream, unsigned char *buf, size_t len)
+{
+   /* MMC Command: READ TOC/PMA/ATIP */
+   unsigned char cdb[] = {0x43, 0x2, 0x2, 0, 0, 0, 0x1, 0x9, 0x30, 0};
+#ifdef CDROM_DEBUG
+   unsigned short data_len = 0;
+   unsigned char first_session = 0;
+   unsigned char last_session = 0;
+   int i;
+#endif
+   int rv;
+
+   if (!buf)
+      return 1;
+
+   rv = cdrom_send_command(stream, DIRECTION_IN, buf, len, cdb, sizeof(cdb), 0);
+
+   if (rv)
+     return 1;
+
+#ifdef CDROM_DEBUG
+   data_len = buf[0] << 8 | buf[1];
+   first_session = buf[2];
+   last_session = buf[3];
+
+   printf("[CDROM] Data Length: %d\n", data_len);
+   printf("[CDROM] First Session: %d\n", first_session);
+   printf("[CDROM] Last Session: %d\n", last_session);
+
+   for (i = 0; i < (data_len - 2) / 11; i++)
+   {
+      unsigned char session_num = buf[4 + (i * 11) + 0];
+      unsigned char adr = (buf[4 + (i * 11) + 1] >> 4) & 0xF;
+      /*unsigned char control = buf[4 + (i * 11) + 1] & 0xF;*/
+      unsigned char tno = buf[4 + (i * 11) + 2];
+      unsigned char point = buf[4 + (i * 11) + 3];
+      unsigned char pmin = buf[4 + (i * 11) + 8];
+      unsigned char psec = buf[4 + (i * 11) + 9];
+      unsigned char pframe = buf[4 + (i * 11) + 10];
+
+      /*printf("i %d control %d adr %d tno %d point %d: ", i, control, adr, tno, point);*/
+
+      if (/*(control == 4 || control == 6) && */adr == 1 && tno == 0 && point >= 1 && point <= 99)
+      {
+         printf("[CDROM] - Session#: %d TNO %d POINT %d ", session_num, tno, point);
+         printf("[CDROM] Track start time: (MSF %02u:%02u:%02u) ", (unsigned)pmin, (unsigned)psec, (unsigned)pframe);
+      }
+      else if (/*(control == 4 || control == 6) && */adr == 1 && tno == 0 && point == 0xA0)
+      {
+         printf("[CDROM] - Session#: %d TNO %d POINT %d ", session_num, tno, point);
+         printf("[CDROM] First Track Number: %d ", pmin);
+         printf("[CDROM] Disc Type: %d ", psec);
+      }
+      else if (/*(control == 4 || control == 6) && */adr == 1 && tno == 0 && point == 0xA1)
+      {
+         printf("[CDROM] - Session#: %d TNO %d POINT %d ", session_num, tno, point);
+         printf("[CDROM] Last Track Number: %d ", pmin);
+      }
+      else if (/*(control == 4 || control == 6) && */adr == 1 && tno == 0 && point == 0xA2)
+      {
+         printf("[CDROM] - Session#: %d TNO %d POINT %d ", session_num, tno, point);
+         printf("[CDROM] Lead-out runtime: (MSF %02u:%02u:%02u) ", (unsigned)pmin, (unsigned)psec, (unsigned)pframe);
+      }
+
+      printf("\n");
+   }
+
+   fflush(stdout);
+#endif
+   return 0;
+}
+
+int cdrom_read_track_info(libretro_vfs_implementation_file *stream, unsigned char track, cdrom_toc_t *toc)
+{
+   /* MMC Command: READ TRACK INFORMATION */
+   unsigned char cdb[] = {0x52, 0x1, 0, 0, 0, 0, 0, 0x1, 0x80, 0};
+   unsigned char buf[384] = {0};
+   unsigned lba = 0;
+   unsigned track_size = 0;
+   int rv;
+   ssize_t pregap_lba_len;
+
+   cdb[5] = track;
+
+   rv = cdrom_send_command(stream, DIRECTION_IN, buf, sizeof(buf), cdb, sizeof(cdb), 0);
+
+   if (rv)
+     return 1;
 
    memcpy(&lba, buf + 8, 4);
    memcpy(&track_size, buf + 24, 4);
@@ -1015,23 +1371,16 @@ int cdrom_set_read_speed(libretro_vfs_implementation_file *stream, unsigned spee
    return cdrom_send_command(stream, DIRECTION_NONE, NULL, 0, cmd, sizeof(cmd), 0);
 }
 
-int cdrom_write_cue(libretro_vfs_implementation_file *stream, char **out_buf, size_t *out_len, char cdrom_drive, unsigned char *num_tracks, cdrom_toc_t *toc)
+int cdrom_read_toc(libretro_vfs_implementation_file *stream, cdrom_toc_t *toc)
 {
    unsigned char buf[2352] = {0};
    unsigned short data_len = 0;
-   size_t len = 0;
-   size_t pos = 0;
+   unsigned char num_tracks = 0;
    int rv = 0;
    int i;
 
-   if (!out_buf || !out_len || !num_tracks || !toc)
-   {
-#ifdef CDROM_DEBUG
-      printf("[CDROM] Invalid buffer/length pointer for CDROM cue sheet\n");
-      fflush(stdout);
-#endif
+   if (!toc)
       return 1;
-   }
 
    cdrom_set_read_speed(stream, 0xFFFFFFFF);
 
@@ -1051,28 +1400,26 @@ int cdrom_write_cue(libretro_vfs_implementation_file *stream, char **out_buf, si
 
       if (/*(control == 4 || control == 6) && */adr == 1 && tno == 0 && point == 0xA1)
       {
-         *num_tracks = pmin;
+         num_tracks = pmin;
 #ifdef CDROM_DEBUG
-         printf("[CDROM] Number of CDROM tracks: %d\n", *num_tracks);
+         printf("[CDROM] Number of CDROM tracks: %d\n", num_tracks);
          fflush(stdout);
 #endif
          break;
       }
    }
 
-   if (!*num_tracks || *num_tracks > 99)
+   if (!num_tracks || num_tracks > 99)
    {
 #ifdef CDROM_DEBUG
-      printf("[CDROM] Invalid number of CDROM tracks: %d\n", *num_tracks);
+      printf("[CDROM] Invalid number of CDROM tracks: %d\n", num_tracks);
       fflush(stdout);
 #endif
       return 1;
    }
 
-   len = CDROM_CUE_TRACK_BYTES * (*num_tracks);
-   toc->num_tracks = *num_tracks;
-   *out_buf = (char*)calloc(1, len);
-   *out_len = len;
+   memset(toc->track, 0, sizeof(toc->track));
+   toc->num_tracks = num_tracks;
 
    for (i = 0; i < (data_len - 2) / 11; i++)
    {
@@ -1090,17 +1437,15 @@ int cdrom_write_cue(libretro_vfs_implementation_file *stream, char **out_buf, si
       unsigned lba = cdrom_msf_to_lba(pmin, psec, pframe);
 
       /*printf("i %d control %d adr %d tno %d point %d: amin %d asec %d aframe %d pmin %d psec %d pframe %d\n", i, control, adr, tno, point, amin, asec, aframe, pmin, psec, pframe);*/
-      /* why is control always 0? */
 
       if (/*(control == 4 || control == 6) && */adr == 1 && tno == 0 && point >= 1 && point <= 99)
       {
-         bool audio = false;
-         const char *track_type = "MODE1/2352";
-
-         audio = (!(control & 0x4) && !(control & 0x5));
+         /* control bit 2 marks a data track, bit 0 pre-emphasis on an audio one (bit 1 is copy permitted, bit 3 four channel audio) */
+         bool audio = !(control & 0x4);
+         bool pre_emphasis = audio && (control & 0x1);
 
 #ifdef CDROM_DEBUG
-         printf("[CDROM] Track %02d CONTROL %01X ADR %01X AUDIO? %d\n", point, control, adr, audio);
+         printf("[CDROM] Track %02d CONTROL %01X ADR %01X AUDIO? %d PRE-EMPHASIS? %d\n", point, control, adr, audio, pre_emphasis);
          fflush(stdout);
 #endif
 
@@ -1110,266 +1455,912 @@ int cdrom_write_cue(libretro_vfs_implementation_file *stream, char **out_buf, si
          toc->track[point - 1].frame = pframe;
          toc->track[point - 1].lba = lba;
          toc->track[point - 1].audio = audio;
+         toc->track[point - 1].pre_emphasis = pre_emphasis;
+      }
+   }
+
+   return 0;
+}
+
+int cdrom_write_cue_sheet(const cdrom_toc_t *toc, char cdrom_drive, char **out_buf, size_t *out_len)
+{
+   size_t len = 0;
+   size_t pos = 0;
+   int i;
+
+   if (!toc || !out_buf || !out_len || !toc->num_tracks)
+      return 1;
+
+   len = CDROM_CUE_TRACK_BYTES * toc->num_tracks;
+   *out_buf = (char*)calloc(1, len);
+   *out_len = len;
+
+   if (!*out_buf)
+      return 1;
+
+   for (i = 0; i < toc->num_tracks; i++)
+   {
+      const cdrom_track_t *track = &toc->track[i];
+      unsigned char point = track->track_num;
+      const char *track_type = "MODE1/2352";
+
+      /* not present in the raw TOC */
+      if (!point)
+         continue;
+
+      if (track->audio)
+         track_type = "AUDIO";
+      else if (track->mode == 1)
+         track_type = "MODE1/2352";
+      else if (track->mode == 2)
+         track_type = "MODE2/2352";
+
+#if defined(_WIN32) && !defined(_XBOX)
+      pos += snprintf(*out_buf + pos, len - pos, "FILE \"cdrom://%c:/drive-track%02d.bin\" BINARY\n", cdrom_drive, point);
+#else
+      pos += snprintf(*out_buf + pos, len - pos, "FILE \"cdrom://drive%c-track%02d.bin\" BINARY\n", cdrom_drive, point);
+#endif
+      pos += snprintf(*out_buf + pos, len - pos, "  TRACK %02d %s\n", point, track_type);
+
+      if (track->pre_emphasis)
+         pos += snprintf(*out_buf + pos, len - pos, "    FLAGS PRE\n");
+
+      {
+         unsigned pregap_lba_len = track->lba - track->lba_start;
+
+         if (track->audio && pregap_lba_len > 0)
+         {
+            unsigned char min = 0;
+            unsigned char sec = 0;
+            unsigned char frame = 0;
+
+            cdrom_lba_to_msf(pregap_lba_len, &min, &sec, &frame);
+
+            pos += snprintf(*out_buf + pos, len - pos, "    INDEX 00 00:00:00\n");
+            pos += snprintf(*out_buf + pos, len - pos, "    INDEX 01 %02u:%02u:%02u\n", (unsigned)min, (unsigned)sec, (unsigned)frame);
+         }
+         else
+            pos += snprintf(*out_buf + pos, len - pos, "    INDEX 01 00:00:00\n");
+      }
+   }
+
+   return 0;
+}
+
+int cdrom_write_cue(libretro_vfs_implementation_file *stream, char **out_buf, size_t *out_len, char cdrom_drive, unsigned char *num_tracks, cdrom_toc_t *toc)
+{
+   int rv;
+   int i;
+
+   if (!out_buf || !out_len || !num_tracks || !toc)
+   {
+#ifdef CDROM_DEBUG
+      printf("[CDROM] Invalid buffer/length pointer for CDROM cue sheet\n");
+      fflush(stdout);
+#endif
+      return 1;
+   }
+
+   rv = cdrom_read_toc(stream, toc);
+
+   if (rv)
+      return rv;
+
+   *num_tracks = toc->num_tracks;
+
+   for (i = 0; i < toc->num_tracks; i++)
+   {
+      if (toc->track[i].track_num)
+         cdrom_read_track_info(stream, toc->track[i].track_num, toc);
+   }
+
+   return cdrom_write_cue_sheet(toc, cdrom_drive, out_buf, out_len);
+}
+
+/* needs 32 bytes for full vendor, product and version */
+int cdrom_get_inquiry(libretro_vfs_implementation_file *stream, char *model, int len, bool *is_cdrom)
+{
+   /* MMC Command: INQUIRY */
+   unsigned char cdb[] = {0x12, 0, 0, 0, 0xff, 0};
+   unsigned char buf[256] = {0};
+   int rv = cdrom_send_command(stream, DIRECTION_IN, buf, sizeof(buf), cdb, sizeof(cdb), 0);
+   bool cdrom = false;
+
+   if (rv)
+      return 1;
+
+   if (model && len >= 32)
+   {
+      memset(model, 0, len);
+
+      /* vendor */
+      memcpy(model, buf + 8, 8);
+
+      model[8] = ' ';
+
+      /* product */
+      memcpy(model + 9, buf + 16, 16);
+
+      model[25] = ' ';
+
+      /* version */
+      memcpy(model + 26, buf + 32, 4);
+   }
+
+   cdrom = (buf[0] == 5);
+
+   if (is_cdrom && cdrom)
+      *is_cdrom = true;
+
+#ifdef CDROM_DEBUG
+   printf("[CDROM] Device Model: %s (is CD-ROM? %s)\n", model, (cdrom ? "yes" : "no"));
+#endif
+   return 0;
+}
+
+int cdrom_read(libretro_vfs_implementation_file *stream, cdrom_group_timeouts_t *timeouts, unsigned char min, unsigned char sec, unsigned char frame, void *s, size_t len, size_t skip)
+{
+   /* MMC Command: READ CD MSF */
+   unsigned char cdb[] = {0xB9, 0, 0, 0, 0, 0, 0, 0, 0, 0xF8, 0, 0};
+   int rv;
+   double frames = ceil((len + skip) / 2352.0);
+   unsigned frame_end = cdrom_msf_to_lba(min, sec, frame) + frames;
+
+   cdb[3] = min;
+   cdb[4] = sec;
+   cdb[5] = frame;
+
+   if (frames <= 1)
+   {
+      cdrom_lba_to_msf(frame_end, &cdb[6], &cdb[7], &cdb[8]);
+#ifdef CDROM_DEBUG
+      printf("[CDROM] single-frame read: %d %d %d skip %" PRId64 "\n", cdb[3], cdb[4], cdb[5], skip);
+      fflush(stdout);
+#endif
+   }
+   else
+   {
+      cdrom_lba_to_msf(frame_end, &cdb[6], &cdb[7], &cdb[8]);
+
+#ifdef CDROM_DEBUG
+      printf("[CDROM] multi-frame read: %d sectors starting from %02d:%02d:%02d skip %" PRId64 "\n", (int)frames, cdb[3], cdb[4], cdb[5], skip);
+      fflush(stdout);
+#endif
+   }
+
+   /* regardless of the length specified here, a new buffer will be allocated and padded to a sector multiple inside cdrom_send_command */
+   rv = cdrom_send_command(stream, DIRECTION_IN, s, len, cdb, sizeof(cdb), skip);
+
+#ifdef CDROM_DEBUG
+   printf("[CDROM] read msf status code %d\n", rv);
+   fflush(stdout);
+#endif
+
+   if (rv)
+   {
+      stream->cdrom.last_frame_valid = false;
+      return 1;
+   }
+
+   return 0;
+}
+
+int cdrom_read_lba(libretro_vfs_implementation_file *stream, const cdrom_drive_caps_t *caps, unsigned lba, void *s, size_t len, size_t skip)
+{
+   int rv;
+
+   if (!caps || !caps->valid)
+   {
+      unsigned char min = 0;
+      unsigned char sec = 0;
+      unsigned char frame = 0;
+
+      cdrom_lba_to_msf(lba, &min, &sec, &frame);
+
+      return cdrom_read(stream, NULL, min, sec, frame, s, len, skip);
+   }
+
+   rv = cdrom_read_frames(stream, caps->read_command, caps->batch_frames, caps->c2_pointers, true, lba, s, len, skip);
+
+#ifdef CDROM_DEBUG
+   printf("[CDROM] read lba status code %d\n", rv);
+   fflush(stdout);
+#endif
+
+   return rv;
+}
+
+int cdrom_read_lba_once(libretro_vfs_implementation_file *stream, const cdrom_drive_caps_t *caps, unsigned lba, void *s, size_t len, size_t skip)
+{
+   if (!caps || !caps->valid)
+      return cdrom_read_frames(stream, 0xB9, 1, false, false, lba, s, len, skip);
+
+   return cdrom_read_frames(stream, caps->read_command, caps->batch_frames, caps->c2_pointers, false, lba, s, len, skip);
+}
+
+int cdrom_stop(libretro_vfs_implementation_file *stream)
+{
+   /* MMC Command: START STOP UNIT */
+   unsigned char cdb[] = {0x1B, 0, 0, 0, 0x0, 0};
+   int rv = cdrom_send_command(stream, DIRECTION_NONE, NULL, 0, cdb, sizeof(cdb), 0);
+
+#ifdef CDROM_DEBUG
+   printf("[CDROM] stop status code %d\n", rv);
+   fflush(stdout);
+#endif
+
+   if (rv)
+      return 1;
+
+   return 0;
+}
+
+int cdrom_unlock(libretro_vfs_implementation_file *stream)
+{
+   /* MMC Command: PREVENT ALLOW MEDIUM REMOVAL */
+   unsigned char cdb[] = {0x1E, 0, 0, 0, 0x2, 0};
+   int rv = cdrom_send_command(stream, DIRECTION_NONE, NULL, 0, cdb, sizeof(cdb), 0);
+
+#ifdef CDROM_DEBUG
+   printf("[CDROM] persistent prevent clear status code %d\n", rv);
+   fflush(stdout);
+#endif
+
+   if (rv)
+      return 1;
+
+   cdb[4] = 0x0;
+
+   rv = cdrom_send_command(stream, DIRECTION_NONE, NULL, 0, cdb, sizeof(cdb), 0);
+
+#ifdef CDROM_DEBUG
+   printf("[CDROM] prevent clear status code %d\n", rv);
+   fflush(stdout);
+#endif
+
+   if (rv)
+      return 1;
+
+   return 0;
+}
+
+int cdrom_open_tray(libretro_vfs_implementation_file *stream)
+{
+   /* MMC Command: START STOP UNIT */
+   unsigned char cdb[] = {0x1B, 0, 0, 0, 0x2, 0};
+   int rv;
+
+   cdrom_unlock(stream);
+   cdrom_stop(stream);
+
+   rv = cdrom_send_command(stream, DIRECTION_NONE, NULL, 0, cdb, sizeof(cdb), 0);
+
+#ifdef CDROM_DEBUG
+   printf("[CDROM] open tray status code %d\n", rv);
+   fflush(stdout);
+#endif
+
+   if (rv)
+      return 1;
+
+   return 0;
+}
+
+int cdrom_close_tray(libretro_vfs_implementation_file *stream)
+{
+   /* MMC Command: START STOP UNIT */
+   unsigned char cdb[] = {0x1B, 0, 0, 0, 0x3, 0};
+   int rv = cdrom_send_command(stream, DIRECTION_NONE, NULL, 0, cdb, sizeof(cdb), 0);
+
+#ifdef CDROM_DEBUG
+   printf("[CDROM] close tray status code %d\n", rv);
+   fflush(stdout);
+#endif
+
+   if (rv)
+      return 1;
+
+   return 0;
+}
+
+#if defined(__linux__) && !defined(ANDROID)
+#define CDROM_MAX_DRIVE_NODES 256
+#define CDROM_MAX_PROBE_THREADS 16
+#define CDROM_PROBE_TIMEOUT_MS 2000
+
+/* One /dev/sg* node as last seen, keyed by its device number and sysfs identity so unchanged nodes are never probed twice. */
+typedef struct
+{
+   char node[32];
+   char identity[256];
+   char model[32];
+   dev_t rdev;
+   unsigned index;
+   bool is_cdrom;
+   bool probed;
+   bool seen;
+} cdrom_drive_node_t;
+
+typedef struct
+{
+   char path[PATH_MAX];
+   char model[32];
+   retro_time_t start_usec;
+   bool is_cdrom;
+   bool started;
+   bool finished;
+   bool abandoned;
+} cdrom_probe_job_t;
+
+/* Shared by the enumerating thread and its probe workers; whoever drops the last reference frees it,
+ * so a worker stuck on an unresponsive node can outlive the enumeration that gave up on it. */
+typedef struct
+{
+   slock_t *lock;
+   scond_t *cond;
+   cdrom_probe_job_t *jobs;
+   unsigned num_jobs;
+   unsigned next_job;
+   unsigned refs;
+   cdrom_drive_probe_t probe;
+} cdrom_probe_batch_t;
+
+static cdrom_drive_node_t cdrom_drive_nodes[CDROM_MAX_DRIVE_NODES];
+static unsigned cdrom_drive_num_nodes = 0;
+static bool cdrom_drive_nodes_valid = false;
+static int cdrom_drive_inotify_fd = -1;
+static char cdrom_drive_dev_root[256] = "/dev";
+static char cdrom_drive_sys_root[256] = "/sys/class/scsi_generic";
+static cdrom_drive_probe_t cdrom_drive_probe = NULL;
+static unsigned cdrom_drive_timeout_ms = CDROM_PROBE_TIMEOUT_MS;
+
+static bool cdrom_probe_inquiry(const char *path, char *model, size_t len)
+{
+   RFILE *file = filestream_open(path, RETRO_VFS_FILE_ACCESS_READ, 0);
+   char drive_model[32] = {0};
+   bool is_cdrom = false;
+
+   if (!file)
+      return false;
+
+   cdrom_get_inquiry(filestream_get_vfs_handle(file), drive_model, sizeof(drive_model), &is_cdrom);
+   filestream_close(file);
+
+   strlcpy(model, drive_model, len);
+
+   return is_cdrom;
+}
+
+static void cdrom_probe_batch_unref(cdrom_probe_batch_t *batch)
+{
+   bool last;
+
+   slock_lock(batch->lock);
+   last = (--batch->refs == 0);
+   slock_unlock(batch->lock);
+
+   if (!last)
+      return;
+
+   scond_free(batch->cond);
+   slock_free(batch->lock);
+   free(batch->jobs);
+   free(batch);
+}
+
+static void cdrom_probe_worker(void *data)
+{
+   cdrom_probe_batch_t *batch = (cdrom_probe_batch_t*)data;
+
+   for (;;)
+   {
+      cdrom_probe_job_t *job;
+      char model[32] = {0};
+      bool is_cdrom;
+
+      slock_lock(batch->lock);
+
+      if (batch->next_job >= batch->num_jobs)
+      {
+         slock_unlock(batch->lock);
+         break;
+      }
+
+      job = &batch->jobs[batch->next_job++];
+      job->started = true;
+      job->start_usec = cpu_features_get_time_usec();
+
+      slock_unlock(batch->lock);
+
+      is_cdrom = batch->probe(job->path, model, sizeof(model));
+
+      slock_lock(batch->lock);
+      job->is_cdrom = is_cdrom;
+      strlcpy(job->model, model, sizeof(job->model));
+      job->finished = true;
+      scond_signal(batch->cond);
+      slock_unlock(batch->lock);
+   }
+
+   cdrom_probe_batch_unref(batch);
+}
+
+/* Probes every job concurrently, giving each node at most the configured timeout once it has started. */
+static void cdrom_probe_nodes(cdrom_probe_job_t *jobs, unsigned num_jobs)
+{
+   sthread_t *threads[CDROM_MAX_PROBE_THREADS] = {NULL};
+   cdrom_probe_batch_t *batch;
+   unsigned num_threads = MIN(num_jobs, CDROM_MAX_PROBE_THREADS);
+   unsigned live_threads = 0;
+   retro_time_t timeout_usec = (retro_time_t)cdrom_drive_timeout_ms * 1000;
+   unsigned i;
+
+   if (!num_jobs)
+      return;
+
+   batch = (cdrom_probe_batch_t*)calloc(1, sizeof(*batch));
+
+   if (!batch)
+      return;
+
+   batch->jobs = (cdrom_probe_job_t*)calloc(num_jobs, sizeof(*jobs));
+   batch->lock = slock_new();
+   batch->cond = scond_new();
+   batch->num_jobs = num_jobs;
+   batch->probe = cdrom_drive_probe ? cdrom_drive_probe : cdrom_probe_inquiry;
+   batch->refs = 1;
+
+   if (!batch->jobs || !batch->lock || !batch->cond)
+   {
+      batch->num_jobs = 0;
+      cdrom_probe_batch_unref(batch);
+      return;
+   }
+
+   memcpy(batch->jobs, jobs, num_jobs * sizeof(*jobs));
+
+   for (i = 0; i < num_threads; i++)
+   {
+      slock_lock(batch->lock);
+      batch->refs++;
+      slock_unlock(batch->lock);
+
+      threads[i] = sthread_create(cdrom_probe_worker, batch);
+
+      if (!threads[i])
+      {
+         cdrom_probe_batch_unref(batch);
+         break;
+      }
+   }
+
+   live_threads = i;
+
+   /* no threads at all, probe serially */
+   if (i == 0)
+   {
+      batch->refs++;
+      cdrom_probe_worker(batch);
+   }
+
+   slock_lock(batch->lock);
+
+   for (;;)
+   {
+      retro_time_t now = cpu_features_get_time_usec();
+      unsigned resolved = 0;
+      unsigned stuck = 0;
+
+      for (i = 0; i < num_jobs; i++)
+      {
+         cdrom_probe_job_t *job = &batch->jobs[i];
+
+         if (!job->finished && !job->abandoned && job->started && now - job->start_usec > timeout_usec)
+            job->abandoned = true;
+
+         if (job->abandoned && !job->finished)
+            stuck++;
+      }
+
+      for (i = 0; i < num_jobs; i++)
+      {
+         cdrom_probe_job_t *job = &batch->jobs[i];
+
+         /* every worker is hung, nothing queued would ever start */
+         if (!job->started && stuck >= MAX(live_threads, 1))
+            job->abandoned = true;
+
+         if (job->finished || job->abandoned)
+            resolved++;
+      }
+
+      if (resolved == num_jobs)
+         break;
+
+      scond_wait_timeout(batch->cond, batch->lock, 10000);
+   }
+
+   for (i = 0; i < num_jobs; i++)
+      jobs[i] = batch->jobs[i];
+
+   slock_unlock(batch->lock);
+
+   for (i = 0; i < num_threads; i++)
+   {
+      unsigned j;
+      bool stuck = false;
+
+      if (!threads[i])
+         break;
+
+      /* a worker still inside a timed out probe is left behind, it releases the batch when the node answers */
+      slock_lock(batch->lock);
+      for (j = 0; j < num_jobs; j++)
+      {
+         if (batch->jobs[j].abandoned && !batch->jobs[j].finished)
+            stuck = true;
+      }
+      slock_unlock(batch->lock);
+
+      if (stuck)
+         sthread_detach(threads[i]);
+      else
+         sthread_join(threads[i]);
+   }
+
+   cdrom_probe_batch_unref(batch);
+}
+
+static bool cdrom_read_sysfs_string(const char *sys_root, const char *node, const char *attr, char *out, size_t len)
+{
+   char path[PATH_MAX];
+   FILE *fp;
+   size_t read_len;
+
+   snprintf(path, sizeof(path), "%s/%s/device/%s", sys_root, node, attr);
+
+   fp = fopen(path, "r");
+
+   if (!fp)
+      return false;
+
+   read_len = fread(out, 1, len - 1, fp);
+   fclose(fp);
+
+   out[read_len] = '\0';
+
+   while (read_len && (out[read_len - 1] == '\n' || out[read_len - 1] == ' '))
+      out[--read_len] = '\0';
+
+   return true;
+}
+
+/* Fills in the identity of a node; returns -1 if it is gone, 0 if sysfs already says it is not an optical drive, 1 if it needs probing. */
+static int cdrom_drive_node_identify(cdrom_drive_node_t *node)
+{
+   char path[PATH_MAX];
+   char identity[PATH_MAX];
+   char type[8] = {0};
+   struct stat st;
+
+   snprintf(path, sizeof(path), "%s/%s", cdrom_drive_dev_root, node->node);
+
+   if (stat(path, &st))
+      return -1;
+
+   node->rdev = st.st_rdev;
+   node->identity[0] = '\0';
+
+   snprintf(path, sizeof(path), "%s/%s/device", cdrom_drive_sys_root, node->node);
+
+   if (realpath(path, identity))
+      strlcpy(node->identity, identity, sizeof(node->identity));
+
+   /* SCSI peripheral device type 5 is CD/DVD, anything else can be skipped without an INQUIRY */
+   if (cdrom_read_sysfs_string(cdrom_drive_sys_root, node->node, "type", type, sizeof(type)))
+      return atoi(type) == 5;
+
+   return 1;
+}
+
+static cdrom_drive_node_t* cdrom_drive_node_find(const char *name)
+{
+   unsigned i;
+
+   for (i = 0; i < cdrom_drive_num_nodes; i++)
+   {
+      if (string_is_equal(cdrom_drive_nodes[i].node, name))
+         return &cdrom_drive_nodes[i];
+   }
+
+   return NULL;
+}
+
+static void cdrom_drive_nodes_compact(void)
+{
+   unsigned i;
+
+   for (i = 0; i < cdrom_drive_num_nodes;)
+   {
+      if (string_is_empty(cdrom_drive_nodes[i].node))
+         cdrom_drive_nodes[i] = cdrom_drive_nodes[--cdrom_drive_num_nodes];
+      else
+         i++;
+   }
+}
+
+/* (Re)validates the named nodes against the cache and probes only those whose identity changed. */
+static void cdrom_drive_nodes_update(char names[][32], unsigned num_names)
+{
+   cdrom_probe_job_t *jobs = (cdrom_probe_job_t*)calloc(MAX(num_names, 1), sizeof(*jobs));
+   cdrom_drive_node_t **pending = (cdrom_drive_node_t**)calloc(MAX(num_names, 1), sizeof(*pending));
+   unsigned num_jobs = 0;
+   unsigned i;
+
+   if (!jobs || !pending)
+   {
+      free(jobs);
+      free(pending);
+      return;
+   }
 
-         cdrom_read_track_info(stream, point, toc);
+   for (i = 0; i < num_names; i++)
+   {
+      cdrom_drive_node_t candidate = {{0}};
+      cdrom_drive_node_t *node = cdrom_drive_node_find(names[i]);
+      int maybe_cdrom;
 
-         if (audio)
-            track_type = "AUDIO";
-         else if (toc->track[point - 1].mode == 1)
-            track_type = "MODE1/2352";
-         else if (toc->track[point - 1].mode == 2)
-            track_type = "MODE2/2352";
+      strlcpy(candidate.node, names[i], sizeof(candidate.node));
+      sscanf(names[i] + strlen("sg"), "%u", &candidate.index);
 
-#if defined(_WIN32) && !defined(_XBOX)
-         pos += snprintf(*out_buf + pos, len - pos, "FILE \"cdrom://%c:/drive-track%02d.bin\" BINARY\n", cdrom_drive, point);
-#else
-         pos += snprintf(*out_buf + pos, len - pos, "FILE \"cdrom://drive%c-track%02d.bin\" BINARY\n", cdrom_drive, point);
-#endif
-         pos += snprintf(*out_buf + pos, len - pos, "  TRACK %02d %s\n", point, track_type);
+      maybe_cdrom = cdrom_drive_node_identify(&candidate);
 
-         {
-            unsigned pregap_lba_len = toc->track[point - 1].lba - toc->track[point - 1].lba_start;
+      if (maybe_cdrom < 0)
+      {
+         /* the node is gone, dropped once probing is over so pending entries stay put */
+         if (node)
+            node->node[0] = '\0';
+         continue;
+      }
 
-            if (toc->track[point - 1].audio && pregap_lba_len > 0)
-            {
-               unsigned char min = 0;
-               unsigned char sec = 0;
-               unsigned char frame = 0;
+      if (node && node->probed && node->rdev == candidate.rdev && string_is_equal(node->identity, candidate.identity))
+      {
+         node->seen = true;
+         continue;
+      }
 
-               cdrom_lba_to_msf(pregap_lba_len, &min, &sec, &frame);
+      if (!node)
+      {
+         if (cdrom_drive_num_nodes >= CDROM_MAX_DRIVE_NODES)
+            continue;
 
-               pos += snprintf(*out_buf + pos, len - pos, "    INDEX 00 00:00:00\n");
-               pos += snprintf(*out_buf + pos, len - pos, "    INDEX 01 %02u:%02u:%02u\n", (unsigned)min, (unsigned)sec, (unsigned)frame);
-            }
-            else
-               pos += snprintf(*out_buf + pos, len - pos, "    INDEX 01 00:00:00\n");
-         }
+         node = &cdrom_drive_nodes[cdrom_drive_num_nodes++];
       }
-   }
-
-   return 0;
-}
 
-/* needs 32 bytes for full vendor, product and version */
-int cdrom_get_inquiry(libretro_vfs_implementation_file *stream, char *model, int len, bool *is_cdrom)
-{
-   /* MMC Command: INQUIRY */
-   unsigned char cdb[] = {0x12, 0, 0, 0, 0xff, 0};
-   unsigned char buf[256] = {0};
-   int rv = cdrom_send_command(stream, DIRECTION_IN, buf, sizeof(buf), cdb, sizeof(cdb), 0);
-   bool cdrom = false;
+      *node = candidate;
+      node->seen = true;
 
-   if (rv)
-      return 1;
+      if (!maybe_cdrom)
+      {
+         node->probed = true;
+         continue;
+      }
 
-   if (model && len >= 32)
-   {
-      memset(model, 0, len);
+      snprintf(jobs[num_jobs].path, sizeof(jobs[num_jobs].path), "%s/%s", cdrom_drive_dev_root, node->node);
+      pending[num_jobs++] = node;
+   }
 
-      /* vendor */
-      memcpy(model, buf + 8, 8);
+   cdrom_probe_nodes(jobs, num_jobs);
 
-      model[8] = ' ';
+   for (i = 0; i < num_jobs; i++)
+   {
+      cdrom_drive_node_t *node = pending[i];
 
-      /* product */
-      memcpy(model + 9, buf + 16, 16);
+      if (jobs[i].finished)
+      {
+         node->is_cdrom = jobs[i].is_cdrom;
+         strlcpy(node->model, jobs[i].model, sizeof(node->model));
+         node->probed = true;
+      }
+      else
+      {
+         /* timed out: trust sysfs instead, the node is probed again once /dev reports a change to it */
+         char vendor[16] = {0};
+         char model[24] = {0};
 
-      model[25] = ' ';
+         cdrom_read_sysfs_string(cdrom_drive_sys_root, node->node, "vendor", vendor, sizeof(vendor));
+         cdrom_read_sysfs_string(cdrom_drive_sys_root, node->node, "model", model, sizeof(model));
 
-      /* version */
-      memcpy(model + 26, buf + 32, 4);
+         snprintf(node->model, sizeof(node->model), "%s %s", vendor, model);
+         node->is_cdrom = !string_is_empty(node->identity);
+         node->probed = true;
+      }
    }
 
-   cdrom = (buf[0] == 5);
-
-   if (is_cdrom && cdrom)
-      *is_cdrom = true;
+   cdrom_drive_nodes_compact();
 
-#ifdef CDROM_DEBUG
-   printf("[CDROM] Device Model: %s (is CD-ROM? %s)\n", model, (cdrom ? "yes" : "no"));
-#endif
-   return 0;
+   free(jobs);
+   free(pending);
 }
 
-int cdrom_read(libretro_vfs_implementation_file *stream, cdrom_group_timeouts_t *timeouts, unsigned char min, unsigned char sec, unsigned char frame, void *s, size_t len, size_t skip)
+static void cdrom_drive_nodes_rescan(void)
 {
-   /* MMC Command: READ CD MSF */
-   unsigned char cdb[] = {0xB9, 0, 0, 0, 0, 0, 0, 0, 0, 0xF8, 0, 0};
-   int rv;
-   double frames = ceil((len + skip) / 2352.0);
-   unsigned frame_end = cdrom_msf_to_lba(min, sec, frame) + frames;
+   struct string_list *dir_list = dir_list_new(cdrom_drive_dev_root, NULL, false, true, false, false);
+   char (*names)[32] = NULL;
+   unsigned num_names = 0;
+   unsigned i;
 
-   cdb[3] = min;
-   cdb[4] = sec;
-   cdb[5] = frame;
+   if (!dir_list)
+      return;
 
-   if (frames <= 1)
-   {
-      cdrom_lba_to_msf(frame_end, &cdb[6], &cdb[7], &cdb[8]);
-#ifdef CDROM_DEBUG
-      printf("[CDROM] single-frame read: %d %d %d skip %" PRId64 "\n", cdb[3], cdb[4], cdb[5], skip);
-      fflush(stdout);
-#endif
-   }
-   else
+   names = (char(*)[32])calloc(dir_list->size + 1, sizeof(*names));
+
+   if (names)
    {
-      cdrom_lba_to_msf(frame_end, &cdb[6], &cdb[7], &cdb[8]);
+      for (i = 0; i < cdrom_drive_num_nodes; i++)
+         cdrom_drive_nodes[i].seen = false;
 
-#ifdef CDROM_DEBUG
-      printf("[CDROM] multi-frame read: %d sectors starting from %02d:%02d:%02d skip %" PRId64 "\n", (int)frames, cdb[3], cdb[4], cdb[5], skip);
-      fflush(stdout);
-#endif
-   }
+      for (i = 0; i < dir_list->size; i++)
+      {
+         const char *name = path_basename(dir_list->elems[i].data);
 
-   /* regardless of the length specified here, a new buffer will be allocated and padded to a sector multiple inside cdrom_send_command */
-   rv = cdrom_send_command(stream, DIRECTION_IN, s, len, cdb, sizeof(cdb), skip);
+         if (name && !strncmp(name, "sg", 2) && num_names < CDROM_MAX_DRIVE_NODES)
+            strlcpy(names[num_names++], name, sizeof(names[0]));
+      }
 
-#ifdef CDROM_DEBUG
-   printf("[CDROM] read msf status code %d\n", rv);
-   fflush(stdout);
-#endif
+      cdrom_drive_nodes_update(names, num_names);
 
-   if (rv)
-   {
-      stream->cdrom.last_frame_valid = false;
-      return 1;
+      /* anything not listed anymore has been unplugged */
+      for (i = 0; i < cdrom_drive_num_nodes; i++)
+      {
+         if (!cdrom_drive_nodes[i].seen)
+            cdrom_drive_nodes[i].node[0] = '\0';
+      }
+
+      cdrom_drive_nodes_compact();
+
+      free(names);
    }
 
-   return 0;
+   string_list_free(dir_list);
 }
 
-int cdrom_stop(libretro_vfs_implementation_file *stream)
+/* Applies queued /dev events, returns false if a full rescan is needed instead. */
+static bool cdrom_drive_nodes_apply_events(void)
 {
-   /* MMC Command: START STOP UNIT */
-   unsigned char cdb[] = {0x1B, 0, 0, 0, 0x0, 0};
-   int rv = cdrom_send_command(stream, DIRECTION_NONE, NULL, 0, cdb, sizeof(cdb), 0);
-
-#ifdef CDROM_DEBUG
-   printf("[CDROM] stop status code %d\n", rv);
-   fflush(stdout);
-#endif
+   char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+   char names[64][32];
+   unsigned num_names = 0;
+   bool rescan = false;
 
-   if (rv)
-      return 1;
+   for (;;)
+   {
+      ssize_t len = read(cdrom_drive_inotify_fd, buf, sizeof(buf));
+      ssize_t pos = 0;
 
-   return 0;
-}
+      if (len <= 0)
+         break;
 
-int cdrom_unlock(libretro_vfs_implementation_file *stream)
-{
-   /* MMC Command: PREVENT ALLOW MEDIUM REMOVAL */
-   unsigned char cdb[] = {0x1E, 0, 0, 0, 0x2, 0};
-   int rv = cdrom_send_command(stream, DIRECTION_NONE, NULL, 0, cdb, sizeof(cdb), 0);
+      while (pos < len)
+      {
+         const struct inotify_event *event = (const struct inotify_event*)(buf + pos);
 
-#ifdef CDROM_DEBUG
-   printf("[CDROM] persistent prevent clear status code %d\n", rv);
-   fflush(stdout);
-#endif
+         if (event->mask & IN_Q_OVERFLOW)
+            rescan = true;
+         else if (event->len && !strncmp(event->name, "sg", 2))
+         {
+            unsigned i;
+            bool dup = false;
 
-   if (rv)
-      return 1;
+            for (i = 0; i < num_names; i++)
+               if (string_is_equal(names[i], event->name))
+                  dup = true;
 
-   cdb[4] = 0x0;
+            if (!dup)
+            {
+               if (num_names < ARRAY_SIZE(names))
+                  strlcpy(names[num_names++], event->name, sizeof(names[0]));
+               else
+                  rescan = true;
+            }
+         }
 
-   rv = cdrom_send_command(stream, DIRECTION_NONE, NULL, 0, cdb, sizeof(cdb), 0);
+         pos += sizeof(struct inotify_event) + event->len;
+      }
+   }
 
-#ifdef CDROM_DEBUG
-   printf("[CDROM] prevent clear status code %d\n", rv);
-   fflush(stdout);
-#endif
+   if (rescan)
+      return false;
 
-   if (rv)
-      return 1;
+   if (num_names)
+      cdrom_drive_nodes_update(names, num_names);
 
-   return 0;
+   return true;
 }
 
-int cdrom_open_tray(libretro_vfs_implementation_file *stream)
+static int cdrom_drive_node_compare(const void *a, const void *b)
 {
-   /* MMC Command: START STOP UNIT */
-   unsigned char cdb[] = {0x1B, 0, 0, 0, 0x2, 0};
-   int rv;
-
-   cdrom_unlock(stream);
-   cdrom_stop(stream);
-
-   rv = cdrom_send_command(stream, DIRECTION_NONE, NULL, 0, cdb, sizeof(cdb), 0);
+   const cdrom_drive_node_t *node_a = *(const cdrom_drive_node_t**)a;
+   const cdrom_drive_node_t *node_b = *(const cdrom_drive_node_t**)b;
 
-#ifdef CDROM_DEBUG
-   printf("[CDROM] open tray status code %d\n", rv);
-   fflush(stdout);
-#endif
+   return (int)node_a->index - (int)node_b->index;
+}
 
-   if (rv)
-      return 1;
+void cdrom_drive_list_configure(const char *dev_root, const char *sys_root, cdrom_drive_probe_t probe, unsigned timeout_ms)
+{
+   cdrom_drive_list_reset();
 
-   return 0;
+   strlcpy(cdrom_drive_dev_root, dev_root ? dev_root : "/dev", sizeof(cdrom_drive_dev_root));
+   strlcpy(cdrom_drive_sys_root, sys_root ? sys_root : "/sys/class/scsi_generic", sizeof(cdrom_drive_sys_root));
+   cdrom_drive_probe = probe;
+   cdrom_drive_timeout_ms = timeout_ms ? timeout_ms : CDROM_PROBE_TIMEOUT_MS;
 }
 
-int cdrom_close_tray(libretro_vfs_implementation_file *stream)
+void cdrom_drive_list_reset(void)
 {
-   /* MMC Command: START STOP UNIT */
-   unsigned char cdb[] = {0x1B, 0, 0, 0, 0x3, 0};
-   int rv = cdrom_send_command(stream, DIRECTION_NONE, NULL, 0, cdb, sizeof(cdb), 0);
-
-#ifdef CDROM_DEBUG
-   printf("[CDROM] close tray status code %d\n", rv);
-   fflush(stdout);
-#endif
+   if (cdrom_drive_inotify_fd >= 0)
+      close(cdrom_drive_inotify_fd);
 
-   if (rv)
-      return 1;
+   cdrom_drive_inotify_fd = -1;
+   cdrom_drive_num_nodes = 0;
+   cdrom_drive_nodes_valid = false;
+}
+#else
+void cdrom_drive_list_configure(const char *dev_root, const char *sys_root, cdrom_drive_probe_t probe, unsigned timeout_ms)
+{
+}
 
-   return 0;
+void cdrom_drive_list_reset(void)
+{
 }
+#endif
 
 struct string_list* cdrom_get_available_drives(void)
 {
    struct string_list *list = string_list_new();
 #if defined(__linux__) && !defined(ANDROID)
-   struct string_list *dir_list = dir_list_new("/dev", NULL, false, false, false, false);
-   int i;
-
-   if (!dir_list)
-      return list;
+   const cdrom_drive_node_t *sorted[CDROM_MAX_DRIVE_NODES];
+   unsigned i;
 
-   for (i = 0; i < (int)dir_list->size; i++)
+   if (!cdrom_drive_nodes_valid)
    {
-      if (strstr(dir_list->elems[i].data, "/dev/sg"))
+      /* watch before scanning so nothing plugged in meanwhile is missed */
+      cdrom_drive_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+      if (cdrom_drive_inotify_fd >= 0 && inotify_add_watch(cdrom_drive_inotify_fd, cdrom_drive_dev_root, IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO) < 0)
       {
-         char drive_model[32] = {0};
-         char drive_string[33] = {0};
-         union string_list_elem_attr attr = {0};
-         int dev_index = 0;
-         RFILE *file = filestream_open(dir_list->elems[i].data, RETRO_VFS_FILE_ACCESS_READ, 0);
-         libretro_vfs_implementation_file *stream;
-         bool is_cdrom = false;
+         close(cdrom_drive_inotify_fd);
+         cdrom_drive_inotify_fd = -1;
+      }
 
-         if (!file)
-            continue;
+      cdrom_drive_nodes_rescan();
+      cdrom_drive_nodes_valid = true;
+   }
+   else if (cdrom_drive_inotify_fd < 0 || !cdrom_drive_nodes_apply_events())
+      cdrom_drive_nodes_rescan();
 
-         stream = filestream_get_vfs_handle(file);
-         cdrom_get_inquiry(stream, drive_model, sizeof(drive_model), &is_cdrom);
-         filestream_close(file);
+   for (i = 0; i < cdrom_drive_num_nodes; i++)
+      sorted[i] = &cdrom_drive_nodes[i];
 
-         if (!is_cdrom)
-            continue;
+   qsort(sorted, cdrom_drive_num_nodes, sizeof(*sorted), cdrom_drive_node_compare);
 
-         sscanf(dir_list->elems[i].data + strlen("/dev/sg"), "%d", &dev_index);
+   for (i = 0; i < cdrom_drive_num_nodes; i++)
+   {
+      char drive_string[33] = {0};
+      union string_list_elem_attr attr = {0};
 
-         dev_index = '0' + dev_index;
-         attr.i = dev_index;
+      if (!sorted[i]->is_cdrom)
+         continue;
 
-         if (!string_is_empty(drive_model))
-            strlcat(drive_string, drive_model, sizeof(drive_string));
-         else
-            strlcat(drive_string, "Unknown Drive", sizeof(drive_string));
+      attr.i = '0' + sorted[i]->index;
 
-         string_list_append(list, drive_string, attr);
-      }
-   }
+      if (!string_is_empty(sorted[i]->model))
+         strlcat(drive_string, sorted[i]->model, sizeof(drive_string));
+      else
+         strlcat(drive_string, "Unknown Drive", sizeof(drive_string));
 
-   string_list_free(dir_list);
+      string_list_append(list, drive_string, attr);
+   }
 #endif
 #if defined(_WIN32) && !defined(_XBOX)
    DWORD drive_mask = GetLogicalDrives();
@@ -1441,6 +2432,41 @@ bool cdrom_is_media_inserted(libretro_vfs_implementation_file *stream)
    return true;
 }
 
+int cdrom_get_media_event(libretro_vfs_implementation_file *stream, cdrom_media_event_t *event)
+{
+   /* MMC Command: GET EVENT STATUS NOTIFICATION, polled, media class only */
+   unsigned char cdb[] = {0x4A, 0x1, 0, 0, 0x10, 0, 0, 0, 0x8, 0};
+   unsigned char buf[8] = {0};
+   int rv = cdrom_send_command(stream, DIRECTION_IN, buf, sizeof(buf), cdb, sizeof(cdb), 0);
+
+   memset(event, 0, sizeof(*event));
+
+   if (rv)
+      return 1;
+
+   /* NEA: the drive has no media class event to report */
+   if (buf[2] & 0x80)
+      return 1;
+
+   /* the drive answered with some other class than requested */
+   if ((buf[2] & 0x7) != 4)
+      return 1;
+
+   event->code = (cdrom_media_event_code_t)(buf[4] & 0xF);
+   event->tray_open = (buf[5] & 0x1) != 0;
+   event->media_present = (buf[5] & 0x2) != 0;
+
+#ifdef CDROM_DEBUG
+   if (event->code != CDROM_MEDIA_EVENT_NONE)
+   {
+      printf("[CDROM] Media event %d (tray %s, media %s)\n", event->code, event->tray_open ? "open" : "closed", event->media_present ? "present" : "absent");
+      fflush(stdout);
+   }
+#endif
+
+   return 0;
+}
+
 bool cdrom_drive_has_media(const char drive)
 {
    RFILE *file;
@@ -1470,23 +2496,12 @@ bool cdrom_drive_has_media(const char drive)
 bool cdrom_set_read_cache(libretro_vfs_implementation_file *stream, bool enabled)
 {
    /* MMC Command: MODE SENSE (10) and MODE SELECT (10) */
-   unsigned char cdb_sense_changeable[] = {0x5A, 0, 0x48, 0, 0, 0, 0, 0, 0x14, 0};
    unsigned char cdb_sense[] = {0x5A, 0, 0x8, 0, 0, 0, 0, 0, 0x14, 0};
    unsigned char cdb_select[] = {0x55, 0x10, 0, 0, 0, 0, 0, 0, 0x14, 0};
    unsigned char buf[20] = {0};
    int rv, i;
 
-   rv = cdrom_send_command(stream, DIRECTION_IN, buf, sizeof(buf), cdb_sense_changeable, sizeof(cdb_sense_changeable), 0);
-
-#ifdef CDROM_DEBUG
-   printf("[CDROM] mode sense changeable status code %d\n", rv);
-   fflush(stdout);
-#endif
-
-   if (rv)
-      return false;
-
-   if (!(buf[10] & 0x1))
+   if (!cdrom_read_cache_changeable(stream))
    {
       /* RCD (read cache disable) bit is not changeable */
 #ifdef CDROM_DEBUG
@@ -1496,8 +2511,6 @@ bool cdrom_set_read_cache(libretro_vfs_implementation_file *stream, bool enabled
       return false;
    }
 
-   memset(buf, 0, sizeof(buf));
-
    rv = cdrom_send_command(stream, DIRECTION_IN, buf, sizeof(buf), cdb_sense, sizeof(cdb_sense), 0);
 
 #ifdef CDROM_DEBUG
@@ -1632,16 +2645,22 @@ void cdrom_device_fillpath(char *path, size_t len, char drive, unsigned char tra
 #ifdef _WIN32
       pos = strlcpy(path, "cdrom://", len);
 
-      if (len > pos)
+      if (len > pos + 1)
+      {
          path[pos++] = drive;
+         path[pos] = '\0';
+      }
 
       pos = strlcat(path, ":/drive.cue", len);
 #else
 #ifdef __linux__
       pos = strlcpy(path, "cdrom://drive", len);
 
-      if (len > pos)
+      if (len > pos + 1)
+      {
          path[pos++] = drive;
+         path[pos] = '\0';
+      }
 
       pos = strlcat(path, ".cue", len);
 #endif
@@ -1652,16 +2671,22 @@ void cdrom_device_fillpath(char *path, size_t len, char drive, unsigned char tra
 #ifdef _WIN32
       pos = strlcpy(path, "cdrom://", len);
 
-      if (len > pos)
+      if (len > pos + 1)
+      {
          path[pos++] = drive;
+         path[pos] = '\0';
+      }
 
       pos += snprintf(path + pos, len - pos, ":/drive-track%02d.bin", track);
 #else
 #ifdef __linux__
       pos = strlcpy(path, "cdrom://drive", len);
 
-      if (len > pos)
+      if (len > pos + 1)
+      {
          path[pos++] = drive;
+         path[pos] = '\0';
+      }
 
       pos += snprintf(path + pos, len - pos, "-track%02d.bin", track);
 #endif
@@ -0,0 +1,783 @@
+/* Copyright  (C) 2010-2019 The RetroArch team
+ *
+ * ---------------------------------------------------------------------------------------
+ * The following license statement only applies to this file (cdrom_sim.c).
+ * ---------------------------------------------------------------------------------------
+ *
+ * Permission is hereby granted, free of charge,
+ * to any person obtaining a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cdrom/cdrom_sim.h>
+#include <streams/file_stream.h>
+#include <file/file_path.h>
+#include <lists/string_list.h>
+#include <string/stdstring.h>
+#include <rthreads/rthreads.h>
+#include <retro_miscellaneous.h>
+#include <compat/strl.h>
+
+#define CDROM_SIM_MAX_FILES 99
+#define CDROM_SIM_MAX_TRACKS 99
+#define CDROM_SIM_MAX_TRANSFER_BYTES (64 * 1024)
+
+/* Addresses are MSF frame counts like everywhere else in the cdrom layer, so the first track starts at 150 (00:02:00). */
+typedef struct
+{
+   char path[PATH_MAX_LENGTH];
+   unsigned sectors;
+} cdrom_sim_file_t;
+
+typedef struct
+{
+   unsigned gap_start;   /* first address of the track, including a PREGAP that is not in the file */
+   unsigned data_start;  /* first address backed by the file */
+   unsigned start;       /* INDEX 01 */
+   unsigned file_sector; /* sector of the file at data_start */
+   unsigned char file;
+   unsigned char mode;   /* 1 or 2 for data tracks */
+   bool audio;
+   bool pre_emphasis;    /* FLAGS PRE */
+} cdrom_sim_track_t;
+
+struct cdrom_sim
+{
+   slock_t *lock;
+   cdrom_sim_file_t files[CDROM_SIM_MAX_FILES];
+   cdrom_sim_track_t tracks[CDROM_SIM_MAX_TRACKS];
+   unsigned leadout;
+   unsigned char num_files;
+   unsigned char num_tracks;
+   cdrom_media_event_code_t event;
+   bool present;
+   bool read_cache_disabled;
+};
+
+typedef struct
+{
+   cdrom_sim_t *sim;
+   RFILE *files[CDROM_SIM_MAX_FILES];
+} cdrom_sim_handle_t;
+
+static void cdrom_sim_set_sense(unsigned char *sense, size_t sense_len, unsigned char key, unsigned char asc, unsigned char ascq)
+{
+   if (!sense || sense_len < 14)
+      return;
+
+   memset(sense, 0, sense_len);
+
+   /* fixed format, current error */
+   sense[0] = 0x70;
+   sense[2] = key;
+   sense[7] = (unsigned char)(MIN(sense_len, 18) - 8);
+   sense[12] = asc;
+   sense[13] = ascq;
+}
+
+static unsigned cdrom_sim_parse_msf(const char *str)
+{
+   unsigned min = 0;
+   unsigned sec = 0;
+   unsigned frame = 0;
+
+   if (sscanf(str, "%u:%u:%u", &min, &sec, &frame) != 3)
+      return 0;
+
+   return (min * 60 + sec) * 75 + frame;
+}
+
+static bool cdrom_sim_add_file(cdrom_sim_t *sim, const char *path)
+{
+   cdrom_sim_file_t *file = NULL;
+   RFILE *fp = NULL;
+   int64_t size;
+
+   if (sim->num_files >= CDROM_SIM_MAX_FILES)
+      return false;
+
+   fp = filestream_open(path, RETRO_VFS_FILE_ACCESS_READ, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+
+   if (!fp)
+      return false;
+
+   size = filestream_get_size(fp);
+   filestream_close(fp);
+
+   if (size < 0)
+      return false;
+
+   file = &sim->files[sim->num_files++];
+   strlcpy(file->path, path, sizeof(file->path));
+   file->sectors = (unsigned)(size / 2352);
+
+   return true;
+}
+
+static bool cdrom_sim_parse_cue(cdrom_sim_t *sim, const char *cue_path)
+{
+   void *buf = NULL;
+   int64_t len = 0;
+   struct string_list *lines = NULL;
+   unsigned file_base = 0;
+   unsigned shift = 0;
+   unsigned pregap = 0;
+   int index00 = -1;
+   cdrom_sim_track_t *track = NULL;
+   size_t i;
+
+   if (filestream_read_file(cue_path, &buf, &len) <= 0)
+      return false;
+
+   lines = string_split((const char*)buf, "\r\n");
+   free(buf);
+
+   if (!lines)
+      return false;
+
+   for (i = 0; i < lines->size; i++)
+   {
+      const char *word = lines->elems[i].data;
+
+      while (*word == ' ' || *word == '\t')
+         word++;
+
+      if (!strncmp(word, "FILE ", 5))
+      {
+         char name[PATH_MAX_LENGTH] = {0};
+         char path[PATH_MAX_LENGTH] = {0};
+         const char *start = word + 5;
+         const char *end = NULL;
+
+         if (*start == '"')
+            end = strchr(++start, '"');
+         else
+            end = strchr(start, ' ');
+
+         if (!end)
+            end = start + strlen(start);
+
+         strlcpy(name, start, MIN((size_t)(end - start) + 1, sizeof(name)));
+         fill_pathname_resolve_relative(path, cue_path, name, sizeof(path));
+
+         if (sim->num_files)
+            file_base += sim->files[sim->num_files - 1].sectors;
+
+         if (!cdrom_sim_add_file(sim, path))
+            goto error;
+      }
+      else if (!strncmp(word, "TRACK ", 6))
+      {
+         if (!sim->num_files || sim->num_tracks >= CDROM_SIM_MAX_TRACKS)
+            goto error;
+
+         track = &sim->tracks[sim->num_tracks++];
+         track->file = sim->num_files - 1;
+         track->audio = strstr(word, "AUDIO") != NULL;
+         track->mode = strstr(word, "MODE2") ? 2 : 1;
+         index00 = -1;
+      }
+      else if (!strncmp(word, "FLAGS ", 6) && track)
+         track->pre_emphasis = track->audio && strstr(word, " PRE") != NULL;
+      else if (!strncmp(word, "PREGAP ", 7) || !strncmp(word, "POSTGAP ", 8))
+      {
+         /* neither is in the file, a POSTGAP is silence before the next track just like a PREGAP */
+         pregap += cdrom_sim_parse_msf(strchr(word, ' ') + 1);
+      }
+      else if (!strncmp(word, "INDEX ", 6) && track)
+      {
+         unsigned number = 0;
+         char msf[16] = {0};
+         unsigned sector;
+
+         if (sscanf(word + 6, "%u %15s", &number, msf) != 2)
+            continue;
+
+         sector = cdrom_sim_parse_msf(msf);
+
+         if (number == 0)
+            index00 = (int)sector;
+         else if (number == 1)
+         {
+            shift += pregap;
+
+            track->file_sector = index00 >= 0 ? (unsigned)index00 : sector;
+            track->start = 150 + file_base + sector + shift;
+            track->data_start = 150 + file_base + track->file_sector + shift;
+            track->gap_start = track->data_start - pregap;
+
+            pregap = 0;
+         }
+      }
+   }
+
+   if (sim->num_files)
+      file_base += sim->files[sim->num_files - 1].sectors;
+
+   sim->leadout = 150 + file_base + shift + pregap;
+
+   string_list_free(lines);
+
+   return sim->num_tracks > 0;
+
+error:
+   string_list_free(lines);
+
+   return false;
+}
+
+cdrom_sim_t* cdrom_sim_new(const char *path)
+{
+   cdrom_sim_t *sim = NULL;
+
+   if (string_is_empty(path))
+      return NULL;
+
+   sim = (cdrom_sim_t*)calloc(1, sizeof(*sim));
+
+   if (!sim)
+      return NULL;
+
+   if (string_is_equal_noncase(path_get_extension(path), "cue"))
+   {
+      if (!cdrom_sim_parse_cue(sim, path))
+         goto error;
+   }
+   else
+   {
+      cdrom_sim_track_t *track = &sim->tracks[0];
+
+      if (!cdrom_sim_add_file(sim, path))
+         goto error;
+
+      track->gap_start = 150;
+      track->data_start = 150;
+      track->start = 150;
+      track->audio = true;
+
+      sim->num_tracks = 1;
+      sim->leadout = 150 + sim->files[0].sectors;
+   }
+
+   sim->lock = slock_new();
+
+   if (!sim->lock)
+      goto error;
+
+   sim->present = true;
+
+   return sim;
+
+error:
+   free(sim);
+
+   return NULL;
+}
+
+void cdrom_sim_free(cdrom_sim_t *sim)
+{
+   if (!sim)
+      return;
+
+   slock_free(sim->lock);
+   free(sim);
+}
+
+unsigned char cdrom_sim_get_num_tracks(const cdrom_sim_t *sim)
+{
+   return sim ? sim->num_tracks : 0;
+}
+
+void cdrom_sim_set_media(cdrom_sim_t *sim, bool present)
+{
+   if (!sim)
+      return;
+
+   slock_lock(sim->lock);
+
+   if (sim->present != present)
+   {
+      sim->present = present;
+      sim->event = present ? CDROM_MEDIA_EVENT_NEW_MEDIA : CDROM_MEDIA_EVENT_MEDIA_REMOVAL;
+   }
+
+   slock_unlock(sim->lock);
+}
+
+/* the track an address belongs to, its pregap included */
+static const cdrom_sim_track_t* cdrom_sim_find_track(const cdrom_sim_t *sim, unsigned addr)
+{
+   int i;
+
+   for (i = sim->num_tracks - 1; i >= 0; i--)
+   {
+      if (addr >= sim->tracks[i].gap_start)
+         return &sim->tracks[i];
+   }
+
+   return NULL;
+}
+
+static void cdrom_sim_read_sector(cdrom_sim_handle_t *handle, unsigned addr, unsigned char *out)
+{
+   const cdrom_sim_track_t *track = cdrom_sim_find_track(handle->sim, addr);
+   unsigned sector;
+   RFILE *fp;
+
+   memset(out, 0, 2352);
+
+   /* lead-in and pregaps that are not part of the image read as silence */
+   if (!track || addr < track->data_start)
+      return;
+
+   sector = track->file_sector + (addr - track->data_start);
+
+   if (sector >= handle->sim->files[track->file].sectors)
+      return;
+
+   fp = handle->files[track->file];
+
+   if (!fp)
+   {
+      fp = filestream_open(handle->sim->files[track->file].path, RETRO_VFS_FILE_ACCESS_READ, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+      handle->files[track->file] = fp;
+
+      if (!fp)
+         return;
+   }
+
+   if (filestream_seek(fp, (int64_t)sector * 2352, RETRO_VFS_SEEK_POSITION_START) == 0)
+      filestream_read(fp, out, 2352);
+}
+
+static int cdrom_sim_read_cd(cdrom_sim_handle_t *handle, unsigned addr, unsigned count, bool c2, unsigned char *buf, size_t len, unsigned char *sense, size_t sense_len)
+{
+   size_t sector_bytes = 2352 + (c2 ? 294 : 0);
+   unsigned i;
+
+   if (addr + count > handle->sim->leadout)
+   {
+      /* LOGICAL BLOCK ADDRESS OUT OF RANGE */
+      cdrom_sim_set_sense(sense, sense_len, 0x5, 0x21, 0);
+      return 1;
+   }
+
+   count = MIN(count, (unsigned)(len / sector_bytes));
+
+   for (i = 0; i < count; i++)
+   {
+      unsigned char *out = buf + i * sector_bytes;
+
+      cdrom_sim_read_sector(handle, addr + i, out);
+
+      /* an image has no read errors */
+      if (c2)
+         memset(out + 2352, 0, 294);
+   }
+
+   return 0;
+}
+
+/* the Q channel control nibble of a track */
+static unsigned char cdrom_sim_control(const cdrom_sim_track_t *track)
+{
+   if (!track->audio)
+      return 4;
+
+   return track->pre_emphasis ? 1 : 0;
+}
+
+static size_t cdrom_sim_toc_entry(unsigned char *out, unsigned char control, unsigned char point, unsigned char pmin, unsigned char psec, unsigned char pframe)
+{
+   memset(out, 0, 11);
+
+   out[0] = 1;
+   out[1] = (1 << 4) | control;
+   out[3] = point;
+   out[8] = pmin;
+   out[9] = psec;
+   out[10] = pframe;
+
+   return 11;
+}
+
+static size_t cdrom_sim_read_raw_toc(const cdrom_sim_t *sim, unsigned char *out)
+{
+   unsigned char first_control = cdrom_sim_control(&sim->tracks[0]);
+   unsigned char last_control = cdrom_sim_control(&sim->tracks[sim->num_tracks - 1]);
+   unsigned char min, sec, frame;
+   size_t pos = 4;
+   bool xa = false;
+   int i;
+
+   for (i = 0; i < sim->num_tracks; i++)
+   {
+      if (!sim->tracks[i].audio && sim->tracks[i].mode == 2)
+         xa = true;
+   }
+
+   pos += cdrom_sim_toc_entry(out + pos, first_control, 0xA0, 1, xa ? 0x20 : 0, 0);
+   pos += cdrom_sim_toc_entry(out + pos, last_control, 0xA1, sim->num_tracks, 0, 0);
+
+   cdrom_lba_to_msf(sim->leadout, &min, &sec, &frame);
+   pos += cdrom_sim_toc_entry(out + pos, last_control, 0xA2, min, sec, frame);
+
+   for (i = 0; i < sim->num_tracks; i++)
+   {
+      cdrom_lba_to_msf(sim->tracks[i].start, &min, &sec, &frame);
+      pos += cdrom_sim_toc_entry(out + pos, cdrom_sim_control(&sim->tracks[i]), i + 1, min, sec, frame);
+   }
+
+   out[0] = ((pos - 2) >> 8) & 0xFF;
+   out[1] = (pos - 2) & 0xFF;
+   out[2] = 1;
+   out[3] = 1;
+
+   return pos;
+}
+
+static size_t cdrom_sim_read_track_info(const cdrom_sim_t *sim, unsigned char number, unsigned char *out)
+{
+   const cdrom_sim_track_t *track = &sim->tracks[number - 1];
+   unsigned end = number < sim->num_tracks ? sim->tracks[number].start : sim->leadout;
+   /* a drive reports the start as an LBA, which begins at 00:02:00 */
+   unsigned lba = track->start - 150;
+   unsigned size = end - track->start;
+
+   memset(out, 0, 36);
+
+   out[1] = 34;
+   out[2] = number;
+   out[3] = 1;
+   out[5] = cdrom_sim_control(track);
+   out[6] = track->audio ? 0xF : track->mode;
+   out[8] = (lba >> 24) & 0xFF;
+   out[9] = (lba >> 16) & 0xFF;
+   out[10] = (lba >> 8) & 0xFF;
+   out[11] = lba & 0xFF;
+   out[24] = (size >> 24) & 0xFF;
+   out[25] = (size >> 16) & 0xFF;
+   out[26] = (size >> 8) & 0xFF;
+   out[27] = size & 0xFF;
+
+   return 36;
+}
+
+static size_t cdrom_sim_feature(unsigned char *out, unsigned short code, unsigned char add_len)
+{
+   out[0] = (code >> 8) & 0xFF;
+   out[1] = code & 0xFF;
+   /* persistent and current */
+   out[2] = 0x3;
+   out[3] = add_len;
+
+   return 4 + add_len;
+}
+
+static size_t cdrom_sim_get_configuration(const unsigned char *cmd, unsigned char *out)
+{
+   unsigned char rt = cmd[1] & 0x3;
+   unsigned short first = cmd[2] << 8 | cmd[3];
+   static const unsigned short features[] = {0x0, 0x1, 0x1D, 0x1E, 0x107};
+   size_t pos = 8;
+   unsigned i;
+
+   memset(out, 0, 64);
+
+   for (i = 0; i < sizeof(features) / sizeof(features[0]); i++)
+   {
+      unsigned char *feature = out + pos;
+
+      if (rt == 2 ? features[i] != first : features[i] < first)
+         continue;
+
+      switch (features[i])
+      {
+         case 0x0:
+            /* profile list, CD-ROM only */
+            pos += cdrom_sim_feature(feature, features[i], 4);
+            feature[5] = 0x08;
+            feature[6] = 0x1;
+            break;
+         case 0x1:
+            /* core, ATAPI */
+            pos += cdrom_sim_feature(feature, features[i], 8);
+            feature[7] = 0x2;
+            break;
+         case 0x1E:
+            /* CD read with C2 error pointers and CD-Text */
+            pos += cdrom_sim_feature(feature, features[i], 4);
+            feature[4] = 0x3;
+            break;
+         case 0x107:
+            pos += cdrom_sim_feature(feature, features[i], 4);
+            break;
+         default:
+            pos += cdrom_sim_feature(feature, features[i], 0);
+            break;
+      }
+   }
+
+   out[0] = ((pos - 4) >> 24) & 0xFF;
+   out[1] = ((pos - 4) >> 16) & 0xFF;
+   out[2] = ((pos - 4) >> 8) & 0xFF;
+   out[3] = (pos - 4) & 0xFF;
+   out[7] = 0x08;
+
+   return pos;
+}
+
+static size_t cdrom_sim_mode_sense(const cdrom_sim_t *sim, const unsigned char *cmd, unsigned char *out)
+{
+   unsigned char page = cmd[2] & 0x3F;
+   bool changeable = (cmd[2] >> 6) == 1;
+
+   memset(out, 0, 28);
+
+   switch (page)
+   {
+      case 0x08:
+         /* caching, only RCD can be changed */
+         out[8] = 0x08;
+         out[9] = 0x12;
+         out[10] = changeable ? 0x1 : (sim->read_cache_disabled ? 0x1 : 0);
+         break;
+      case 0x1D:
+         /* timeout and protect, group timeouts in seconds */
+         out[8] = 0x1D;
+         out[9] = 0x0A;
+
+         if (!changeable)
+         {
+            out[15] = 10;
+            out[17] = 30;
+            out[19] = 60;
+         }
+         break;
+      default:
+         return 0;
+   }
+
+   out[1] = (unsigned char)(out[9] + 2 + 6);
+
+   return out[9] + 2 + 8;
+}
+
+static void* cdrom_sim_open(void *data, char drive)
+{
+   cdrom_sim_handle_t *handle = (cdrom_sim_handle_t*)calloc(1, sizeof(*handle));
+
+   (void)drive;
+
+   if (!handle)
+      return NULL;
+
+   handle->sim = (cdrom_sim_t*)data;
+
+   return handle;
+}
+
+static void cdrom_sim_close(void *data, void *handle_data)
+{
+   cdrom_sim_handle_t *handle = (cdrom_sim_handle_t*)handle_data;
+   int i;
+
+   (void)data;
+
+   if (!handle)
+      return;
+
+   for (i = 0; i < CDROM_SIM_MAX_FILES; i++)
+   {
+      if (handle->files[i])
+         filestream_close(handle->files[i]);
+   }
+
+   free(handle);
+}
+
+static int cdrom_sim_send(void *data, void *handle_data, CDROM_CMD_Direction dir, void *buf, size_t len, const unsigned char *cmd, size_t cmd_len, unsigned char *sense, size_t sense_len)
+{
+   cdrom_sim_t *sim = (cdrom_sim_t*)data;
+   cdrom_sim_handle_t *handle = (cdrom_sim_handle_t*)handle_data;
+   unsigned char *out = (unsigned char*)buf;
+   unsigned char reply[2352];
+   size_t reply_len = 0;
+   bool present;
+
+   if (!cmd || cmd_len < 6)
+      return 1;
+
+   slock_lock(sim->lock);
+   present = sim->present;
+   slock_unlock(sim->lock);
+
+   memset(reply, 0, sizeof(reply));
+
+   switch (cmd[0])
+   {
+      case 0x00: /* TEST UNIT READY */
+      case 0x43: /* READ TOC/PMA/ATIP */
+      case 0x52: /* READ TRACK INFORMATION */
+      case 0xB9: /* READ CD MSF */
+      case 0xBE: /* READ CD */
+         if (!present)
+         {
+            /* MEDIUM NOT PRESENT */
+            cdrom_sim_set_sense(sense, sense_len, 0x2, 0x3A, 0);
+            return 1;
+         }
+         break;
+      default:
+         break;
+   }
+
+   switch (cmd[0])
+   {
+      case 0x00: /* TEST UNIT READY */
+      case 0x1E: /* PREVENT ALLOW MEDIUM REMOVAL */
+      case 0xBB: /* SET CD SPEED */
+         return 0;
+      case 0x03: /* REQUEST SENSE */
+         cdrom_sim_set_sense(reply, 18, 0, 0, 0);
+         reply_len = 18;
+         break;
+      case 0x12: /* INQUIRY */
+         if (cmd[1] & 0x1)
+         {
+            static const char serial[] = "REDBOOKSIM0001";
+
+            if (cmd[2] != 0x80)
+               goto illegal;
+
+            reply[1] = 0x80;
+            reply[3] = sizeof(serial) - 1;
+            memcpy(reply + 4, serial, sizeof(serial) - 1);
+            reply_len = 4 + sizeof(serial) - 1;
+         }
+         else
+         {
+            reply[0] = 5;
+            reply[1] = 0x80;
+            reply[2] = 5;
+            reply[3] = 2;
+            reply[4] = 31;
+            memcpy(reply + 8, "REDBOOK ", 8);
+            memcpy(reply + 16, "VIRTUAL CD-ROM  ", 16);
+            memcpy(reply + 32, "1.0 ", 4);
+            reply_len = 36;
+         }
+         break;
+      case 0x1B: /* START STOP UNIT */
+         /* LoEj moves the tray */
+         if (cmd[4] & 0x2)
+            cdrom_sim_set_media(sim, (cmd[4] & 0x1) != 0);
+         return 0;
+      case 0x43: /* READ TOC/PMA/ATIP */
+         /* only the raw TOC, there is no ATIP on a pressed disc */
+         if ((cmd[2] & 0xF) != 0x2)
+            goto illegal;
+
+         reply_len = cdrom_sim_read_raw_toc(sim, reply);
+         break;
+      case 0x46: /* GET CONFIGURATION */
+         reply_len = cdrom_sim_get_configuration(cmd, reply);
+         break;
+      case 0x4A: /* GET EVENT STATUS NOTIFICATION */
+         if (!(cmd[1] & 0x1) || !(cmd[4] & 0x10))
+            goto illegal;
+
+         slock_lock(sim->lock);
+         reply[4] = (unsigned char)sim->event;
+         reply[5] = sim->present ? 0x2 : 0x1;
+         sim->event = CDROM_MEDIA_EVENT_NONE;
+         slock_unlock(sim->lock);
+
+         reply[1] = 6;
+         reply[2] = 4;
+         reply[3] = 0x10;
+         reply_len = 8;
+         break;
+      case 0x52: /* READ TRACK INFORMATION */
+      {
+         unsigned number = cmd[2] << 24 | cmd[3] << 16 | cmd[4] << 8 | cmd[5];
+
+         if ((cmd[1] & 0x3) != 1 || number < 1 || number > sim->num_tracks)
+            goto illegal;
+
+         reply_len = cdrom_sim_read_track_info(sim, (unsigned char)number, reply);
+         break;
+      }
+      case 0x55: /* MODE SELECT (10) */
+         if (dir == DIRECTION_OUT && out && len >= 11 && (out[8] & 0x3F) == 0x08)
+            sim->read_cache_disabled = (out[10] & 0x1) != 0;
+         return 0;
+      case 0x5A: /* MODE SENSE (10) */
+         reply_len = cdrom_sim_mode_sense(sim, cmd, reply);
+
+         if (!reply_len)
+            goto illegal;
+         break;
+      case 0xB9: /* READ CD MSF, the end is exclusive */
+      {
+         unsigned start = cdrom_msf_to_lba(cmd[3], cmd[4], cmd[5]);
+         unsigned end = cdrom_msf_to_lba(cmd[6], cmd[7], cmd[8]);
+
+         if (cmd_len < 10 || end < start)
+            goto illegal;
+
+         return cdrom_sim_read_cd(handle, start, end - start, ((cmd[9] >> 1) & 0x3) == 1, out, len, sense, sense_len);
+      }
+      case 0xBE: /* READ CD, by LBA which starts at MSF 00:02:00 */
+      {
+         unsigned lba = cmd[2] << 24 | cmd[3] << 16 | cmd[4] << 8 | cmd[5];
+         unsigned count = cmd[6] << 16 | cmd[7] << 8 | cmd[8];
+
+         if (cmd_len < 10)
+            goto illegal;
+
+         return cdrom_sim_read_cd(handle, lba + 150, count, ((cmd[9] >> 1) & 0x3) == 1, out, len, sense, sense_len);
+      }
+      default:
+         /* INVALID COMMAND OPERATION CODE */
+         cdrom_sim_set_sense(sense, sense_len, 0x5, 0x20, 0);
+         return 1;
+   }
+
+   if (out && len)
+      memcpy(out, reply, MIN(len, reply_len));
+
+   return 0;
+
+illegal:
+   /* INVALID FIELD IN CDB */
+   cdrom_sim_set_sense(sense, sense_len, 0x5, 0x24, 0);
+   return 1;
+}
+
+void cdrom_sim_get_transport(cdrom_sim_t *sim, cdrom_transport_t *transport)
+{
+   if (!transport)
+      return;
+
+   transport->open = cdrom_sim_open;
+   transport->close = cdrom_sim_close;
+   transport->send = cdrom_sim_send;
+   transport->data = sim;
+   transport->max_transfer_bytes = CDROM_SIM_MAX_TRANSFER_BYTES;
+}
@@ -0,0 +1,530 @@
+/* Copyright  (C) 2010-2019 The RetroArch team
+*
+* ---------------------------------------------------------------------------------------
+* The following license statement only applies to this file (cdrom_trace.c).
+* ---------------------------------------------------------------------------------------
+*
+* Permission is hereby granted, free of charge,
+* to any person obtaining a copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+* and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+* INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+* IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+* WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cdrom/cdrom_trace.h>
+#include <compat/strl.h>
+#include <retro_miscellaneous.h>
+#include <features/features_cpu.h>
+#include <streams/file_stream.h>
+#include <retro_atomic.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#if defined(_MSC_VER)
+#define CDROM_TRACE_TLS __declspec(thread)
+#else
+#define CDROM_TRACE_TLS __thread
+#endif
+
+#define CDROM_TRACE_RING_RECORDS 1024 /* power of two */
+#define CDROM_TRACE_MAX_RINGS 32
+#define CDROM_TRACE_MAX_KEYS 32
+
+/* Log-linear buckets in the style of HdrHistogram: exact below 64 us,
+ * above that 32 sub-buckets per power of two, so about 3% precision up to 2^32 us. */
+#define CDROM_TRACE_SUB_BUCKETS 32
+#define CDROM_TRACE_LINEAR_LIMIT (CDROM_TRACE_SUB_BUCKETS * 2)
+#define CDROM_TRACE_BUCKETS (CDROM_TRACE_LINEAR_LIMIT + (32 - 6) * CDROM_TRACE_SUB_BUCKETS)
+
+typedef struct
+{
+   cdrom_trace_record_t records[CDROM_TRACE_RING_RECORDS];
+   volatile uint32_t head;      /* only moved by the thread the ring belongs to, once a record is written */
+   volatile long in_use;
+} cdrom_trace_ring_t;
+
+typedef struct
+{
+   uint32_t buckets[CDROM_TRACE_BUCKETS];
+   volatile uint32_t max_usec;
+   unsigned char opcode;
+   char drive;
+} cdrom_trace_histogram_t;
+
+static volatile long cdrom_trace_enabled = 1;
+
+static cdrom_trace_ring_t *cdrom_trace_rings[CDROM_TRACE_MAX_RINGS];
+static retro_spinlock_t cdrom_trace_rings_lock = 0;
+static CDROM_TRACE_TLS cdrom_trace_ring_t *cdrom_trace_ring_self = NULL;
+static CDROM_TRACE_TLS int cdrom_trace_ring_index = -1;
+
+static cdrom_trace_histogram_t cdrom_trace_histograms[CDROM_TRACE_MAX_KEYS];
+static volatile uint32_t cdrom_trace_num_histograms = 0;
+static retro_spinlock_t cdrom_trace_histograms_lock = 0;
+
+#ifndef _WIN32
+static pthread_key_t cdrom_trace_ring_key;
+static pthread_once_t cdrom_trace_ring_key_once = PTHREAD_ONCE_INIT;
+
+/* a thread that exits gives its ring back, the records stay readable until the ring is reused */
+static void cdrom_trace_ring_release(void *data)
+{
+   cdrom_trace_ring_t *ring = (cdrom_trace_ring_t*)data;
+
+   RETRO_ATOMIC_STORE_RELEASE(&ring->in_use, 0);
+}
+
+static void cdrom_trace_ring_key_init(void)
+{
+   pthread_key_create(&cdrom_trace_ring_key, cdrom_trace_ring_release);
+}
+#endif
+
+static cdrom_trace_ring_t* cdrom_trace_ring_get(void)
+{
+   unsigned i;
+
+   if (cdrom_trace_ring_self)
+      return cdrom_trace_ring_self;
+
+   /* already found the pool exhausted */
+   if (cdrom_trace_ring_index == -2)
+      return NULL;
+
+#ifndef _WIN32
+   pthread_once(&cdrom_trace_ring_key_once, cdrom_trace_ring_key_init);
+#endif
+
+   retro_spinlock_lock(&cdrom_trace_rings_lock);
+
+   for (i = 0; i < CDROM_TRACE_MAX_RINGS; i++)
+   {
+      if (!cdrom_trace_rings[i])
+      {
+         cdrom_trace_rings[i] = (cdrom_trace_ring_t*)calloc(1, sizeof(cdrom_trace_ring_t));
+
+         if (!cdrom_trace_rings[i])
+            break;
+      }
+
+      if (!RETRO_ATOMIC_LOAD_ACQUIRE(&cdrom_trace_rings[i]->in_use))
+      {
+         RETRO_ATOMIC_STORE_RELEASE(&cdrom_trace_rings[i]->in_use, 1);
+         cdrom_trace_ring_self = cdrom_trace_rings[i];
+         cdrom_trace_ring_index = i;
+         break;
+      }
+   }
+
+   retro_spinlock_unlock(&cdrom_trace_rings_lock);
+
+   if (!cdrom_trace_ring_self)
+   {
+      cdrom_trace_ring_index = -2;
+      return NULL;
+   }
+
+#ifndef _WIN32
+   pthread_setspecific(cdrom_trace_ring_key, cdrom_trace_ring_self);
+#endif
+
+   return cdrom_trace_ring_self;
+}
+
+static unsigned cdrom_trace_bucket(uint32_t usec)
+{
+   unsigned msb = 0;
+   unsigned shift;
+
+   if (usec < CDROM_TRACE_LINEAR_LIMIT)
+      return usec;
+
+   while ((usec >> msb) > 1)
+      msb++;
+
+   /* keep the top 6 bits, the leading one selects the power of two */
+   shift = msb - 5;
+
+   return CDROM_TRACE_LINEAR_LIMIT + (shift - 1) * CDROM_TRACE_SUB_BUCKETS + ((usec >> shift) - CDROM_TRACE_SUB_BUCKETS);
+}
+
+/* highest value that lands in the bucket */
+static uint32_t cdrom_trace_bucket_value(unsigned bucket)
+{
+   unsigned shift;
+   uint64_t mantissa;
+
+   if (bucket < CDROM_TRACE_LINEAR_LIMIT)
+      return bucket;
+
+   shift = (bucket - CDROM_TRACE_LINEAR_LIMIT) / CDROM_TRACE_SUB_BUCKETS + 1;
+   mantissa = (bucket - CDROM_TRACE_LINEAR_LIMIT) % CDROM_TRACE_SUB_BUCKETS + CDROM_TRACE_SUB_BUCKETS;
+
+   return (uint32_t)(((mantissa + 1) << shift) - 1);
+}
+
+static cdrom_trace_histogram_t* cdrom_trace_histogram_get(char drive, unsigned char opcode, bool create)
+{
+   cdrom_trace_histogram_t *histogram = NULL;
+   /* pairs with the release once a key is filled in, so every key below count is complete */
+   uint32_t count = RETRO_ATOMIC_LOAD_ACQUIRE(&cdrom_trace_num_histograms);
+   unsigned i;
+
+   for (i = 0; i < count; i++)
+   {
+      if (cdrom_trace_histograms[i].drive == drive && cdrom_trace_histograms[i].opcode == opcode)
+         return &cdrom_trace_histograms[i];
+   }
+
+   if (!create)
+      return NULL;
+
+   retro_spinlock_lock(&cdrom_trace_histograms_lock);
+
+   /* someone else may have added it meanwhile */
+   for (i = 0; i < cdrom_trace_num_histograms; i++)
+   {
+      if (cdrom_trace_histograms[i].drive == drive && cdrom_trace_histograms[i].opcode == opcode)
+         histogram = &cdrom_trace_histograms[i];
+   }
+
+   if (!histogram && cdrom_trace_num_histograms < CDROM_TRACE_MAX_KEYS)
+   {
+      histogram = &cdrom_trace_histograms[cdrom_trace_num_histograms];
+      histogram->drive = drive;
+      histogram->opcode = opcode;
+
+      /* publish the key only once it is filled in */
+      RETRO_ATOMIC_STORE_RELEASE(&cdrom_trace_num_histograms, cdrom_trace_num_histograms + 1);
+   }
+
+   retro_spinlock_unlock(&cdrom_trace_histograms_lock);
+
+   return histogram;
+}
+
+/* start and length of the commands that address sectors */
+static void cdrom_trace_cdb_extent(const unsigned char *cmd, uint32_t *lba, uint32_t *sectors)
+{
+   *lba = 0;
+   *sectors = 0;
+
+   switch (cmd[0])
+   {
+      case 0x28: /* READ (10) */
+         *lba = ((uint32_t)cmd[2] << 24) | ((uint32_t)cmd[3] << 16) | ((uint32_t)cmd[4] << 8) | cmd[5];
+         *sectors = ((uint32_t)cmd[7] << 8) | cmd[8];
+         break;
+      case 0xA8: /* READ (12) */
+         *lba = ((uint32_t)cmd[2] << 24) | ((uint32_t)cmd[3] << 16) | ((uint32_t)cmd[4] << 8) | cmd[5];
+         *sectors = ((uint32_t)cmd[6] << 24) | ((uint32_t)cmd[7] << 16) | ((uint32_t)cmd[8] << 8) | cmd[9];
+         break;
+      case 0xBE: /* READ CD */
+         *lba = ((uint32_t)cmd[2] << 24) | ((uint32_t)cmd[3] << 16) | ((uint32_t)cmd[4] << 8) | cmd[5];
+         *sectors = ((uint32_t)cmd[6] << 16) | ((uint32_t)cmd[7] << 8) | cmd[8];
+         break;
+      case 0xB9: /* READ CD MSF, the end address is exclusive */
+      {
+         uint32_t start = (cmd[3] * 60 + cmd[4]) * 75 + cmd[5];
+         uint32_t end = (cmd[6] * 60 + cmd[7]) * 75 + cmd[8];
+
+         *lba = start >= 150 ? start - 150 : 0;
+         *sectors = end > start ? end - start : 0;
+         break;
+      }
+      default:
+         break;
+   }
+}
+
+static const char* cdrom_trace_opcode_name(unsigned char opcode)
+{
+   switch (opcode)
+   {
+      case 0x00: return "TEST UNIT READY";
+      case 0x12: return "INQUIRY";
+      case 0x1B: return "START STOP UNIT";
+      case 0x1E: return "PREVENT ALLOW REMOVAL";
+      case 0x28: return "READ (10)";
+      case 0x43: return "READ TOC";
+      case 0x46: return "GET CONFIGURATION";
+      case 0x4A: return "GET EVENT STATUS";
+      case 0x52: return "READ TRACK INFO";
+      case 0x55: return "MODE SELECT";
+      case 0x5A: return "MODE SENSE";
+      case 0xA8: return "READ (12)";
+      case 0xB9: return "READ CD MSF";
+      case 0xBB: return "SET CD SPEED";
+      case 0xBE: return "READ CD";
+      default:
+         break;
+   }
+
+   return "";
+}
+
+void cdrom_trace_set_enabled(bool enabled)
+{
+   RETRO_ATOMIC_STORE_RELEASE(&cdrom_trace_enabled, enabled ? 1 : 0);
+}
+
+bool cdrom_trace_is_enabled(void)
+{
+   return RETRO_ATOMIC_LOAD_ACQUIRE(&cdrom_trace_enabled) != 0;
+}
+
+uint64_t cdrom_trace_begin(void)
+{
+   if (!RETRO_ATOMIC_LOAD_ACQUIRE(&cdrom_trace_enabled))
+      return 0;
+
+   return (uint64_t)cpu_features_get_time_usec();
+}
+
+void cdrom_trace_end(uint64_t start_usec, char drive, const unsigned char *cmd, int status, const unsigned char *sense, unsigned retries)
+{
+   uint64_t now;
+   uint32_t latency;
+   uint32_t old_max;
+   cdrom_trace_histogram_t *histogram;
+   cdrom_trace_ring_t *ring;
+
+   if (!start_usec)
+      return;
+
+   now = (uint64_t)cpu_features_get_time_usec();
+   latency = now > start_usec ? (uint32_t)MIN(now - start_usec, 0xFFFFFFFFu) : 0;
+
+   histogram = cdrom_trace_histogram_get(drive, cmd[0], true);
+
+   if (histogram)
+   {
+      RETRO_ATOMIC_INC(&histogram->buckets[cdrom_trace_bucket(latency)]);
+
+      do
+      {
+         old_max = RETRO_ATOMIC_LOAD_ACQUIRE(&histogram->max_usec);
+      } while (latency > old_max && !RETRO_ATOMIC_CAS(&histogram->max_usec, old_max, latency));
+   }
+
+   ring = cdrom_trace_ring_get();
+
+   if (ring)
+   {
+      cdrom_trace_record_t *record = &ring->records[ring->head & (CDROM_TRACE_RING_RECORDS - 1)];
+
+      cdrom_trace_cdb_extent(cmd, &record->lba, &record->sectors);
+
+      record->time_usec = start_usec;
+      record->latency_usec = latency;
+      record->thread = (uint16_t)cdrom_trace_ring_index;
+      record->opcode = cmd[0];
+      record->drive = (uint8_t)drive;
+      record->status = (uint8_t)(status != 0);
+      record->retries = (uint8_t)MIN(retries, 255);
+      record->sense_key = (status && sense) ? sense[2] & 0xF : 0;
+      record->asc = (status && sense) ? sense[12] : 0;
+      record->ascq = (status && sense) ? sense[13] : 0;
+      memset(record->reserved, 0, sizeof(record->reserved));
+
+      /* the record is complete before it becomes visible to a dump */
+      RETRO_ATOMIC_STORE_RELEASE(&ring->head, ring->head + 1);
+   }
+}
+
+bool cdrom_trace_get_latency(char drive, unsigned char opcode, cdrom_trace_latency_t *latency)
+{
+   cdrom_trace_histogram_t *histogram = cdrom_trace_histogram_get(drive, opcode, false);
+   uint32_t buckets[CDROM_TRACE_BUCKETS];
+   uint64_t p50_count, p99_count, p999_count;
+   uint64_t seen = 0;
+   unsigned i;
+
+   memset(latency, 0, sizeof(*latency));
+
+   if (!histogram)
+      return false;
+
+   /* work on a copy so the percentiles agree with each other while commands keep coming in */
+   for (i = 0; i < CDROM_TRACE_BUCKETS; i++)
+   {
+      buckets[i] = RETRO_ATOMIC_LOAD_ACQUIRE(&histogram->buckets[i]);
+      latency->count += buckets[i];
+   }
+
+   if (!latency->count)
+      return false;
+
+   p50_count = (latency->count * 500 + 999) / 1000;
+   p99_count = (latency->count * 990 + 999) / 1000;
+   p999_count = (latency->count * 999 + 999) / 1000;
+
+   for (i = 0; i < CDROM_TRACE_BUCKETS; i++)
+   {
+      if (!buckets[i])
+         continue;
+
+      seen += buckets[i];
+
+      if (!latency->p50_usec && seen >= p50_count)
+         latency->p50_usec = cdrom_trace_bucket_value(i);
+      if (!latency->p99_usec && seen >= p99_count)
+         latency->p99_usec = cdrom_trace_bucket_value(i);
+      if (!latency->p999_usec && seen >= p999_count)
+      {
+         latency->p999_usec = cdrom_trace_bucket_value(i);
+         break;
+      }
+   }
+
+   latency->max_usec = RETRO_ATOMIC_LOAD_ACQUIRE(&histogram->max_usec);
+
+   /* the bucket bound can overshoot the largest sample */
+   latency->p50_usec = MIN(latency->p50_usec, latency->max_usec);
+   latency->p99_usec = MIN(latency->p99_usec, latency->max_usec);
+   latency->p999_usec = MIN(latency->p999_usec, latency->max_usec);
+
+   return true;
+}
+
+size_t cdrom_trace_summary(char *buf, size_t len)
+{
+   uint32_t count = RETRO_ATOMIC_LOAD_ACQUIRE(&cdrom_trace_num_histograms);
+   size_t pos = 0;
+   unsigned i;
+
+   if (!buf || !len)
+      return 0;
+
+   buf[0] = '\0';
+
+   for (i = 0; i < count && pos < len; i++)
+   {
+      cdrom_trace_latency_t latency;
+      int written;
+
+      if (!cdrom_trace_get_latency(cdrom_trace_histograms[i].drive, cdrom_trace_histograms[i].opcode, &latency))
+         continue;
+
+      written = snprintf(buf + pos, len - pos, "drive %c %02X %-21s %8llu cmds  p50 %8u us  p99 %8u us  p999 %8u us  max %8u us\n",
+            cdrom_trace_histograms[i].drive ? cdrom_trace_histograms[i].drive : '?',
+            (unsigned)cdrom_trace_histograms[i].opcode,
+            cdrom_trace_opcode_name(cdrom_trace_histograms[i].opcode),
+            (unsigned long long)latency.count,
+            (unsigned)latency.p50_usec, (unsigned)latency.p99_usec, (unsigned)latency.p999_usec, (unsigned)latency.max_usec);
+
+      if (written < 0)
+         break;
+
+      pos += MIN((size_t)written, len - pos - 1);
+   }
+
+   return pos;
+}
+
+static int cdrom_trace_record_compare(const void *a, const void *b)
+{
+   const cdrom_trace_record_t *record_a = (const cdrom_trace_record_t*)a;
+   const cdrom_trace_record_t *record_b = (const cdrom_trace_record_t*)b;
+
+   if (record_a->time_usec < record_b->time_usec)
+      return -1;
+
+   return record_a->time_usec > record_b->time_usec;
+}
+
+int cdrom_trace_dump(const char *path)
+{
+   cdrom_trace_file_header_t header = {{0}};
+   cdrom_trace_record_t *records = (cdrom_trace_record_t*)malloc(CDROM_TRACE_MAX_RINGS * CDROM_TRACE_RING_RECORDS * sizeof(cdrom_trace_record_t));
+   uint32_t count = 0;
+   RFILE *file;
+   unsigned i;
+   int rv = 0;
+
+   if (!records)
+      return 1;
+
+   retro_spinlock_lock(&cdrom_trace_rings_lock);
+
+   for (i = 0; i < CDROM_TRACE_MAX_RINGS; i++)
+   {
+      cdrom_trace_ring_t *ring = cdrom_trace_rings[i];
+      uint32_t head;
+      uint32_t first;
+      uint32_t j;
+
+      if (!ring)
+         continue;
+
+      /* pairs with the release after the record at head - 1 was written */
+      head = RETRO_ATOMIC_LOAD_ACQUIRE(&ring->head);
+
+      first = head > CDROM_TRACE_RING_RECORDS ? head - CDROM_TRACE_RING_RECORDS : 0;
+
+      for (j = first; j < head; j++)
+         records[count++] = ring->records[j & (CDROM_TRACE_RING_RECORDS - 1)];
+   }
+
+   retro_spinlock_unlock(&cdrom_trace_rings_lock);
+
+   qsort(records, count, sizeof(*records), cdrom_trace_record_compare);
+
+   memcpy(header.magic, CDROM_TRACE_MAGIC, sizeof(header.magic));
+   header.version = CDROM_TRACE_VERSION;
+   header.record_size = sizeof(cdrom_trace_record_t);
+   header.count = count;
+
+   file = filestream_open(path, RETRO_VFS_FILE_ACCESS_WRITE, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+
+   if (!file)
+   {
+      free(records);
+      return 1;
+   }
+
+   if (filestream_write(file, &header, sizeof(header)) != sizeof(header))
+      rv = 1;
+   else if (count && filestream_write(file, records, count * sizeof(*records)) != (int64_t)(count * sizeof(*records)))
+      rv = 1;
+
+   filestream_close(file);
+   free(records);
+
+   return rv;
+}
+
+void cdrom_trace_reset(void)
+{
+   unsigned i;
+
+   retro_spinlock_lock(&cdrom_trace_rings_lock);
+
+   for (i = 0; i < CDROM_TRACE_MAX_RINGS; i++)
+   {
+      if (cdrom_trace_rings[i])
+         RETRO_ATOMIC_STORE_RELEASE(&cdrom_trace_rings[i]->head, 0);
+   }
+
+   retro_spinlock_unlock(&cdrom_trace_rings_lock);
+
+   retro_spinlock_lock(&cdrom_trace_histograms_lock);
+   RETRO_ATOMIC_STORE_RELEASE(&cdrom_trace_num_histograms, 0);
+   memset(cdrom_trace_histograms, 0, sizeof(cdrom_trace_histograms));
+   retro_spinlock_unlock(&cdrom_trace_histograms_lock);
+}
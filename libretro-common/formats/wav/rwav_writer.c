@@ -0,0 +1,161 @@
+/* Copyright  (C) 2010-2019 The RetroArch team
+ *
+ * ---------------------------------------------------------------------------------------
+ * The following license statement only applies to this file (rwav_writer.c).
+ * ---------------------------------------------------------------------------------------
+ *
+ * Permission is hereby granted, free of charge,
+ * to any person obtaining a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <formats/rwav.h>
+#include <streams/file_stream.h>
+
+#define RWAV_HEADER_SIZE 44
+
+struct rwav_writer
+{
+   RFILE *file;
+   unsigned samplerate;
+   unsigned numchannels;
+   unsigned bitspersample;
+   uint64_t data_bytes;
+   bool error;
+};
+
+static void rwav_put_le16(uint8_t *p, unsigned v)
+{
+   p[0] = (uint8_t)(v & 0xff);
+   p[1] = (uint8_t)((v >> 8) & 0xff);
+}
+
+static void rwav_put_le32(uint8_t *p, uint32_t v)
+{
+   p[0] = (uint8_t)(v & 0xff);
+   p[1] = (uint8_t)((v >> 8) & 0xff);
+   p[2] = (uint8_t)((v >> 16) & 0xff);
+   p[3] = (uint8_t)((v >> 24) & 0xff);
+}
+
+/* the canonical 44 byte header of a PCM wave file with data_bytes of samples, the RIFF size counts the pad byte
+ * an odd sized data chunk is followed by */
+static bool rwav_writer_header(rwav_writer_t *writer, uint32_t data_bytes)
+{
+   uint8_t header[RWAV_HEADER_SIZE];
+   unsigned block_align = writer->numchannels * writer->bitspersample / 8;
+
+   memcpy(header, "RIFF", 4);
+   rwav_put_le32(header + 4, 36 + data_bytes + (data_bytes & 1));
+   memcpy(header + 8, "WAVE", 4);
+   memcpy(header + 12, "fmt ", 4);
+   rwav_put_le32(header + 16, 16);
+   rwav_put_le16(header + 20, 1); /* PCM */
+   rwav_put_le16(header + 22, writer->numchannels);
+   rwav_put_le32(header + 24, writer->samplerate);
+   rwav_put_le32(header + 28, writer->samplerate * block_align);
+   rwav_put_le16(header + 32, block_align);
+   rwav_put_le16(header + 34, writer->bitspersample);
+   memcpy(header + 36, "data", 4);
+   rwav_put_le32(header + 40, data_bytes);
+
+   return filestream_write(writer->file, header, sizeof(header)) == sizeof(header);
+}
+
+rwav_writer_t* rwav_writer_open(const char *path, unsigned samplerate,
+      unsigned numchannels, unsigned bitspersample)
+{
+   rwav_writer_t *writer = NULL;
+
+   if (!numchannels || (bitspersample != 8 && bitspersample != 16))
+      return NULL;
+
+   writer = (rwav_writer_t*)calloc(1, sizeof(*writer));
+
+   if (!writer)
+      return NULL;
+
+   writer->samplerate    = samplerate;
+   writer->numchannels   = numchannels;
+   writer->bitspersample = bitspersample;
+   writer->file          = filestream_open(path,
+         RETRO_VFS_FILE_ACCESS_WRITE, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+
+   /* the sizes are not known yet, rwav_writer_close() fills them in */
+   if (!writer->file || !rwav_writer_header(writer, 0))
+   {
+      if (writer->file)
+         filestream_close(writer->file);
+      free(writer);
+      return NULL;
+   }
+
+   return writer;
+}
+
+bool rwav_writer_write(rwav_writer_t *writer, const void *samples, size_t size)
+{
+   if (writer->error)
+      return false;
+
+   /* the sizes in the header are 32 bits */
+   if (writer->data_bytes + size > 0xffffffffu - 36 - 1 ||
+         filestream_write(writer->file, samples, (int64_t)size) != (int64_t)size)
+   {
+      writer->error = true;
+      return false;
+   }
+
+   writer->data_bytes += size;
+
+   return true;
+}
+
+uint64_t rwav_writer_get_size(const rwav_writer_t *writer)
+{
+   return writer->data_bytes;
+}
+
+bool rwav_writer_close(rwav_writer_t *writer)
+{
+   bool ok;
+
+   if (!writer)
+      return false;
+
+   ok = !writer->error;
+
+   /* an odd sized data chunk is padded to an even size */
+   if (ok && (writer->data_bytes & 1))
+   {
+      uint8_t pad = 0;
+      ok = filestream_write(writer->file, &pad, 1) == 1;
+   }
+
+   if (ok)
+      ok = filestream_seek(writer->file, 0, RETRO_VFS_SEEK_POSITION_START) == 0 &&
+            rwav_writer_header(writer, (uint32_t)writer->data_bytes);
+
+   if (filestream_close(writer->file) != 0)
+      ok = false;
+
+   free(writer);
+
+   return ok;
+}
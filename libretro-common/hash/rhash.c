@@ -31,6 +31,49 @@
 #include <retro_miscellaneous.h>
 #include <retro_endianness.h>
 #include <streams/file_stream.h>
+#include <encodings/crc32.h>
+
+/* The SHA-NI and ARMv8 SHA2 paths are compiled for those instructions whatever the
+ * build targets, and only taken once the CPU was found to have them. */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SHA256_HAVE_SHANI
+#define SHA256_TARGET_SHANI __attribute__((target("sha,sse4.1,ssse3")))
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(_M_X64)
+#define SHA256_HAVE_SHANI
+#define SHA256_TARGET_SHANI
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SHA256_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__aarch64__) && !defined(__AARCH64EB__)
+#if defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO)
+#define SHA256_HAVE_ARMV8
+#define SHA256_TARGET_ARMV8
+#elif defined(__clang__) && defined(__linux__)
+#define SHA256_HAVE_ARMV8
+#define SHA256_TARGET_ARMV8 __attribute__((target("crypto")))
+#elif defined(__GNUC__) && defined(__linux__)
+#define SHA256_HAVE_ARMV8
+#define SHA256_TARGET_ARMV8 __attribute__((target("+crypto")))
+#endif
+#endif
+
+#ifdef SHA256_HAVE_ARMV8
+#include <arm_neon.h>
+#if !defined(__ARM_FEATURE_SHA2) && !defined(__ARM_FEATURE_CRYPTO)
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+#endif
+#endif
 
 #define LSL32(x, n) ((uint32_t)(x) << (n))
 #define LSR32(x, n) ((uint32_t)(x) >> (n))
@@ -53,7 +96,24 @@ static const uint32_t T_K[64] = {
    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
 };
 
-/* SHA256 implementation from bSNES. Written by valditx. */
+/* SHA256 implementation from bSNES. Written by valditx.
+ * Blocks go through the fastest compression function the CPU has, see sha256_set_impl(). */
+
+typedef void (*sha256_compress_t)(uint32_t *h, const uint8_t *blocks, size_t count);
+
+/* compresses the blocks of several messages side by side, h[i] and blocks[i] being those of message i */
+typedef void (*sha256_compress_multi_t)(uint32_t **h, const uint8_t **blocks, size_t count);
+
+struct sha256_variant
+{
+   enum sha256_impl impl;
+   sha256_compress_t compress;
+   /* NULL if hashing the messages one after another is as fast */
+   sha256_compress_multi_t compress_multi;
+   unsigned lanes;
+};
+
+#define SHA256_MAX_LANES 4
 
 struct sha256_ctx
 {
@@ -64,72 +124,490 @@ struct sha256_ctx
    } in;
    unsigned inlen;
 
-   uint32_t w[64];
    uint32_t h[8];
    uint64_t len;
+   sha256_compress_t compress;
 };
 
-static void sha256_init(struct sha256_ctx *p)
+static uint32_t sha256_load32be(const uint8_t *p)
 {
-   memset(p, 0, sizeof(struct sha256_ctx));
-   memcpy(p->h, T_H, sizeof(T_H));
+   return LSL32(p[0], 24) | LSL32(p[1], 16) | LSL32(p[2], 8) | p[3];
 }
 
-static void sha256_block(struct sha256_ctx *p)
+static void sha256_compress_scalar(uint32_t *state, const uint8_t *blocks, size_t count)
+{
+   uint32_t w[64];
+
+   while (count--)
+   {
+      unsigned i;
+      uint32_t s0, s1;
+      uint32_t a, b, c, d, e, f, g, h;
+
+      for (i = 0; i < 16; i++)
+         w[i] = sha256_load32be(blocks + i * 4);
+
+      for (i = 16; i < 64; i++)
+      {
+         s0 = ROR32(w[i - 15],  7) ^ ROR32(w[i - 15], 18) ^ LSR32(w[i - 15],  3);
+         s1 = ROR32(w[i -  2], 17) ^ ROR32(w[i -  2], 19) ^ LSR32(w[i -  2], 10);
+         w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+      }
+
+      a = state[0]; b = state[1]; c = state[2]; d = state[3];
+      e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+      for (i = 0; i < 64; i++)
+      {
+         uint32_t t1, t2, maj, ch;
+
+         s0 = ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22);
+         maj = (a & b) ^ (a & c) ^ (b & c);
+         t2  = s0 + maj;
+         s1  = ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25);
+         ch  = (e & f) ^ (~e & g);
+         t1  = h + s1 + ch + T_K[i] + w[i];
+
+         h   = g;
+         g   = f;
+         f   = e;
+         e   = d + t1;
+         d   = c;
+         c   = b;
+         b   = a;
+         a   = t1 + t2;
+      }
+
+      state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+      state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+
+      /* Next block */
+      blocks += 64;
+   }
+}
+
+#ifdef SHA256_HAVE_SSE2
+#define SHA256_SSE2_ROR(x, n) _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - (n)))
+
+/* the scalar rounds on four messages at once, one to each 32-bit lane */
+static void sha256_compress_sse2_x4(uint32_t **state, const uint8_t **blocks, size_t count)
 {
    unsigned i;
-   uint32_t s0, s1;
-   uint32_t a, b, c, d, e, f, g, h;
+   size_t offset;
+   __m128i s[8];
+   __m128i w[16];
+
+   for (i = 0; i < 8; i++)
+      s[i] = _mm_setr_epi32((int)state[0][i], (int)state[1][i], (int)state[2][i], (int)state[3][i]);
+
+   for (offset = 0; offset < count * 64; offset += 64)
+   {
+      __m128i a = s[0], b = s[1], c = s[2], d = s[3];
+      __m128i e = s[4], f = s[5], g = s[6], h = s[7];
+
+      for (i = 0; i < 64; i++)
+      {
+         __m128i s0, s1, t1, t2, maj, ch;
+
+         if (i < 16)
+            w[i] = _mm_setr_epi32(
+                  (int)sha256_load32be(blocks[0] + offset + i * 4),
+                  (int)sha256_load32be(blocks[1] + offset + i * 4),
+                  (int)sha256_load32be(blocks[2] + offset + i * 4),
+                  (int)sha256_load32be(blocks[3] + offset + i * 4));
+         else
+         {
+            __m128i w15 = w[(i - 15) & 15];
+            __m128i w2  = w[(i -  2) & 15];
+
+            s0 = _mm_xor_si128(_mm_xor_si128(SHA256_SSE2_ROR(w15,  7), SHA256_SSE2_ROR(w15, 18)), _mm_srli_epi32(w15,  3));
+            s1 = _mm_xor_si128(_mm_xor_si128(SHA256_SSE2_ROR(w2,  17), SHA256_SSE2_ROR(w2,  19)), _mm_srli_epi32(w2,  10));
+
+            /* w[i & 15] still holds w[i - 16] */
+            w[i & 15] = _mm_add_epi32(_mm_add_epi32(w[i & 15], s0), _mm_add_epi32(w[(i - 7) & 15], s1));
+         }
+
+         s0  = _mm_xor_si128(_mm_xor_si128(SHA256_SSE2_ROR(a, 2), SHA256_SSE2_ROR(a, 13)), SHA256_SSE2_ROR(a, 22));
+         maj = _mm_or_si128(_mm_and_si128(a, b), _mm_and_si128(c, _mm_or_si128(a, b)));
+         t2  = _mm_add_epi32(s0, maj);
+         s1  = _mm_xor_si128(_mm_xor_si128(SHA256_SSE2_ROR(e, 6), SHA256_SSE2_ROR(e, 11)), SHA256_SSE2_ROR(e, 25));
+         ch  = _mm_xor_si128(_mm_and_si128(e, f), _mm_andnot_si128(e, g));
+         t1  = _mm_add_epi32(_mm_add_epi32(h, s1), _mm_add_epi32(ch, _mm_add_epi32(_mm_set1_epi32((int)T_K[i]), w[i & 15])));
+
+         h   = g;
+         g   = f;
+         f   = e;
+         e   = _mm_add_epi32(d, t1);
+         d   = c;
+         c   = b;
+         b   = a;
+         a   = _mm_add_epi32(t1, t2);
+      }
+
+      s[0] = _mm_add_epi32(s[0], a); s[1] = _mm_add_epi32(s[1], b);
+      s[2] = _mm_add_epi32(s[2], c); s[3] = _mm_add_epi32(s[3], d);
+      s[4] = _mm_add_epi32(s[4], e); s[5] = _mm_add_epi32(s[5], f);
+      s[6] = _mm_add_epi32(s[6], g); s[7] = _mm_add_epi32(s[7], h);
+   }
+
+   for (i = 0; i < 8; i++)
+   {
+      uint32_t lanes[4];
+
+      _mm_storeu_si128((__m128i*)lanes, s[i]);
+
+      state[0][i] = lanes[0];
+      state[1][i] = lanes[1];
+      state[2][i] = lanes[2];
+      state[3][i] = lanes[3];
+   }
+}
+#endif
+
+/* the 16 groups of 4 rounds of a block, unrolled so the message schedule stays in registers */
+#define SHA256_UNROLL16(R) \
+   R(0)  R(1)  R(2)  R(3)  R(4)  R(5)  R(6)  R(7) \
+   R(8)  R(9)  R(10) R(11) R(12) R(13) R(14) R(15)
+
+#ifdef SHA256_HAVE_SHANI
+/* The SHA-NI state is kept as ABEF and CDGH rather than ABCD and EFGH. */
+SHA256_TARGET_SHANI
+static void sha256_shani_load(const uint32_t *h, __m128i *abef, __m128i *cdgh)
+{
+   __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)h), 0xb1);
+   __m128i efgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(h + 4)), 0x1b);
+
+   *abef = _mm_alignr_epi8(abcd, efgh, 8);
+   *cdgh = _mm_blend_epi16(efgh, abcd, 0xf0);
+}
+
+SHA256_TARGET_SHANI
+static void sha256_shani_store(uint32_t *h, __m128i abef, __m128i cdgh)
+{
+   __m128i feba = _mm_shuffle_epi32(abef, 0x1b);
+   __m128i dchg = _mm_shuffle_epi32(cdgh, 0xb1);
+
+   _mm_storeu_si128((__m128i*)h, _mm_blend_epi16(feba, dchg, 0xf0));
+   _mm_storeu_si128((__m128i*)(h + 4), _mm_alignr_epi8(dchg, feba, 8));
+}
+
+/* Rounds 4 * g to 4 * g + 3 of a block. msg[] holds the message schedule four words to a register,
+ * the words for the rounds ahead are worked out alongside. */
+#define SHA256_SHANI_ROUNDS(g, abef, cdgh, msg, block) \
+   do \
+   { \
+      __m128i sha256_k; \
+      if ((g) < 4) \
+         msg[(g)] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)((block) + (g) * 16)), sha256_bswap); \
+      sha256_k = _mm_add_epi32(msg[(g) & 3], _mm_loadu_si128((const __m128i*)(T_K + (g) * 4))); \
+      cdgh = _mm_sha256rnds2_epu32(cdgh, abef, sha256_k); \
+      if ((g) >= 3 && (g) < 15) \
+         msg[((g) + 1) & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(msg[((g) + 1) & 3], \
+                  _mm_alignr_epi8(msg[(g) & 3], msg[((g) - 1) & 3], 4)), msg[(g) & 3]); \
+      abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(sha256_k, 0x0e)); \
+      if ((g) >= 1 && (g) < 13) \
+         msg[((g) - 1) & 3] = _mm_sha256msg1_epu32(msg[((g) - 1) & 3], msg[(g) & 3]); \
+   } while (0)
+
+SHA256_TARGET_SHANI
+static void sha256_compress_shani(uint32_t *h, const uint8_t *blocks, size_t count)
+{
+   const __m128i sha256_bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+   __m128i abef, cdgh;
+
+   sha256_shani_load(h, &abef, &cdgh);
+
+   while (count--)
+   {
+      __m128i msg[4];
+      __m128i abef_save = abef;
+      __m128i cdgh_save = cdgh;
+
+#define SHA256_SHANI_GROUP(g) SHA256_SHANI_ROUNDS(g, abef, cdgh, msg, blocks);
+      SHA256_UNROLL16(SHA256_SHANI_GROUP)
+#undef SHA256_SHANI_GROUP
+
+      abef = _mm_add_epi32(abef, abef_save);
+      cdgh = _mm_add_epi32(cdgh, cdgh_save);
+      blocks += 64;
+   }
+
+   sha256_shani_store(h, abef, cdgh);
+}
+
+/* Two messages interleaved, so one's rounds run while the other's wait on the previous ones. */
+SHA256_TARGET_SHANI
+static void sha256_compress_shani_x2(uint32_t **h, const uint8_t **blocks, size_t count)
+{
+   const __m128i sha256_bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+   const uint8_t *block0 = blocks[0];
+   const uint8_t *block1 = blocks[1];
+   __m128i abef0, cdgh0, abef1, cdgh1;
+
+   sha256_shani_load(h[0], &abef0, &cdgh0);
+   sha256_shani_load(h[1], &abef1, &cdgh1);
+
+   while (count--)
+   {
+      __m128i msg0[4], msg1[4];
+      __m128i abef0_save = abef0, cdgh0_save = cdgh0;
+      __m128i abef1_save = abef1, cdgh1_save = cdgh1;
+
+#define SHA256_SHANI_GROUP(g) \
+      SHA256_SHANI_ROUNDS(g, abef0, cdgh0, msg0, block0); \
+      SHA256_SHANI_ROUNDS(g, abef1, cdgh1, msg1, block1);
+      SHA256_UNROLL16(SHA256_SHANI_GROUP)
+#undef SHA256_SHANI_GROUP
+
+      abef0 = _mm_add_epi32(abef0, abef0_save);
+      cdgh0 = _mm_add_epi32(cdgh0, cdgh0_save);
+      abef1 = _mm_add_epi32(abef1, abef1_save);
+      cdgh1 = _mm_add_epi32(cdgh1, cdgh1_save);
+      block0 += 64;
+      block1 += 64;
+   }
+
+   sha256_shani_store(h[0], abef0, cdgh0);
+   sha256_shani_store(h[1], abef1, cdgh1);
+}
+
+static bool sha256_have_shani(void)
+{
+#ifdef _MSC_VER
+   int regs[4];
+
+   __cpuid(regs, 0);
+
+   if (regs[0] < 7)
+      return false;
+
+   __cpuid(regs, 1);
+
+   if (!(regs[2] & (1 << 9)) || !(regs[2] & (1 << 19)))
+      return false;
+
+   __cpuidex(regs, 7, 0);
+
+   return (regs[1] & (1 << 29)) != 0;
+#else
+   unsigned eax, ebx, ecx, edx;
+
+   if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+      return false;
+
+   if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+      return false;
+
+   if (__get_cpuid_max(0, NULL) < 7)
+      return false;
+
+   __cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+   return (ebx & (1 << 29)) != 0;
+#endif
+}
+#endif
+
+#ifdef SHA256_HAVE_ARMV8
+/* Rounds 4 * g to 4 * g + 3 of a block, see SHA256_SHANI_ROUNDS(). */
+#define SHA256_ARMV8_ROUNDS(g, abcd, efgh, msg, block) \
+   do \
+   { \
+      uint32x4_t sha256_k, sha256_abcd; \
+      if ((g) < 4) \
+         msg[(g)] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8((block) + (g) * 16))); \
+      sha256_k = vaddq_u32(msg[(g) & 3], vld1q_u32(T_K + (g) * 4)); \
+      if ((g) < 12) \
+         msg[(g) & 3] = vsha256su0q_u32(msg[(g) & 3], msg[((g) + 1) & 3]); \
+      sha256_abcd = abcd; \
+      abcd = vsha256hq_u32(abcd, efgh, sha256_k); \
+      efgh = vsha256h2q_u32(efgh, sha256_abcd, sha256_k); \
+      if ((g) < 12) \
+         msg[(g) & 3] = vsha256su1q_u32(msg[(g) & 3], msg[((g) + 2) & 3], msg[((g) + 3) & 3]); \
+   } while (0)
+
+SHA256_TARGET_ARMV8
+static void sha256_compress_armv8(uint32_t *h, const uint8_t *blocks, size_t count)
+{
+   uint32x4_t abcd = vld1q_u32(h);
+   uint32x4_t efgh = vld1q_u32(h + 4);
 
-   for (i = 0; i < 16; i++)
-      p->w[i] = load32be(p->in.u32 + i);
+   while (count--)
+   {
+      uint32x4_t msg[4];
+      uint32x4_t abcd_save = abcd;
+      uint32x4_t efgh_save = efgh;
+
+#define SHA256_ARMV8_GROUP(g) SHA256_ARMV8_ROUNDS(g, abcd, efgh, msg, blocks);
+      SHA256_UNROLL16(SHA256_ARMV8_GROUP)
+#undef SHA256_ARMV8_GROUP
+
+      abcd = vaddq_u32(abcd, abcd_save);
+      efgh = vaddq_u32(efgh, efgh_save);
+      blocks += 64;
+   }
 
-   for (i = 16; i < 64; i++)
+   vst1q_u32(h, abcd);
+   vst1q_u32(h + 4, efgh);
+}
+
+SHA256_TARGET_ARMV8
+static void sha256_compress_armv8_x2(uint32_t **h, const uint8_t **blocks, size_t count)
+{
+   const uint8_t *block0 = blocks[0];
+   const uint8_t *block1 = blocks[1];
+   uint32x4_t abcd0 = vld1q_u32(h[0]);
+   uint32x4_t efgh0 = vld1q_u32(h[0] + 4);
+   uint32x4_t abcd1 = vld1q_u32(h[1]);
+   uint32x4_t efgh1 = vld1q_u32(h[1] + 4);
+
+   while (count--)
    {
-      s0 = ROR32(p->w[i - 15],  7) ^ ROR32(p->w[i - 15], 18) ^ LSR32(p->w[i - 15],  3);
-      s1 = ROR32(p->w[i -  2], 17) ^ ROR32(p->w[i -  2], 19) ^ LSR32(p->w[i -  2], 10);
-      p->w[i] = p->w[i - 16] + s0 + p->w[i - 7] + s1;
+      uint32x4_t msg0[4], msg1[4];
+      uint32x4_t abcd0_save = abcd0, efgh0_save = efgh0;
+      uint32x4_t abcd1_save = abcd1, efgh1_save = efgh1;
+
+#define SHA256_ARMV8_GROUP(g) \
+      SHA256_ARMV8_ROUNDS(g, abcd0, efgh0, msg0, block0); \
+      SHA256_ARMV8_ROUNDS(g, abcd1, efgh1, msg1, block1);
+      SHA256_UNROLL16(SHA256_ARMV8_GROUP)
+#undef SHA256_ARMV8_GROUP
+
+      abcd0 = vaddq_u32(abcd0, abcd0_save);
+      efgh0 = vaddq_u32(efgh0, efgh0_save);
+      abcd1 = vaddq_u32(abcd1, abcd1_save);
+      efgh1 = vaddq_u32(efgh1, efgh1_save);
+      block0 += 64;
+      block1 += 64;
    }
 
-   a = p->h[0]; b = p->h[1]; c = p->h[2]; d = p->h[3];
-   e = p->h[4]; f = p->h[5]; g = p->h[6]; h = p->h[7];
+   vst1q_u32(h[0], abcd0);
+   vst1q_u32(h[0] + 4, efgh0);
+   vst1q_u32(h[1], abcd1);
+   vst1q_u32(h[1] + 4, efgh1);
+}
+
+static bool sha256_have_armv8(void)
+{
+#if defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO)
+   return true;
+#else
+   return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#endif
+}
+#endif
+
+static const struct sha256_variant sha256_variant_scalar = {
+   SHA256_IMPL_SCALAR,
+   sha256_compress_scalar,
+#ifdef SHA256_HAVE_SSE2
+   sha256_compress_sse2_x4, 4
+#else
+   NULL, 1
+#endif
+};
 
-   for (i = 0; i < 64; i++)
+#ifdef SHA256_HAVE_SHANI
+static const struct sha256_variant sha256_variant_shani = {
+   SHA256_IMPL_SHANI, sha256_compress_shani, sha256_compress_shani_x2, 2
+};
+#endif
+
+#ifdef SHA256_HAVE_ARMV8
+static const struct sha256_variant sha256_variant_armv8 = {
+   SHA256_IMPL_ARMV8, sha256_compress_armv8, sha256_compress_armv8_x2, 2
+};
+#endif
+
+/* Picked on first use. Threads that race on it store the same pointer. */
+static const struct sha256_variant *sha256_variant = NULL;
+
+bool sha256_set_impl(enum sha256_impl impl)
+{
+   const struct sha256_variant *variant = NULL;
+
+   switch (impl)
    {
-      uint32_t t1, t2, maj, ch;
-
-      s0 = ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22);
-      maj = (a & b) ^ (a & c) ^ (b & c);
-      t2  = s0 + maj;
-      s1  = ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25);
-      ch  = (e & f) ^ (~e & g);
-      t1  = h + s1 + ch + T_K[i] + p->w[i];
-
-      h   = g;
-      g   = f;
-      f   = e;
-      e   = d + t1;
-      d   = c;
-      c   = b;
-      b   = a;
-      a   = t1 + t2;
+      case SHA256_IMPL_SCALAR:
+         variant = &sha256_variant_scalar;
+         break;
+      case SHA256_IMPL_SHANI:
+#ifdef SHA256_HAVE_SHANI
+         if (sha256_have_shani())
+            variant = &sha256_variant_shani;
+#endif
+         break;
+      case SHA256_IMPL_ARMV8:
+#ifdef SHA256_HAVE_ARMV8
+         if (sha256_have_armv8())
+            variant = &sha256_variant_armv8;
+#endif
+         break;
    }
 
-   p->h[0] += a; p->h[1] += b; p->h[2] += c; p->h[3] += d;
-   p->h[4] += e; p->h[5] += f; p->h[6] += g; p->h[7] += h;
+   if (!variant)
+      return false;
+
+   sha256_variant = variant;
+
+   return true;
+}
+
+static const struct sha256_variant *sha256_get_variant(void)
+{
+   if (!sha256_variant)
+   {
+      if (     !sha256_set_impl(SHA256_IMPL_SHANI)
+            && !sha256_set_impl(SHA256_IMPL_ARMV8))
+         sha256_set_impl(SHA256_IMPL_SCALAR);
+   }
+
+   return sha256_variant;
+}
+
+enum sha256_impl sha256_get_impl(void)
+{
+   return sha256_get_variant()->impl;
+}
+
+const char *sha256_get_impl_name(enum sha256_impl impl)
+{
+   switch (impl)
+   {
+      case SHA256_IMPL_SCALAR:
+         return "scalar";
+      case SHA256_IMPL_SHANI:
+         return "shani";
+      case SHA256_IMPL_ARMV8:
+         return "armv8";
+   }
+
+   return "unknown";
+}
+
+static void sha256_init(struct sha256_ctx *p, sha256_compress_t compress)
+{
+   memset(p, 0, sizeof(struct sha256_ctx));
+   memcpy(p->h, T_H, sizeof(T_H));
+   p->compress = compress;
+}
+
+static void sha256_block(struct sha256_ctx *p)
+{
+   p->compress(p->h, p->in.u8, 1);
 
    /* Next block */
    p->inlen = 0;
 }
 
 static void sha256_chunk(struct sha256_ctx *p,
-      const uint8_t *s, unsigned len)
+      const uint8_t *s, size_t len)
 {
    p->len += len;
 
-   while (len)
+   if (p->inlen)
    {
-      unsigned l = 64 - p->inlen;
+      size_t l = 64 - p->inlen;
 
       if (len < l)
          l       = len;
@@ -137,12 +615,24 @@ static void sha256_chunk(struct sha256_ctx *p,
       memcpy(p->in.u8 + p->inlen, s, l);
 
       s         += l;
-      p->inlen  += l;
+      p->inlen  += (unsigned)l;
       len       -= l;
 
       if (p->inlen == 64)
          sha256_block(p);
    }
+
+   /* whole blocks are compressed straight from the input */
+   if (len >= 64)
+   {
+      p->compress(p->h, s, len / 64);
+
+      s         += len & ~(size_t)63;
+      len       &= 63;
+   }
+
+   memcpy(p->in.u8 + p->inlen, s, len);
+   p->inlen     += (unsigned)len;
 }
 
 static void sha256_final(struct sha256_ctx *p)
@@ -171,6 +661,22 @@ static void sha256_subhash(struct sha256_ctx *p, uint32_t *t)
       store32be(t++, p->h[i]);
 }
 
+static void sha256_output(struct sha256_ctx *p, char *s)
+{
+   unsigned i;
+
+   union
+   {
+      uint32_t u32[8];
+      uint8_t u8[32];
+   } shahash;
+
+   sha256_subhash(p, shahash.u32);
+
+   for (i = 0; i < 32; i++)
+      snprintf(s + 2 * i, 3, "%02x", (unsigned)shahash.u8[i]);
+}
+
 /**
  * sha256_hash:
  * @s                 : Output.
@@ -181,22 +687,69 @@ static void sha256_subhash(struct sha256_ctx *p, uint32_t *t)
  **/
 void sha256_hash(char *s, const uint8_t *in, size_t size)
 {
-   unsigned i;
    struct sha256_ctx sha;
 
-   union
+   sha256_init(&sha, sha256_get_variant()->compress);
+   sha256_chunk(&sha, in, size);
+   sha256_final(&sha);
+   sha256_output(&sha, s);
+}
+
+/**
+ * sha256_hash_multi:
+ * @out               : Outputs, one for each input.
+ * @in                : Inputs.
+ * @size              : Sizes of @in.
+ * @count             : Number of inputs.
+ *
+ * Hashes each of @in like sha256_hash(). Inputs are taken in groups
+ * that are compressed side by side, which is faster where the CPU can
+ * interleave them; the groups run as far as their shortest input.
+ **/
+void sha256_hash_multi(char **out, const uint8_t *const *in,
+      const size_t *size, unsigned count)
+{
+   unsigned i, j;
+   const struct sha256_variant *variant = sha256_get_variant();
+
+   for (i = 0; i < count; i += variant->lanes)
    {
-      uint32_t u32[8];
-      uint8_t u8[32];
-   } shahash;
+      struct sha256_ctx sha[SHA256_MAX_LANES];
+      unsigned lanes = count - i < variant->lanes ? count - i : variant->lanes;
+      size_t blocks  = 0;
 
-   sha256_init(&sha);
-   sha256_chunk(&sha, in, (unsigned)size);
-   sha256_final(&sha);
-   sha256_subhash(&sha, shahash.u32);
+      for (j = 0; j < lanes; j++)
+         sha256_init(&sha[j], variant->compress);
 
-   for (i = 0; i < 32; i++)
-      snprintf(s + 2 * i, 3, "%02x", (unsigned)shahash.u8[i]);
+      if (variant->compress_multi && lanes == variant->lanes)
+      {
+         uint32_t *h[SHA256_MAX_LANES];
+         const uint8_t *data[SHA256_MAX_LANES];
+
+         blocks = size[i] / 64;
+
+         for (j = 0; j < lanes; j++)
+         {
+            h[j]    = sha[j].h;
+            data[j] = in[i + j];
+
+            if (size[i + j] / 64 < blocks)
+               blocks = size[i + j] / 64;
+         }
+
+         if (blocks)
+            variant->compress_multi(h, data, blocks);
+      }
+
+      for (j = 0; j < lanes; j++)
+      {
+         sha[j].len = blocks * 64;
+
+         sha256_chunk(&sha[j], in[i + j] + blocks * 64, size[i + j] - blocks * 64);
+         sha256_final(&sha[j]);
+         sha256_output(&sha[j], out[i + j]);
+      }
+   }
 }
 
 #ifndef HAVE_ZLIB
@@ -252,13 +805,10 @@ uint32_t crc32_adjust(uint32_t checksum, uint8_t input)
    return ((checksum >> 8) & 0x00ffffff) ^ crc32_hash_table[(checksum ^ input) & 0xff];
 }
 
+/* the same CRC, encoding_crc32() picks the fastest way the CPU has to take it */
 uint32_t crc32_calculate(const uint8_t *data, size_t length)
 {
-   size_t i;
-   uint32_t checksum = ~0;
-   for (i = 0; i < length; i++)
-      checksum = crc32_adjust(checksum, data[i]);
-   return ~checksum;
+   return encoding_crc32(0, data, length);
 }
 #endif
 
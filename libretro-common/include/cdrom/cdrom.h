@@ -39,6 +39,26 @@ struct string_list;
 
 RETRO_BEGIN_DECLS
 
+typedef enum
+{
+   DIRECTION_NONE,
+   DIRECTION_IN,
+   DIRECTION_OUT
+} CDROM_CMD_Direction;
+
+/* Commands can be served by something other than a real drive, such as a disc image.
+ * While a transport is set, newly opened cdrom:// streams talk to it instead of the device. */
+typedef struct
+{
+   /* returns a handle for the given drive, NULL if there is no such drive */
+   void* (*open)(void *data, char drive);
+   void (*close)(void *data, void *handle);
+   /* fills in fixed format sense data and returns non-zero on CHECK CONDITION, like a drive would */
+   int (*send)(void *data, void *handle, CDROM_CMD_Direction dir, void *buf, size_t len, const unsigned char *cmd, size_t cmd_len, unsigned char *sense, size_t sense_len);
+   void *data;
+   unsigned max_transfer_bytes;
+} cdrom_transport_t;
+
 typedef struct
 {
    unsigned short g1_timeout;
@@ -46,6 +66,42 @@ typedef struct
    unsigned short g3_timeout;
 } cdrom_group_timeouts_t;
 
+/* What a drive can do, parsed from GET CONFIGURATION at open time.
+ * Used by the read path to pick the command, batch size and C2 usage. */
+typedef struct
+{
+   char model[32];
+   char serial[32];
+   unsigned max_transfer_bytes;
+   unsigned short current_profile;
+   unsigned char read_command; /* 0xBE (READ CD) or 0xB9 (READ CD MSF) */
+   unsigned char batch_frames; /* frames requested per read command */
+   bool valid;
+   bool cd_read;
+   bool c2_pointers;
+   bool cd_text;
+   bool multiread;
+   bool streaming;
+   bool read_cache_control;
+} cdrom_drive_caps_t;
+
+/* media class event codes of GET EVENT STATUS NOTIFICATION */
+typedef enum
+{
+   CDROM_MEDIA_EVENT_NONE = 0,
+   CDROM_MEDIA_EVENT_EJECT_REQUEST = 1,
+   CDROM_MEDIA_EVENT_NEW_MEDIA = 2,
+   CDROM_MEDIA_EVENT_MEDIA_REMOVAL = 3,
+   CDROM_MEDIA_EVENT_MEDIA_CHANGED = 4
+} cdrom_media_event_code_t;
+
+typedef struct
+{
+   cdrom_media_event_code_t code;
+   bool tray_open;
+   bool media_present;
+} cdrom_media_event_t;
+
 typedef struct
 {
    unsigned lba_start; /* start of pregap */
@@ -58,6 +114,7 @@ typedef struct
    unsigned char frame;
    unsigned char mode;
    bool audio;
+   bool pre_emphasis; /* audio mastered with 50/15 us pre-emphasis, from the control bits of the TOC */
 } cdrom_track_t;
 
 typedef struct
@@ -65,6 +122,7 @@ typedef struct
    char drive;
    unsigned char num_tracks;
    cdrom_group_timeouts_t timeouts;
+   cdrom_drive_caps_t caps;
    cdrom_track_t track[99];
 } cdrom_toc_t;
 
@@ -78,11 +136,30 @@ int cdrom_read_subq(libretro_vfs_implementation_file *stream, unsigned char *buf
 
 int cdrom_write_cue(libretro_vfs_implementation_file *stream, char **out_buf, size_t *out_len, char cdrom_drive, unsigned char *num_tracks, cdrom_toc_t *toc);
 
+/* The pieces cdrom_write_cue() is made of, for callers that want to build the TOC incrementally:
+ * cdrom_read_toc() fills num_tracks and each track's start/type from the raw TOC in a single command,
+ * cdrom_read_track_info() adds the pregap, size and mode of one track,
+ * cdrom_write_cue_sheet() renders the cue text from a finished TOC. */
+int cdrom_read_toc(libretro_vfs_implementation_file *stream, cdrom_toc_t *toc);
+
+int cdrom_read_track_info(libretro_vfs_implementation_file *stream, unsigned char track, cdrom_toc_t *toc);
+
+int cdrom_write_cue_sheet(const cdrom_toc_t *toc, char cdrom_drive, char **out_buf, size_t *out_len);
+
 /* needs 32 bytes for full vendor, product and version */
 int cdrom_get_inquiry(libretro_vfs_implementation_file *stream, char *model, int len, bool *is_cdrom);
 
 int cdrom_read(libretro_vfs_implementation_file *stream, cdrom_group_timeouts_t *timeouts, unsigned char min, unsigned char sec, unsigned char frame, void *s, size_t len, size_t skip);
 
+/* reads using the command, batch size and C2 mode from caps; a NULL or invalid caps behaves like cdrom_read() */
+int cdrom_read_lba(libretro_vfs_implementation_file *stream, const cdrom_drive_caps_t *caps, unsigned lba, void *s, size_t len, size_t skip);
+
+/* like cdrom_read_lba(), but a command that fails is not retried, for callers that read again on their own */
+int cdrom_read_lba_once(libretro_vfs_implementation_file *stream, const cdrom_drive_caps_t *caps, unsigned lba, void *s, size_t len, size_t skip);
+
+/* probes the drive once per model/serial, later calls for the same drive are served from a cache */
+int cdrom_get_drive_caps(libretro_vfs_implementation_file *stream, cdrom_drive_caps_t *caps);
+
 int cdrom_set_read_speed(libretro_vfs_implementation_file *stream, unsigned speed);
 
 int cdrom_stop(libretro_vfs_implementation_file *stream);
@@ -93,13 +170,42 @@ int cdrom_open_tray(libretro_vfs_implementation_file *stream);
 
 int cdrom_close_tray(libretro_vfs_implementation_file *stream);
 
-/* must be freed by the caller */
+/* Puts a transport behind one drive name, NULL goes back to the real drive.
+ * Fails if the drive already has a transport. Must not change while cdrom:// streams on the drive are open. */
+bool cdrom_set_transport(char drive, const cdrom_transport_t *transport);
+
+const cdrom_transport_t* cdrom_get_transport(char drive);
+
+/* Sees every attempt at a command after it completes, on the thread that sent it.
+ * For DIRECTION_IN, buf holds what the drive returned. status is non-zero on CHECK CONDITION. */
+typedef void (*cdrom_command_observer_t)(void *data, char drive, CDROM_CMD_Direction dir, const void *buf, size_t len, const unsigned char *cmd, size_t cmd_len, const unsigned char *sense, size_t sense_len, int status, uint64_t latency_usec);
+
+/* NULL removes the observer. Must not change while commands are in flight. */
+void cdrom_set_command_observer(cdrom_command_observer_t observer, void *data);
+
+/* must be freed by the caller
+ * On Linux the first call probes all /dev/sg* nodes concurrently and caches the result,
+ * later calls only look at nodes /dev has reported changes for. */
 struct string_list* cdrom_get_available_drives(void);
 
+/* returns true if the node at path is an optical drive, and its model */
+typedef bool (*cdrom_drive_probe_t)(const char *path, char *model, size_t len);
+
+/* Points drive enumeration at other /dev and sysfs roots, probe function and per-node timeout.
+ * NULL/0 select the defaults. Meant for exercising enumeration against a fake device tree. */
+void cdrom_drive_list_configure(const char *dev_root, const char *sys_root, cdrom_drive_probe_t probe, unsigned timeout_ms);
+
+/* forgets all cached drives */
+void cdrom_drive_list_reset(void);
+
 bool cdrom_is_media_inserted(libretro_vfs_implementation_file *stream);
 
 bool cdrom_drive_has_media(const char drive);
 
+/* Reads the next queued media class event, a single command that does not disturb a playing drive.
+ * Returns non-zero if the drive does not support polled event notification. */
+int cdrom_get_media_event(libretro_vfs_implementation_file *stream, cdrom_media_event_t *event);
+
 void cdrom_get_current_config_core(libretro_vfs_implementation_file *stream);
 
 void cdrom_get_current_config_profiles(libretro_vfs_implementation_file *stream);
@@ -0,0 +1,54 @@
+/* Copyright  (C) 2010-2019 The RetroArch team
+ *
+ * ---------------------------------------------------------------------------------------
+ * The following license statement only applies to this file (cdrom_sim.h).
+ * ---------------------------------------------------------------------------------------
+ *
+ * Permission is hereby granted, free of charge,
+ * to any person obtaining a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __LIBRETRO_SDK_CDROM_SIM_H
+#define __LIBRETRO_SDK_CDROM_SIM_H
+
+#include <cdrom/cdrom.h>
+
+#include <retro_common_api.h>
+#include <boolean.h>
+
+RETRO_BEGIN_DECLS
+
+/* A drive that plays a disc image. It answers the same MMC commands the cdrom layer sends to
+ * real drives, so installing its transport with cdrom_set_transport() puts an image behind
+ * the cdrom:// paths without anything above the transport knowing the difference. */
+
+typedef struct cdrom_sim cdrom_sim_t;
+
+/* path is a .cue sheet or a raw .bin, which is played as a single audio track. NULL on failure. */
+cdrom_sim_t* cdrom_sim_new(const char *path);
+
+/* Uninstall the transport first if it is still set. */
+void cdrom_sim_free(cdrom_sim_t *sim);
+
+void cdrom_sim_get_transport(cdrom_sim_t *sim, cdrom_transport_t *transport);
+
+unsigned char cdrom_sim_get_num_tracks(const cdrom_sim_t *sim);
+
+/* Ejects or inserts the disc, queueing a media event like a drive does when its tray moves. */
+void cdrom_sim_set_media(cdrom_sim_t *sim, bool present);
+
+RETRO_END_DECLS
+
+#endif
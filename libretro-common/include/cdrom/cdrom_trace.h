@@ -0,0 +1,101 @@
+/* Copyright  (C) 2010-2019 The RetroArch team
+ *
+ * ---------------------------------------------------------------------------------------
+ * The following license statement only applies to this file (cdrom_trace.h).
+ * ---------------------------------------------------------------------------------------
+ *
+ * Permission is hereby granted, free of charge,
+ * to any person obtaining a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __LIBRETRO_SDK_CDROM_TRACE_H
+#define __LIBRETRO_SDK_CDROM_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <retro_common_api.h>
+#include <boolean.h>
+
+RETRO_BEGIN_DECLS
+
+/* Command tracing for the SCSI layer. Every command sent to a drive is timed and
+ * appended to a ring owned by the calling thread, and its latency is added to a
+ * histogram per drive and opcode. Tracing is on by default; the cost per command
+ * is two clock reads and a few stores. */
+
+#define CDROM_TRACE_MAGIC "CDTR"
+#define CDROM_TRACE_VERSION 1
+
+/* one command, as stored in the rings and in dump files */
+typedef struct
+{
+   uint64_t time_usec;    /* when the command was issued */
+   uint32_t latency_usec; /* including retries */
+   uint32_t lba;          /* first sector for read commands, 0 otherwise */
+   uint32_t sectors;      /* sector count for read commands, 0 otherwise */
+   uint16_t thread;       /* ring the record came from */
+   uint8_t opcode;
+   uint8_t drive;
+   uint8_t status;        /* 0 on success */
+   uint8_t retries;
+   uint8_t sense_key;
+   uint8_t asc;
+   uint8_t ascq;
+   uint8_t reserved[3];
+} cdrom_trace_record_t;
+
+/* dump file header, followed by count records */
+typedef struct
+{
+   char magic[4];
+   uint32_t version;
+   uint32_t record_size;
+   uint32_t count;
+} cdrom_trace_file_header_t;
+
+typedef struct
+{
+   uint64_t count;
+   uint32_t p50_usec;
+   uint32_t p99_usec;
+   uint32_t p999_usec;
+   uint32_t max_usec;
+} cdrom_trace_latency_t;
+
+void cdrom_trace_set_enabled(bool enabled);
+
+bool cdrom_trace_is_enabled(void);
+
+/* Returns the start time to hand to cdrom_trace_end(), 0 if tracing is disabled. */
+uint64_t cdrom_trace_begin(void);
+
+void cdrom_trace_end(uint64_t start_usec, char drive, const unsigned char *cmd, int status, const unsigned char *sense, unsigned retries);
+
+/* Latency percentiles of one opcode on one drive, returns false if it was never seen. */
+bool cdrom_trace_get_latency(char drive, unsigned char opcode, cdrom_trace_latency_t *latency);
+
+/* Writes one line per drive and opcode into buf, returns the length of the text. */
+size_t cdrom_trace_summary(char *buf, size_t len);
+
+/* Writes the records still held by the rings to a file, returns 0 on success. */
+int cdrom_trace_dump(const char *path);
+
+/* Forgets all records and histograms. Not safe while commands are in flight. */
+void cdrom_trace_reset(void);
+
+RETRO_END_DECLS
+
+#endif
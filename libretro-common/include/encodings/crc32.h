@@ -25,12 +25,36 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <boolean.h>
 
 #include <retro_common_api.h>
 
 RETRO_BEGIN_DECLS
 
+enum encoding_crc32_impl
+{
+   ENCODING_CRC32_BYTEWISE = 0,
+   ENCODING_CRC32_SLICE8,
+   ENCODING_CRC32_PCLMUL,
+   ENCODING_CRC32_ARMV8
+};
+
 uint32_t encoding_crc32(uint32_t crc, const uint8_t *buf, size_t len);
+
+/**
+ * encoding_crc32_set_impl:
+ *
+ * Makes encoding_crc32() use the given implementation rather than the
+ * fastest the CPU has, which it picks on its own otherwise. For tests
+ * and benchmarks.
+ *
+ * Returns: false if the CPU or the build does not have it.
+ */
+bool encoding_crc32_set_impl(enum encoding_crc32_impl impl);
+
+enum encoding_crc32_impl encoding_crc32_get_impl(void);
+
+const char *encoding_crc32_get_impl_name(enum encoding_crc32_impl impl);
 uint32_t file_crc32(uint32_t crc, const char *path);
 
 RETRO_END_DECLS
@@ -25,6 +25,8 @@
 
 #include <retro_common_api.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <boolean.h>
 
 RETRO_BEGIN_DECLS
 
@@ -82,6 +84,32 @@ enum rwav_state rwav_load(rwav_t* out, const void* buf, size_t size);
  */
 void rwav_free(rwav_t *rwav);
 
+typedef struct rwav_writer rwav_writer_t;
+
+/**
+ * Creates a PCM wave file at path to write samples to as they come,
+ * without holding them in memory. NULL if it could not be created.
+ */
+rwav_writer_t* rwav_writer_open(const char *path, unsigned samplerate,
+      unsigned numchannels, unsigned bitspersample);
+
+/**
+ * Appends size bytes of interleaved samples, in the byte order of the
+ * file which is little-endian. Once a write failed all later ones fail.
+ */
+bool rwav_writer_write(rwav_writer_t *writer, const void *samples, size_t size);
+
+/**
+ * Bytes of samples written so far.
+ */
+uint64_t rwav_writer_get_size(const rwav_writer_t *writer);
+
+/**
+ * Fills in the sizes in the header and closes the file. Returns false
+ * if any of it could not be written, the file is then incomplete.
+ */
+bool rwav_writer_close(rwav_writer_t *writer);
+
 RETRO_END_DECLS
 
 #endif
@@ -0,0 +1,75 @@
+/* Copyright  (C) 2010-2019 The RetroArch team
+ *
+ * ---------------------------------------------------------------------------------------
+ * The following license statement only applies to this file (retro_atomic.h).
+ * ---------------------------------------------------------------------------------------
+ *
+ * Permission is hereby granted, free of charge,
+ * to any person obtaining a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __LIBRETRO_COMMON_ATOMIC_H
+#define __LIBRETRO_COMMON_ATOMIC_H
+
+#include <retro_inline.h>
+
+/* Atomic operations on 32-bit integers and on pointers, for flags, counters and locks that are only
+ * held for a few stores, where a slock_t cannot be used because there is nowhere to create it first.
+ *
+ * A load with acquire that reads the value of a store with release sees everything written before
+ * that store. Compare and swap and increment are full barriers. */
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+
+#define RETRO_ATOMIC_LOAD_ACQUIRE(ptr) InterlockedCompareExchange((volatile LONG*)(ptr), 0, 0)
+#define RETRO_ATOMIC_STORE_RELEASE(ptr, val) InterlockedExchange((volatile LONG*)(ptr), (LONG)(val))
+#define RETRO_ATOMIC_CAS(ptr, old_val, new_val) (InterlockedCompareExchange((volatile LONG*)(ptr), (LONG)(new_val), (LONG)(old_val)) == (LONG)(old_val))
+#define RETRO_ATOMIC_INC(ptr) InterlockedIncrement((volatile LONG*)(ptr))
+#define RETRO_ATOMIC_LOAD_PTR_ACQUIRE(ptr) InterlockedCompareExchangePointer((PVOID volatile*)(ptr), NULL, NULL)
+#define RETRO_ATOMIC_STORE_PTR_RELEASE(ptr, val) InterlockedExchangePointer((PVOID volatile*)(ptr), (PVOID)(val))
+#define RETRO_ATOMIC_CAS_PTR(ptr, old_val, new_val) (InterlockedCompareExchangePointer((PVOID volatile*)(ptr), (PVOID)(new_val), (PVOID)(old_val)) == (PVOID)(old_val))
+#define RETRO_ATOMIC_YIELD() SwitchToThread()
+#else
+#include <sched.h>
+
+#define RETRO_ATOMIC_LOAD_ACQUIRE(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define RETRO_ATOMIC_STORE_RELEASE(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#define RETRO_ATOMIC_CAS(ptr, old_val, new_val) __sync_bool_compare_and_swap((ptr), (old_val), (new_val))
+#define RETRO_ATOMIC_INC(ptr) __sync_fetch_and_add((ptr), 1)
+#define RETRO_ATOMIC_LOAD_PTR_ACQUIRE(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define RETRO_ATOMIC_STORE_PTR_RELEASE(ptr, val) __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#define RETRO_ATOMIC_CAS_PTR(ptr, old_val, new_val) __sync_bool_compare_and_swap((ptr), (old_val), (new_val))
+#define RETRO_ATOMIC_YIELD() sched_yield()
+#endif
+
+/* A lock that needs no setup, 0 is unlocked. Whoever waits for it gives up the CPU between tries. */
+typedef volatile long retro_spinlock_t;
+
+static INLINE void retro_spinlock_lock(retro_spinlock_t *lock)
+{
+   while (!RETRO_ATOMIC_CAS(lock, 0, 1))
+      RETRO_ATOMIC_YIELD();
+}
+
+static INLINE void retro_spinlock_unlock(retro_spinlock_t *lock)
+{
+   RETRO_ATOMIC_STORE_RELEASE(lock, 0);
+}
+
+#endif
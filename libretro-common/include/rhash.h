@@ -48,6 +48,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <boolean.h>
 
 #include <compat/msvc.h>
 #ifdef HAVE_CONFIG_H
@@ -70,6 +71,53 @@ RETRO_BEGIN_DECLS
  **/
 void sha256_hash(char *out, const uint8_t *in, size_t size);
 
+/**
+ * sha256_hash_multi:
+ * @out               : Outputs, one for each input.
+ * @in                : Inputs.
+ * @size              : Sizes of @in.
+ * @count             : Number of inputs.
+ *
+ * Hashes each of @in like sha256_hash(), several of them at once.
+ **/
+void sha256_hash_multi(char **out, const uint8_t *const *in,
+      const size_t *size, unsigned count);
+
+enum sha256_impl
+{
+   SHA256_IMPL_SCALAR = 0,
+   SHA256_IMPL_SHANI,
+   SHA256_IMPL_ARMV8
+};
+
+/**
+ * sha256_set_impl:
+ *
+ * Makes sha256_hash() use the given implementation rather than the
+ * fastest the CPU has, which it picks on its own otherwise. For tests
+ * and benchmarks.
+ *
+ * Returns: false if the CPU or the build does not have it.
+ **/
+bool sha256_set_impl(enum sha256_impl impl);
+
+enum sha256_impl sha256_get_impl(void);
+
+const char *sha256_get_impl_name(enum sha256_impl impl);
+
+#ifndef HAVE_ZLIB
+/**
+ * crc32_calculate:
+ * @data              : Input.
+ * @length            : Size of @data.
+ *
+ * Zlib CRC32 of @data, taken by encoding_crc32().
+ **/
+uint32_t crc32_calculate(const uint8_t *data, size_t length);
+
+uint32_t crc32_adjust(uint32_t checksum, uint8_t input);
+#endif
+
 typedef struct SHA1Context
 {
    unsigned Message_Digest[5]; /* Message Digest (output)          */
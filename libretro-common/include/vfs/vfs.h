@@ -51,8 +51,11 @@ typedef struct
    unsigned char cur_track;
    unsigned cur_lba;
    unsigned last_frame_lba;
+   unsigned c2_errors;
+   unsigned char sense_key;           /* of the last command, 0 if it succeeded */
    unsigned char last_frame[2352];
    bool last_frame_valid;
+   void *transport_handle;
 } vfs_cdrom_t;
 #endif
 
@@ -43,10 +43,59 @@ int64_t retro_vfs_file_read_cdrom(libretro_vfs_implementation_file *stream,
 
 int retro_vfs_file_error_cdrom(libretro_vfs_implementation_file *stream);
 
-const cdrom_toc_t* retro_vfs_file_get_cdrom_toc(void);
+/* The TOC, build state and media polling are kept per drive, so each drive can be used from its own thread. */
+const cdrom_toc_t* retro_vfs_file_get_cdrom_toc(char drive);
+
+/* What the drive can do. A read can switch the read command of the drive while other streams read, which this
+ * copy is safe from, unlike the caps in the TOC. */
+void retro_vfs_file_cdrom_get_caps(char drive, cdrom_drive_caps_t *caps);
+
+/* Reads like cdrom_read_lba() with the caps of the drive of the stream, or like cdrom_read_lba_once() without
+ * retry. A drive that rejects READ CD is switched to READ CD MSF once that works. */
+int retro_vfs_file_cdrom_read_lba(libretro_vfs_implementation_file *stream, unsigned lba, void *s, size_t len,
+      size_t skip, bool retry);
 
 const vfs_cdrom_t* retro_vfs_file_get_cdrom_position(const libretro_vfs_implementation_file *stream);
 
+/* The drive named by a cdrom:// cue path, 0 if it names none. */
+char retro_vfs_file_cdrom_get_drive(const char *path);
+
+/* Starts building the TOC of the drive named by a cdrom:// cue path.
+ * Returns once the raw TOC and the first audio track are known, the
+ * remaining tracks and the cue sheet are completed in the background. */
+bool retro_vfs_file_cdrom_toc_begin(const char *path);
+
+/* Blocks until the given track (1-based) is fully described. */
+bool retro_vfs_file_cdrom_toc_wait_track(char drive, unsigned char track);
+
+bool retro_vfs_file_cdrom_toc_track_ready(char drive, unsigned char track);
+
+/* Cancels an unfinished build and releases its resources. */
+void retro_vfs_file_cdrom_toc_end(char drive);
+
+/* Like retro_vfs_file_cdrom_toc_end(), but also forgets the TOC itself, for when the disc is gone. */
+void retro_vfs_file_cdrom_toc_invalidate(char drive);
+
+typedef struct
+{
+   retro_time_t elapsed_usec;
+   retro_time_t cpu_usec; /* spent by the polling thread */
+   unsigned commands;
+   unsigned events;
+} retro_vfs_cdrom_media_poll_stats_t;
+
+/* Starts watching a drive for ejects and new discs every interval_ms (0 pauses polling).
+ * The drive is polled from its own thread with GET EVENT STATUS NOTIFICATION. */
+bool retro_vfs_file_cdrom_media_poll_begin(char drive, unsigned interval_ms);
+
+void retro_vfs_file_cdrom_media_poll_set_interval(char drive, unsigned interval_ms);
+
+/* Returns true once for every change since the last call, present tells if a readable disc is in the drive now. */
+bool retro_vfs_file_cdrom_media_changed(char drive, bool *present);
+
+/* Stops polling, stats (may be NULL) receive the cost of it. */
+void retro_vfs_file_cdrom_media_poll_end(char drive, retro_vfs_cdrom_media_poll_stats_t *stats);
+
 RETRO_END_DECLS
 
 #endif
@@ -409,10 +409,10 @@ libretro_vfs_implementation_file *retro_vfs_file_open_impl(
       {
          retro_vfs_file_open_cdrom(stream, path, mode, hints);
 #if defined(_WIN32) && !defined(_XBOX)
-         if (!stream->fh)
+         if (!stream->fh && !stream->cdrom.transport_handle)
             goto error;
 #else
-         if (!stream->fp)
+         if (!stream->fp && !stream->cdrom.transport_handle)
             goto error;
 #endif
       }
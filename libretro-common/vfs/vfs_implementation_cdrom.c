@@ -21,25 +21,619 @@
 */
 
 #include <vfs/vfs_implementation.h>
+#include <vfs/vfs_implementation_cdrom.h>
 #include <file/file_path.h>
 #include <compat/fopen_utf8.h>
 #include <string/stdstring.h>
+#include <rthreads/rthreads.h>
+#include <features/features_cpu.h>
 #include <cdrom/cdrom.h>
 
 #if defined(_WIN32) && !defined(_XBOX)
 #include <windows.h>
 #endif
 
-static cdrom_toc_t vfs_cdrom_toc = {0};
+#if defined(__linux__) && !defined(ANDROID)
+#include <time.h>
+#endif
+
+/* Incremental TOC construction: the raw TOC and the first audio track are read up front,
+ * the remaining track info and the cue sheet are filled in by a worker thread. */
+typedef struct
+{
+   sthread_t *thread;
+   slock_t *lock;
+   scond_t *cond;
+   libretro_vfs_implementation_file *stream;
+   cdrom_toc_t *toc;
+   char *cue_buf;
+   size_t cue_len;
+   char drive;
+   bool track_ready[99];
+   bool active;
+   bool done;
+   bool cancel;
+} vfs_cdrom_toc_builder_t;
+
+/* Media change detection: a thread polls GET EVENT STATUS NOTIFICATION on its own handle,
+ * the owner of the TOC picks up changes with retro_vfs_file_cdrom_media_changed(). */
+typedef struct
+{
+   sthread_t *thread;
+   slock_t *lock;
+   scond_t *cond;
+   libretro_vfs_implementation_file *stream;
+   retro_time_t start_usec;
+   retro_time_t cpu_usec;
+   unsigned interval_ms;
+   unsigned commands;
+   unsigned events;
+   bool present;
+   bool changed;
+   bool active;
+   bool stop;
+} vfs_cdrom_media_poller_t;
+
+/* Everything known about one drive. Each drive has its own, so players on different drives
+ * can run on different threads without sharing anything here. */
+typedef struct
+{
+   cdrom_toc_t toc;
+   vfs_cdrom_toc_builder_t builder;
+   vfs_cdrom_media_poller_t poller;
+} vfs_cdrom_drive_t;
+
+/* 0-9 and A-Z, plus one for streams whose path names no drive */
+#define VFS_CDROM_MAX_DRIVES 36
+
+static vfs_cdrom_drive_t vfs_cdrom_drives[VFS_CDROM_MAX_DRIVES + 1];
+
+static vfs_cdrom_drive_t* vfs_cdrom_get_drive(char drive)
+{
+   if (drive >= '0' && drive <= '9')
+      return &vfs_cdrom_drives[drive - '0'];
+
+   /* windows drive letters are not case sensitive */
+   if (drive >= 'a' && drive <= 'z')
+      drive -= 'a' - 'A';
+
+   if (drive >= 'A' && drive <= 'Z')
+      return &vfs_cdrom_drives[10 + drive - 'A'];
+
+   return &vfs_cdrom_drives[VFS_CDROM_MAX_DRIVES];
+}
+
+const cdrom_toc_t* retro_vfs_file_get_cdrom_toc(char drive)
+{
+   return &vfs_cdrom_get_drive(drive)->toc;
+}
+
+void retro_vfs_file_cdrom_get_caps(char drive, cdrom_drive_caps_t *caps)
+{
+   vfs_cdrom_drive_t *cdrom = vfs_cdrom_get_drive(drive);
+
+   if (cdrom->builder.active)
+      slock_lock(cdrom->builder.lock);
+
+   *caps = cdrom->toc.caps;
+
+   if (cdrom->builder.active)
+      slock_unlock(cdrom->builder.lock);
+}
+
+int retro_vfs_file_cdrom_read_lba(libretro_vfs_implementation_file *stream, unsigned lba, void *s, size_t len,
+      size_t skip, bool retry)
+{
+   vfs_cdrom_drive_t *cdrom = vfs_cdrom_get_drive(stream->cdrom.drive);
+   cdrom_drive_caps_t caps;
+   int rv;
+
+   retro_vfs_file_cdrom_get_caps(stream->cdrom.drive, &caps);
+
+   rv = retry ? cdrom_read_lba(stream, &caps, lba, s, len, skip) : cdrom_read_lba_once(stream, &caps, lba, s, len, skip);
+
+   /* Some drives advertise the CD Read feature but reject READ CD for audio as ILLEGAL REQUEST. If READ CD MSF
+    * works instead, every stream of the drive sticks to it from now on. Other errors, like a scratch, are not
+    * the command's fault. */
+   if (rv && caps.valid && caps.read_command == 0xBE && stream->cdrom.sense_key == 0x5)
+   {
+      caps.read_command = 0xB9;
+      rv = retry ? cdrom_read_lba(stream, &caps, lba, s, len, skip) : cdrom_read_lba_once(stream, &caps, lba, s, len, skip);
+
+      if (!rv)
+      {
+         if (cdrom->builder.active)
+            slock_lock(cdrom->builder.lock);
+
+         cdrom->toc.caps.read_command = 0xB9;
+
+         if (cdrom->builder.active)
+            slock_unlock(cdrom->builder.lock);
+      }
+   }
+
+   return rv;
+}
+
+static void vfs_cdrom_toc_builder_thread(void *data)
+{
+   vfs_cdrom_toc_builder_t *builder = (vfs_cdrom_toc_builder_t*)data;
+   cdrom_toc_t *scratch = (cdrom_toc_t*)malloc(sizeof(*scratch));
+   cdrom_group_timeouts_t timeouts = {0};
+   char *cue_buf = NULL;
+   size_t cue_len = 0;
+   bool cancel = false;
+   int i;
+
+   if (scratch)
+   {
+      /* track info is read into a private copy so readers never see a half written entry */
+      slock_lock(builder->lock);
+      memcpy(scratch, builder->toc, sizeof(*scratch));
+      slock_unlock(builder->lock);
+
+      for (i = 0; i < scratch->num_tracks; i++)
+      {
+         bool ready;
+
+         slock_lock(builder->lock);
+         cancel = builder->cancel;
+         ready = builder->track_ready[i];
+         slock_unlock(builder->lock);
+
+         if (cancel)
+            break;
+
+         if (!ready && scratch->track[i].track_num)
+            cdrom_read_track_info(builder->stream, i + 1, scratch);
+
+         slock_lock(builder->lock);
+         if (!ready)
+         {
+            /* only the fields READ TRACK INFORMATION provides, the rest is already published */
+            builder->toc->track[i].lba_start = scratch->track[i].lba_start;
+            builder->toc->track[i].track_size = scratch->track[i].track_size;
+            builder->toc->track[i].track_bytes = scratch->track[i].track_bytes;
+            builder->toc->track[i].mode = scratch->track[i].mode;
+         }
+         builder->track_ready[i] = true;
+         scond_broadcast(builder->cond);
+         slock_unlock(builder->lock);
+      }
+
+      if (!cancel)
+      {
+         cdrom_get_timeouts(builder->stream, &timeouts);
+         cdrom_write_cue_sheet(scratch, builder->drive, &cue_buf, &cue_len);
+      }
+
+      free(scratch);
+   }
+
+   slock_lock(builder->lock);
+   if (!cancel)
+      builder->toc->timeouts = timeouts;
+   builder->cue_buf = cue_buf;
+   builder->cue_len = cue_len;
+   builder->done = true;
+   scond_broadcast(builder->cond);
+   slock_unlock(builder->lock);
+
+#ifdef CDROM_DEBUG
+   printf("[CDROM] TOC builder finished (%s)\n", cancel ? "cancelled" : "complete");
+   fflush(stdout);
+#endif
+}
+
+#ifndef _WIN32
+/* drives 0-9 are /dev/sg0-9, letters have no device and are only there for transports */
+static bool vfs_cdrom_is_drive_name(char drive)
+{
+   return (drive >= '0' && drive <= '9') || (drive >= 'A' && drive <= 'Z');
+}
+#endif
+
+char retro_vfs_file_cdrom_get_drive(const char *path)
+{
+   const char *cdrom_prefix = "cdrom://";
+   size_t prefix_len = strlen(cdrom_prefix);
+
+   if (strncmp(path, cdrom_prefix, prefix_len))
+      return 0;
+
+   path += prefix_len;
+
+#ifdef _WIN32
+   if (strlen(path) >= strlen("d:/drive.cue") && !memcmp(path + 1, ":/drive", strlen(":/drive")))
+      return path[0];
+#else
+   if (strlen(path) >= strlen("drive1.cue") && !memcmp(path, "drive", strlen("drive")) && vfs_cdrom_is_drive_name(path[5]))
+      return path[5];
+#endif
+
+   return 0;
+}
+
+bool retro_vfs_file_cdrom_toc_begin(const char *path)
+{
+   char track_path[64] = {0};
+   libretro_vfs_implementation_file *stream = NULL;
+   char drive = retro_vfs_file_cdrom_get_drive(path);
+   cdrom_toc_t *toc = &vfs_cdrom_get_drive(drive)->toc;
+   vfs_cdrom_toc_builder_t *builder = &vfs_cdrom_get_drive(drive)->builder;
+   int i;
+
+   if (!drive)
+      return false;
+
+   retro_vfs_file_cdrom_toc_end(drive);
+
+   cdrom_device_fillpath(track_path, sizeof(track_path), drive, 1, false);
+
+   stream = retro_vfs_file_open_impl(track_path, RETRO_VFS_FILE_ACCESS_READ, 0);
+
+   if (!stream)
+      return false;
+
+   if (cdrom_read_toc(stream, toc))
+   {
+      retro_vfs_file_close_impl(stream);
+      return false;
+   }
+
+   toc->drive = drive;
+   cdrom_get_drive_caps(stream, &toc->caps);
+
+   memset(builder, 0, sizeof(*builder));
+
+   builder->stream = stream;
+   builder->toc = toc;
+   builder->drive = drive;
+
+   /* only the first audio track is needed to start playing */
+   for (i = 0; i < toc->num_tracks; i++)
+   {
+      if (toc->track[i].audio && toc->track[i].track_num)
+      {
+         cdrom_read_track_info(stream, i + 1, toc);
+         builder->track_ready[i] = true;
+         break;
+      }
+   }
+
+   builder->lock = slock_new();
+   builder->cond = scond_new();
+   builder->active = true;
+
+   if (builder->lock && builder->cond)
+      builder->thread = sthread_create(vfs_cdrom_toc_builder_thread, builder);
+
+   /* no threads available, finish the TOC right here */
+   if (!builder->thread)
+      vfs_cdrom_toc_builder_thread(builder);
+
+   return true;
+}
+
+bool retro_vfs_file_cdrom_toc_wait_track(char drive, unsigned char track)
+{
+   vfs_cdrom_toc_builder_t *builder = &vfs_cdrom_get_drive(drive)->builder;
+   bool ready;
+
+   if (!builder->active)
+      return true;
+
+   if (track < 1 || track > 99)
+      return false;
+
+   slock_lock(builder->lock);
+   while (!builder->track_ready[track - 1] && !builder->done)
+      scond_wait(builder->cond, builder->lock);
+   ready = builder->track_ready[track - 1];
+   slock_unlock(builder->lock);
+
+   return ready;
+}
+
+bool retro_vfs_file_cdrom_toc_track_ready(char drive, unsigned char track)
+{
+   vfs_cdrom_toc_builder_t *builder = &vfs_cdrom_get_drive(drive)->builder;
+   bool ready;
+
+   if (!builder->active)
+      return true;
+
+   if (track < 1 || track > 99)
+      return false;
+
+   slock_lock(builder->lock);
+   ready = builder->track_ready[track - 1];
+   slock_unlock(builder->lock);
+
+   return ready;
+}
+
+void retro_vfs_file_cdrom_toc_end(char drive)
+{
+   vfs_cdrom_toc_builder_t *builder = &vfs_cdrom_get_drive(drive)->builder;
+
+   if (!builder->active)
+      return;
+
+   if (builder->thread)
+   {
+      slock_lock(builder->lock);
+      builder->cancel = true;
+      slock_unlock(builder->lock);
+
+      sthread_join(builder->thread);
+   }
+
+   if (builder->stream)
+      retro_vfs_file_close_impl(builder->stream);
+
+   if (builder->cond)
+      scond_free(builder->cond);
+   if (builder->lock)
+      slock_free(builder->lock);
+   if (builder->cue_buf)
+      free(builder->cue_buf);
+
+   memset(builder, 0, sizeof(*builder));
+}
+
+/* hands the cue sheet of a running incremental build to a stream opening the same drive's cue */
+static bool vfs_cdrom_toc_builder_get_cue(libretro_vfs_implementation_file *stream)
+{
+   vfs_cdrom_toc_builder_t *builder = &vfs_cdrom_get_drive(stream->cdrom.drive)->builder;
+   bool found = false;
+
+   if (!builder->active || builder->drive != stream->cdrom.drive)
+      return false;
+
+   slock_lock(builder->lock);
+   while (!builder->done)
+      scond_wait(builder->cond, builder->lock);
+
+   if (builder->cue_buf)
+   {
+      stream->cdrom.cue_buf = (char*)malloc(builder->cue_len);
+
+      if (stream->cdrom.cue_buf)
+      {
+         memcpy(stream->cdrom.cue_buf, builder->cue_buf, builder->cue_len);
+         stream->cdrom.cue_len = builder->cue_len;
+         found = true;
+      }
+   }
+   slock_unlock(builder->lock);
+
+   return found;
+}
+
+void retro_vfs_file_cdrom_toc_invalidate(char drive)
+{
+   cdrom_toc_t *toc = &vfs_cdrom_get_drive(drive)->toc;
+
+   retro_vfs_file_cdrom_toc_end(drive);
+
+   memset(toc, 0, sizeof(*toc));
+}
+
+static retro_time_t vfs_cdrom_thread_cpu_usec(void)
+{
+#if defined(__linux__) && !defined(ANDROID)
+   struct timespec ts;
+
+   if (!clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+      return (retro_time_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+   return 0;
+}
+
+static void vfs_cdrom_media_poller_thread(void *data)
+{
+   vfs_cdrom_media_poller_t *poller = (vfs_cdrom_media_poller_t*)data;
+   retro_time_t cpu_start = vfs_cdrom_thread_cpu_usec();
+   unsigned event_failures = 0;
+   bool present = true;
+   bool waiting_ready = false;
+
+   slock_lock(poller->lock);
+
+   while (!poller->stop)
+   {
+      cdrom_media_event_t event;
+      unsigned commands = 0;
+      bool removed = false;
+      bool inserted = false;
+
+      if (poller->interval_ms)
+         scond_wait_timeout(poller->cond, poller->lock, (int64_t)poller->interval_ms * 1000);
+      else
+         scond_wait(poller->cond, poller->lock);
+
+      if (poller->stop)
+         break;
+
+      if (!poller->interval_ms)
+         continue;
+
+      slock_unlock(poller->lock);
+
+      /* drives that keep rejecting the command have no polled event support, stop asking */
+      if (event_failures < 3)
+      {
+         commands++;
+
+         if (cdrom_get_media_event(poller->stream, &event))
+            event_failures++;
+         else
+            event_failures = 0;
+      }
+
+      if (event_failures)
+      {
+         /* fall back to watching the ready state */
+         bool ready = cdrom_is_media_inserted(poller->stream);
+
+         commands++;
+
+         removed = present && !ready;
+         inserted = !present && ready;
+      }
+      else
+      {
+         bool now_present = event.media_present && !event.tray_open;
+
+         removed = present && (!now_present || event.code == CDROM_MEDIA_EVENT_MEDIA_REMOVAL || event.code == CDROM_MEDIA_EVENT_MEDIA_CHANGED);
+
+         if (removed || event.code == CDROM_MEDIA_EVENT_NEW_MEDIA || (!present && now_present))
+            waiting_ready = now_present || event.code == CDROM_MEDIA_EVENT_NEW_MEDIA;
+
+         /* a disc that was just inserted is not readable until it has spun up */
+         if (waiting_ready)
+         {
+            commands++;
+
+            if (cdrom_is_media_inserted(poller->stream))
+            {
+               waiting_ready = false;
+               inserted = true;
+            }
+         }
+      }
+
+      slock_lock(poller->lock);
+
+      poller->commands += commands;
+
+      if (removed)
+         present = false;
+
+      if (inserted)
+         present = true;
+
+      if (removed || inserted)
+      {
+         poller->events++;
+         poller->present = present;
+         poller->changed = true;
+      }
+   }
+
+   poller->cpu_usec = vfs_cdrom_thread_cpu_usec() - cpu_start;
+
+   slock_unlock(poller->lock);
+}
+
+bool retro_vfs_file_cdrom_media_poll_begin(char drive, unsigned interval_ms)
+{
+   char track_path[64] = {0};
+   vfs_cdrom_media_poller_t *poller = &vfs_cdrom_get_drive(drive)->poller;
+
+   retro_vfs_file_cdrom_media_poll_end(drive, NULL);
+
+   cdrom_device_fillpath(track_path, sizeof(track_path), drive, 1, false);
+
+   memset(poller, 0, sizeof(*poller));
+
+   poller->stream = retro_vfs_file_open_impl(track_path, RETRO_VFS_FILE_ACCESS_READ, 0);
+
+   if (!poller->stream)
+      return false;
+
+   poller->lock = slock_new();
+   poller->cond = scond_new();
+   poller->interval_ms = interval_ms;
+   poller->present = true;
+   poller->start_usec = cpu_features_get_time_usec();
+   poller->active = true;
+
+   if (poller->lock && poller->cond)
+      poller->thread = sthread_create(vfs_cdrom_media_poller_thread, poller);
 
-const cdrom_toc_t* retro_vfs_file_get_cdrom_toc(void)
+   if (!poller->thread)
+   {
+      retro_vfs_file_cdrom_media_poll_end(drive, NULL);
+      return false;
+   }
+
+   return true;
+}
+
+void retro_vfs_file_cdrom_media_poll_set_interval(char drive, unsigned interval_ms)
+{
+   vfs_cdrom_media_poller_t *poller = &vfs_cdrom_get_drive(drive)->poller;
+
+   if (!poller->active)
+      return;
+
+   slock_lock(poller->lock);
+   poller->interval_ms = interval_ms;
+   scond_signal(poller->cond);
+   slock_unlock(poller->lock);
+}
+
+bool retro_vfs_file_cdrom_media_changed(char drive, bool *present)
+{
+   vfs_cdrom_media_poller_t *poller = &vfs_cdrom_get_drive(drive)->poller;
+   bool changed;
+
+   if (!poller->active)
+      return false;
+
+   slock_lock(poller->lock);
+   changed = poller->changed;
+   poller->changed = false;
+   *present = poller->present;
+   slock_unlock(poller->lock);
+
+   return changed;
+}
+
+void retro_vfs_file_cdrom_media_poll_end(char drive, retro_vfs_cdrom_media_poll_stats_t *stats)
 {
-   return &vfs_cdrom_toc;
+   vfs_cdrom_media_poller_t *poller = &vfs_cdrom_get_drive(drive)->poller;
+
+   if (stats)
+      memset(stats, 0, sizeof(*stats));
+
+   if (!poller->active)
+      return;
+
+   if (poller->thread)
+   {
+      slock_lock(poller->lock);
+      poller->stop = true;
+      scond_signal(poller->cond);
+      slock_unlock(poller->lock);
+
+      sthread_join(poller->thread);
+   }
+
+   if (stats)
+   {
+      stats->commands = poller->commands;
+      stats->events = poller->events;
+      stats->cpu_usec = poller->cpu_usec;
+      stats->elapsed_usec = cpu_features_get_time_usec() - poller->start_usec;
+   }
+
+   if (poller->stream)
+      retro_vfs_file_close_impl(poller->stream);
+   if (poller->cond)
+      scond_free(poller->cond);
+   if (poller->lock)
+      slock_free(poller->lock);
+
+   memset(poller, 0, sizeof(*poller));
 }
 
 int64_t retro_vfs_file_seek_cdrom(libretro_vfs_implementation_file *stream, int64_t offset, int whence)
 {
    const char *ext = path_get_extension(stream->orig_path);
+   const cdrom_toc_t *toc = &vfs_cdrom_get_drive(stream->cdrom.drive)->toc;
 
    if (string_is_equal_noncase(ext, "cue"))
    {
@@ -78,7 +672,7 @@ int64_t retro_vfs_file_seek_cdrom(libretro_vfs_implementation_file *stream, int6
             unsigned new_lba;
 
             stream->cdrom.byte_pos += offset;
-            new_lba = vfs_cdrom_toc.track[stream->cdrom.cur_track - 1].lba + (stream->cdrom.byte_pos / 2352);
+            new_lba = toc->track[stream->cdrom.cur_track - 1].lba + (stream->cdrom.byte_pos / 2352);
             seek_type = "SEEK_CUR";
 
             cdrom_lba_to_msf(new_lba, &min, &sec, &frame);
@@ -87,8 +681,8 @@ int64_t retro_vfs_file_seek_cdrom(libretro_vfs_implementation_file *stream, int6
          }
          case SEEK_END:
          {
-            ssize_t pregap_lba_len = (vfs_cdrom_toc.track[stream->cdrom.cur_track - 1].audio ? 0 : (vfs_cdrom_toc.track[stream->cdrom.cur_track - 1].lba - vfs_cdrom_toc.track[stream->cdrom.cur_track - 1].lba_start));
-            ssize_t lba_len = vfs_cdrom_toc.track[stream->cdrom.cur_track - 1].track_size - pregap_lba_len;
+            ssize_t pregap_lba_len = (toc->track[stream->cdrom.cur_track - 1].audio ? 0 : (toc->track[stream->cdrom.cur_track - 1].lba - toc->track[stream->cdrom.cur_track - 1].lba_start));
+            ssize_t lba_len = toc->track[stream->cdrom.cur_track - 1].track_size - pregap_lba_len;
 
             cdrom_lba_to_msf(lba_len + lba, &min, &sec, &frame);
 
@@ -102,7 +696,7 @@ int64_t retro_vfs_file_seek_cdrom(libretro_vfs_implementation_file *stream, int6
          {
             seek_type = "SEEK_SET";
             stream->cdrom.byte_pos = offset;
-            cdrom_lba_to_msf(vfs_cdrom_toc.track[stream->cdrom.cur_track - 1].lba + (stream->cdrom.byte_pos / 2352), &min, &sec, &frame);
+            cdrom_lba_to_msf(toc->track[stream->cdrom.cur_track - 1].lba + (stream->cdrom.byte_pos / 2352), &min, &sec, &frame);
             break;
          }
       }
@@ -123,10 +717,46 @@ int64_t retro_vfs_file_seek_cdrom(libretro_vfs_implementation_file *stream, int6
    return 0;
 }
 
+/* opens the drive itself, or asks the transport for it if one is set */
+static bool vfs_cdrom_open_device(libretro_vfs_implementation_file *stream, const char *cdrom_path)
+{
+   const cdrom_transport_t *transport = cdrom_get_transport(stream->cdrom.drive);
+
+   if (transport)
+   {
+      stream->cdrom.transport_handle = transport->open(transport->data, stream->cdrom.drive);
+
+      return stream->cdrom.transport_handle != NULL;
+   }
+
+#if defined(_WIN32) && !defined(_XBOX)
+   if (stream->cdrom.drive >= '0' && stream->cdrom.drive <= '9')
+      return false;
+
+   stream->fh = CreateFile(cdrom_path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+   if (stream->fh == INVALID_HANDLE_VALUE)
+   {
+      stream->fh = NULL;
+      return false;
+   }
+
+   return true;
+#else
+   if (stream->cdrom.drive >= 'A' && stream->cdrom.drive <= 'Z')
+      return false;
+
+   stream->fp = (FILE*)fopen_utf8(cdrom_path, "r+b");
+
+   return stream->fp != NULL;
+#endif
+}
+
 void retro_vfs_file_open_cdrom(
       libretro_vfs_implementation_file *stream,
       const char *path, unsigned mode, unsigned hints)
 {
+   cdrom_toc_t *toc = NULL;
 #if defined(__linux__) && !defined(ANDROID)
    char cdrom_path[] = "/dev/sg1";
    size_t path_len = strlen(path);
@@ -158,11 +788,10 @@ void retro_vfs_file_open_cdrom(
    {
       if (!memcmp(path, "drive", strlen("drive")))
       {
-         if (path[5] >= '0' && path[5] <= '9')
+         if (vfs_cdrom_is_drive_name(path[5]))
          {
             cdrom_path[7] = path[5];
             stream->cdrom.drive = path[5];
-            vfs_cdrom_toc.drive = stream->cdrom.drive;
          }
       }
    }
@@ -171,9 +800,7 @@ void retro_vfs_file_open_cdrom(
    printf("[CDROM] Open: Path %s URI %s\n", cdrom_path, path);
    fflush(stdout);
 #endif
-   stream->fp = (FILE*)fopen_utf8(cdrom_path, "r+b");
-
-   if (!stream->fp)
+   if (!vfs_cdrom_open_device(stream, cdrom_path))
       return;
 
    if (string_is_equal_noncase(ext, "cue"))
@@ -184,8 +811,15 @@ void retro_vfs_file_open_cdrom(
          stream->cdrom.cue_buf = NULL;
       }
 
-      cdrom_write_cue(stream, &stream->cdrom.cue_buf, &stream->cdrom.cue_len, stream->cdrom.drive, &vfs_cdrom_toc.num_tracks, &vfs_cdrom_toc);
-      cdrom_get_timeouts(stream, &vfs_cdrom_toc.timeouts);
+      if (!vfs_cdrom_toc_builder_get_cue(stream))
+      {
+         toc = &vfs_cdrom_get_drive(stream->cdrom.drive)->toc;
+         toc->drive = stream->cdrom.drive;
+
+         cdrom_write_cue(stream, &stream->cdrom.cue_buf, &stream->cdrom.cue_len, stream->cdrom.drive, &toc->num_tracks, toc);
+         cdrom_get_timeouts(stream, &toc->timeouts);
+         cdrom_get_drive_caps(stream, &toc->caps);
+      }
 
 #ifdef CDROM_DEBUG
       if (string_is_empty(stream->cdrom.cue_buf))
@@ -227,11 +861,11 @@ void retro_vfs_file_open_cdrom(
    {
       if (!memcmp(path + 1, ":/drive", strlen(":/drive")))
       {
-         if ((path[0] >= 'A' && path[0] <= 'Z') || (path[0] >= 'a' && path[0] <= 'z'))
+         /* digits have no device and are only there for transports */
+         if ((path[0] >= 'A' && path[0] <= 'Z') || (path[0] >= 'a' && path[0] <= 'z') || (path[0] >= '0' && path[0] <= '9'))
          {
             cdrom_path[4] = path[0];
             stream->cdrom.drive = path[0];
-            vfs_cdrom_toc.drive = stream->cdrom.drive;
          }
       }
    }
@@ -240,9 +874,7 @@ void retro_vfs_file_open_cdrom(
    printf("[CDROM] Open: Path %s URI %s\n", cdrom_path, path);
    fflush(stdout);
 #endif
-   stream->fh = CreateFile(cdrom_path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-
-   if (stream->fh == INVALID_HANDLE_VALUE)
+   if (!vfs_cdrom_open_device(stream, cdrom_path))
       return;
 
    if (string_is_equal_noncase(ext, "cue"))
@@ -253,8 +885,15 @@ void retro_vfs_file_open_cdrom(
          stream->cdrom.cue_buf = NULL;
       }
 
-      cdrom_write_cue(stream, &stream->cdrom.cue_buf, &stream->cdrom.cue_len, stream->cdrom.drive, &vfs_cdrom_toc.num_tracks, &vfs_cdrom_toc);
-      cdrom_get_timeouts(stream, &vfs_cdrom_toc.timeouts);
+      if (!vfs_cdrom_toc_builder_get_cue(stream))
+      {
+         toc = &vfs_cdrom_get_drive(stream->cdrom.drive)->toc;
+         toc->drive = stream->cdrom.drive;
+
+         cdrom_write_cue(stream, &stream->cdrom.cue_buf, &stream->cdrom.cue_len, stream->cdrom.drive, &toc->num_tracks, toc);
+         cdrom_get_timeouts(stream, &toc->timeouts);
+         cdrom_get_drive_caps(stream, &toc->caps);
+      }
 
 #ifdef CDROM_DEBUG
       if (string_is_empty(stream->cdrom.cue_buf))
@@ -270,18 +909,24 @@ void retro_vfs_file_open_cdrom(
 #endif
    }
 #endif
-   if (vfs_cdrom_toc.num_tracks > 1 && stream->cdrom.cur_track)
+   /* a track can be opened while the rest of the TOC is still being built */
+   if (stream->cdrom.cur_track)
+      retro_vfs_file_cdrom_toc_wait_track(stream->cdrom.drive, stream->cdrom.cur_track);
+
+   toc = &vfs_cdrom_get_drive(stream->cdrom.drive)->toc;
+
+   if (toc->num_tracks > 1 && stream->cdrom.cur_track)
    {
-      stream->cdrom.cur_min = vfs_cdrom_toc.track[stream->cdrom.cur_track - 1].min;
-      stream->cdrom.cur_sec = vfs_cdrom_toc.track[stream->cdrom.cur_track - 1].sec;
-      stream->cdrom.cur_frame = vfs_cdrom_toc.track[stream->cdrom.cur_track - 1].frame;
+      stream->cdrom.cur_min = toc->track[stream->cdrom.cur_track - 1].min;
+      stream->cdrom.cur_sec = toc->track[stream->cdrom.cur_track - 1].sec;
+      stream->cdrom.cur_frame = toc->track[stream->cdrom.cur_track - 1].frame;
       stream->cdrom.cur_lba = cdrom_msf_to_lba(stream->cdrom.cur_min, stream->cdrom.cur_sec, stream->cdrom.cur_frame);
    }
    else
    {
-      stream->cdrom.cur_min = vfs_cdrom_toc.track[0].min;
-      stream->cdrom.cur_sec = vfs_cdrom_toc.track[0].sec;
-      stream->cdrom.cur_frame = vfs_cdrom_toc.track[0].frame;
+      stream->cdrom.cur_min = toc->track[0].min;
+      stream->cdrom.cur_sec = toc->track[0].sec;
+      stream->cdrom.cur_frame = toc->track[0].frame;
       stream->cdrom.cur_lba = cdrom_msf_to_lba(stream->cdrom.cur_min, stream->cdrom.cur_sec, stream->cdrom.cur_frame);
    }
 }
@@ -293,6 +938,17 @@ int retro_vfs_file_close_cdrom(libretro_vfs_implementation_file *stream)
    fflush(stdout);
 #endif
 
+   if (stream->cdrom.transport_handle)
+   {
+      const cdrom_transport_t *transport = cdrom_get_transport(stream->cdrom.drive);
+
+      if (transport)
+         transport->close(transport->data, stream->cdrom.transport_handle);
+
+      stream->cdrom.transport_handle = NULL;
+      return 0;
+   }
+
 #if defined(_WIN32) && !defined(_XBOX)
    if (!stream->fh || !CloseHandle(stream->fh))
       return -1;
@@ -337,6 +993,7 @@ int64_t retro_vfs_file_read_cdrom(libretro_vfs_implementation_file *stream,
 {
    int rv;
    const char *ext = path_get_extension(stream->orig_path);
+   cdrom_toc_t *toc = &vfs_cdrom_get_drive(stream->cdrom.drive)->toc;
 
    if (string_is_equal_noncase(ext, "cue"))
    {
@@ -370,22 +1027,21 @@ int64_t retro_vfs_file_read_cdrom(libretro_vfs_implementation_file *stream,
       unsigned char rsec = 0;
       unsigned char rframe = 0;
 
-      if (stream->cdrom.byte_pos >= vfs_cdrom_toc.track[stream->cdrom.cur_track - 1].track_bytes)
+      if (stream->cdrom.byte_pos >= toc->track[stream->cdrom.cur_track - 1].track_bytes)
          return 0;
 
-      if (stream->cdrom.byte_pos + len > vfs_cdrom_toc.track[stream->cdrom.cur_track - 1].track_bytes)
-         len -= (stream->cdrom.byte_pos + len) - vfs_cdrom_toc.track[stream->cdrom.cur_track - 1].track_bytes;
+      if (stream->cdrom.byte_pos + len > toc->track[stream->cdrom.cur_track - 1].track_bytes)
+         len -= (stream->cdrom.byte_pos + len) - toc->track[stream->cdrom.cur_track - 1].track_bytes;
 
       cdrom_lba_to_msf(stream->cdrom.cur_lba, &min, &sec, &frame);
-      cdrom_lba_to_msf(stream->cdrom.cur_lba - vfs_cdrom_toc.track[stream->cdrom.cur_track - 1].lba, &rmin, &rsec, &rframe);
+      cdrom_lba_to_msf(stream->cdrom.cur_lba - toc->track[stream->cdrom.cur_track - 1].lba, &rmin, &rsec, &rframe);
 
 #ifdef CDROM_DEBUG
       printf("[CDROM] Read: Reading %" PRIu64 " bytes from %s starting at byte offset %" PRIu64 " (rMSF %02u:%02u:%02u aMSF %02u:%02u:%02u) (LBA %u) skip %" PRIu64 "...\n", len, stream->orig_path, stream->cdrom.byte_pos, (unsigned)rmin, (unsigned)rsec, (unsigned)rframe, (unsigned)min, (unsigned)sec, (unsigned)frame, stream->cdrom.cur_lba, skip);
       fflush(stdout);
 #endif
 
-      rv = cdrom_read(stream, &vfs_cdrom_toc.timeouts, min, sec, frame, s, (size_t)len, skip);
-      /*rv = cdrom_read_lba(stream, stream->cdrom.cur_lba, s, (size_t)len, skip);*/
+      rv = retro_vfs_file_cdrom_read_lba(stream, stream->cdrom.cur_lba, s, (size_t)len, skip, true);
 
       if (rv)
       {
@@ -397,7 +1053,7 @@ int64_t retro_vfs_file_read_cdrom(libretro_vfs_implementation_file *stream,
       }
 
       stream->cdrom.byte_pos += len;
-      stream->cdrom.cur_lba = vfs_cdrom_toc.track[stream->cdrom.cur_track - 1].lba + (stream->cdrom.byte_pos / 2352);
+      stream->cdrom.cur_lba = toc->track[stream->cdrom.cur_track - 1].lba + (stream->cdrom.byte_pos / 2352);
 
       cdrom_lba_to_msf(stream->cdrom.cur_lba, &stream->cdrom.cur_min, &stream->cdrom.cur_sec, &stream->cdrom.cur_frame);
 
@@ -23,6 +23,8 @@ You may obtain a copy of the License at
 
 #include <retro_miscellaneous.h>
 #include <streams/file_stream.h>
+#include <file/file_path.h>
+#include <features/features_cpu.h>
 
 #ifdef STANDALONE
 //#define SDL_MAIN_HANDLED
@@ -30,12 +32,11 @@ You may obtain a copy of the License at
 #endif
 
 #include <libretro.h>
+#include <cdrom/cdrom_trace.h>
 #include "redbook.h"
-#include "ugui_tools.h"
 
 #define VIDEO_WIDTH 320
 #define VIDEO_HEIGHT 240
-#define VIDEO_PIXELS VIDEO_WIDTH * VIDEO_HEIGHT
 
 #define DESC_NUM_PORTS(desc) ((desc)->port_max - (desc)->port_min + 1)
 #define DESC_NUM_INDICES(desc) ((desc)->index_max - (desc)->index_min + 1)
@@ -49,12 +50,18 @@ You may obtain a copy of the License at
    id \
 )
 
-static uint32_t *frame_buf = NULL;
+static redbook_t *redbook = NULL;
 static struct retro_log_callback logging = {0};
-static retro_log_printf_t log_cb;
+retro_log_printf_t log_cb;
+static retro_audio_sample_batch_t audio_batch_cb;
+static retro_audio_sample_t audio_cb;
+static retro_video_refresh_t video_cb;
+struct retro_perf_callback perf_cb = {0};
 /*static bool use_audio_cb;*/
 static float last_aspect = 0.0f;
 static float last_sample_rate = 0.0f;
+static unsigned video_fps = 60;
+static bool game_loaded = false;
 static retro_environment_t environ_cb = NULL;
 static char retro_base_directory[4096] = {0};
 static retro_input_poll_t input_poll_cb = NULL;
@@ -64,7 +71,6 @@ static struct retro_rumble_interface rumble;
 static unsigned phase;
 static int mouse_rel_x;
 static int mouse_rel_y;*/
-static char *cue_sheet = NULL;
 
 struct descriptor
 {
@@ -135,14 +141,70 @@ static size_t audio_sample_batch(const int16_t *data, size_t frames)
 }
 #endif
 
+/* the core runs a single player, which hands its frames straight to the frontend */
+static void redbook_video(void *data, const uint32_t *buf, unsigned width, unsigned height, size_t pitch)
+{
+   (void)data;
+
+   if (video_cb)
+      video_cb(buf, width, height, pitch);
+}
+
+static size_t redbook_audio(void *data, const int16_t *buf, size_t frames)
+{
+   (void)data;
+
+   return audio_batch_cb ? audio_batch_cb(buf, frames) : 0;
+}
+
+/* Stand-ins for frontends without a perf interface, so stage timings still reach the core's log. */
+static void RETRO_CALLCONV fallback_perf_register(struct retro_perf_counter *counter)
+{
+   counter->registered = true;
+}
+
+static void RETRO_CALLCONV fallback_perf_start(struct retro_perf_counter *counter)
+{
+   counter->start = cpu_features_get_perf_counter();
+}
+
+static void RETRO_CALLCONV fallback_perf_stop(struct retro_perf_counter *counter)
+{
+   counter->total += cpu_features_get_perf_counter() - counter->start;
+   counter->call_cnt++;
+}
+
+static void RETRO_CALLCONV fallback_perf_log(void)
+{
+}
+
+static void init_perf_interface(void)
+{
+   if (environ_cb && environ_cb(RETRO_ENVIRONMENT_GET_PERF_INTERFACE, &perf_cb) && perf_cb.perf_register && perf_cb.perf_start && perf_cb.perf_stop)
+   {
+      if (!perf_cb.get_cpu_features)
+         perf_cb.get_cpu_features = cpu_features_get;
+      if (!perf_cb.perf_log)
+         perf_cb.perf_log = fallback_perf_log;
+      return;
+   }
+
+   perf_cb.get_time_usec = cpu_features_get_time_usec;
+   perf_cb.get_cpu_features = cpu_features_get;
+   perf_cb.get_perf_counter = cpu_features_get_perf_counter;
+   perf_cb.perf_register = fallback_perf_register;
+   perf_cb.perf_start = fallback_perf_start;
+   perf_cb.perf_stop = fallback_perf_stop;
+   perf_cb.perf_log = fallback_perf_log;
+}
+
 void retro_init(void)
 {
    const char *dir = NULL;
    int size = 0;
    struct descriptor *desc = NULL;
    int i;
-
-   frame_buf = (uint32_t*)calloc(1, VIDEO_PIXELS * sizeof(uint32_t));
+   redbook_output_t output = { redbook_video, redbook_audio, NULL };
 
    if (environ_cb && environ_cb(RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY, &dir) && dir && *dir)
    {
@@ -157,16 +219,21 @@ void retro_init(void)
       descriptors[i]->value = (uint16_t*)calloc(size, sizeof(uint16_t));
    }
 
-   redbook_init(VIDEO_WIDTH, VIDEO_HEIGHT, frame_buf);
+   init_perf_interface();
+   redbook_kernels_init(perf_cb.get_cpu_features());
+
+   redbook = redbook_new(VIDEO_WIDTH, VIDEO_HEIGHT, &output);
+
+   if (!redbook && log_cb)
+      log_cb(RETRO_LOG_ERROR, "[Redbook] Could not create the player\n");
 }
 
 void retro_deinit(void)
 {
    int i;
 
-   redbook_free();
-   free(frame_buf);
-   frame_buf = NULL;
+   redbook_free(redbook);
+   redbook = NULL;
 
    /* Free descriptor values */
    for (i = 0; i < ARRAY_SIZE(descriptors); i++)
@@ -198,9 +265,9 @@ void retro_get_system_info(struct retro_system_info *info)
 void retro_get_system_av_info(struct retro_system_av_info *info)
 {
    float aspect                = (float)VIDEO_WIDTH / (float)VIDEO_HEIGHT;
-   float sampling_rate         = 44100.0f;
+   float sampling_rate         = (float)REDBOOK_SAMPLE_RATE;
 
-   info->timing.fps            = 60.0f;
+   info->timing.fps            = (double)video_fps;
    info->timing.sample_rate    = sampling_rate;
 
    info->geometry.base_width   = VIDEO_WIDTH;
@@ -228,6 +295,21 @@ void retro_set_environment(retro_environment_t cb)
       { NULL, 0 },
    };
 
+   static const struct retro_variable vars[] =
+   {
+      { "redbook_media_poll_interval", "Disc change check interval; 1000 ms|250 ms|500 ms|2000 ms|5000 ms|disabled" },
+      { "redbook_fps", "Screen refresh rate; 60|30|20|15|10" },
+      { "redbook_meter_smoothing", "Smooth level meters; disabled|enabled" },
+      { "redbook_crossfade", "Crossfade between tracks; disabled|1 s|2 s|3 s|5 s|10 s" },
+      { "redbook_normalization", "Volume normalization; disabled|track|album" },
+      { "redbook_silence", "Long silences; play|shorten|skip" },
+      { "redbook_speed", "Playback speed; 1.0x|0.5x|0.75x|1.25x|1.5x|2.0x" },
+      { "redbook_verify", "Verify discs with AccurateRip; disabled|enabled" },
+      { "redbook_read_offset", "Drive read offset correction; 0|+6|+30|+48|+97|+102|+103|+667|+685|+738|-472" },
+      { "redbook_rip", "Rip discs to WAV; disabled|enabled" },
+      { NULL, NULL },
+   };
+
    environ_cb = cb;
 
    if (cb(RETRO_ENVIRONMENT_GET_LOG_INTERFACE, &logging))
@@ -237,6 +319,7 @@ void retro_set_environment(retro_environment_t cb)
 
    cb(RETRO_ENVIRONMENT_SET_CONTROLLER_INFO, (void*)ports);
    cb(RETRO_ENVIRONMENT_SET_SUPPORT_NO_GAME, &no_content);
+   cb(RETRO_ENVIRONMENT_SET_VARIABLES, (void*)vars);
 }
 
 void retro_set_audio_sample(retro_audio_sample_t cb)
@@ -325,9 +408,166 @@ static void update_input(void)
 }
 #endif
 
+static void RETRO_CALLCONV frame_time_callback(retro_usec_t usec)
+{
+   redbook_set_frame_time(redbook, usec);
+}
+
+/* audio follows the time that actually passed between frames, not the advertised frame rate */
+static void set_frame_time_callback(void)
+{
+   struct retro_frame_time_callback frame_time = { frame_time_callback, 1000000 / video_fps };
+
+   redbook_set_frame_time(redbook, 0);
+
+   if (!environ_cb(RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK, &frame_time) && log_cb)
+      log_cb(RETRO_LOG_INFO, "[Redbook] No frame time callback, sending 1/%u s of audio per frame\n", video_fps);
+}
+
+/* Fewer frames per second means fewer redraws and wakeups, each frame then carries more audio.
+ * Once a game is loaded the frontend is told about the new rate. */
+static void set_fps(unsigned fps)
+{
+   struct retro_system_av_info info;
+
+   if (fps == video_fps)
+      return;
+
+   video_fps = fps;
+   redbook_set_fps(redbook, fps);
+
+   if (!game_loaded)
+      return;
+
+   retro_get_system_av_info(&info);
+
+   if (!environ_cb(RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO, &info) && log_cb)
+      log_cb(RETRO_LOG_WARN, "[Redbook] The frontend did not accept %u fps\n", fps);
+
+   set_frame_time_callback();
+}
+
+/* disc measurements, the track index and rips go with the saves, or the system files if there is no save directory */
+static void set_cache_path(void)
+{
+   const char *dir = NULL;
+   char path[PATH_MAX_LENGTH];
+
+   if (!environ_cb || !environ_cb(RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY, &dir) || !dir || !*dir)
+      dir = retro_base_directory;
+
+   if (!*dir)
+      return;
+
+   fill_pathname_join(path, dir, "redbook_disc_cache.txt", sizeof(path));
+   redbook_set_cache_path(redbook, path);
+
+   fill_pathname_join(path, dir, "redbook_track_index.txt", sizeof(path));
+   redbook_set_index_path(redbook, path);
+
+   fill_pathname_join(path, dir, "redbook_rip", sizeof(path));
+   redbook_set_rip_dir(redbook, path);
+
+   /* the database files are supplied by the user, like other system files */
+   if (*retro_base_directory)
+   {
+      fill_pathname_join(path, retro_base_directory, "redbook_accuraterip", sizeof(path));
+      redbook_set_accuraterip_dir(redbook, path);
+   }
+}
+
 static void check_variables(void)
 {
+   struct retro_variable var = {0};
+
+   if (!environ_cb)
+      return;
+
+   var.key = "redbook_fps";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value && atoi(var.value) > 0)
+      set_fps((unsigned)atoi(var.value));
+
+   var.key = "redbook_meter_smoothing";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      redbook_set_meter_smoothing(redbook, !strcmp(var.value, "enabled"));
+
+   var.key = "redbook_crossfade";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      redbook_set_crossfade(redbook, (unsigned)atoi(var.value) * 1000);
+
+   var.key = "redbook_normalization";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "track"))
+         redbook_set_normalization(redbook, REDBOOK_NORMALIZATION_TRACK);
+      else if (!strcmp(var.value, "album"))
+         redbook_set_normalization(redbook, REDBOOK_NORMALIZATION_ALBUM);
+      else
+         redbook_set_normalization(redbook, REDBOOK_NORMALIZATION_DISABLED);
+   }
+
+   var.key = "redbook_silence";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "shorten"))
+         redbook_set_silence(redbook, REDBOOK_SILENCE_SHORTEN);
+      else if (!strcmp(var.value, "skip"))
+         redbook_set_silence(redbook, REDBOOK_SILENCE_SKIP);
+      else
+         redbook_set_silence(redbook, REDBOOK_SILENCE_PLAY);
+   }
+
+   var.key = "redbook_speed";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      redbook_set_speed(redbook, atof(var.value));
+
+   {
+      bool verify = false;
+      int read_offset = 0;
+
+      var.key = "redbook_verify";
+      var.value = NULL;
+
+      if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+         verify = !strcmp(var.value, "enabled");
+
+      var.key = "redbook_read_offset";
+      var.value = NULL;
+
+      if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+         read_offset = atoi(var.value);
 
+      redbook_set_verify(redbook, verify, read_offset);
+   }
+
+   var.key = "redbook_rip";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      redbook_set_rip(redbook, !strcmp(var.value, "enabled"));
+
+   var.key = "redbook_media_poll_interval";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "disabled"))
+         redbook_set_media_poll_interval(redbook, 0);
+      else
+         redbook_set_media_poll_interval(redbook, atoi(var.value));
+   }
 }
 
 /*static void audio_callback(void)
@@ -349,7 +589,9 @@ void retro_run(void)
    int offset = 0;
    bool updated = false;
 
+   REDBOOK_PERF_START(redbook, REDBOOK_PERF_INPUT);
    update_input();
+   REDBOOK_PERF_STOP(redbook, REDBOOK_PERF_INPUT);
 
    /* Combine RetroPad input states into one value */
    for (i = joypad.id_min; i <= joypad.id_max; i++)
@@ -364,13 +606,36 @@ void retro_run(void)
       check_variables();
 #endif
 
-   redbook_run_frame(input_state);
+   redbook_run_frame(redbook, input_state);
+}
+
+/* Drive latency per command for this session, and the raw records if REDBOOK_CDROM_TRACE names a file.
+ * The trace covers every drive in the process, so it is kept here around the one player rather than in it. */
+static void log_cdrom_trace(void)
+{
+   char summary[4096];
+   const char *trace_path = getenv("REDBOOK_CDROM_TRACE");
+
+   if (log_cb && cdrom_trace_summary(summary, sizeof(summary)))
+      log_cb(RETRO_LOG_INFO, "[Redbook] Drive command latency:\n%s", summary);
+
+   if (trace_path && *trace_path)
+   {
+      if (cdrom_trace_dump(trace_path))
+      {
+         if (log_cb)
+            log_cb(RETRO_LOG_WARN, "[Redbook] Could not write the drive trace to %s\n", trace_path);
+      }
+      else if (log_cb)
+         log_cb(RETRO_LOG_INFO, "[Redbook] Drive trace written to %s\n", trace_path);
+   }
 }
 
 bool retro_load_game(const struct retro_game_info *info)
 {
-   int64_t len = 0;
    enum retro_pixel_format fmt = RETRO_PIXEL_FORMAT_XRGB8888;
+   /* states are the raw struct, so only load on the platform that saved them */
+   uint64_t quirks = RETRO_SERIALIZATION_QUIRK_ENDIAN_DEPENDENT | RETRO_SERIALIZATION_QUIRK_PLATFORM_DEPENDENT;
    /*struct retro_audio_callback audio_cb = { audio_callback, audio_set_state };*/
    struct retro_input_descriptor desc[] =
    {
@@ -380,12 +645,20 @@ bool retro_load_game(const struct retro_game_info *info)
       { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_RIGHT, "Right" },
       { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_A, "A" },
       { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_B, "B" },
+      { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_L, "Review" },
+      { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_R, "Cue" },
+      { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_L2, "Skip back" },
+      { 0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_R2, "Skip forward" },
       { 0 },
    };
 
+   if (!redbook)
+      return false;
+
    if (environ_cb)
    {
       environ_cb(RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS, desc);
+      environ_cb(RETRO_ENVIRONMENT_SET_SERIALIZATION_QUIRKS, &quirks);
 
       if (!environ_cb(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &fmt))
       {
@@ -398,21 +671,33 @@ bool retro_load_game(const struct retro_game_info *info)
    use_audio_cb = environ_cb(RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK, &audio_cb);*/
 
    check_variables();
+   set_cache_path();
+
+   if (environ_cb)
+      set_frame_time_callback();
 
    (void)info;
 
-   if (!filestream_read_file(info->path, (void**)&cue_sheet, &len))
+   cdrom_trace_reset();
+
+   if (!redbook_load_game(redbook, info->path))
    {
       printf("Error reading from path: %s\n", info->path);
       return false;
    }
 
+   game_loaded = true;
+
    return true;
 }
 
 void retro_unload_game(void)
 {
+   game_loaded = false;
+
+   redbook_unload_game(redbook);
 
+   log_cdrom_trace();
 }
 
 unsigned retro_get_region(void)
@@ -422,22 +707,26 @@ unsigned retro_get_region(void)
 
 bool retro_load_game_special(unsigned type, const struct retro_game_info *info, size_t num)
 {
+   (void)type;
+   (void)info;
+   (void)num;
+
    return false;
 }
 
 size_t retro_serialize_size(void)
 {
-   return false;
+   return redbook_serialize_size(redbook);
 }
 
 bool retro_serialize(void *data_, size_t size)
 {
-   return false;
+   return redbook_serialize(redbook, data_, size);
 }
 
 bool retro_unserialize(const void *data_, size_t size)
 {
-   return false;
+   return redbook_unserialize(redbook, data_, size);
 }
 
 void *retro_get_memory_data(unsigned id)
@@ -509,7 +798,7 @@ int main(int argc, char *argv[])
       retro_run();
 
       SDL_RenderClear(renderer);
-      SDL_UpdateTexture(texture, NULL, gui_get_framebuffer(), VIDEO_WIDTH * sizeof(unsigned));
+      SDL_UpdateTexture(texture, NULL, redbook_get_framebuffer(redbook), VIDEO_WIDTH * sizeof(unsigned));
       SDL_RenderCopy(renderer, texture, NULL, NULL);
       SDL_RenderPresent(renderer);
    }
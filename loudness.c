@@ -0,0 +1,863 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <libretro.h>
+#include <retro_miscellaneous.h>
+#include "loudness.h"
+#include "simd.h"
+
+#define LOUDNESS_RATE 44100
+
+/* gating blocks are 400 ms and overlap by 75%, so a new one ends every 100 ms */
+#define LOUDNESS_STEP_FRAMES (LOUDNESS_RATE / 10)
+
+/* true peak is looked for by 4x oversampling with the 48 tap interpolation filter of BS.1770 */
+#define LOUDNESS_PEAK_TAPS 12
+#define LOUDNESS_PEAK_HISTORY (LOUDNESS_PEAK_TAPS - 1)
+
+/* frames the true peak is looked at in one go, a window that cannot beat the peak so far is skipped */
+#define LOUDNESS_PEAK_WINDOW 64
+
+/* no phase of the interpolation filter gives more than this times the largest sample it looks at,
+ * the sum of the magnitudes of the taps of phases 1 and 2 */
+#define LOUDNESS_PEAK_GAIN 2.0228271484375f
+
+#define LOUDNESS_PI 3.14159265358979323846
+
+struct loudness
+{
+   /* K-weighting as two biquads in direct form I, run side by side: lanes 0 and 1 are the first stage
+    * for the left and right channel, lanes 2 and 3 the second stage, fed with what the first stage gave
+    * two frames earlier so that no lane waits for another within a frame. Frames are filtered in pairs,
+    * the second one straight from the outputs before the first, which halves the chain of operations
+    * each frame waits for: y[n + 1] = f[n + 1] - a1 f[n] + c1 y[n - 1] + c2 y[n - 2]. */
+   float b0[4], b1[4], b2[4], a1[4], a2[4];
+   float c1[4], c2[4];
+   float x1[4], x2[4];
+   float y1[4], y2[4];
+
+   /* the interpolation filter folded with its mirror image, phases 0 and 3 first, then 1 and 2 */
+   float peak_sum[2][LOUDNESS_PEAK_TAPS / 2];
+   float peak_diff[2][LOUDNESS_PEAK_TAPS / 2];
+   float peak_history[2][LOUDNESS_PEAK_HISTORY];
+   float peak;             /* of the current track, in sample values */
+   float album_peak;
+
+   double step_energy;     /* of the 100 ms step being added up */
+   float steps[3];         /* the steps before it, a gating block is four of them */
+   unsigned step_frames;
+   unsigned num_steps;
+
+   float *blocks;          /* mean square of every gating block so far, 1.0 is a full scale square wave */
+   size_t num_blocks;
+   size_t max_blocks;
+   size_t track_first_block;
+};
+
+/* Phases 0 and 1 of the interpolation filter, tap k applies to the sample k frames back. Phases 3 and 2
+ * are the same taps reversed. */
+static const double loudness_peak_phases[2][LOUDNESS_PEAK_TAPS] =
+{
+   {
+       0.0017089843750, 0.0109863281250, -0.0196533203125, 0.0332031250000, -0.0594482421875, 0.1373291015625,
+       0.9721679687500, -0.1022949218750, 0.0476074218750, -0.0266113281250, 0.0148925781250, -0.0083007812500,
+   },
+   {
+      -0.0291748046875, 0.0292968750000, -0.0517578125000, 0.0891113281250, -0.1665039062500, 0.4650878906250,
+       0.7797851562500, -0.2003173828125, 0.1015625000000, -0.0582275390625, 0.0330810546875, -0.0189208984375,
+   },
+};
+
+/* K-weights frames and returns the sum of the squares of both channels */
+typedef float (*loudness_filter_t)(loudness_t *loudness, const int16_t *samples, size_t frames);
+
+/* Returns twice the largest interpolated magnitude of frames samples of one channel, x[-11] to x[-1]
+ * are the ones before them. A phase and its mirror image give a + b and a - b for the same a and b,
+ * so the larger of their magnitudes is |a| + |b| and both take half the multiplications. */
+typedef float (*loudness_peak_t)(const loudness_t *loudness, const float *x, size_t frames);
+
+/* splits frames into the two channels and returns the largest magnitude in them */
+typedef float (*loudness_split_t)(float *left, float *right, const int16_t *samples, size_t frames);
+
+typedef void (*loudness_gain_t)(int16_t *samples, size_t frames, float gain, float step);
+
+/* one frame on its own, for an odd one at the end */
+static void loudness_filter_frame_c(loudness_t *loudness, const int16_t *frame, float *x1, float *x2, float *y1, float *y2, float *sum)
+{
+   float x[4], y[4];
+   int j;
+
+   x[0] = frame[0];
+   x[1] = frame[1];
+   x[2] = y2[0];
+   x[3] = y2[1];
+
+   for (j = 0; j < 4; j++)
+   {
+      float f = loudness->b0[j] * x[j] + loudness->b1[j] * x1[j];
+
+      f = f + loudness->b2[j] * x2[j];
+      y[j] = (f - loudness->a2[j] * y2[j]) - loudness->a1[j] * y1[j];
+      sum[j] = sum[j] + y[j] * y[j];
+   }
+
+   memcpy(x2, x1, sizeof(x));
+   memcpy(x1, x, sizeof(x));
+   memcpy(y2, y1, sizeof(y));
+   memcpy(y1, y, sizeof(y));
+}
+
+static float loudness_filter_c(loudness_t *loudness, const int16_t *samples, size_t frames)
+{
+   float x1[4], x2[4], y1[4], y2[4];
+   float sum_a[4] = {0};
+   float sum_b[4] = {0};
+   size_t i;
+   int j;
+
+   memcpy(x1, loudness->x1, sizeof(x1));
+   memcpy(x2, loudness->x2, sizeof(x2));
+   memcpy(y1, loudness->y1, sizeof(y1));
+   memcpy(y2, loudness->y2, sizeof(y2));
+
+   for (i = 0; i + 2 <= frames; i += 2)
+   {
+      float xa[4], xb[4], ya[4], yb[4];
+
+      xa[0] = samples[(i * 2) + 0];
+      xa[1] = samples[(i * 2) + 1];
+      xa[2] = y2[0];
+      xa[3] = y2[1];
+      xb[0] = samples[(i * 2) + 2];
+      xb[1] = samples[(i * 2) + 3];
+      xb[2] = y1[0];
+      xb[3] = y1[1];
+
+      for (j = 0; j < 4; j++)
+      {
+         float fa = loudness->b0[j] * xa[j] + loudness->b1[j] * x1[j];
+         float fb = loudness->b0[j] * xb[j] + loudness->b1[j] * xa[j];
+
+         fa = fa + loudness->b2[j] * x2[j];
+         fb = fb + loudness->b2[j] * x1[j];
+         ya[j] = (fa - loudness->a2[j] * y2[j]) - loudness->a1[j] * y1[j];
+         yb[j] = ((fb - loudness->a1[j] * fa) + loudness->c1[j] * y1[j]) + loudness->c2[j] * y2[j];
+         sum_a[j] = sum_a[j] + ya[j] * ya[j];
+         sum_b[j] = sum_b[j] + yb[j] * yb[j];
+      }
+
+      memcpy(x2, xa, sizeof(x2));
+      memcpy(x1, xb, sizeof(x1));
+      memcpy(y2, ya, sizeof(y2));
+      memcpy(y1, yb, sizeof(y1));
+   }
+
+   if (i < frames)
+      loudness_filter_frame_c(loudness, samples + i * 2, x1, x2, y1, y2, sum_a);
+
+   memcpy(loudness->x1, x1, sizeof(x1));
+   memcpy(loudness->x2, x2, sizeof(x2));
+   memcpy(loudness->y1, y1, sizeof(y1));
+   memcpy(loudness->y2, y2, sizeof(y2));
+
+   return (sum_a[2] + sum_b[2]) + (sum_a[3] + sum_b[3]);
+}
+
+static float loudness_peak_c(const loudness_t *loudness, const float *x, size_t frames)
+{
+   float peak = 0.0f;
+   size_t i;
+   int p, k;
+
+   for (i = 0; i < frames; i++)
+   {
+      for (p = 0; p < 2; p++)
+      {
+         float a = loudness->peak_sum[p][0] * (x[i] + x[i - 11]);
+         float b = loudness->peak_diff[p][0] * (x[i] - x[i - 11]);
+
+         for (k = 1; k < LOUDNESS_PEAK_TAPS / 2; k++)
+         {
+            a = a + loudness->peak_sum[p][k] * (x[i - k] + x[i - 11 + k]);
+            b = b + loudness->peak_diff[p][k] * (x[i - k] - x[i - 11 + k]);
+         }
+
+         peak = MAX(peak, (float)fabs(a) + (float)fabs(b));
+      }
+   }
+
+   return peak;
+}
+
+static float loudness_split_c(float *left, float *right, const int16_t *samples, size_t frames)
+{
+   float max = 0.0f;
+   size_t i;
+
+   for (i = 0; i < frames; i++)
+   {
+      left[i] = samples[(i * 2) + 0];
+      right[i] = samples[(i * 2) + 1];
+
+      max = MAX(max, MAX((float)fabs(left[i]), (float)fabs(right[i])));
+   }
+
+   return max;
+}
+
+static void loudness_gain_c(int16_t *samples, size_t frames, float gain, float step)
+{
+   size_t i;
+
+   for (i = 0; i < frames; i++)
+   {
+      float g = gain + step * (float)i;
+
+      samples[(i * 2) + 0] = simd_to_int16(samples[(i * 2) + 0] * g);
+      samples[(i * 2) + 1] = simd_to_int16(samples[(i * 2) + 1] * g);
+   }
+}
+
+#ifdef SIMD_HAVE_SSE2
+static float loudness_filter_sse2(loudness_t *loudness, const int16_t *samples, size_t frames)
+{
+   __m128 b0 = _mm_loadu_ps(loudness->b0);
+   __m128 b1 = _mm_loadu_ps(loudness->b1);
+   __m128 b2 = _mm_loadu_ps(loudness->b2);
+   __m128 a1 = _mm_loadu_ps(loudness->a1);
+   __m128 a2 = _mm_loadu_ps(loudness->a2);
+   __m128 c1 = _mm_loadu_ps(loudness->c1);
+   __m128 c2 = _mm_loadu_ps(loudness->c2);
+   __m128 x1 = _mm_loadu_ps(loudness->x1);
+   __m128 x2 = _mm_loadu_ps(loudness->x2);
+   __m128 y1 = _mm_loadu_ps(loudness->y1);
+   __m128 y2 = _mm_loadu_ps(loudness->y2);
+   __m128 sum_a = _mm_setzero_ps();
+   __m128 sum_b = _mm_setzero_ps();
+   float state[4][4];
+   float out_a[4];
+   float out_b[4];
+   size_t i = 0;
+
+/* two frames through both stages, in holds them in its low and high two lanes */
+#define LOUDNESS_FILTER_SSE2(in) \
+   { \
+      __m128 xa = _mm_movelh_ps(in, y2); \
+      __m128 xb = _mm_movelh_ps(_mm_movehl_ps(in, in), y1); \
+      __m128 fa = _mm_add_ps(_mm_mul_ps(b0, xa), _mm_mul_ps(b1, x1)); \
+      __m128 fb = _mm_add_ps(_mm_mul_ps(b0, xb), _mm_mul_ps(b1, xa)); \
+      __m128 ya, yb; \
+      fa = _mm_add_ps(fa, _mm_mul_ps(b2, x2)); \
+      fb = _mm_add_ps(fb, _mm_mul_ps(b2, x1)); \
+      ya = _mm_sub_ps(_mm_sub_ps(fa, _mm_mul_ps(a2, y2)), _mm_mul_ps(a1, y1)); \
+      yb = _mm_add_ps(_mm_add_ps(_mm_sub_ps(fb, _mm_mul_ps(a1, fa)), _mm_mul_ps(c1, y1)), _mm_mul_ps(c2, y2)); \
+      sum_a = _mm_add_ps(sum_a, _mm_mul_ps(ya, ya)); \
+      sum_b = _mm_add_ps(sum_b, _mm_mul_ps(yb, yb)); \
+      x2 = xa; \
+      x1 = xb; \
+      y2 = ya; \
+      y1 = yb; \
+   }
+
+   for (; i + 4 <= frames; i += 4)
+   {
+      __m128i in = _mm_loadu_si128((const __m128i*)(samples + i * 2));
+
+      LOUDNESS_FILTER_SSE2(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(in, in), 16)));
+      LOUDNESS_FILTER_SSE2(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(in, in), 16)));
+   }
+
+   if (i + 2 <= frames)
+   {
+      __m128 in = _mm_setr_ps(samples[(i * 2) + 0], samples[(i * 2) + 1], samples[(i * 2) + 2], samples[(i * 2) + 3]);
+
+      LOUDNESS_FILTER_SSE2(in);
+      i += 2;
+   }
+
+#undef LOUDNESS_FILTER_SSE2
+
+   _mm_storeu_ps(state[0], x1);
+   _mm_storeu_ps(state[1], x2);
+   _mm_storeu_ps(state[2], y1);
+   _mm_storeu_ps(state[3], y2);
+   _mm_storeu_ps(out_a, sum_a);
+   _mm_storeu_ps(out_b, sum_b);
+
+   if (i < frames)
+      loudness_filter_frame_c(loudness, samples + i * 2, state[0], state[1], state[2], state[3], out_a);
+
+   memcpy(loudness->x1, state[0], sizeof(state[0]));
+   memcpy(loudness->x2, state[1], sizeof(state[1]));
+   memcpy(loudness->y1, state[2], sizeof(state[2]));
+   memcpy(loudness->y2, state[3], sizeof(state[3]));
+
+   return (out_a[2] + out_b[2]) + (out_a[3] + out_b[3]);
+}
+
+/* four consecutive samples at a time, each lane does what loudness_peak_c() does for one of them */
+static float loudness_peak_sse2(const loudness_t *loudness, const float *x, size_t frames)
+{
+   __m128 sum_coeffs[2][LOUDNESS_PEAK_TAPS / 2];
+   __m128 diff_coeffs[2][LOUDNESS_PEAK_TAPS / 2];
+   __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+   __m128 peak = _mm_setzero_ps();
+   float out[4];
+   size_t i;
+   int p, k;
+
+   for (p = 0; p < 2; p++)
+   {
+      for (k = 0; k < LOUDNESS_PEAK_TAPS / 2; k++)
+      {
+         sum_coeffs[p][k] = _mm_set1_ps(loudness->peak_sum[p][k]);
+         diff_coeffs[p][k] = _mm_set1_ps(loudness->peak_diff[p][k]);
+      }
+   }
+
+   for (i = 0; i + 4 <= frames; i += 4)
+   {
+      __m128 first = _mm_loadu_ps(x + i);
+      __m128 last = _mm_loadu_ps(x + i - 11);
+      __m128 sum = _mm_add_ps(first, last);
+      __m128 diff = _mm_sub_ps(first, last);
+      __m128 a0 = _mm_mul_ps(sum_coeffs[0][0], sum);
+      __m128 b0 = _mm_mul_ps(diff_coeffs[0][0], diff);
+      __m128 a1 = _mm_mul_ps(sum_coeffs[1][0], sum);
+      __m128 b1 = _mm_mul_ps(diff_coeffs[1][0], diff);
+
+      for (k = 1; k < LOUDNESS_PEAK_TAPS / 2; k++)
+      {
+         first = _mm_loadu_ps(x + i - k);
+         last = _mm_loadu_ps(x + i - 11 + k);
+         sum = _mm_add_ps(first, last);
+         diff = _mm_sub_ps(first, last);
+         a0 = _mm_add_ps(a0, _mm_mul_ps(sum_coeffs[0][k], sum));
+         b0 = _mm_add_ps(b0, _mm_mul_ps(diff_coeffs[0][k], diff));
+         a1 = _mm_add_ps(a1, _mm_mul_ps(sum_coeffs[1][k], sum));
+         b1 = _mm_add_ps(b1, _mm_mul_ps(diff_coeffs[1][k], diff));
+      }
+
+      peak = _mm_max_ps(peak, _mm_add_ps(_mm_and_ps(a0, abs_mask), _mm_and_ps(b0, abs_mask)));
+      peak = _mm_max_ps(peak, _mm_add_ps(_mm_and_ps(a1, abs_mask), _mm_and_ps(b1, abs_mask)));
+   }
+
+   _mm_storeu_ps(out, peak);
+
+   return MAX(MAX(MAX(out[0], out[1]), MAX(out[2], out[3])), loudness_peak_c(loudness, x + i, frames - i));
+}
+
+static float loudness_split_sse2(float *left, float *right, const int16_t *samples, size_t frames)
+{
+   __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+   __m128 max = _mm_setzero_ps();
+   float out[4];
+   size_t i;
+
+   for (i = 0; i + 4 <= frames; i += 4)
+   {
+      __m128i in = _mm_loadu_si128((const __m128i*)(samples + i * 2));
+      __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(in, in), 16));
+      __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(in, in), 16));
+
+      _mm_storeu_ps(left + i, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+      _mm_storeu_ps(right + i, _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+
+      max = _mm_max_ps(max, _mm_max_ps(_mm_and_ps(lo, abs_mask), _mm_and_ps(hi, abs_mask)));
+   }
+
+   _mm_storeu_ps(out, max);
+
+   return MAX(MAX(MAX(out[0], out[1]), MAX(out[2], out[3])), loudness_split_c(left + i, right + i, samples + i * 2, frames - i));
+}
+
+static void loudness_gain_sse2(int16_t *samples, size_t frames, float gain, float step)
+{
+   __m128 lo = _mm_setr_ps(gain, gain, gain + step, gain + step);
+   __m128 hi = _mm_add_ps(lo, _mm_set1_ps(step * 2));
+   __m128 inc = _mm_set1_ps(step * 4);
+   size_t i;
+
+   for (i = 0; i + 4 <= frames; i += 4)
+   {
+      __m128i in = _mm_loadu_si128((const __m128i*)(samples + i * 2));
+      __m128 in_lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(in, in), 16));
+      __m128 in_hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(in, in), 16));
+
+      _mm_storeu_si128((__m128i*)(samples + i * 2), simd_to_int16_sse2(_mm_mul_ps(in_lo, lo), _mm_mul_ps(in_hi, hi)));
+
+      lo = _mm_add_ps(lo, inc);
+      hi = _mm_add_ps(hi, inc);
+   }
+
+   loudness_gain_c(samples + i * 2, frames - i, gain + step * (float)i, step);
+}
+#endif
+
+#ifdef SIMD_HAVE_NEON
+static float loudness_filter_neon(loudness_t *loudness, const int16_t *samples, size_t frames)
+{
+   float32x4_t b0 = vld1q_f32(loudness->b0);
+   float32x4_t b1 = vld1q_f32(loudness->b1);
+   float32x4_t b2 = vld1q_f32(loudness->b2);
+   float32x4_t a1 = vld1q_f32(loudness->a1);
+   float32x4_t a2 = vld1q_f32(loudness->a2);
+   float32x4_t c1 = vld1q_f32(loudness->c1);
+   float32x4_t c2 = vld1q_f32(loudness->c2);
+   float32x4_t x1 = vld1q_f32(loudness->x1);
+   float32x4_t x2 = vld1q_f32(loudness->x2);
+   float32x4_t y1 = vld1q_f32(loudness->y1);
+   float32x4_t y2 = vld1q_f32(loudness->y2);
+   float32x4_t sum_a = vdupq_n_f32(0.0f);
+   float32x4_t sum_b = vdupq_n_f32(0.0f);
+   float state[4][4];
+   float out_a[4];
+   float out_b[4];
+   size_t i = 0;
+
+#define LOUDNESS_FILTER_NEON(in) \
+   { \
+      float32x4_t xa = vcombine_f32(vget_low_f32(in), vget_low_f32(y2)); \
+      float32x4_t xb = vcombine_f32(vget_high_f32(in), vget_low_f32(y1)); \
+      float32x4_t fa = vaddq_f32(vmulq_f32(b0, xa), vmulq_f32(b1, x1)); \
+      float32x4_t fb = vaddq_f32(vmulq_f32(b0, xb), vmulq_f32(b1, xa)); \
+      float32x4_t ya, yb; \
+      fa = vaddq_f32(fa, vmulq_f32(b2, x2)); \
+      fb = vaddq_f32(fb, vmulq_f32(b2, x1)); \
+      ya = vsubq_f32(vsubq_f32(fa, vmulq_f32(a2, y2)), vmulq_f32(a1, y1)); \
+      yb = vaddq_f32(vaddq_f32(vsubq_f32(fb, vmulq_f32(a1, fa)), vmulq_f32(c1, y1)), vmulq_f32(c2, y2)); \
+      sum_a = vaddq_f32(sum_a, vmulq_f32(ya, ya)); \
+      sum_b = vaddq_f32(sum_b, vmulq_f32(yb, yb)); \
+      x2 = xa; \
+      x1 = xb; \
+      y2 = ya; \
+      y1 = yb; \
+   }
+
+   for (; i + 4 <= frames; i += 4)
+   {
+      int16x8_t in = vld1q_s16(samples + i * 2);
+
+      LOUDNESS_FILTER_NEON(vcvtq_f32_s32(vmovl_s16(vget_low_s16(in))));
+      LOUDNESS_FILTER_NEON(vcvtq_f32_s32(vmovl_s16(vget_high_s16(in))));
+   }
+
+   if (i + 2 <= frames)
+   {
+      float32x4_t in = vcvtq_f32_s32(vmovl_s16(vld1_s16(samples + i * 2)));
+
+      LOUDNESS_FILTER_NEON(in);
+      i += 2;
+   }
+
+#undef LOUDNESS_FILTER_NEON
+
+   vst1q_f32(state[0], x1);
+   vst1q_f32(state[1], x2);
+   vst1q_f32(state[2], y1);
+   vst1q_f32(state[3], y2);
+   vst1q_f32(out_a, sum_a);
+   vst1q_f32(out_b, sum_b);
+
+   if (i < frames)
+      loudness_filter_frame_c(loudness, samples + i * 2, state[0], state[1], state[2], state[3], out_a);
+
+   memcpy(loudness->x1, state[0], sizeof(state[0]));
+   memcpy(loudness->x2, state[1], sizeof(state[1]));
+   memcpy(loudness->y1, state[2], sizeof(state[2]));
+   memcpy(loudness->y2, state[3], sizeof(state[3]));
+
+   return (out_a[2] + out_b[2]) + (out_a[3] + out_b[3]);
+}
+
+static float loudness_peak_neon(const loudness_t *loudness, const float *x, size_t frames)
+{
+   float32x4_t peak = vdupq_n_f32(0.0f);
+   float out[4];
+   size_t i;
+   int k;
+
+   for (i = 0; i + 4 <= frames; i += 4)
+   {
+      float32x4_t first = vld1q_f32(x + i);
+      float32x4_t last = vld1q_f32(x + i - 11);
+      float32x4_t sum = vaddq_f32(first, last);
+      float32x4_t diff = vsubq_f32(first, last);
+      float32x4_t a0 = vmulq_n_f32(sum, loudness->peak_sum[0][0]);
+      float32x4_t b0 = vmulq_n_f32(diff, loudness->peak_diff[0][0]);
+      float32x4_t a1 = vmulq_n_f32(sum, loudness->peak_sum[1][0]);
+      float32x4_t b1 = vmulq_n_f32(diff, loudness->peak_diff[1][0]);
+
+      for (k = 1; k < LOUDNESS_PEAK_TAPS / 2; k++)
+      {
+         first = vld1q_f32(x + i - k);
+         last = vld1q_f32(x + i - 11 + k);
+         sum = vaddq_f32(first, last);
+         diff = vsubq_f32(first, last);
+         a0 = vaddq_f32(a0, vmulq_n_f32(sum, loudness->peak_sum[0][k]));
+         b0 = vaddq_f32(b0, vmulq_n_f32(diff, loudness->peak_diff[0][k]));
+         a1 = vaddq_f32(a1, vmulq_n_f32(sum, loudness->peak_sum[1][k]));
+         b1 = vaddq_f32(b1, vmulq_n_f32(diff, loudness->peak_diff[1][k]));
+      }
+
+      peak = vmaxq_f32(peak, vaddq_f32(vabsq_f32(a0), vabsq_f32(b0)));
+      peak = vmaxq_f32(peak, vaddq_f32(vabsq_f32(a1), vabsq_f32(b1)));
+   }
+
+   vst1q_f32(out, peak);
+
+   return MAX(MAX(MAX(out[0], out[1]), MAX(out[2], out[3])), loudness_peak_c(loudness, x + i, frames - i));
+}
+
+static float loudness_split_neon(float *left, float *right, const int16_t *samples, size_t frames)
+{
+   float32x4_t max = vdupq_n_f32(0.0f);
+   float out[4];
+   size_t i;
+
+   for (i = 0; i + 4 <= frames; i += 4)
+   {
+      int16x4x2_t in = vld2_s16(samples + i * 2);
+      float32x4_t l = vcvtq_f32_s32(vmovl_s16(in.val[0]));
+      float32x4_t r = vcvtq_f32_s32(vmovl_s16(in.val[1]));
+
+      vst1q_f32(left + i, l);
+      vst1q_f32(right + i, r);
+
+      max = vmaxq_f32(max, vmaxq_f32(vabsq_f32(l), vabsq_f32(r)));
+   }
+
+   vst1q_f32(out, max);
+
+   return MAX(MAX(MAX(out[0], out[1]), MAX(out[2], out[3])), loudness_split_c(left + i, right + i, samples + i * 2, frames - i));
+}
+
+static void loudness_gain_neon(int16_t *samples, size_t frames, float gain, float step)
+{
+   float init[4];
+   float32x4_t lo, hi;
+   float32x4_t inc = vdupq_n_f32(step * 4);
+   size_t i;
+
+   init[0] = init[1] = gain;
+   init[2] = init[3] = gain + step;
+
+   lo = vld1q_f32(init);
+   hi = vaddq_f32(lo, vdupq_n_f32(step * 2));
+
+   for (i = 0; i + 4 <= frames; i += 4)
+   {
+      int16x8_t in = vld1q_s16(samples + i * 2);
+      float32x4_t out_lo = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(in))), lo);
+      float32x4_t out_hi = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(in))), hi);
+
+      vst1q_s16(samples + i * 2, simd_to_int16_neon(out_lo, out_hi));
+
+      lo = vaddq_f32(lo, inc);
+      hi = vaddq_f32(hi, inc);
+   }
+
+   loudness_gain_c(samples + i * 2, frames - i, gain + step * (float)i, step);
+}
+#endif
+
+static loudness_filter_t loudness_filter = loudness_filter_c;
+static loudness_peak_t loudness_peak = loudness_peak_c;
+static loudness_split_t loudness_split = loudness_split_c;
+static loudness_gain_t loudness_gain = loudness_gain_c;
+static const char *loudness_kernel_name = "C";
+
+void loudness_init(uint64_t cpu_features)
+{
+   loudness_filter_t filter = loudness_filter_c;
+   loudness_peak_t peak = loudness_peak_c;
+   loudness_split_t split = loudness_split_c;
+   loudness_gain_t gain = loudness_gain_c;
+   const char *name = "C";
+
+#ifdef SIMD_HAVE_SSE2
+   if (cpu_features & RETRO_SIMD_SSE2)
+   {
+      filter = loudness_filter_sse2;
+      peak = loudness_peak_sse2;
+      split = loudness_split_sse2;
+      gain = loudness_gain_sse2;
+      name = "SSE2";
+   }
+#endif
+
+#ifdef SIMD_HAVE_NEON
+   if (cpu_features & (RETRO_SIMD_NEON | RETRO_SIMD_ASIMD))
+   {
+      filter = loudness_filter_neon;
+      peak = loudness_peak_neon;
+      split = loudness_split_neon;
+      gain = loudness_gain_neon;
+      name = "NEON";
+   }
+#endif
+
+   (void)cpu_features;
+
+   loudness_filter = filter;
+   loudness_peak = peak;
+   loudness_split = split;
+   loudness_gain = gain;
+   loudness_kernel_name = name;
+}
+
+const char* loudness_get_kernel_name(void)
+{
+   return loudness_kernel_name;
+}
+
+/* a biquad of the K-weighting for both channels, lanes first and first + 1 */
+static void loudness_set_stage(loudness_t *loudness, int first, double b0, double b1, double b2, double a0, double a1, double a2)
+{
+   int j;
+
+   for (j = first; j < first + 2; j++)
+   {
+      loudness->b0[j] = (float)(b0 / a0);
+      loudness->b1[j] = (float)(b1 / a0);
+      loudness->b2[j] = (float)(b2 / a0);
+      loudness->a1[j] = (float)(a1 / a0);
+      loudness->a2[j] = (float)(a2 / a0);
+      loudness->c1[j] = (float)((a1 / a0) * (a1 / a0) - a2 / a0);
+      loudness->c2[j] = (float)((a1 / a0) * (a2 / a0));
+   }
+}
+
+/* The filters of BS.1770 are given for 48 kHz. These are the analog prototypes they come from, a high
+ * shelf and a high pass, redone for 44.1 kHz through the bilinear transform. The interpolation filter
+ * for the true peak is the one of the standard, at 44.1 kHz it upsamples to 176.4 kHz. */
+static void loudness_setup_filters(loudness_t *loudness)
+{
+   double k = tan(LOUDNESS_PI * 1681.974450955533 / LOUDNESS_RATE);
+   double q = 0.7071752369554196;
+   double vh = pow(10.0, 3.999843853973347 / 20.0);
+   double vb = pow(vh, 0.4996667741545416);
+   double a0;
+   int p, i;
+
+   loudness_set_stage(loudness, 0,
+         vh + vb * k / q + k * k, 2.0 * (k * k - vh), vh - vb * k / q + k * k,
+         1.0 + k / q + k * k, 2.0 * (k * k - 1.0), 1.0 - k / q + k * k);
+
+   k = tan(LOUDNESS_PI * 38.13547087602444 / LOUDNESS_RATE);
+   q = 0.5003270373238773;
+   a0 = 1.0 + k / q + k * k;
+
+   /* the numerator of the high pass is left as 1, -2, 1 like in the 48 kHz filter of the standard */
+   loudness_set_stage(loudness, 2,
+         a0, -2.0 * a0, a0,
+         a0, 2.0 * (k * k - 1.0), 1.0 - k / q + k * k);
+
+   for (p = 0; p < 2; p++)
+   {
+      for (i = 0; i < LOUDNESS_PEAK_TAPS / 2; i++)
+      {
+         loudness->peak_sum[p][i] = (float)(loudness_peak_phases[p][i] + loudness_peak_phases[p][LOUDNESS_PEAK_TAPS - 1 - i]);
+         loudness->peak_diff[p][i] = (float)(loudness_peak_phases[p][i] - loudness_peak_phases[p][LOUDNESS_PEAK_TAPS - 1 - i]);
+      }
+   }
+}
+
+loudness_t* loudness_new(void)
+{
+   loudness_t *loudness = (loudness_t*)calloc(1, sizeof(*loudness));
+
+   if (!loudness)
+      return NULL;
+
+   loudness_setup_filters(loudness);
+   loudness_begin_track(loudness);
+
+   return loudness;
+}
+
+void loudness_free(loudness_t *loudness)
+{
+   if (!loudness)
+      return;
+
+   free(loudness->blocks);
+   free(loudness);
+}
+
+void loudness_begin_track(loudness_t *loudness)
+{
+   memset(loudness->x1, 0, sizeof(loudness->x1));
+   memset(loudness->x2, 0, sizeof(loudness->x2));
+   memset(loudness->y1, 0, sizeof(loudness->y1));
+   memset(loudness->y2, 0, sizeof(loudness->y2));
+   memset(loudness->peak_history, 0, sizeof(loudness->peak_history));
+
+   loudness->peak = 0.0f;
+   loudness->step_energy = 0.0;
+   loudness->step_frames = 0;
+   loudness->num_steps = 0;
+   loudness->track_first_block = loudness->num_blocks;
+}
+
+static bool loudness_add_block(loudness_t *loudness, float energy)
+{
+   if (loudness->num_blocks == loudness->max_blocks)
+   {
+      size_t max_blocks = loudness->max_blocks ? loudness->max_blocks * 2 : 4096;
+      float *blocks = (float*)realloc(loudness->blocks, max_blocks * sizeof(*blocks));
+
+      if (!blocks)
+         return false;
+
+      loudness->blocks = blocks;
+      loudness->max_blocks = max_blocks;
+   }
+
+   loudness->blocks[loudness->num_blocks++] = energy;
+
+   return true;
+}
+
+/* True peak of a window. Interpolating cannot give more than LOUDNESS_PEAK_GAIN times the largest
+ * sample the filter sees, so when that is below the peak so far only the history is kept. */
+static void loudness_add_peak(loudness_t *loudness, const int16_t *samples, size_t frames)
+{
+   float x[2][LOUDNESS_PEAK_HISTORY + LOUDNESS_PEAK_WINDOW];
+   float sample_max;
+   float history_max = 0.0f;
+   size_t i;
+   int c;
+
+   for (c = 0; c < 2; c++)
+   {
+      memcpy(x[c], loudness->peak_history[c], sizeof(loudness->peak_history[c]));
+
+      for (i = 0; i < LOUDNESS_PEAK_HISTORY; i++)
+         history_max = MAX(history_max, (float)fabs(x[c][i]));
+   }
+
+   sample_max = loudness_split(x[0] + LOUDNESS_PEAK_HISTORY, x[1] + LOUDNESS_PEAK_HISTORY, samples, frames);
+
+   loudness->peak = MAX(loudness->peak, sample_max);
+
+   for (c = 0; c < 2; c++)
+   {
+      if (MAX(sample_max, history_max) * LOUDNESS_PEAK_GAIN > loudness->peak)
+      {
+         float peak = loudness_peak(loudness, x[c] + LOUDNESS_PEAK_HISTORY, frames) * 0.5f;
+
+         loudness->peak = MAX(loudness->peak, peak);
+      }
+
+      memcpy(loudness->peak_history[c], x[c] + frames, sizeof(loudness->peak_history[c]));
+   }
+}
+
+bool loudness_add(loudness_t *loudness, const int16_t *samples, size_t frames)
+{
+   size_t i;
+
+   for (i = 0; i < frames; i += LOUDNESS_PEAK_WINDOW)
+      loudness_add_peak(loudness, samples + i * 2, MIN(frames - i, LOUDNESS_PEAK_WINDOW));
+
+   while (frames)
+   {
+      size_t count = MIN(frames, LOUDNESS_STEP_FRAMES - loudness->step_frames);
+
+      loudness->step_energy += loudness_filter(loudness, samples, count);
+      loudness->step_frames += count;
+      samples += count * 2;
+      frames -= count;
+
+      if (loudness->step_frames == LOUDNESS_STEP_FRAMES)
+      {
+         float step = (float)(loudness->step_energy / ((double)LOUDNESS_STEP_FRAMES * 32768.0 * 32768.0));
+
+         if (loudness->num_steps >= 3 &&
+               !loudness_add_block(loudness, (loudness->steps[0] + loudness->steps[1] + loudness->steps[2] + step) / 4.0f))
+            return false;
+
+         loudness->steps[0] = loudness->steps[1];
+         loudness->steps[1] = loudness->steps[2];
+         loudness->steps[2] = step;
+         loudness->num_steps++;
+         loudness->step_energy = 0.0;
+         loudness->step_frames = 0;
+      }
+   }
+
+   loudness->album_peak = MAX(loudness->album_peak, loudness->peak);
+
+   return true;
+}
+
+/* the gated mean of BS.1770: blocks under -70 LUFS are left out, then those more than 10 LU under the rest */
+static float loudness_gate(const float *blocks, size_t count)
+{
+   const double absolute = pow(10.0, (-70.0 + 0.691) / 10.0);
+   double sum = 0.0;
+   double relative;
+   size_t num = 0;
+   size_t i;
+
+   for (i = 0; i < count; i++)
+   {
+      if (blocks[i] > absolute)
+      {
+         sum += blocks[i];
+         num++;
+      }
+   }
+
+   if (!num)
+      return LOUDNESS_SILENCE;
+
+   relative = sum / num / 10.0;
+   sum = 0.0;
+   num = 0;
+
+   for (i = 0; i < count; i++)
+   {
+      if (blocks[i] > absolute && blocks[i] > relative)
+      {
+         sum += blocks[i];
+         num++;
+      }
+   }
+
+   return (float)(-0.691 + 10.0 * log10(sum / num));
+}
+
+void loudness_get_track(const loudness_t *loudness, float *lufs, float *peak)
+{
+   *lufs = loudness_gate(loudness->blocks + loudness->track_first_block, loudness->num_blocks - loudness->track_first_block);
+   *peak = loudness->peak / 32768.0f;
+}
+
+void loudness_get_album(const loudness_t *loudness, float *lufs, float *peak)
+{
+   *lufs = loudness_gate(loudness->blocks, loudness->num_blocks);
+   *peak = loudness->album_peak / 32768.0f;
+}
+
+void loudness_apply_gain(int16_t *samples, size_t frames, float gain, float step)
+{
+   loudness_gain(samples, frames, gain, step);
+}
@@ -0,0 +1,56 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef LOUDNESS_H__
+#define LOUDNESS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <boolean.h>
+
+/* Integrated loudness is reported as this when nothing was loud enough to pass the absolute gate. */
+#define LOUDNESS_SILENCE -70.0f
+
+/* EBU R128 / ITU-R BS.1770 loudness and true peak of 44.1 kHz stereo audio, for every track of a disc
+ * and for all of them together. Tracks are added one after another, the gating blocks of all of them
+ * are kept for the album figure. */
+typedef struct loudness loudness_t;
+
+/* Picks the fastest analysis kernels for the given RETRO_SIMD_* feature mask. */
+void loudness_init(uint64_t cpu_features);
+
+const char* loudness_get_kernel_name(void);
+
+loudness_t* loudness_new(void);
+
+void loudness_free(loudness_t *loudness);
+
+/* Starts a track, which does not follow on from the audio added before. */
+void loudness_begin_track(loudness_t *loudness);
+
+/* Analyzes interleaved stereo frames of the current track. False if memory ran out. */
+bool loudness_add(loudness_t *loudness, const int16_t *samples, size_t frames);
+
+/* Integrated loudness in LUFS and true peak of the current track. */
+void loudness_get_track(const loudness_t *loudness, float *lufs, float *peak);
+
+/* The same over all tracks added. */
+void loudness_get_album(const loudness_t *loudness, float *lufs, float *peak);
+
+/* Multiplies interleaved stereo frames by a gain that changes by step every frame, saturating. */
+void loudness_apply_gain(int16_t *samples, size_t frames, float gain, float step);
+
+#endif /* LOUDNESS_H__ */
@@ -0,0 +1,168 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <libretro.h>
+#include "meter.h"
+#include "simd.h"
+
+/* frames per block of 32-bit lane sums, 4096 * 32768 cannot overflow */
+#define METER_BLOCK_FRAMES 4096
+
+typedef void (*meter_sum_t)(const int16_t *samples, size_t frames, uint64_t *left, uint64_t *right);
+
+static void meter_sum_c(const int16_t *samples, size_t frames, uint64_t *left, uint64_t *right)
+{
+   uint64_t sum_left = 0;
+   uint64_t sum_right = 0;
+   size_t i;
+
+   for (i = 0; i < frames; i++)
+   {
+      int32_t l = samples[(i * 2) + 0];
+      int32_t r = samples[(i * 2) + 1];
+
+      sum_left  += (uint32_t)(l < 0 ? -l : l);
+      sum_right += (uint32_t)(r < 0 ? -r : r);
+   }
+
+   *left += sum_left;
+   *right += sum_right;
+}
+
+#ifdef SIMD_HAVE_SSE2
+static void meter_sum_sse2(const int16_t *samples, size_t frames, uint64_t *left, uint64_t *right)
+{
+   size_t done = 0;
+
+   while (frames - done >= 4)
+   {
+      size_t block = (frames - done) & ~(size_t)3;
+      uint32_t lanes[4];
+      __m128i acc = _mm_setzero_si128();
+      size_t i;
+
+      if (block > METER_BLOCK_FRAMES)
+         block = METER_BLOCK_FRAMES;
+
+      for (i = 0; i < block; i += 4)
+      {
+         /* 4 stereo frames, widened to 32 bits because |-32768| does not fit in 16 */
+         __m128i v = _mm_loadu_si128((const __m128i*)(samples + (done + i) * 2));
+         __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+         __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+         __m128i lo_sign = _mm_srai_epi32(lo, 31);
+         __m128i hi_sign = _mm_srai_epi32(hi, 31);
+
+         lo = _mm_sub_epi32(_mm_xor_si128(lo, lo_sign), lo_sign);
+         hi = _mm_sub_epi32(_mm_xor_si128(hi, hi_sign), hi_sign);
+
+         /* lanes 0 and 2 are left, 1 and 3 right */
+         acc = _mm_add_epi32(acc, _mm_add_epi32(lo, hi));
+      }
+
+      _mm_storeu_si128((__m128i*)lanes, acc);
+
+      *left += (uint64_t)lanes[0] + lanes[2];
+      *right += (uint64_t)lanes[1] + lanes[3];
+
+      done += block;
+   }
+
+   meter_sum_c(samples + done * 2, frames - done, left, right);
+}
+#endif
+
+#ifdef SIMD_HAVE_NEON
+static void meter_sum_neon(const int16_t *samples, size_t frames, uint64_t *left, uint64_t *right)
+{
+   size_t done = 0;
+
+   while (frames - done >= 8)
+   {
+      size_t block = (frames - done) & ~(size_t)7;
+      uint32_t lanes_left[4];
+      uint32_t lanes_right[4];
+      uint32x4_t acc_left = vdupq_n_u32(0);
+      uint32x4_t acc_right = vdupq_n_u32(0);
+      int16x4_t zero = vdup_n_s16(0);
+      size_t i;
+
+      if (block > METER_BLOCK_FRAMES)
+         block = METER_BLOCK_FRAMES;
+
+      for (i = 0; i < block; i += 8)
+      {
+         /* deinterleave 8 frames, the widening absolute difference handles -32768 */
+         int16x8x2_t v = vld2q_s16(samples + (done + i) * 2);
+
+         acc_left = vaddq_u32(acc_left, vreinterpretq_u32_s32(vabdl_s16(vget_low_s16(v.val[0]), zero)));
+         acc_left = vaddq_u32(acc_left, vreinterpretq_u32_s32(vabdl_s16(vget_high_s16(v.val[0]), zero)));
+         acc_right = vaddq_u32(acc_right, vreinterpretq_u32_s32(vabdl_s16(vget_low_s16(v.val[1]), zero)));
+         acc_right = vaddq_u32(acc_right, vreinterpretq_u32_s32(vabdl_s16(vget_high_s16(v.val[1]), zero)));
+      }
+
+      vst1q_u32(lanes_left, acc_left);
+      vst1q_u32(lanes_right, acc_right);
+
+      *left += (uint64_t)lanes_left[0] + lanes_left[1] + lanes_left[2] + lanes_left[3];
+      *right += (uint64_t)lanes_right[0] + lanes_right[1] + lanes_right[2] + lanes_right[3];
+
+      done += block;
+   }
+
+   meter_sum_c(samples + done * 2, frames - done, left, right);
+}
+#endif
+
+static meter_sum_t meter_kernel = meter_sum_c;
+static const char *meter_kernel_name = "C";
+
+void meter_init(uint64_t cpu_features)
+{
+   meter_sum_t kernel = meter_sum_c;
+   const char *name = "C";
+
+#ifdef SIMD_HAVE_SSE2
+   if (cpu_features & RETRO_SIMD_SSE2)
+   {
+      kernel = meter_sum_sse2;
+      name = "SSE2";
+   }
+#endif
+
+#ifdef SIMD_HAVE_NEON
+   if (cpu_features & (RETRO_SIMD_NEON | RETRO_SIMD_ASIMD))
+   {
+      kernel = meter_sum_neon;
+      name = "NEON";
+   }
+#endif
+
+   (void)cpu_features;
+
+   meter_kernel = kernel;
+   meter_kernel_name = name;
+}
+
+const char* meter_get_kernel_name(void)
+{
+   return meter_kernel_name;
+}
+
+void meter_sum(const int16_t *samples, size_t frames, uint64_t *left, uint64_t *right)
+{
+   meter_kernel(samples, frames, left, right);
+}
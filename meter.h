@@ -0,0 +1,31 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef METER_H__
+#define METER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Picks the fastest metering kernel for the given RETRO_SIMD_* feature mask. */
+void meter_init(uint64_t cpu_features);
+
+const char* meter_get_kernel_name(void);
+
+/* Adds up the absolute sample values of each channel of interleaved stereo frames. */
+void meter_sum(const int16_t *samples, size_t frames, uint64_t *left, uint64_t *right);
+
+#endif /* METER_H__ */
@@ -0,0 +1,653 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libretro.h>
+#include <cdrom/cdrom.h>
+#include <streams/file_stream.h>
+#include <rthreads/rthreads.h>
+#include <features/features_cpu.h>
+#include <vfs/vfs_implementation_cdrom.h>
+#include <retro_miscellaneous.h>
+
+#include "reader.h"
+#include "deemphasis.h"
+#include "silence.h"
+
+/* Audio is read in chunks of a few CD frames. A seek waits for one chunk, so this bounds the latency
+ * of the first audio after it; the ring holds about 3 s ahead and a little behind, still 1.5 s when
+ * playing at twice the speed. */
+#define READER_CHUNK_FRAMES 4
+#define READER_CHUNK_BYTES (READER_CHUNK_FRAMES * 2352)
+#define READER_CHUNKS 64
+
+/* chunks the thread leaves alone after they were played, about 1/5 s to go back to without a read */
+#define READER_HISTORY_CHUNKS 4
+
+/* chunks played in a row at each stop while scanning, about 1/10 s */
+#define READER_SCAN_CHUNKS 2
+
+/* how long a read right after a seek waits for its first chunk, a quarter of a frame at 60 fps.
+ * A drive that seeks faster than this has no gap in the audio, a slower one fills the gap with silence. */
+#define READER_SEEK_WAIT_USEC 4000
+
+typedef struct
+{
+   int64_t byte_pos;
+   unsigned len;
+   unsigned char track;
+   unsigned char data[READER_CHUNK_BYTES];
+} reader_chunk_t;
+
+struct reader
+{
+   reader_chunk_t chunks[READER_CHUNKS];
+   unsigned char scratch[READER_CHUNK_BYTES];
+   sthread_t *thread;
+   slock_t *lock;
+   scond_t *cond;
+
+   /* the open track, only touched by the thread */
+   RFILE *file;
+   int64_t file_pos;
+   char file_drive;
+   unsigned char file_track;
+
+   /* de-emphasis of tracks that need it, also only touched by the thread. The filter carries on
+    * from the previous chunk if this one follows on from it. */
+   deemphasis_t deemphasis;
+   int64_t deemphasis_pos;
+   unsigned char deemphasis_track;
+
+   /* read ahead audio, head is the oldest chunk. The history chunks before head were played already
+    * but are kept until they are overwritten, so going back a little does not need the drive. */
+   unsigned head;
+   unsigned count;
+   unsigned head_offset;
+   unsigned history;
+
+   /* where the thread reads next, a seek bumps generation so reads in flight are dropped */
+   char drive;
+   unsigned char next_track;
+   int64_t next_pos;
+   unsigned generation;
+   unsigned failures;
+
+   int scan;
+   unsigned scan_chunks;
+
+   /* silent frames in a row up to the last chunk read, chunks that would take it past the limit are dropped */
+   size_t silence_limit;
+   size_t silence_frames;
+
+   retro_time_t seek_time_usec;
+   unsigned seek_latency_usec;
+
+   bool active;
+   bool close_file;
+   bool quit;
+};
+
+/* the next audio track after track in the direction of step, wrapping around forwards only; 0 if there is none */
+static unsigned char reader_next_audio_track(const cdrom_toc_t *toc, unsigned char track, int step)
+{
+   int i;
+
+   for (i = 1; i <= toc->num_tracks; i++)
+   {
+      int next = track + step * i;
+
+      if (next > toc->num_tracks)
+         next -= toc->num_tracks;
+
+      if (next < 1)
+         return 0;
+
+      if (toc->track[next - 1].audio)
+         return (unsigned char)next;
+   }
+
+   return 0;
+}
+
+/* reads the chunk at pos of track into scratch, opening the track first if needed; returns the bytes read or -1 */
+static int64_t reader_read_chunk(reader_t *reader, char drive, unsigned char track, int64_t pos)
+{
+   int64_t bytes_read;
+
+   if (!reader->file || reader->file_drive != drive || reader->file_track != track)
+   {
+      char path[64];
+
+      if (reader->file)
+         filestream_close(reader->file);
+
+      cdrom_device_fillpath(path, sizeof(path), drive, track, false);
+
+      reader->file = filestream_open(path, RETRO_VFS_FILE_ACCESS_READ, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+      reader->file_drive = drive;
+      reader->file_track = track;
+      reader->file_pos = 0;
+
+      if (!reader->file)
+         return -1;
+   }
+
+   if (pos != reader->file_pos)
+   {
+      if (filestream_seek(reader->file, pos, RETRO_VFS_SEEK_POSITION_START) < 0)
+         return -1;
+
+      reader->file_pos = pos;
+   }
+
+   bytes_read = filestream_read(reader->file, reader->scratch, READER_CHUNK_BYTES);
+
+   if (bytes_read > 0)
+      reader->file_pos += bytes_read;
+
+   return bytes_read;
+}
+
+/* undoes the pre-emphasis of the chunk in scratch if its track has it */
+static void reader_deemphasize(reader_t *reader, char drive, unsigned char track, int64_t pos, int64_t bytes_read)
+{
+   const cdrom_toc_t *toc = retro_vfs_file_get_cdrom_toc(drive);
+
+   if (bytes_read <= 0 || !toc || !track || track > toc->num_tracks || !toc->track[track - 1].pre_emphasis)
+      return;
+
+   if (track != reader->deemphasis_track || pos != reader->deemphasis_pos)
+      deemphasis_clear(&reader->deemphasis);
+
+   deemphasis_run(&reader->deemphasis, (int16_t*)reader->scratch, (size_t)bytes_read / 4);
+
+   reader->deemphasis_track = track;
+   reader->deemphasis_pos = pos + bytes_read;
+}
+
+/* False for a chunk that would only make a silence longer than the limit, called with the lock held.
+ * leading and trailing are the silent frames at either end of the chunk. */
+static bool reader_keep_chunk(reader_t *reader, size_t frames, size_t leading, size_t trailing)
+{
+   if (!reader->silence_limit || reader->scan)
+   {
+      reader->silence_frames = 0;
+      return true;
+   }
+
+   if (leading < frames)
+   {
+      reader->silence_frames = trailing;
+      return true;
+   }
+
+   if (reader->silence_frames >= reader->silence_limit)
+      return false;
+
+   reader->silence_frames += frames;
+
+   return true;
+}
+
+/* keeps what was read and works out where to read next, called with the lock held */
+static void reader_advance(reader_t *reader, unsigned char track, int64_t pos, int64_t bytes_read, bool keep)
+{
+   const cdrom_toc_t *toc = retro_vfs_file_get_cdrom_toc(reader->drive);
+   int64_t next = pos + MAX(bytes_read, 0);
+
+   if (bytes_read > 0 && keep)
+   {
+      reader_chunk_t *chunk = &reader->chunks[(reader->head + reader->count) % READER_CHUNKS];
+
+      memcpy(chunk->data, reader->scratch, (size_t)bytes_read);
+      chunk->byte_pos = pos;
+      chunk->len = (unsigned)bytes_read;
+      chunk->track = track;
+      reader->count++;
+
+      if (reader->history + reader->count > READER_CHUNKS)
+         reader->history--;
+
+      /* a read may be waiting for the first audio after a seek */
+      scond_signal(reader->cond);
+
+      if (!reader->seek_latency_usec)
+         reader->seek_latency_usec = (unsigned)MAX(1, cpu_features_get_time_usec() - reader->seek_time_usec);
+   }
+
+   if (bytes_read > 0)
+   {
+      reader->failures = 0;
+
+      /* scanning skips over everything between the snippets instead of reading it */
+      if (reader->scan && ++reader->scan_chunks >= READER_SCAN_CHUNKS)
+      {
+         int64_t span = (int64_t)READER_SCAN_CHUNKS * READER_CHUNK_BYTES;
+
+         reader->scan_chunks = 0;
+
+         if (reader->scan > 0)
+            next += span * (reader->scan - 1);
+         else
+            next -= span * (1 - reader->scan);
+      }
+   }
+   else
+      reader->failures++;
+
+   if (next < 0)
+   {
+      unsigned char previous = reader_next_audio_track(toc, track, -1);
+
+      if (previous && toc->track[previous - 1].track_bytes)
+      {
+         track = previous;
+         next = MAX(0, (int64_t)toc->track[previous - 1].track_bytes + next);
+         next -= next % 2352;
+      }
+      else
+      {
+         /* rewound to the start of the disc, play on from there */
+         next = 0;
+         reader->scan = 0;
+      }
+   }
+   else if (bytes_read < READER_CHUNK_BYTES || next >= toc->track[track - 1].track_bytes)
+   {
+      /* the end of the track, or a track that cannot be read: carry on with the next one */
+      track = reader_next_audio_track(toc, track, 1);
+      next = 0;
+
+      if (!track || reader->failures > toc->num_tracks)
+      {
+         reader->active = false;
+         return;
+      }
+   }
+
+   reader->next_track = track;
+   reader->next_pos = next;
+}
+
+static void reader_thread(void *data)
+{
+   reader_t *reader = (reader_t*)data;
+
+   slock_lock(reader->lock);
+
+   while (!reader->quit)
+   {
+      char drive;
+      unsigned char track;
+      int64_t pos;
+      int64_t bytes_read;
+      unsigned generation;
+      bool find_silence;
+      size_t frames;
+      size_t leading = 0;
+      size_t trailing = 0;
+
+      if (reader->close_file)
+      {
+         RFILE *file = reader->file;
+
+         reader->file = NULL;
+         reader->close_file = false;
+
+         slock_unlock(reader->lock);
+
+         if (file)
+            filestream_close(file);
+
+         slock_lock(reader->lock);
+
+         /* reader_close() may be waiting for this */
+         scond_broadcast(reader->cond);
+         continue;
+      }
+
+      if (!reader->active || reader->count >= READER_CHUNKS - READER_HISTORY_CHUNKS)
+      {
+         scond_wait(reader->cond, reader->lock);
+         continue;
+      }
+
+      drive = reader->drive;
+      track = reader->next_track;
+      pos = reader->next_pos;
+      generation = reader->generation;
+      find_silence = reader->silence_limit && !reader->scan;
+
+      slock_unlock(reader->lock);
+
+      bytes_read = reader_read_chunk(reader, drive, track, pos);
+      reader_deemphasize(reader, drive, track, pos, bytes_read);
+
+      /* the chunk is scanned here, before it is added to the audio read ahead */
+      frames = (size_t)MAX(bytes_read, 0) / 4;
+
+      if (find_silence && frames)
+      {
+         leading = silence_leading((const int16_t*)reader->scratch, frames, SILENCE_THRESHOLD);
+         trailing = leading < frames ? silence_trailing((const int16_t*)reader->scratch, frames, SILENCE_THRESHOLD) : frames;
+      }
+
+      slock_lock(reader->lock);
+
+      /* a seek came in while reading, the chunk is not wanted anymore */
+      if (generation != reader->generation)
+         continue;
+
+      reader_advance(reader, track, pos, bytes_read,
+            !find_silence || !frames || reader_keep_chunk(reader, frames, leading, trailing));
+   }
+
+   slock_unlock(reader->lock);
+
+   if (reader->file)
+      filestream_close(reader->file);
+}
+
+reader_t* reader_new(void)
+{
+   reader_t *reader = (reader_t*)calloc(1, sizeof(*reader));
+
+   if (!reader)
+      return NULL;
+
+   reader->lock = slock_new();
+   reader->cond = scond_new();
+
+   deemphasis_setup(&reader->deemphasis);
+
+   if (reader->lock && reader->cond)
+      reader->thread = sthread_create(reader_thread, reader);
+
+   if (!reader->thread)
+   {
+      if (reader->cond)
+         scond_free(reader->cond);
+      if (reader->lock)
+         slock_free(reader->lock);
+
+      free(reader);
+      return NULL;
+   }
+
+   return reader;
+}
+
+void reader_free(reader_t *reader)
+{
+   if (!reader)
+      return;
+
+   slock_lock(reader->lock);
+   reader->quit = true;
+   scond_signal(reader->cond);
+   slock_unlock(reader->lock);
+
+   sthread_join(reader->thread);
+
+   scond_free(reader->cond);
+   slock_free(reader->lock);
+   free(reader);
+}
+
+/* drops the read ahead audio and points the thread at a new position, called with the lock held */
+static void reader_retarget(reader_t *reader, unsigned char track, int64_t byte_pos)
+{
+   reader->next_track = track;
+   reader->next_pos = MAX(0, byte_pos - byte_pos % 4);
+   reader->head = 0;
+   reader->count = 0;
+   reader->head_offset = 0;
+   reader->history = 0;
+   reader->generation++;
+   reader->failures = 0;
+   reader->scan_chunks = 0;
+   reader->silence_frames = 0;
+   reader->seek_time_usec = cpu_features_get_time_usec();
+   reader->seek_latency_usec = 0;
+
+   scond_signal(reader->cond);
+}
+
+/* moves playback to byte_pos of track if that is still in memory, called with the lock held */
+static bool reader_seek_buffered(reader_t *reader, unsigned char track, int64_t byte_pos)
+{
+   unsigned i;
+   unsigned first = (reader->head + READER_CHUNKS - reader->history) % READER_CHUNKS;
+
+   if (byte_pos % 4)
+      return false;
+
+   for (i = 0; i < reader->history + reader->count; i++)
+   {
+      unsigned index = (first + i) % READER_CHUNKS;
+      const reader_chunk_t *chunk = &reader->chunks[index];
+
+      if (chunk->track != track || byte_pos < chunk->byte_pos || byte_pos >= chunk->byte_pos + chunk->len)
+         continue;
+
+      /* the chunks are in the order they play in, so everything from here on is still valid */
+      reader->count = reader->history + reader->count - i;
+      reader->history = i;
+      reader->head = index;
+      reader->head_offset = (unsigned)(byte_pos - chunk->byte_pos);
+
+      return true;
+   }
+
+   return false;
+}
+
+bool reader_seek(reader_t *reader, char drive, unsigned char track, int64_t byte_pos)
+{
+   bool buffered;
+
+   slock_lock(reader->lock);
+
+   buffered = reader->active && reader->drive == drive && reader_seek_buffered(reader, track, byte_pos);
+
+   if (!buffered)
+   {
+      reader->drive = drive;
+      reader->active = true;
+      reader_retarget(reader, track, byte_pos);
+   }
+
+   slock_unlock(reader->lock);
+
+   return buffered;
+}
+
+void reader_stop(reader_t *reader)
+{
+   slock_lock(reader->lock);
+
+   reader_retarget(reader, 0, 0);
+   reader->active = false;
+   reader->close_file = true;
+
+   slock_unlock(reader->lock);
+}
+
+void reader_close(reader_t *reader)
+{
+   reader_stop(reader);
+
+   slock_lock(reader->lock);
+
+   /* a read in progress finishes first, then the thread closes the file */
+   scond_broadcast(reader->cond);
+
+   while (reader->close_file)
+      scond_wait(reader->cond, reader->lock);
+
+   slock_unlock(reader->lock);
+}
+
+static void reader_position(const reader_t *reader, unsigned char *track, int64_t *byte_pos)
+{
+   if (reader->count)
+   {
+      *track = reader->chunks[reader->head].track;
+      *byte_pos = reader->chunks[reader->head].byte_pos + reader->head_offset;
+   }
+   else
+   {
+      *track = reader->next_track;
+      *byte_pos = reader->next_pos;
+   }
+}
+
+void reader_set_scan(reader_t *reader, int speed)
+{
+   slock_lock(reader->lock);
+
+   if (reader->scan != speed)
+   {
+      reader->scan = speed;
+
+      /* start scanning, or go back to playing, from what is being heard now rather than from what was read ahead */
+      if (reader->active)
+      {
+         unsigned char track;
+         int64_t byte_pos;
+
+         reader_position(reader, &track, &byte_pos);
+         reader_retarget(reader, track, byte_pos);
+      }
+   }
+
+   slock_unlock(reader->lock);
+}
+
+void reader_set_silence_limit(reader_t *reader, size_t frames)
+{
+   slock_lock(reader->lock);
+   reader->silence_limit = frames;
+   slock_unlock(reader->lock);
+}
+
+size_t reader_read(reader_t *reader, int16_t *buf, size_t frames)
+{
+   size_t done = 0;
+
+   slock_lock(reader->lock);
+
+   if (reader->active && !reader->count && !reader->seek_latency_usec)
+      scond_wait_timeout(reader->cond, reader->lock, READER_SEEK_WAIT_USEC);
+
+   while (done < frames && reader->count)
+   {
+      reader_chunk_t *chunk = &reader->chunks[reader->head];
+      size_t count = MIN((chunk->len - reader->head_offset) / 4, frames - done);
+
+      memcpy(buf + done * 2, chunk->data + reader->head_offset, count * 4);
+
+      reader->head_offset += (unsigned)(count * 4);
+      done += count;
+
+      if (reader->head_offset + 4 > chunk->len)
+      {
+         reader->head = (reader->head + 1) % READER_CHUNKS;
+         reader->count--;
+         reader->history++;
+         reader->head_offset = 0;
+
+         scond_signal(reader->cond);
+      }
+   }
+
+   slock_unlock(reader->lock);
+
+   return done;
+}
+
+bool reader_get_position(reader_t *reader, unsigned char *track, int64_t *byte_pos)
+{
+   bool active;
+
+   slock_lock(reader->lock);
+
+   active = reader->active || reader->count;
+
+   if (active)
+      reader_position(reader, track, byte_pos);
+
+   slock_unlock(reader->lock);
+
+   return active;
+}
+
+bool reader_get_position_before(reader_t *reader, size_t frames, unsigned char *track, int64_t *byte_pos)
+{
+   size_t bytes = frames * 4;
+   size_t offset;
+   unsigned index;
+   unsigned back = 0;
+   bool found = true;
+
+   slock_lock(reader->lock);
+
+   index = reader->head;
+   offset = reader->head_offset;
+
+   if (!bytes)
+   {
+      reader_position(reader, track, byte_pos);
+      found = *track != 0;
+   }
+   else
+   {
+      /* back through the chunks played, which is the audio as it was read rather than as it is on the disc */
+      while (bytes > offset && back < reader->history)
+      {
+         bytes -= offset;
+         index = (index + READER_CHUNKS - 1) % READER_CHUNKS;
+         offset = reader->chunks[index].len;
+         back++;
+      }
+
+      found = bytes <= offset;
+
+      if (found)
+      {
+         *track = reader->chunks[index].track;
+         *byte_pos = reader->chunks[index].byte_pos + (int64_t)(offset - bytes);
+      }
+   }
+
+   slock_unlock(reader->lock);
+
+   return found;
+}
+
+unsigned reader_get_seek_latency_usec(reader_t *reader)
+{
+   unsigned latency;
+
+   slock_lock(reader->lock);
+   latency = reader->seek_latency_usec;
+   slock_unlock(reader->lock);
+
+   return latency;
+}
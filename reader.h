@@ -0,0 +1,67 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef READER_H__
+#define READER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <boolean.h>
+
+/* Reads audio ahead of playback on its own thread, so a slow drive command never stalls a frame.
+ * Playback runs from track to track on its own; seeking or scanning drops what was read ahead
+ * and the first audio at the new position is a single read away. */
+
+typedef struct reader reader_t;
+
+reader_t* reader_new(void);
+
+void reader_free(reader_t *reader);
+
+/* Plays the given track of drive from byte_pos on. Returns true if that audio was still in memory,
+ * otherwise anything read ahead is dropped and reading starts over at the new position. */
+bool reader_seek(reader_t *reader, char drive, unsigned char track, int64_t byte_pos);
+
+/* Closes the track, for example when the disc goes away. */
+void reader_stop(reader_t *reader);
+
+/* Like reader_stop(), but returns only once the drive is no longer read from or open,
+ * so whatever stands behind the drive can go away. */
+void reader_close(reader_t *reader);
+
+/* 0 plays normally. Other values play short snippets while moving through the disc at that many
+ * times normal speed, forwards for positive values and backwards for negative ones. */
+void reader_set_scan(reader_t *reader, int speed);
+
+/* Silences read ahead that go on for longer than frames are cut down to that many frames, 0 plays them
+ * as they are. Reading carries on through the rest of the silence as fast as the drive allows. */
+void reader_set_silence_limit(reader_t *reader, size_t frames);
+
+/* Copies up to frames stereo frames of audio, returns how many were ready.
+ * Right after a seek this waits a few milliseconds for the first audio at the new position. */
+size_t reader_read(reader_t *reader, int16_t *buf, size_t frames);
+
+/* Position of the next frame reader_read() returns, false while stopped. */
+bool reader_get_position(reader_t *reader, unsigned char *track, int64_t *byte_pos);
+
+/* Position of the frame reader_read() returned frames frames ago, false if that is no longer in memory.
+ * Seeking there is served from memory and reads the same audio again. */
+bool reader_get_position_before(reader_t *reader, size_t frames, unsigned char *track, int64_t *byte_pos);
+
+/* Time from the last seek until its first audio was ready, 0 if it is not ready yet. */
+unsigned reader_get_seek_latency_usec(reader_t *reader);
+
+#endif /* READER_H__ */
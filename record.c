@@ -0,0 +1,561 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libretro.h>
+#include <cdrom/cdrom.h>
+#include <vfs/vfs_implementation_cdrom.h>
+#include <streams/file_stream.h>
+#include <rthreads/rthreads.h>
+#include <encodings/crc32.h>
+#include <features/features_cpu.h>
+#include <compat/strl.h>
+#include <retro_miscellaneous.h>
+#include <retro_timers.h>
+#include <retro_atomic.h>
+
+#include "record.h"
+
+/* Replies are matched to commands by drive and CDB. Threads interleave differently on every run,
+ * so a command may take any of the next REPLAY_WINDOW unused replies, not just the next one. */
+#define REPLAY_WINDOW 256
+
+/* Polling commands run on a timer and are sent a different number of times when the timing changes.
+ * Those past the end of the recording get the last reply to the same CDB. */
+#define REPLAY_REPEATS 32
+
+/* read commands looked at to work out the transfer size the drive was used with */
+#define REPLAY_PROBE_READS 16
+
+typedef struct
+{
+   record_command_t command;
+   unsigned char *data;
+} replay_reply_t;
+
+typedef struct
+{
+   volatile long active;   /* claimed by the player that records */
+   RFILE *file;
+   slock_t *lock;          /* made once and never freed, commands of other players may be waiting on it */
+   retro_time_t start_usec;
+   uint64_t frames;
+} record_state_t;
+
+typedef struct
+{
+   RFILE *commands;
+   RFILE *frames;
+   slock_t *lock;
+   replay_reply_t window[REPLAY_WINDOW];
+   unsigned window_count;
+   replay_reply_t repeats[REPLAY_REPEATS];
+   unsigned repeat_next;
+   record_replay_stats_t stats;
+   char content_path[512];
+   char drive;
+   double speed;
+   uint64_t sleep_usec;
+   bool commands_done;
+} replay_state_t;
+
+static record_state_t record = {0};
+static replay_state_t replay = {0};
+
+static void record_command(void *data, char drive, CDROM_CMD_Direction dir, const void *buf, size_t len, const unsigned char *cmd, size_t cmd_len, const unsigned char *sense, size_t sense_len, int status, uint64_t latency_usec)
+{
+   record_chunk_header_t chunk;
+   record_command_t command;
+   retro_time_t now = cpu_features_get_time_usec();
+
+   (void)data;
+
+   memset(&command, 0, sizeof(command));
+
+   command.latency_usec = (uint32_t)MIN(latency_usec, 0xFFFFFFFF);
+   command.drive = (uint8_t)drive;
+   command.dir = (uint8_t)dir;
+   command.cmd_len = (uint8_t)MIN(cmd_len, sizeof(command.cmd));
+   command.status = status ? 1 : 0;
+
+   memcpy(command.cmd, cmd, command.cmd_len);
+
+   if (sense)
+      memcpy(command.sense, sense, MIN(sense_len, sizeof(command.sense)));
+
+   if (dir == DIRECTION_IN && buf)
+   {
+      command.data_len = (uint32_t)len;
+      command.data_crc = encoding_crc32(0, (const uint8_t*)buf, len);
+   }
+
+   chunk.type = RECORD_CHUNK_COMMAND;
+   chunk.size = sizeof(command) + command.data_len;
+
+   slock_lock(record.lock);
+
+   if (record.file)
+   {
+      command.time_usec = (uint64_t)(now - record.start_usec);
+
+      filestream_write(record.file, &chunk, sizeof(chunk));
+      filestream_write(record.file, &command, sizeof(command));
+
+      if (command.data_len)
+         filestream_write(record.file, buf, command.data_len);
+   }
+
+   slock_unlock(record.lock);
+}
+
+bool record_begin(const char *path, const char *content_path)
+{
+   record_file_header_t header;
+   RFILE *file;
+
+   /* there is one recorder for the process, the commands of every player go to it */
+   if (!RETRO_ATOMIC_CAS(&record.active, 0, 1))
+      return false;
+
+   if (!record.lock && !(record.lock = slock_new()))
+   {
+      RETRO_ATOMIC_STORE_RELEASE(&record.active, 0);
+      return false;
+   }
+
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+   header.version = RECORD_VERSION;
+   header.path_len = (uint32_t)strlen(content_path);
+
+   file = filestream_open(path, RETRO_VFS_FILE_ACCESS_WRITE, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+
+   if (!file ||
+         filestream_write(file, &header, sizeof(header)) != sizeof(header) ||
+         filestream_write(file, content_path, header.path_len) != header.path_len)
+   {
+      if (file)
+         filestream_close(file);
+      RETRO_ATOMIC_STORE_RELEASE(&record.active, 0);
+      return false;
+   }
+
+   slock_lock(record.lock);
+   record.file = file;
+   record.start_usec = cpu_features_get_time_usec();
+   record.frames = 0;
+   slock_unlock(record.lock);
+
+   cdrom_set_command_observer(record_command, NULL);
+
+   return true;
+}
+
+void record_frame(unsigned input_state)
+{
+   record_chunk_header_t chunk;
+   record_frame_t frame;
+
+   if (!record.file)
+      return;
+
+   chunk.type = RECORD_CHUNK_FRAME;
+   chunk.size = sizeof(frame);
+
+   frame.frame = record.frames++;
+   frame.input_state = input_state;
+   frame.reserved = 0;
+
+   slock_lock(record.lock);
+
+   if (record.file)
+   {
+      filestream_write(record.file, &chunk, sizeof(chunk));
+      filestream_write(record.file, &frame, sizeof(frame));
+   }
+
+   slock_unlock(record.lock);
+}
+
+void record_end(void)
+{
+   if (!RETRO_ATOMIC_LOAD_ACQUIRE(&record.active))
+      return;
+
+   cdrom_set_command_observer(NULL, NULL);
+
+   /* the observer sees the commands of every player, one already in record_command() finds no file
+    * once it gets the lock */
+   slock_lock(record.lock);
+
+   if (record.file)
+      filestream_close(record.file);
+
+   record.file = NULL;
+   record.frames = 0;
+
+   slock_unlock(record.lock);
+
+   RETRO_ATOMIC_STORE_RELEASE(&record.active, 0);
+}
+
+bool record_is_active(void)
+{
+   return RETRO_ATOMIC_LOAD_ACQUIRE(&record.active) != 0;
+}
+
+static RFILE* replay_open(const char *path, char *content_path, size_t len)
+{
+   record_file_header_t header;
+   char stored_path[512] = {0};
+   RFILE *file = filestream_open(path, RETRO_VFS_FILE_ACCESS_READ, RETRO_VFS_FILE_ACCESS_HINT_NONE);
+
+   if (!file)
+      return NULL;
+
+   if (filestream_read(file, &header, sizeof(header)) != sizeof(header) ||
+         memcmp(header.magic, RECORD_MAGIC, sizeof(header.magic)) ||
+         header.version != RECORD_VERSION ||
+         header.path_len >= sizeof(stored_path) ||
+         filestream_read(file, stored_path, header.path_len) != header.path_len)
+   {
+      filestream_close(file);
+      return NULL;
+   }
+
+   if (content_path)
+      strlcpy(content_path, stored_path, len);
+
+   return file;
+}
+
+/* skips to the next chunk of the given type and returns its payload size, or -1 at the end of the file */
+static int64_t replay_next_chunk(RFILE *file, uint32_t type)
+{
+   record_chunk_header_t chunk;
+
+   while (filestream_read(file, &chunk, sizeof(chunk)) == sizeof(chunk))
+   {
+      if (chunk.type == type)
+         return chunk.size;
+
+      if (filestream_seek(file, chunk.size, RETRO_VFS_SEEK_POSITION_CURRENT) != 0)
+         break;
+   }
+
+   return -1;
+}
+
+static bool replay_read_reply(replay_reply_t *reply)
+{
+   int64_t size = replay_next_chunk(replay.commands, RECORD_CHUNK_COMMAND);
+
+   if (size < (int64_t)sizeof(reply->command) ||
+         filestream_read(replay.commands, &reply->command, sizeof(reply->command)) != sizeof(reply->command) ||
+         size != (int64_t)(sizeof(reply->command) + reply->command.data_len))
+      return false;
+
+   reply->data = NULL;
+
+   if (!reply->command.data_len)
+      return true;
+
+   reply->data = (unsigned char*)malloc(reply->command.data_len);
+
+   if (!reply->data || filestream_read(replay.commands, reply->data, reply->command.data_len) != reply->command.data_len)
+   {
+      free(reply->data);
+      reply->data = NULL;
+      return false;
+   }
+
+   if (encoding_crc32(0, reply->data, reply->command.data_len) != reply->command.data_crc)
+      replay.stats.corrupt++;
+
+   return true;
+}
+
+static void replay_fill_window(void)
+{
+   while (!replay.commands_done && replay.window_count < REPLAY_WINDOW)
+   {
+      if (!replay_read_reply(&replay.window[replay.window_count]))
+         replay.commands_done = true;
+      else
+         replay.window_count++;
+   }
+}
+
+static bool replay_reply_matches(const replay_reply_t *reply, unsigned char drive, const unsigned char *cmd, size_t cmd_len)
+{
+   return reply->command.drive == drive && reply->command.cmd_len == cmd_len && !memcmp(reply->command.cmd, cmd, cmd_len);
+}
+
+/* keeps the reply for commands that outlive the recording, replacing an older reply to the same command */
+static void replay_keep_reply(replay_reply_t *reply)
+{
+   unsigned slot = replay.repeat_next;
+   unsigned i;
+
+   for (i = 0; i < REPLAY_REPEATS; i++)
+   {
+      if (replay_reply_matches(&replay.repeats[i], reply->command.drive, reply->command.cmd, reply->command.cmd_len))
+         break;
+   }
+
+   if (i < REPLAY_REPEATS)
+      slot = i;
+   else
+      replay.repeat_next = (replay.repeat_next + 1) % REPLAY_REPEATS;
+
+   free(replay.repeats[slot].data);
+   replay.repeats[slot] = *reply;
+}
+
+static void* replay_transport_open(void *data, char drive)
+{
+   (void)data;
+
+   return (void*)(uintptr_t)(unsigned char)drive;
+}
+
+static void replay_transport_close(void *data, void *handle)
+{
+   (void)data;
+   (void)handle;
+}
+
+static int replay_transport_send(void *data, void *handle, CDROM_CMD_Direction dir, void *buf, size_t len, const unsigned char *cmd, size_t cmd_len, unsigned char *sense, size_t sense_len)
+{
+   unsigned char drive = (unsigned char)(uintptr_t)handle;
+   const replay_reply_t *reply = NULL;
+   unsigned sleep_ms = 0;
+   bool recorded = false;
+   int status = 1;
+   unsigned i;
+
+   (void)data;
+
+   slock_lock(replay.lock);
+
+   replay.stats.commands++;
+
+   replay_fill_window();
+
+   for (i = 0; i < replay.window_count; i++)
+   {
+      if (replay_reply_matches(&replay.window[i], drive, cmd, cmd_len))
+      {
+         replay_reply_t taken = replay.window[i];
+
+         memmove(&replay.window[i], &replay.window[i + 1], (replay.window_count - i - 1) * sizeof(replay.window[0]));
+         replay.window_count--;
+
+         replay_keep_reply(&taken);
+         recorded = true;
+         break;
+      }
+   }
+
+   /* a reply taken from the window is now the one kept for its command */
+   for (i = 0; i < REPLAY_REPEATS; i++)
+   {
+      if (replay_reply_matches(&replay.repeats[i], drive, cmd, cmd_len))
+      {
+         reply = &replay.repeats[i];
+         break;
+      }
+   }
+
+   if (reply)
+   {
+      if (!recorded)
+         replay.stats.repeated++;
+
+      if (dir == DIRECTION_IN && buf && reply->data)
+         memcpy(buf, reply->data, MIN(len, reply->command.data_len));
+
+      if (sense)
+         memcpy(sense, reply->command.sense, MIN(sense_len, sizeof(reply->command.sense)));
+
+      status = reply->command.status;
+
+      /* sleeps are whole milliseconds, carry the rest over to the next command */
+      if (replay.speed > 0)
+      {
+         replay.sleep_usec += (uint64_t)(reply->command.latency_usec / replay.speed);
+         sleep_ms = (unsigned)(replay.sleep_usec / 1000);
+         replay.sleep_usec -= sleep_ms * 1000ull;
+      }
+   }
+   else
+   {
+      replay.stats.unmatched++;
+
+      if (sense && sense_len >= 14)
+      {
+         /* ILLEGAL REQUEST, INVALID COMMAND OPERATION CODE */
+         memset(sense, 0, sense_len);
+         sense[0] = 0x70;
+         sense[2] = 0x5;
+         sense[7] = 0xA;
+         sense[12] = 0x20;
+      }
+   }
+
+   slock_unlock(replay.lock);
+
+   if (sleep_ms)
+      retro_sleep(sleep_ms);
+
+   return status;
+}
+
+/* The batch size of read commands comes from the transfer limit of the host adapter, which is not a command.
+ * Use the largest read of the first few in the recording so the replay issues the same reads. */
+static unsigned replay_probe_max_transfer(const char *path)
+{
+   RFILE *file = replay_open(path, NULL, 0);
+   unsigned max_transfer = 0;
+   unsigned reads = 0;
+   int64_t size;
+
+   if (!file)
+      return 0;
+
+   while (reads < REPLAY_PROBE_READS && (size = replay_next_chunk(file, RECORD_CHUNK_COMMAND)) >= (int64_t)sizeof(record_command_t))
+   {
+      record_command_t command;
+
+      if (filestream_read(file, &command, sizeof(command)) != sizeof(command) ||
+            filestream_seek(file, size - sizeof(command), RETRO_VFS_SEEK_POSITION_CURRENT) != 0)
+         break;
+
+      if (!command.status && (command.cmd[0] == 0xBE || command.cmd[0] == 0xB9))
+      {
+         max_transfer = MAX(max_transfer, command.data_len);
+         reads++;
+      }
+   }
+
+   filestream_close(file);
+
+   return max_transfer;
+}
+
+bool replay_begin(const char *path, double speed)
+{
+   cdrom_transport_t transport;
+
+   if (replay.lock)
+      replay_end(NULL);
+
+   memset(&replay, 0, sizeof(replay));
+
+   replay.commands = replay_open(path, replay.content_path, sizeof(replay.content_path));
+   replay.frames = replay_open(path, NULL, 0);
+   replay.lock = slock_new();
+   replay.speed = speed;
+
+   if (!replay.commands || !replay.frames || !replay.lock)
+   {
+      replay_end(NULL);
+      return false;
+   }
+
+   /* the recording answers for the drive it was made with */
+   replay.drive = retro_vfs_file_cdrom_get_drive(replay.content_path);
+
+   memset(&transport, 0, sizeof(transport));
+
+   transport.open = replay_transport_open;
+   transport.close = replay_transport_close;
+   transport.send = replay_transport_send;
+   transport.max_transfer_bytes = replay_probe_max_transfer(path);
+
+   if (!transport.max_transfer_bytes)
+      transport.max_transfer_bytes = 65536;
+
+   if (!cdrom_set_transport(replay.drive, &transport))
+   {
+      replay.drive = 0;
+      replay_end(NULL);
+      return false;
+   }
+
+   return true;
+}
+
+const char* replay_get_content_path(void)
+{
+   return replay.content_path;
+}
+
+bool replay_frame(unsigned *input_state)
+{
+   record_frame_t frame;
+
+   if (!replay.frames)
+      return false;
+
+   if (replay_next_chunk(replay.frames, RECORD_CHUNK_FRAME) != sizeof(frame) ||
+         filestream_read(replay.frames, &frame, sizeof(frame)) != sizeof(frame))
+   {
+      filestream_close(replay.frames);
+      replay.frames = NULL;
+      return false;
+   }
+
+   replay.stats.frames++;
+   *input_state = frame.input_state;
+
+   return true;
+}
+
+void replay_end(record_replay_stats_t *stats)
+{
+   unsigned i;
+
+   if (replay.drive)
+      cdrom_set_transport(replay.drive, NULL);
+
+   if (stats)
+      *stats = replay.stats;
+
+   for (i = 0; i < replay.window_count; i++)
+      free(replay.window[i].data);
+
+   for (i = 0; i < REPLAY_REPEATS; i++)
+      free(replay.repeats[i].data);
+
+   if (replay.commands)
+      filestream_close(replay.commands);
+
+   if (replay.frames)
+      filestream_close(replay.frames);
+
+   if (replay.lock)
+      slock_free(replay.lock);
+
+   memset(&replay, 0, sizeof(replay));
+}
+
+bool replay_is_active(void)
+{
+   return replay.lock != NULL;
+}
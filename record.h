@@ -0,0 +1,107 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef RECORD_H__
+#define RECORD_H__
+
+#include <stdint.h>
+#include <boolean.h>
+
+/* Session recordings: every command sent to the drive with its timing, sense and returned data,
+ * and the input of every frame. Replaying one serves the recorded replies through a cdrom transport,
+ * so the whole session runs through the same code again without the disc it was recorded from. */
+
+#define RECORD_MAGIC "RBRC"
+#define RECORD_VERSION 1
+
+/* file header, followed by path_len bytes of content path and then chunks */
+typedef struct
+{
+   char magic[4];
+   uint32_t version;
+   uint32_t path_len;
+   uint32_t reserved;
+} record_file_header_t;
+
+enum record_chunk_type
+{
+   RECORD_CHUNK_COMMAND = 1,
+   RECORD_CHUNK_FRAME
+};
+
+typedef struct
+{
+   uint32_t type;
+   uint32_t size; /* payload bytes that follow */
+} record_chunk_header_t;
+
+/* payload of RECORD_CHUNK_COMMAND, followed by data_len bytes of returned data */
+typedef struct
+{
+   uint64_t time_usec;    /* since the recording started */
+   uint32_t latency_usec;
+   uint32_t data_len;     /* 0 unless the command reads from the drive */
+   uint32_t data_crc;     /* crc32 of the returned data */
+   uint8_t drive;
+   uint8_t dir;
+   uint8_t cmd_len;
+   uint8_t status;        /* 0 on success */
+   uint8_t cmd[16];
+   uint8_t sense[16];
+} record_command_t;
+
+/* payload of RECORD_CHUNK_FRAME */
+typedef struct
+{
+   uint64_t frame;
+   uint32_t input_state;
+   uint32_t reserved;
+} record_frame_t;
+
+typedef struct
+{
+   unsigned commands;
+   unsigned unmatched;  /* commands the recording had no reply for */
+   unsigned repeated;   /* commands answered with an earlier reply to the same command */
+   unsigned corrupt;    /* replies whose data did not match the recorded crc */
+   unsigned frames;
+} record_replay_stats_t;
+
+/* Starts recording commands to all drives. content_path is stored for the replay to open. False if
+ * another player is recording already. */
+bool record_begin(const char *path, const char *content_path);
+
+void record_frame(unsigned input_state);
+
+void record_end(void);
+
+bool record_is_active(void);
+
+/* Installs a transport that answers from the recording at path.
+ * speed scales the recorded drive latencies: 1 keeps the original timing, 0 replies immediately. */
+bool replay_begin(const char *path, double speed);
+
+/* the content path the session was recorded with */
+const char* replay_get_content_path(void);
+
+/* Gets the input of the next recorded frame, false once the recording has no more frames. */
+bool replay_frame(unsigned *input_state);
+
+void replay_end(record_replay_stats_t *stats);
+
+bool replay_is_active(void);
+
+#endif /* RECORD_H__ */
@@ -15,103 +15,1434 @@ You may obtain a copy of the License at
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <libretro.h>
 #include <streams/file_stream.h>
 #include <vfs/vfs_implementation_cdrom.h>
+#include <cdrom/cdrom_sim.h>
 #include <compat/strl.h>
+#include <retro_miscellaneous.h>
+#include <encodings/crc32.h>
+#include <features/features_cpu.h>
 #include <math.h>
+#include <memalign.h>
 #include "redbook.h"
 #include "ugui_tools.h"
+#include "meter.h"
+#include "record.h"
+#include "reader.h"
+#include "crossfade.h"
+#include "deemphasis.h"
+#include "loudness.h"
+#include "disc_cache.h"
+#include "disc_scan.h"
+#include "disc_rip.h"
+#include "accuraterip.h"
+#include "silence.h"
+#include "stretch.h"
 
-#define ONE_FRAME_AUDIO_BYTES (2352 * 75) / 60
+/* the longest gap between frames audio is produced for, anything beyond that is dropped rather than sent in one burst */
+#define MAX_FRAME_AUDIO_FRAMES (REDBOOK_SAMPLE_RATE / 4)
 
-static unsigned *frame_buf = NULL;
-static int frame_width = 0;
-static int frame_height = 0;
-static RFILE *file = NULL;
-static unsigned char first_audio_track = 1;
-static unsigned char audio_track = 1;
-static bool paused = false;
-static bool audio_tracks_detected = false;
-static uint64_t avg_left = 0;
-static uint64_t avg_right = 0;
+/* time for a smoothed meter to fall to 1/e of its level */
+#define METER_FALL_USEC 150000.0
 
-static void previous_track(void)
+/* holding L or R scans at the first speed, and at the second once held this long */
+#define SCAN_SLOW_SPEED 4
+#define SCAN_FAST_SPEED 16
+#define SCAN_FAST_HOLD_USEC 2000000
+
+/* L2 and R2 jump this far through the track */
+#define SEEK_STEP_PERCENT 10.0
+
+#define MAX_CROSSFADE_MS 10000
+
+/* normalized playback aims for this integrated loudness, the ReplayGain 2.0 reference level */
+#define NORMALIZATION_TARGET_LUFS -18.0
+
+/* silences at least this long are shortened to it, and skipped at the ends of tracks */
+#define SILENCE_MIN_MS 1000
+#define SILENCE_MIN_BYTES ((int64_t)SILENCE_MIN_MS * REDBOOK_SAMPLE_RATE / 1000 * 4)
+
+struct redbook
+{
+   redbook_output_t output;
+   gui_t *gui;
+   reader_t *reader;
+   reader_t *fade_reader;            /* plays the outgoing track while a crossfade runs */
+   int frame_width;
+   int frame_height;
+   char content_path[512];
+   char drive;
+   cdrom_sim_t *image_drive;
+   bool recording;
+   bool replaying;
+   bool playing;
+   bool seek_latency_pending;
+   bool paused;
+   bool audio_tracks_detected;
+   bool first_audio_pending;
+   bool meter_smoothing;
+   unsigned char first_audio_track;
+   unsigned char audio_track;
+   int scan_speed;
+   retro_usec_t scan_hold_usec;
+   unsigned input_state_old;
+   uint64_t avg_left;
+   uint64_t avg_right;
+   double meter_left;
+   double meter_right;
+   retro_time_t load_time_usec;
+   unsigned media_poll_interval_ms;
+   retro_usec_t frame_time_usec;
+   unsigned video_fps;
+   uint64_t audio_frames_remainder;
+   unsigned crossfade_ms;
+   size_t fade_pos;
+   size_t fade_len;                  /* frames, 0 while no crossfade runs */
+   bool fade_reader_running;         /* until the next seek, also after the fade finished */
+   enum redbook_normalization normalization;
+   char cache_path[PATH_MAX_LENGTH];
+   char index_path[PATH_MAX_LENGTH];
+   char accuraterip_dir[PATH_MAX_LENGTH];
+   bool verify;
+   int read_offset;                  /* frames, of the drive that is played from */
+   disc_scan_t *disc_scan;
+   bool rip;
+   char rip_dir[PATH_MAX_LENGTH];
+   disc_rip_t *disc_rip;
+   disc_rip_result_t rip_result;     /* of the last rip, only filled in once it is over */
+   uint32_t rip_disc_id;             /* the disc that was ripped last, 0 for none */
+   enum redbook_silence silence;
+   disc_cache_entry_t disc_info;     /* of the disc in the drive, tracks not analyzed yet play as they are */
+   uint32_t disc_info_id;            /* the disc the info was looked up for, 0 before that */
+   float gain;                       /* reached at the end of the last frame */
+   stretch_t *stretch;
+   double speed;
+   struct retro_perf_counter perf[REDBOOK_PERF_STAGES];
+   int16_t audio_buf[MAX_FRAME_AUDIO_FRAMES * 2];
+   int16_t fade_buf[MAX_FRAME_AUDIO_FRAMES * 2];
+};
+
+/* players are allocated on their own cache lines, so ones running on different threads never share one */
+#define REDBOOK_ALIGN 64
+
+/* Images are played through a simulated drive, which needs a drive name the cdrom:// paths accept and
+ * no real drive can have, those are letters on Windows and /dev/sg0-9 elsewhere. Each image playing at
+ * the same time takes the next free one, counting from the first. */
+#ifdef _WIN32
+#define IMAGE_DRIVE_FIRST '0'
+#define IMAGE_DRIVE_LAST '9'
+#else
+#define IMAGE_DRIVE_FIRST 'A'
+#define IMAGE_DRIVE_LAST 'Z'
+#endif
+
+static const char *redbook_perf_names[REDBOOK_PERF_STAGES] =
+{
+   "redbook_input",
+   "redbook_read",
+   "redbook_meter",
+   "redbook_text",
+   "redbook_gui_draw",
+   "redbook_vu_draw",
+   "redbook_video",
+};
+
+/* also stops the outgoing reader of a fade that already finished */
+static void end_crossfade(redbook_t *rb)
+{
+   if (rb->fade_reader_running)
+      reader_stop(rb->fade_reader);
+
+   rb->fade_reader_running = false;
+   rb->fade_pos = 0;
+   rb->fade_len = 0;
+}
+
+static void seek_reader(redbook_t *rb, unsigned char track, int64_t byte_pos)
+{
+   rb->audio_track = track;
+   rb->playing = true;
+
+   if (rb->stretch)
+      stretch_reset(rb->stretch);
+
+   /* going back a few frames, as runahead does, is usually served from memory */
+   if (!reader_seek(rb->reader, rb->drive, track, byte_pos))
+      rb->seek_latency_pending = true;
+}
+
+/* plays track from byte_pos on, the read ahead audio is thrown away so the new position is heard right away */
+static void seek_track(redbook_t *rb, unsigned char track, int64_t byte_pos)
+{
+   end_crossfade(rb);
+   seek_reader(rb, track, byte_pos);
+}
+
+/* where track starts playing, past its leading silence when that is skipped */
+static int64_t get_track_start(redbook_t *rb, unsigned char track)
+{
+   const disc_cache_audible_t *audible = &rb->disc_info.audible[track - 1];
+
+   if (rb->silence != REDBOOK_SILENCE_SKIP || !audible->analyzed || audible->start < SILENCE_MIN_BYTES)
+      return 0;
+
+   return audible->start;
+}
+
+/* where track stops playing, before its trailing silence when that is skipped */
+static int64_t get_track_end(redbook_t *rb, const cdrom_toc_t *toc, unsigned char track)
+{
+   const disc_cache_audible_t *audible = &rb->disc_info.audible[track - 1];
+   int64_t track_bytes = toc->track[track - 1].track_bytes;
+
+   if (rb->silence != REDBOOK_SILENCE_SKIP || !audible->analyzed || track_bytes - audible->end < SILENCE_MIN_BYTES)
+      return track_bytes;
+
+   return audible->end;
+}
+
+static void detect_audio_tracks(redbook_t *rb, const cdrom_toc_t *toc)
+{
+   int i;
+
+   for (i = 0; i < toc->num_tracks; i++)
+   {
+      if (toc->track[i].audio)
+      {
+         rb->first_audio_track = i + 1;
+         rb->audio_tracks_detected = true;
+         break;
+      }
+   }
+}
+
+/* the track being heard and the position in it, false while nothing is playing */
+static bool get_position(redbook_t *rb, unsigned char *track, int64_t *byte_pos)
+{
+   return rb->playing && reader_get_position(rb->reader, track, byte_pos) && *track;
+}
+
+/* also while the stretched audio still plays out after going back to normal speed */
+static bool is_stretching(redbook_t *rb)
+{
+   return rb->stretch && (rb->speed != 1.0 || stretch_is_active(rb->stretch));
+}
+
+static size_t read_audio(void *data, int16_t *buf, size_t frames)
+{
+   return reader_read((reader_t*)data, buf, frames);
+}
+
+/* Fades from what is playing now into track, which the spare reader starts on while the current one
+ * plays on to the end of the fade. The fade ends with the outgoing track at the latest, so it is never
+ * heard past its last frame. False if there is nothing to fade from. */
+static bool start_crossfade(redbook_t *rb, unsigned char track)
+{
+   const cdrom_toc_t *toc = retro_vfs_file_get_cdrom_toc(rb->drive);
+   unsigned char current = 0;
+   int64_t byte_pos = 0;
+   int64_t end;
+   size_t remaining;
+   reader_t *outgoing;
+
+   if (!rb->crossfade_ms || !rb->fade_reader || rb->paused || rb->scan_speed || is_stretching(rb) ||
+         !get_position(rb, &current, &byte_pos))
+      return false;
+
+   end = get_track_end(rb, toc, current);
+
+   if (byte_pos >= end)
+      return false;
+
+   remaining = (size_t)((end - byte_pos) / 4);
+
+   /* a fade that is still running is cut short, its outgoing reader takes the new track */
+   if (rb->fade_len)
+      reader_stop(rb->fade_reader);
+
+   outgoing = rb->reader;
+   rb->reader = rb->fade_reader;
+   rb->fade_reader = outgoing;
+
+   rb->fade_reader_running = true;
+   rb->fade_pos = 0;
+   rb->fade_len = MIN((size_t)((uint64_t)rb->crossfade_ms * REDBOOK_SAMPLE_RATE / 1000), remaining);
+
+   rb->audio_track = track;
+
+   if (!reader_seek(rb->reader, rb->drive, track, get_track_start(rb, track)))
+      rb->seek_latency_pending = true;
+
+   return true;
+}
+
+/* skips to the start of track, through a crossfade if one is set */
+static void change_track(redbook_t *rb, unsigned char track)
+{
+   if (!start_crossfade(rb, track))
+      seek_track(rb, track, get_track_start(rb, track));
+}
+
+static void previous_track(redbook_t *rb)
+{
+   const cdrom_toc_t *toc = retro_vfs_file_get_cdrom_toc(rb->drive);
+
+   if (rb->audio_track > rb->first_audio_track)
+      change_track(rb, rb->audio_track - 1);
+   else
+      change_track(rb, toc->num_tracks);
+}
+
+static unsigned char next_audio_track(redbook_t *rb)
+{
+   const cdrom_toc_t *toc = retro_vfs_file_get_cdrom_toc(rb->drive);
+
+   if (toc->num_tracks > rb->audio_track)
+      return rb->audio_track + 1;
+
+   return rb->first_audio_track;
+}
+
+static void next_track(redbook_t *rb)
+{
+   change_track(rb, next_audio_track(rb));
+}
+
+/* Without a crossfade the reader carries on into the next track by itself, gapless to the frame.
+ * With one, the fade starts so that it ends exactly where the current track does, or where its audio
+ * does when silence is skipped. */
+static void update_crossfade(redbook_t *rb)
+{
+   const cdrom_toc_t *toc = retro_vfs_file_get_cdrom_toc(rb->drive);
+   unsigned char track = 0;
+   int64_t byte_pos = 0;
+   unsigned char next;
+
+   if (!rb->crossfade_ms || rb->fade_len || rb->paused || rb->scan_speed || is_stretching(rb) ||
+         !get_position(rb, &track, &byte_pos))
+      return;
+
+   /* the length of the track is not known until the TOC has it */
+   if (!toc->track[track - 1].track_bytes ||
+         get_track_end(rb, toc, track) - byte_pos > (int64_t)rb->crossfade_ms * REDBOOK_SAMPLE_RATE / 1000 * 4)
+      return;
+
+   rb->audio_track = track;
+   next = next_audio_track(rb);
+
+   if (next && toc->track[next - 1].audio)
+      start_crossfade(rb, next);
+}
+
+/* Moves past the silence at either end of a track, which the reader would play through by itself.
+ * Tracks that are silent all the way through are skipped as well, unless every track is. */
+static void update_silence(redbook_t *rb, const cdrom_toc_t *toc)
+{
+   unsigned char track = 0;
+   int64_t byte_pos = 0;
+   int i;
+
+   if (rb->silence != REDBOOK_SILENCE_SKIP || rb->fade_len || rb->paused || rb->scan_speed || !get_position(rb, &track, &byte_pos))
+      return;
+
+   if (byte_pos < get_track_start(rb, track))
+   {
+      seek_track(rb, track, get_track_start(rb, track));
+      return;
+   }
+
+   if (byte_pos < get_track_end(rb, toc, track))
+      return;
+
+   rb->audio_track = track;
+
+   for (i = 0; i < toc->num_tracks; i++)
+   {
+      rb->audio_track = next_audio_track(rb);
+
+      if (toc->track[rb->audio_track - 1].audio &&
+            get_track_start(rb, rb->audio_track) < get_track_end(rb, toc, rb->audio_track))
+      {
+         change_track(rb, rb->audio_track);
+         return;
+      }
+   }
+
+   rb->audio_track = track;
+}
+
+bool redbook_seek_msf(redbook_t *rb, unsigned char track, unsigned char min, unsigned char sec, unsigned char frame)
+{
+   const cdrom_toc_t *toc = retro_vfs_file_get_cdrom_toc(rb->drive);
+   int64_t byte_pos = (int64_t)cdrom_msf_to_lba(min, sec, frame) * 2352;
+
+   if (!rb->reader || !toc || !track || track > toc->num_tracks || !toc->track[track - 1].audio)
+      return false;
+
+   if (byte_pos >= toc->track[track - 1].track_bytes)
+      return false;
+
+   seek_track(rb, track, byte_pos);
+
+   return true;
+}
+
+bool redbook_seek_percent(redbook_t *rb, double percent)
+{
+   const cdrom_toc_t *toc = retro_vfs_file_get_cdrom_toc(rb->drive);
+   unsigned char track = 0;
+   int64_t byte_pos = 0;
+   unsigned char min = 0;
+   unsigned char sec = 0;
+   unsigned char frame = 0;
+
+   if (!get_position(rb, &track, &byte_pos))
+      return false;
+
+   percent = MAX(0.0, MIN(percent, 100.0));
+
+   /* the last frame of the track at most, going further is the same as skipping to the next one */
+   cdrom_lba_to_msf(MIN((unsigned)(toc->track[track - 1].track_size * percent / 100.0),
+         MAX(toc->track[track - 1].track_size, 1) - 1), &min, &sec, &frame);
+
+   return redbook_seek_msf(rb, track, min, sec, frame);
+}
+
+/* jumps percent of the current track forwards, or backwards for negative values */
+static void seek_step(redbook_t *rb, double percent)
+{
+   const cdrom_toc_t *toc = retro_vfs_file_get_cdrom_toc(rb->drive);
+   unsigned char track = 0;
+   int64_t byte_pos = 0;
+
+   if (get_position(rb, &track, &byte_pos) && toc->track[track - 1].track_bytes)
+      redbook_seek_percent(rb, 100.0 * byte_pos / toc->track[track - 1].track_bytes + percent);
+}
+
+/* holding L or R scans through the disc, speeding up the longer it is held */
+static void update_scan(redbook_t *rb, unsigned input_state)
+{
+   int direction = 0;
+   int speed;
+
+   if (input_state & (1 << RETRO_DEVICE_ID_JOYPAD_L))
+      direction--;
+   if (input_state & (1 << RETRO_DEVICE_ID_JOYPAD_R))
+      direction++;
+
+   if (direction && rb->scan_speed * direction > 0)
+      rb->scan_hold_usec += rb->frame_time_usec > 0 ? rb->frame_time_usec : 1000000 / rb->video_fps;
+   else
+      rb->scan_hold_usec = 0;
+
+   speed = direction * (rb->scan_hold_usec >= SCAN_FAST_HOLD_USEC ? SCAN_FAST_SPEED : SCAN_SLOW_SPEED);
+
+   if (speed != rb->scan_speed)
+   {
+      end_crossfade(rb);
+
+      /* scanning starts from what the reader is at, the input the stretch held is dropped */
+      if (rb->stretch)
+         stretch_reset(rb->stretch);
+
+      rb->scan_speed = speed;
+      reader_set_scan(rb->reader, speed);
+   }
+}
+
+size_t redbook_serialize_size(redbook_t *rb)
+{
+   (void)rb;
+
+   return sizeof(redbook_state_t);
+}
+
+bool redbook_serialize(redbook_t *rb, void *data, size_t size)
+{
+   redbook_state_t state;
+   unsigned char track = 0;
+   int64_t byte_pos = 0;
+
+   if (size < sizeof(state))
+      return false;
+
+   memset(&state, 0, sizeof(state));
+   memcpy(state.magic, REDBOOK_STATE_MAGIC, sizeof(state.magic));
+   state.version = REDBOOK_STATE_VERSION;
+   state.disc_id = disc_cache_get_id(retro_vfs_file_get_cdrom_toc(rb->drive));
+
+   if (get_position(rb, &track, &byte_pos))
+   {
+      state.track = track;
+      state.byte_pos = (uint32_t)byte_pos;
+   }
+
+   state.paused = rb->paused;
+   state.scan_speed = rb->scan_speed;
+   state.scan_hold_usec = (uint64_t)rb->scan_hold_usec;
+   state.input_state = rb->input_state_old;
+   state.audio_frames_remainder = rb->audio_frames_remainder;
+   state.avg_left = rb->avg_left;
+   state.avg_right = rb->avg_right;
+   state.meter_left = rb->meter_left;
+   state.meter_right = rb->meter_right;
+   state.gain = rb->gain;
+
+   if (rb->fade_len && reader_get_position(rb->fade_reader, &track, &byte_pos) && track)
+   {
+      state.fade_track = track;
+      state.fade_byte_pos = (uint32_t)byte_pos;
+      state.fade_pos = (uint32_t)rb->fade_pos;
+      state.fade_len = (uint32_t)rb->fade_len;
+   }
+
+   if (rb->stretch && stretch_is_active(rb->stretch))
+   {
+      stretch_state_t stretch_state;
+
+      stretch_get_state(rb->stretch, &stretch_state);
+
+      /* without its input in memory the stretch starts over after loading */
+      if (stretch_state.input_frames &&
+            reader_get_position_before(rb->reader, stretch_state.input_frames, &track, &byte_pos))
+      {
+         state.stretch_track = track;
+         state.stretch_byte_pos = (uint32_t)byte_pos;
+         state.stretch_input_frames = stretch_state.input_frames;
+         state.stretch_overlap = stretch_state.overlap;
+         state.stretch_next = stretch_state.next;
+         state.stretch_output_pos = stretch_state.output_pos;
+         state.stretch_output_frames = stretch_state.output_frames;
+         state.stretch_running = stretch_state.running;
+         state.stretch_pos = stretch_state.pos;
+      }
+   }
+
+   memcpy(data, &state, sizeof(state));
+
+   return true;
+}
+
+/* Reads the input the time-stretch held when the state was saved again, which leaves the reader where
+ * it was then. False if there is nothing to restore or the input is no longer in memory. */
+static bool restore_stretch(redbook_t *rb, const redbook_state_t *state)
+{
+   stretch_state_t stretch_state;
+   unsigned char track = 0;
+   int64_t byte_pos = 0;
+
+   if (!rb->stretch)
+      return false;
+
+   /* what it holds now was read after the state was saved */
+   stretch_reset(rb->stretch);
+
+   if (!state->stretch_track)
+      return false;
+
+   stretch_state.input_frames = state->stretch_input_frames;
+   stretch_state.overlap = state->stretch_overlap;
+   stretch_state.next = state->stretch_next;
+   stretch_state.output_pos = state->stretch_output_pos;
+   stretch_state.output_frames = state->stretch_output_frames;
+   stretch_state.running = state->stretch_running != 0;
+   stretch_state.pos = state->stretch_pos;
+
+   rb->audio_track = state->track;
+   rb->playing = true;
+
+   if (!reader_seek(rb->reader, rb->drive, state->stretch_track, state->stretch_byte_pos))
+      return false;
+
+   if (!stretch_set_state(rb->stretch, &stretch_state, read_audio, rb->reader) ||
+         !get_position(rb, &track, &byte_pos) || track != state->track || byte_pos != state->byte_pos)
+   {
+      stretch_reset(rb->stretch);
+      return false;
+   }
+
+   return true;
+}
+
+bool redbook_unserialize(redbook_t *rb, const void *data, size_t size)
+{
+   redbook_state_t state;
+   const cdrom_toc_t *toc = retro_vfs_file_get_cdrom_toc(rb->drive);
+   unsigned char track = 0;
+   int64_t byte_pos = 0;
+
+   if (size < sizeof(state) || !rb->reader || !toc)
+      return false;
+
+   memcpy(&state, data, sizeof(state));
+
+   if (memcmp(state.magic, REDBOOK_STATE_MAGIC, sizeof(state.magic)) || state.version != REDBOOK_STATE_VERSION)
+      return false;
+
+   if (state.disc_id != disc_cache_get_id(toc))
+   {
+      if (log_cb)
+         log_cb(RETRO_LOG_WARN, "[Redbook] The state was saved with a different disc\n");
+      return false;
+   }
+
+   if (state.track && (state.track > toc->num_tracks || !toc->track[state.track - 1].audio))
+      return false;
+
+   if (state.fade_track && (!state.track || state.fade_track > toc->num_tracks || !toc->track[state.fade_track - 1].audio ||
+         state.fade_pos >= state.fade_len || state.fade_len > (uint64_t)MAX_CROSSFADE_MS * REDBOOK_SAMPLE_RATE / 1000))
+      return false;
+
+   if (!(state.gain > 0.0f && state.gain < 1000.0f))
+      return false;
+
+   if (state.stretch_track && (!state.track || state.stretch_track > toc->num_tracks || !toc->track[state.stretch_track - 1].audio))
+      return false;
+
+   rb->paused = state.paused;
+   rb->input_state_old = state.input_state;
+   rb->audio_frames_remainder = state.audio_frames_remainder;
+   rb->avg_left = state.avg_left;
+   rb->avg_right = state.avg_right;
+   rb->meter_left = state.meter_left;
+   rb->meter_right = state.meter_right;
+   rb->scan_hold_usec = (retro_usec_t)state.scan_hold_usec;
+   rb->gain = state.gain;
+
+   if (rb->scan_speed != state.scan_speed)
+   {
+      rb->scan_speed = state.scan_speed;
+      reader_set_scan(rb->reader, rb->scan_speed);
+   }
+
+   if (!state.track)
+   {
+      /* saved before playback started, it starts over on the next frame */
+      end_crossfade(rb);
+      reader_stop(rb->reader);
+      rb->playing = false;
+      return true;
+   }
+
+   detect_audio_tracks(rb, toc);
+
+   /* A crossfade that started after the state was saved swapped the readers, the track that was playing
+    * then is in the outgoing one now. Swapping them back lets both carry on from what they read ahead. */
+   if (rb->fade_len && (!state.fade_track || rb->fade_pos < state.fade_pos))
+   {
+      reader_t *outgoing = rb->fade_reader;
+
+      rb->fade_reader = rb->reader;
+      rb->reader = outgoing;
+      rb->audio_track = state.track;
+   }
+
+   if (!restore_stretch(rb, &state) &&
+         (!get_position(rb, &track, &byte_pos) || track != state.track || byte_pos != state.byte_pos))
+      seek_reader(rb, state.track, state.byte_pos);
+
+   if (!state.fade_track)
+      end_crossfade(rb);
+   else
+   {
+      reader_seek(rb->fade_reader, rb->drive, state.fade_track, state.fade_byte_pos);
+
+      rb->fade_reader_running = true;
+      rb->fade_pos = state.fade_pos;
+      rb->fade_len = state.fade_len;
+   }
+
+   return true;
+}
+
+static bool redbook_kernels_picked = false;
+
+void redbook_kernels_init(uint64_t cpu_features)
+{
+   if (redbook_kernels_picked)
+      return;
+
+   meter_init(cpu_features);
+   crossfade_init(cpu_features);
+   deemphasis_init(cpu_features);
+   loudness_init(cpu_features);
+   silence_init(cpu_features);
+   stretch_init(cpu_features);
+   accuraterip_init(cpu_features);
+
+   redbook_kernels_picked = true;
+
+   if (log_cb)
+   {
+      log_cb(RETRO_LOG_INFO, "[Redbook] Using %s metering\n", meter_get_kernel_name());
+      log_cb(RETRO_LOG_INFO, "[Redbook] Using %s crossfading\n", crossfade_get_kernel_name());
+      log_cb(RETRO_LOG_INFO, "[Redbook] Using %s de-emphasis\n", deemphasis_get_kernel_name());
+      log_cb(RETRO_LOG_INFO, "[Redbook] Using %s loudness analysis\n", loudness_get_kernel_name());
+      log_cb(RETRO_LOG_INFO, "[Redbook] Using %s silence detection\n", silence_get_kernel_name());
+      log_cb(RETRO_LOG_INFO, "[Redbook] Using %s time-stretching\n", stretch_get_kernel_name());
+      log_cb(RETRO_LOG_INFO, "[Redbook] Using %s AccurateRip checksums\n", accuraterip_get_kernel_name());
+      log_cb(RETRO_LOG_INFO, "[Redbook] Using %s CRC-32\n", encoding_crc32_get_impl_name(encoding_crc32_get_impl()));
+   }
+}
+
+static void redbook_perf_init(redbook_t *rb)
+{
+   int i;
+
+   for (i = 0; i < REDBOOK_PERF_STAGES; i++)
+   {
+      rb->perf[i].ident = redbook_perf_names[i];
+      perf_cb.perf_register(&rb->perf[i]);
+   }
+}
+
+static void redbook_perf_log(redbook_t *rb)
+{
+   int i;
+
+   if (log_cb)
+   {
+      log_cb(RETRO_LOG_INFO, "[Redbook] Frame stages:\n");
+
+      for (i = 0; i < REDBOOK_PERF_STAGES; i++)
+      {
+         const struct retro_perf_counter *counter = &rb->perf[i];
+
+         log_cb(RETRO_LOG_INFO, "[Redbook]   %-18s %10llu calls %14llu ticks %10llu ticks/call\n",
+               counter->ident, (unsigned long long)counter->call_cnt, (unsigned long long)counter->total,
+               (unsigned long long)(counter->call_cnt ? counter->total / counter->call_cnt : 0));
+      }
+   }
+
+   perf_cb.perf_log();
+}
+
+struct retro_perf_counter* redbook_get_perf_counter(redbook_t *rb, enum redbook_perf_stage stage)
+{
+   return &rb->perf[stage];
+}
+
+const uint32_t* redbook_get_framebuffer(redbook_t *rb)
+{
+   return (const uint32_t*)gui_get_framebuffer(rb->gui);
+}
+
+redbook_t* redbook_new(int width, int height, const redbook_output_t *output)
+{
+   redbook_t *rb = (redbook_t*)memalign_alloc(REDBOOK_ALIGN, sizeof(*rb));
+
+   if (!rb)
+      return NULL;
+
+   memset(rb, 0, sizeof(*rb));
+
+   rb->output = *output;
+   rb->frame_width = width;
+   rb->frame_height = height;
+   rb->first_audio_track = 1;
+   rb->audio_track = 1;
+   rb->media_poll_interval_ms = 1000;
+   rb->video_fps = 60;
+   rb->gain = 1.0f;
+   rb->speed = 1.0;
+
+   rb->gui = gui_new(rb->frame_width, rb->frame_height, sizeof(unsigned));
+
+   if (!rb->gui)
+   {
+      memalign_free(rb);
+      return NULL;
+   }
+
+   gui_set_window_title(rb->gui, "Audio Player");
+
+   redbook_perf_init(rb);
+
+   rb->reader = reader_new();
+
+   if (!rb->reader && log_cb)
+      log_cb(RETRO_LOG_ERROR, "[Redbook] Could not start the audio reader\n");
+
+   /* without it tracks still play, only without crossfading */
+   rb->fade_reader = reader_new();
+
+   /* without it tracks still play, only at normal speed */
+   rb->stretch = stretch_new();
+
+   return rb;
+}
+
+void redbook_free(redbook_t *rb)
+{
+   if (!rb)
+      return;
+
+   stretch_free(rb->stretch);
+   reader_free(rb->fade_reader);
+   reader_free(rb->reader);
+   gui_free(rb->gui);
+   memalign_free(rb);
+}
+
+void redbook_set_frame_time(redbook_t *rb, retro_usec_t usec)
+{
+   rb->frame_time_usec = usec;
+}
+
+/* Whole stereo frames of audio that elapsed since the last frame. The remainder is kept in units of
+ * 1/1000000 of a frame, so the total stays sample exact however the frame times vary. */
+static size_t audio_frames_due(redbook_t *rb)
+{
+   uint64_t frames;
+
+   if (rb->frame_time_usec <= 0)
+      return REDBOOK_SAMPLE_RATE / rb->video_fps;
+
+   rb->audio_frames_remainder += (uint64_t)rb->frame_time_usec * REDBOOK_SAMPLE_RATE;
+   frames = rb->audio_frames_remainder / 1000000;
+   rb->audio_frames_remainder -= frames * 1000000;
+
+   return (size_t)MIN(frames, MAX_FRAME_AUDIO_FRAMES);
+}
+
+void redbook_set_fps(redbook_t *rb, unsigned fps)
+{
+   rb->video_fps = fps ? fps : 60;
+}
+
+void redbook_set_meter_smoothing(redbook_t *rb, bool enabled)
+{
+   rb->meter_smoothing = enabled;
+}
+
+void redbook_set_crossfade(redbook_t *rb, unsigned ms)
+{
+   rb->crossfade_ms = MIN(ms, MAX_CROSSFADE_MS);
+}
+
+void redbook_set_speed(redbook_t *rb, double speed)
+{
+   speed = MIN(MAX(speed, STRETCH_MIN_SPEED), STRETCH_MAX_SPEED);
+
+   /* a fade that runs is cut short, the outgoing track is not stretched along with the incoming one */
+   if (speed != 1.0 && rb->speed == 1.0)
+      end_crossfade(rb);
+
+   rb->speed = speed;
+}
+
+void redbook_set_normalization(redbook_t *rb, enum redbook_normalization normalization)
+{
+   /* looked up again, the disc may not have been measured for it */
+   if (rb->normalization != normalization)
+      rb->disc_info_id = 0;
+
+   rb->normalization = normalization;
+}
+
+void redbook_set_silence(redbook_t *rb, enum redbook_silence silence)
+{
+   size_t limit = silence == REDBOOK_SILENCE_PLAY ? 0 : (size_t)SILENCE_MIN_MS * REDBOOK_SAMPLE_RATE / 1000;
+
+   if (rb->silence != silence)
+      rb->disc_info_id = 0;
+
+   rb->silence = silence;
+
+   if (rb->reader)
+      reader_set_silence_limit(rb->reader, limit);
+   if (rb->fade_reader)
+      reader_set_silence_limit(rb->fade_reader, limit);
+}
+
+void redbook_set_cache_path(redbook_t *rb, const char *path)
+{
+   strlcpy(rb->cache_path, path, sizeof(rb->cache_path));
+}
+
+void redbook_set_index_path(redbook_t *rb, const char *path)
+{
+   strlcpy(rb->index_path, path, sizeof(rb->index_path));
+}
+
+void redbook_set_verify(redbook_t *rb, bool verify, int read_offset)
+{
+   rb->verify = verify;
+   rb->read_offset = read_offset;
+}
+
+void redbook_set_accuraterip_dir(redbook_t *rb, const char *dir)
+{
+   strlcpy(rb->accuraterip_dir, dir, sizeof(rb->accuraterip_dir));
+}
+
+void redbook_set_rip(redbook_t *rb, bool rip)
+{
+   rb->rip = rip;
+}
+
+void redbook_set_rip_dir(redbook_t *rb, const char *dir)
+{
+   strlcpy(rb->rip_dir, dir, sizeof(rb->rip_dir));
+}
+
+static void log_disc_info(const disc_cache_entry_t *entry, const char *source)
+{
+   if (!log_cb)
+      return;
+
+   if (entry->album.analyzed)
+      log_cb(RETRO_LOG_INFO, "[Redbook] Loudness of disc %08x from %s: %.1f LUFS, true peak %.3f\n",
+            (unsigned)entry->disc_id, source, entry->album.loudness, entry->album.peak);
+   else
+      log_cb(RETRO_LOG_INFO, "[Redbook] Loudness of disc %08x from %s: only some tracks\n", (unsigned)entry->disc_id, source);
+}
+
+/* the tracks the scan found on other discs, or earlier on the same one */
+static void log_duplicates(redbook_t *rb, const cdrom_toc_t *toc)
+{
+   unsigned char track;
+
+   for (track = 1; log_cb && track <= toc->num_tracks; track++)
+   {
+      disc_scan_duplicate_t duplicate;
+
+      if (!disc_scan_get_duplicate(rb->disc_scan, track, &duplicate))
+         continue;
+
+      if (duplicate.same_crc)
+         log_cb(RETRO_LOG_INFO, "[Redbook] Track %u is probably the same as track %u of disc %08x (same CRC-32 and length)\n",
+               (unsigned)track, (unsigned)duplicate.track, (unsigned)duplicate.disc_id);
+      else
+         log_cb(RETRO_LOG_INFO, "[Redbook] Track %u sounds like track %u of disc %08x (fingerprint distance %.2f)\n",
+               (unsigned)track, (unsigned)duplicate.track, (unsigned)duplicate.disc_id, duplicate.distance);
+   }
+}
+
+static void log_verify(redbook_t *rb)
 {
-   char path[512] = {0};
-   const cdrom_toc_t *toc = retro_vfs_file_get_cdrom_toc();
+   disc_scan_verify_t *result;
+   unsigned i;
 
-   if (audio_track > first_audio_track)
-      audio_track--;
-   else
-      audio_track = toc->num_tracks;
+   if (!log_cb || !(result = (disc_scan_verify_t*)malloc(sizeof(*result))))
+      return;
 
-   if (file)
-      filestream_close(file);
+   if (!disc_scan_get_verify(rb->disc_scan, result))
+   {
+      free(result);
+      return;
+   }
 
-#ifdef _WIN32
-   snprintf(path, sizeof(path), "cdrom://%c:/drive-track%02d.bin", toc->drive, audio_track);
-#else
-   snprintf(path, sizeof(path), "cdrom://drive%c-track%02d.bin", toc->drive, audio_track);
-#endif
+   log_cb(RETRO_LOG_INFO, "[Redbook] AccurateRip id dBAR-%03u-%08x-%08x-%08x, %s\n", (unsigned)result->id.num_tracks,
+         (unsigned)result->id.id1, (unsigned)result->id.id2, (unsigned)result->id.cddb,
+         result->in_database ? "found in the database" : "not in the database");
+
+   if (result->disc_crc_valid)
+      log_cb(RETRO_LOG_INFO, "[Redbook] CTDB-style CRC of the disc: %08x\n", (unsigned)result->disc_crc);
+
+   for (i = 0; i < result->id.num_tracks && i < ARRAY_SIZE(result->track); i++)
+   {
+      const accuraterip_track_t *track = &result->track[i];
+
+      if (!track->complete)
+         continue;
+
+      if (track->confidence)
+         log_cb(RETRO_LOG_INFO, "[Redbook] Track %u is accurate, confidence %u of %u (v%d %08x)\n", i + 1,
+               track->confidence, track->submissions, track->matched_v2 ? 2 : 1,
+               (unsigned)(track->matched_v2 ? track->v2 : track->v1));
+      else if (track->submissions)
+         log_cb(RETRO_LOG_WARN, "[Redbook] Track %u does not match any of %u submissions (v1 %08x, v2 %08x)\n", i + 1,
+               track->submissions, (unsigned)track->v1, (unsigned)track->v2);
+      else
+         log_cb(RETRO_LOG_INFO, "[Redbook] Track %u: v1 %08x, v2 %08x\n", i + 1, (unsigned)track->v1, (unsigned)track->v2);
+   }
 
-   file = filestream_open(path, RETRO_VFS_FILE_ACCESS_READ, 0);
+   free(result);
 }
 
-static void next_track(void)
+/* true if every audio track has what playback needs to know about it */
+static bool disc_info_complete(redbook_t *rb, const cdrom_toc_t *toc)
 {
-   char path[512] = {0};
-   const cdrom_toc_t *toc = retro_vfs_file_get_cdrom_toc();
+   int i;
 
-   if (toc->num_tracks > audio_track)
-      audio_track++;
-   else
-      audio_track = first_audio_track;
+   if (*rb->index_path && !rb->disc_info.indexed)
+      return false;
 
-   if (file)
-      filestream_close(file);
+   /* verifying is about the reads of this time */
+   if (rb->verify)
+      return false;
 
-#ifdef _WIN32
-   snprintf(path, sizeof(path), "cdrom://%c:/drive-track%02d.bin", toc->drive, audio_track);
-#else
-   snprintf(path, sizeof(path), "cdrom://drive%c-track%02d.bin", toc->drive, audio_track);
-#endif
+   for (i = 0; i < toc->num_tracks && i < (int)ARRAY_SIZE(rb->disc_info.track); i++)
+   {
+      if (!toc->track[i].audio)
+         continue;
+
+      if (rb->normalization != REDBOOK_NORMALIZATION_DISABLED && !rb->disc_info.track[i].analyzed)
+         return false;
+
+      if (rb->silence == REDBOOK_SILENCE_SKIP && !rb->disc_info.audible[i].analyzed)
+         return false;
+   }
+
+   return true;
+}
+
+/* Looks the disc up in the cache once its TOC is known, and scans it if it is not there. A drive is only
+ * scanned while nothing plays from it. Recorded and replayed sessions are never scanned, the reads would
+ * not be in the recording. */
+static void update_disc_info(redbook_t *rb, const cdrom_toc_t *toc)
+{
+   uint32_t id;
+
+   if (rb->disc_scan)
+   {
+      disc_scan_set_idle(rb->disc_scan, rb->image_drive || rb->paused || !rb->playing);
+
+      if (!disc_scan_get_result(rb->disc_scan, &rb->disc_info))
+         return;
+
+      log_duplicates(rb, toc);
+      log_verify(rb);
+
+      disc_scan_free(rb->disc_scan);
+      rb->disc_scan = NULL;
+
+      log_disc_info(&rb->disc_info, "scan");
+
+      if (*rb->cache_path && !disc_cache_store(rb->cache_path, &rb->disc_info) && log_cb)
+         log_cb(RETRO_LOG_WARN, "[Redbook] Could not write the disc cache %s\n", rb->cache_path);
+
+      return;
+   }
+
+   if ((rb->normalization == REDBOOK_NORMALIZATION_DISABLED && rb->silence != REDBOOK_SILENCE_SKIP && !rb->verify) || rb->disc_info_id)
+      return;
+
+   id = disc_cache_get_id(toc);
+
+   if (!id)
+      return;
+
+   rb->disc_info_id = id;
+
+   if (*rb->cache_path && disc_cache_load(rb->cache_path, id, &rb->disc_info))
+   {
+      log_disc_info(&rb->disc_info, "cache");
+
+      if (disc_info_complete(rb, toc))
+         return;
+   }
+
+   /* what the cache had is used until the scan is done */
+   rb->disc_info.disc_id = id;
+
+   if (!rb->recording && !rb->replaying)
+      rb->disc_scan = disc_scan_new(rb->drive, id, rb->image_drive || rb->paused || !rb->playing, rb->index_path,
+            rb->verify ? rb->accuraterip_dir : NULL, rb->image_drive ? 0 : rb->read_offset);
+}
+
+static void log_rip(const disc_rip_result_t *result)
+{
+   unsigned i;
+
+   if (!log_cb)
+      return;
+
+   log_cb(result->complete ? RETRO_LOG_INFO : RETRO_LOG_WARN, "[Redbook] Rip of disc dBAR-%03u-%08x-%08x-%08x %s%s\n",
+         (unsigned)result->id.num_tracks, (unsigned)result->id.id1, (unsigned)result->id.id2, (unsigned)result->id.cddb,
+         result->complete ? "done" : "stopped before the end",
+         result->read_cache_disabled ? "" : ", the drive cache could not be turned off");
+
+   for (i = 0; i < result->id.num_tracks && i < ARRAY_SIZE(result->track); i++)
+   {
+      const disc_rip_track_t *track = &result->track[i];
+      const char *accurate = "";
+
+      if (!track->ripped)
+         continue;
+
+      if (track->accuraterip.confidence)
+         accurate = ", accurate";
+      else if (track->accuraterip.submissions)
+         accurate = ", does not match AccurateRip";
+      else if (result->in_database)
+         accurate = ", not in AccurateRip";
+
+      log_cb(track->suspect_sectors ? RETRO_LOG_WARN : RETRO_LOG_INFO,
+            "[Redbook] Ripped track %u: %u re-reads, %u shifted reads, %u C2 errors, %u suspect sectors, v1 %08x, v2 %08x%s\n",
+            i + 1, track->rereads, track->jitter, track->c2_errors, track->suspect_sectors,
+            (unsigned)track->accuraterip.v1, (unsigned)track->accuraterip.v2, accurate);
+   }
+}
+
+/* Rips the disc once its scan is done, if ripping is on. Like a scan it only reads while nothing plays
+ * from the drive, and never in recorded or replayed sessions. A disc is ripped once while it is in the drive. */
+static void update_rip(redbook_t *rb, const cdrom_toc_t *toc)
+{
+   uint32_t id;
+
+   if (rb->disc_rip)
+   {
+      disc_rip_set_idle(rb->disc_rip, rb->image_drive || rb->paused || !rb->playing);
+
+      if (!disc_rip_get_result(rb->disc_rip, &rb->rip_result))
+         return;
+
+      log_rip(&rb->rip_result);
+      disc_rip_free(rb->disc_rip);
+      rb->disc_rip = NULL;
+      return;
+   }
+
+   if (!rb->rip || !*rb->rip_dir || rb->disc_scan || rb->recording || rb->replaying)
+      return;
+
+   id = disc_cache_get_id(toc);
+
+   if (!id || id == rb->rip_disc_id)
+      return;
+
+   rb->rip_disc_id = id;
+
+   if (log_cb)
+      log_cb(RETRO_LOG_INFO, "[Redbook] Ripping disc %08x to %s\n", (unsigned)id, rb->rip_dir);
+
+   rb->disc_rip = disc_rip_new(rb->drive, id, rb->image_drive || rb->paused || !rb->playing, rb->rip_dir,
+         rb->accuraterip_dir, rb->image_drive ? 0 : rb->read_offset);
+
+   if (!rb->disc_rip && log_cb)
+      log_cb(RETRO_LOG_WARN, "[Redbook] Could not start ripping disc %08x\n", (unsigned)id);
+}
+
+/* forgets what is known about the disc, the scan and rip of it are stopped */
+static void reset_disc_info(redbook_t *rb)
+{
+   disc_scan_free(rb->disc_scan);
+   rb->disc_scan = NULL;
+   disc_rip_free(rb->disc_rip);
+   rb->disc_rip = NULL;
+   rb->rip_disc_id = 0;
+   rb->disc_info_id = 0;
+   memset(&rb->disc_info, 0, sizeof(rb->disc_info));
+}
+
+/* the gain that brings track to the target loudness, as far as its true peak allows without clipping */
+static float get_track_gain(redbook_t *rb, unsigned char track)
+{
+   const disc_cache_loudness_t *loudness = &rb->disc_info.album;
+   double gain;
+
+   if (rb->normalization == REDBOOK_NORMALIZATION_DISABLED || !track)
+      return 1.0f;
+
+   if (rb->normalization == REDBOOK_NORMALIZATION_TRACK)
+      loudness = &rb->disc_info.track[track - 1];
+
+   if (!loudness->analyzed || loudness->loudness <= LOUDNESS_SILENCE)
+      return 1.0f;
+
+   gain = pow(10.0, (NORMALIZATION_TARGET_LUFS - loudness->loudness) / 20.0);
+
+   if (loudness->peak > 0.0f)
+      gain = MIN(gain, 1.0 / loudness->peak);
+
+   return (float)gain;
+}
+
+/* Takes the gain from where the last frame left it to gain over frames, which never clicks.
+ * At unity the audio is left bit exact. */
+static void ramp_gain(redbook_t *rb, int16_t *samples, size_t frames, float gain)
+{
+   if (!frames)
+      return;
+
+   if (gain != 1.0f || rb->gain != 1.0f)
+      loudness_apply_gain(samples, frames, rb->gain, (gain - rb->gain) / frames);
+
+   rb->gain = gain;
+}
+
+/* Levels jump straight to the average of this frame's audio. With smoothing they rise instantly and fall
+ * off with a fixed time constant, so the meters look the same at any frame rate. */
+static void update_meters(redbook_t *rb)
+{
+   double decay;
+
+   if (!rb->meter_smoothing)
+   {
+      rb->meter_left = (double)rb->avg_left;
+      rb->meter_right = (double)rb->avg_right;
+      return;
+   }
+
+   decay = exp(-(rb->frame_time_usec > 0 ? (double)rb->frame_time_usec : 1000000.0 / rb->video_fps) / METER_FALL_USEC);
+
+   rb->meter_left = MAX((double)rb->avg_left, rb->meter_left * decay);
+   rb->meter_right = MAX((double)rb->avg_right, rb->meter_right * decay);
+}
+
+void redbook_set_media_poll_interval(redbook_t *rb, unsigned interval_ms)
+{
+   rb->media_poll_interval_ms = interval_ms;
+
+   retro_vfs_file_cdrom_media_poll_set_interval(rb->drive, interval_ms);
+}
+
+/* the disc was ejected or swapped: drop everything that came from the old one and start over with the new one */
+static void media_changed(redbook_t *rb, bool present)
+{
+   end_crossfade(rb);
+   reader_stop(rb->reader);
+   rb->playing = false;
+
+   if (rb->stretch)
+      stretch_reset(rb->stretch);
+
+   reset_disc_info(rb);
+
+   retro_vfs_file_cdrom_toc_invalidate(rb->drive);
+
+   rb->first_audio_track = 1;
+   rb->audio_track = 1;
+   rb->audio_tracks_detected = false;
+   rb->avg_left = 0;
+   rb->avg_right = 0;
+   rb->meter_left = 0;
+   rb->meter_right = 0;
+
+   if (log_cb)
+      log_cb(RETRO_LOG_INFO, "[Redbook] Disc %s\n", present ? "changed" : "ejected");
+
+   if (!present)
+      return;
+
+   rb->load_time_usec = cpu_features_get_time_usec();
+   rb->first_audio_pending = true;
+
+   if (!retro_vfs_file_cdrom_toc_begin(rb->content_path) && log_cb)
+      log_cb(RETRO_LOG_WARN, "[Redbook] Could not read the TOC of the new disc\n");
+}
 
-   file = filestream_open(path, RETRO_VFS_FILE_ACCESS_READ, 0);
+/* puts a .cue or .bin image behind the cdrom:// paths, so it plays exactly like a disc would */
+static bool redbook_load_image(redbook_t *rb, const char *path)
+{
+   cdrom_transport_t transport;
+   char drive = IMAGE_DRIVE_FIRST;
+
+   rb->image_drive = cdrom_sim_new(path);
+
+   if (!rb->image_drive)
+   {
+      if (log_cb)
+         log_cb(RETRO_LOG_ERROR, "[Redbook] Could not open the image %s\n", path);
+      return false;
+   }
+
+   cdrom_sim_get_transport(rb->image_drive, &transport);
+
+   while (!cdrom_set_transport(drive, &transport))
+   {
+      if (drive == IMAGE_DRIVE_LAST)
+      {
+         if (log_cb)
+            log_cb(RETRO_LOG_ERROR, "[Redbook] No free drive to play the image %s on\n", path);
+         cdrom_sim_free(rb->image_drive);
+         rb->image_drive = NULL;
+         return false;
+      }
+
+      drive++;
+   }
+
+   cdrom_device_fillpath(rb->content_path, sizeof(rb->content_path), drive, 0, true);
+
+   if (log_cb)
+      log_cb(RETRO_LOG_INFO, "[Redbook] Playing image %s (%u tracks)\n", path, (unsigned)cdrom_sim_get_num_tracks(rb->image_drive));
+
+   return true;
+}
+
+static void redbook_unload_image(redbook_t *rb)
+{
+   if (!rb->image_drive)
+      return;
+
+   cdrom_set_transport(retro_vfs_file_cdrom_get_drive(rb->content_path), NULL);
+   cdrom_sim_free(rb->image_drive);
+   rb->image_drive = NULL;
+}
+
+/* REDBOOK_REPLAY plays back a recorded session in place of the content, with drive latencies
+ * scaled by 1 / REDBOOK_REPLAY_SPEED (0 answers immediately). REDBOOK_RECORD records this session.
+ * There is one recorder for the process, so only one player at a time records or replays. */
+static bool redbook_begin_session(redbook_t *rb, const char *path)
+{
+   const char *record_path = getenv("REDBOOK_RECORD");
+   const char *replay_path = getenv("REDBOOK_REPLAY");
+
+   if (replay_path && *replay_path)
+   {
+      const char *speed = getenv("REDBOOK_REPLAY_SPEED");
+
+      if (replay_is_active())
+      {
+         if (log_cb)
+            log_cb(RETRO_LOG_ERROR, "[Redbook] Another player is already replaying\n");
+         return false;
+      }
+
+      if (!replay_begin(replay_path, speed && *speed ? atof(speed) : 1.0))
+      {
+         if (log_cb)
+            log_cb(RETRO_LOG_ERROR, "[Redbook] Could not open the recording %s\n", replay_path);
+         return false;
+      }
+
+      rb->replaying = true;
+      strlcpy(rb->content_path, replay_get_content_path(), sizeof(rb->content_path));
+
+      if (log_cb)
+         log_cb(RETRO_LOG_INFO, "[Redbook] Replaying %s (%s)\n", replay_path, rb->content_path);
+
+      return true;
+   }
+
+   if (strncmp(path, "cdrom://", strlen("cdrom://")) && !redbook_load_image(rb, path))
+      return false;
+
+   if (record_path && *record_path)
+   {
+      if (record_is_active())
+      {
+         if (log_cb)
+            log_cb(RETRO_LOG_WARN, "[Redbook] Another player is already recording\n");
+      }
+      else if (record_begin(record_path, rb->content_path))
+      {
+         rb->recording = true;
+
+         if (log_cb)
+            log_cb(RETRO_LOG_INFO, "[Redbook] Recording to %s\n", record_path);
+      }
+      else if (log_cb)
+         log_cb(RETRO_LOG_WARN, "[Redbook] Could not record to %s\n", record_path);
+   }
+
+   return true;
+}
+
+static void redbook_end_session(redbook_t *rb)
+{
+   if (rb->replaying)
+   {
+      record_replay_stats_t stats;
+
+      replay_end(&stats);
+
+      if (log_cb)
+         log_cb(RETRO_LOG_INFO, "[Redbook] Replay: %u frames, %u commands, %u repeated, %u not in the recording, %u corrupt\n",
+               stats.frames, stats.commands, stats.repeated, stats.unmatched, stats.corrupt);
+
+      rb->replaying = false;
+   }
+
+   if (rb->recording)
+   {
+      record_end();
+      rb->recording = false;
+   }
+
+   redbook_unload_image(rb);
 }
 
-void redbook_init(int width, int height, uint32_t *buf)
+bool redbook_load_game(redbook_t *rb, const char *path)
 {
-   frame_width = width;
-   frame_height = height;
-   frame_buf = buf;
+   if (!rb->reader)
+      return false;
+
+   rb->load_time_usec = cpu_features_get_time_usec();
+   rb->first_audio_pending = true;
+
+   strlcpy(rb->content_path, path, sizeof(rb->content_path));
+
+   if (!redbook_begin_session(rb, path))
+      return false;
+
+   /* images get their drive while the session begins */
+   rb->drive = retro_vfs_file_cdrom_get_drive(rb->content_path);
+
+   /* the TOC is built in the background so playback can start after the first track is known */
+   if (!retro_vfs_file_cdrom_toc_begin(rb->content_path))
+   {
+      redbook_end_session(rb);
+      return false;
+   }
 
-   gui_init(frame_width, frame_height, sizeof(unsigned));
-   gui_set_window_title("Audio Player");
+   if (!retro_vfs_file_cdrom_media_poll_begin(rb->drive, rb->media_poll_interval_ms) && log_cb)
+      log_cb(RETRO_LOG_WARN, "[Redbook] Disc changes will not be detected\n");
+
+   return true;
 }
 
-void redbook_free(void)
+void redbook_unload_game(redbook_t *rb)
 {
-   if (file)
+   retro_vfs_cdrom_media_poll_stats_t stats;
+
+   retro_vfs_file_cdrom_media_poll_end(rb->drive, &stats);
+
+   if (log_cb && stats.elapsed_usec > 0)
    {
-      filestream_close(file);
-      file = NULL;
+      double hours = stats.elapsed_usec / 3600000000.0;
+
+      log_cb(RETRO_LOG_INFO, "[Redbook] Media polling: %u commands, %.3f ms CPU over %.1f s (%.0f commands/hour, %.1f ms CPU/hour), %u changes\n",
+            stats.commands, stats.cpu_usec / 1000.0, stats.elapsed_usec / 1000000.0,
+            stats.commands / hours, stats.cpu_usec / 1000.0 / hours, stats.events);
    }
+
+   reset_disc_info(rb);
+
+   if (rb->fade_reader)
+      reader_close(rb->fade_reader);
+   reader_close(rb->reader);
+
+   if (rb->stretch)
+      stretch_reset(rb->stretch);
+
+   rb->playing = false;
+   rb->fade_reader_running = false;
+   rb->fade_pos = 0;
+   rb->fade_len = 0;
+
+   retro_vfs_file_cdrom_toc_end(rb->drive);
+   redbook_end_session(rb);
+   rb->drive = 0;
+
+   redbook_perf_log(rb);
 }
 
-void redbook_run_frame(unsigned input_state)
+void redbook_run_frame(redbook_t *rb, unsigned input_state)
 {
    unsigned trigger_state = 0;
-   static unsigned trigger_state_old = 0;
-   char path[512] = {0};
-   const cdrom_toc_t *toc = retro_vfs_file_get_cdrom_toc();
+   const cdrom_toc_t *toc = retro_vfs_file_get_cdrom_toc(rb->drive);
+   bool media_present = false;
+
+   if (rb->replaying)
+      replay_frame(&input_state);
+   else if (rb->recording)
+      record_frame(input_state);
 
    if (!toc)
       return;
 
-   trigger_state = input_state & ~trigger_state_old;
-   trigger_state_old = input_state;
+   if (retro_vfs_file_cdrom_media_changed(rb->drive, &media_present))
+      media_changed(rb, media_present);
+
+   trigger_state = input_state & ~rb->input_state_old;
+   rb->input_state_old = input_state;
 
    /*memset(frame_buf, 0xFFCCCCCC, frame_width * frame_height * sizeof(uint32_t));*/
 
@@ -120,84 +1451,153 @@ void redbook_run_frame(unsigned input_state)
       case (1 << RETRO_DEVICE_ID_JOYPAD_A):
          break;
       case (1 << RETRO_DEVICE_ID_JOYPAD_B):
-         paused = !paused;
+         rb->paused = !rb->paused;
          break;
       case (1 << RETRO_DEVICE_ID_JOYPAD_UP):
       case (1 << RETRO_DEVICE_ID_JOYPAD_DOWN):
       case (1 << RETRO_DEVICE_ID_JOYPAD_LEFT):
       {
-         previous_track();
+         previous_track(rb);
          break;
       }
       case (1 << RETRO_DEVICE_ID_JOYPAD_RIGHT):
       {
-         next_track();
+         next_track(rb);
          break;
       }
+      case (1 << RETRO_DEVICE_ID_JOYPAD_L2):
+         seek_step(rb, -SEEK_STEP_PERCENT);
+         break;
+      case (1 << RETRO_DEVICE_ID_JOYPAD_R2):
+         seek_step(rb, SEEK_STEP_PERCENT);
+         break;
       default:
          break;
    }
 
-   if (paused)
+   update_scan(rb, rb->paused ? 0 : input_state);
+   update_disc_info(rb, toc);
+   update_rip(rb, toc);
+
+   if (rb->paused)
       goto end;
 
-   if (!file)
+   if (!rb->playing)
    {
-      int i;
+      detect_audio_tracks(rb, toc);
 
-      for (i = 0; i < toc->num_tracks; i++)
-      {
-         if (toc->track[i].audio)
-         {
-            first_audio_track = i + 1;
-            audio_tracks_detected = true;
-            break;
-         }
-      }
-
-#ifdef _WIN32
-      snprintf(path, sizeof(path), "cdrom://%c:/drive-track%02d.bin", toc->drive, first_audio_track);
-#else
-      snprintf(path, sizeof(path), "cdrom://drive%c-track%02d.bin", toc->drive, first_audio_track);
-#endif
+      rb->audio_track = rb->first_audio_track;
 
-      audio_track = first_audio_track;
+      /* starts at its level rather than ramping to it */
+      rb->gain = get_track_gain(rb, rb->first_audio_track);
 
-      if (audio_tracks_detected)
-         file = filestream_open(path, RETRO_VFS_FILE_ACCESS_READ, 0);
+      if (rb->audio_tracks_detected)
+         seek_track(rb, rb->first_audio_track, get_track_start(rb, rb->first_audio_track));
    }
 
+   update_crossfade(rb);
+   update_silence(rb, toc);
+
    {
-      char data[ONE_FRAME_AUDIO_BYTES] = {0};
+      size_t frames = audio_frames_due(rb);
 
-      if (file)
+      if (rb->playing)
       {
-         int64_t bytes_read = filestream_read(file, data, sizeof(data));
+         size_t filled;
+         unsigned char track = 0;
+         int64_t byte_pos = 0;
+         int64_t next_byte_pos = 0;
+
+         get_position(rb, &track, &byte_pos);
+
+         REDBOOK_PERF_START(rb, REDBOOK_PERF_READ);
+
+         /* scanning sets its own pace, and at normal speed the reader is passed through as it is */
+         if (rb->stretch)
+            filled = stretch_process(rb->stretch, rb->audio_buf, frames, rb->scan_speed ? 1.0 : rb->speed, read_audio, rb->reader);
+         else
+            filled = reader_read(rb->reader, rb->audio_buf, frames);
 
-         if (audio_batch_cb && bytes_read)
+         REDBOOK_PERF_STOP(rb, REDBOOK_PERF_READ);
+
+         /* whatever was not read yet is sent as silence, the frontend still gets exactly the audio that elapsed */
+         memset(rb->audio_buf + filled * 2, 0, (frames - filled) * 4);
+
+         if (frames)
          {
-            int i;
-            avg_left = 0;
-            avg_right = 0;
+            unsigned char next = 0;
+            size_t split = 0;
 
-            audio_batch_cb((const int16_t*)data, sizeof(data) / sizeof(unsigned));
+            get_position(rb, &next, &next_byte_pos);
 
-            for (i = 0; i < sizeof(data) / sizeof(unsigned); i++)
-            {
-               const int16_t *d = (const int16_t*)data;
+            /* a frame that runs into the next track ramps to its gain only from where it starts */
+            if (track && next == track)
+               split = frames;
+            else if (track)
+               split = (size_t)MAX(MIN((toc->track[track - 1].track_bytes - byte_pos) / 4, (int64_t)frames), 0);
+
+            ramp_gain(rb, rb->audio_buf, split, get_track_gain(rb, track));
+            ramp_gain(rb, rb->audio_buf + split * 2, frames - split, get_track_gain(rb, next));
+         }
+
+         if (rb->fade_len)
+         {
+            size_t fade_frames = MIN(frames, rb->fade_len - rb->fade_pos);
+            size_t fade_filled = reader_read(rb->fade_reader, rb->fade_buf, fade_frames);
+            unsigned char fade_track = 0;
+            int64_t fade_byte_pos = 0;
+            float fade_gain;
+
+            memset(rb->fade_buf + fade_filled * 2, 0, (fade_frames - fade_filled) * 4);
 
-               avg_left  += (int64_t)abs(d[(i * 2) + 0]);
-               avg_right += (int64_t)abs(d[(i * 2) + 1]);
+            if (reader_get_position(rb->fade_reader, &fade_track, &fade_byte_pos) &&
+                  (fade_gain = get_track_gain(rb, fade_track)) != 1.0f)
+               loudness_apply_gain(rb->fade_buf, fade_frames, fade_gain, 0.0f);
+
+            crossfade_mix(rb->audio_buf, rb->fade_buf, rb->audio_buf, fade_frames, rb->fade_pos, rb->fade_len);
+
+            rb->fade_pos += fade_frames;
+
+            /* the outgoing reader is left where it is rather than stopped, so loading a state from
+             * before the end of the fade finds it still in place */
+            if (rb->fade_pos >= rb->fade_len)
+            {
+               rb->fade_pos = 0;
+               rb->fade_len = 0;
             }
+         }
+
+         if (rb->seek_latency_pending && filled)
+         {
+            rb->seek_latency_pending = false;
 
-            avg_left /= sizeof(data) / sizeof(unsigned);
-            avg_right /= sizeof(data) / sizeof(unsigned);
+            if (log_cb)
+               log_cb(RETRO_LOG_DEBUG, "[Redbook] Seek latency: %.1f ms\n", reader_get_seek_latency_usec(rb->reader) / 1000.0);
          }
 
-         if (filestream_eof(file))
+         if (rb->output.audio && frames)
          {
-            next_track();
-            return;
+            rb->avg_left = 0;
+            rb->avg_right = 0;
+
+            rb->output.audio(rb->output.data, rb->audio_buf, frames);
+
+            if (rb->first_audio_pending && filled)
+            {
+               rb->first_audio_pending = false;
+
+               if (log_cb)
+                  log_cb(RETRO_LOG_INFO, "[Redbook] Time to first audio: %.1f ms\n", (cpu_features_get_time_usec() - rb->load_time_usec) / 1000.0);
+            }
+
+            REDBOOK_PERF_START(rb, REDBOOK_PERF_METER);
+
+            meter_sum(rb->audio_buf, frames, &rb->avg_left, &rb->avg_right);
+
+            rb->avg_left /= frames;
+            rb->avg_right /= frames;
+
+            REDBOOK_PERF_STOP(rb, REDBOOK_PERF_METER);
          }
       }
    }
@@ -210,49 +1610,46 @@ end:
       char audio_pos_string[10] = {0};
       char audio_total_string[10] = {0};
       int i;
-      const libretro_vfs_implementation_file *stream;
-      const vfs_cdrom_t *cdrom;
+      unsigned char track = 0;
+      int64_t byte_pos = 0;
       unsigned char cur_track_min = 0;
       unsigned char cur_track_sec = 0;
       unsigned char cur_track_frame = 0;
       unsigned char total_track_min = 0;
       unsigned char total_track_sec = 0;
       unsigned char total_track_frame = 0;
-      unsigned *vbuf = gui_get_framebuffer();
+      unsigned *vbuf = gui_get_framebuffer(rb->gui);
 
-      if (!file || !audio_tracks_detected)
+      if (!rb->audio_tracks_detected || !get_position(rb, &track, &byte_pos))
       {
-         strlcpy(play_string, "No audio tracks detected.\n", sizeof(play_string));
+         if (toc->num_tracks)
+            strlcpy(play_string, "No audio tracks detected.\n", sizeof(play_string));
+         else
+            strlcpy(play_string, "No disc.\n", sizeof(play_string));
 
-         gui_set_message(play_string);
-         gui_draw();
+         gui_set_message(rb->gui, play_string);
 
-         if (video_cb)
-            video_cb(gui_get_framebuffer(), frame_width, frame_height, frame_width * sizeof(uint32_t));
+         REDBOOK_PERF_START(rb, REDBOOK_PERF_GUI_DRAW);
+         gui_draw(rb->gui);
+         REDBOOK_PERF_STOP(rb, REDBOOK_PERF_GUI_DRAW);
+
+         REDBOOK_PERF_START(rb, REDBOOK_PERF_VIDEO);
+         if (rb->output.video)
+            rb->output.video(rb->output.data, (const uint32_t*)vbuf, rb->frame_width, rb->frame_height, rb->frame_width * sizeof(uint32_t));
+         REDBOOK_PERF_STOP(rb, REDBOOK_PERF_VIDEO);
 
          return;
       }
 
-      stream = filestream_get_vfs_handle(file);
-      cdrom = retro_vfs_file_get_cdrom_position(stream);
+      REDBOOK_PERF_START(rb, REDBOOK_PERF_TEXT);
 
-      if (cdrom && toc->num_tracks && cdrom->cur_track)
-      {
-         for (i = 0; i < toc->num_tracks; i++)
-         {
-            if (toc->track[i].lba >= cdrom->cur_lba)
-            {
-               /* this track starts after the current position, so the current track is right before this */
-               audio_track = i;
-               break;
-            }
-         }
-      }
+      /* the reader moves on to the next track by itself, so the track shown is the one being heard */
+      rb->audio_track = track;
 
-      cdrom_lba_to_msf(cdrom->cur_lba - toc->track[audio_track - 1].lba, &cur_track_min, &cur_track_sec, &cur_track_frame);
-      cdrom_lba_to_msf(toc->track[audio_track - 1].track_size, &total_track_min, &total_track_sec, &total_track_frame);
+      cdrom_lba_to_msf((unsigned)(byte_pos / 2352), &cur_track_min, &cur_track_sec, &cur_track_frame);
+      cdrom_lba_to_msf(toc->track[rb->audio_track - 1].track_size, &total_track_min, &total_track_sec, &total_track_frame);
 
-      snprintf(track_string, sizeof(track_string), "%02u", (unsigned)audio_track);
+      snprintf(track_string, sizeof(track_string), "%02u", (unsigned)rb->audio_track);
       snprintf(total_track_string, sizeof(total_track_string), "%02u", (unsigned)toc->num_tracks);
       snprintf(audio_pos_string, sizeof(audio_pos_string), "%02u:%02u", (unsigned)cur_track_min, (unsigned)cur_track_sec);
       snprintf(audio_total_string, sizeof(audio_total_string), "%02u:%02u", (unsigned)total_track_min, (unsigned)total_track_sec);
@@ -262,8 +1659,10 @@ end:
       pos = strlcat(play_string + pos, " of ", sizeof(play_string) - pos);
       pos = strlcat(play_string + pos, total_track_string, sizeof(play_string) - pos);
 
-      if (paused)
+      if (rb->paused)
          pos = strlcat(play_string + pos, "\n\nPaused: ", sizeof(play_string) - pos);
+      else if (rb->scan_speed)
+         pos = strlcat(play_string + pos, rb->scan_speed > 0 ? "\n\nCue: " : "\n\nReview: ", sizeof(play_string) - pos);
       else
          pos = strlcat(play_string + pos, "\n\nPlaying: ", sizeof(play_string) - pos);
 
@@ -271,27 +1670,40 @@ end:
       pos = strlcat(play_string + pos, " / ", sizeof(play_string) - pos);
       pos = strlcat(play_string + pos, audio_total_string, sizeof(play_string) - pos);
 
-      gui_set_message(play_string);
-      gui_set_footer("Left/Right = Previous/Next, B = Pause");
-      gui_draw();
+      gui_set_message(rb->gui, play_string);
+      gui_set_footer(rb->gui, "Left/Right = Previous/Next, B = Pause\nL/R = Scan, L2/R2 = Skip 10%");
+
+      REDBOOK_PERF_STOP(rb, REDBOOK_PERF_TEXT);
 
-      if (avg_left)
+      REDBOOK_PERF_START(rb, REDBOOK_PERF_GUI_DRAW);
+      gui_draw(rb->gui);
+      REDBOOK_PERF_STOP(rb, REDBOOK_PERF_GUI_DRAW);
+
+      REDBOOK_PERF_START(rb, REDBOOK_PERF_VU_DRAW);
+
+      update_meters(rb);
+
+      if (rb->meter_left >= 1.0)
       {
-         for (i = 0; i < avg_left / (32768.0 / (double)(frame_width - 10)); i++)
+         for (i = 0; i < rb->meter_left / (32768.0 / (double)(rb->frame_width - 10)); i++)
          {
-            vbuf[frame_width * (int)(frame_height / 1.3) + i + 5] = 0xFFCCCCCC;
+            vbuf[rb->frame_width * (int)(rb->frame_height / 1.3) + i + 5] = 0xFFCCCCCC;
          }
       }
 
-      if (avg_right)
+      if (rb->meter_right >= 1.0)
       {
-         for (i = 0; i < avg_right / (32768.0 / (double)(frame_width - 10)); i++)
+         for (i = 0; i < rb->meter_right / (32768.0 / (double)(rb->frame_width - 10)); i++)
          {
-            vbuf[frame_width * ((int)(frame_height / 1.3) + 2) + i + 5] = 0xFFCCCCCC;
+            vbuf[rb->frame_width * ((int)(rb->frame_height / 1.3) + 2) + i + 5] = 0xFFCCCCCC;
          }
       }
 
-      if (video_cb)
-         video_cb(vbuf, frame_width, frame_height, frame_width * sizeof(uint32_t));
+      REDBOOK_PERF_STOP(rb, REDBOOK_PERF_VU_DRAW);
+
+      REDBOOK_PERF_START(rb, REDBOOK_PERF_VIDEO);
+      if (rb->output.video)
+         rb->output.video(rb->output.data, (const uint32_t*)vbuf, rb->frame_width, rb->frame_height, rb->frame_width * sizeof(uint32_t));
+      REDBOOK_PERF_STOP(rb, REDBOOK_PERF_VIDEO);
    }
 }
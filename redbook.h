@@ -17,14 +17,172 @@ You may obtain a copy of the License at
 #ifndef REDBOOK_H__
 #define REDBOOK_H__
 
-retro_audio_sample_batch_t audio_batch_cb;
-retro_audio_sample_t audio_cb;
-retro_video_refresh_t video_cb;
+#define REDBOOK_SAMPLE_RATE 44100
 
-void redbook_init(int width, int height, uint32_t *buf);
+extern retro_log_printf_t log_cb;
+extern struct retro_perf_callback perf_cb;
 
-void redbook_free(void);
+/* stages of a frame, each timed with a frontend perf counter */
+enum redbook_perf_stage
+{
+   REDBOOK_PERF_INPUT = 0,
+   REDBOOK_PERF_READ,
+   REDBOOK_PERF_METER,
+   REDBOOK_PERF_TEXT,
+   REDBOOK_PERF_GUI_DRAW,
+   REDBOOK_PERF_VU_DRAW,
+   REDBOOK_PERF_VIDEO,
+   REDBOOK_PERF_STAGES
+};
 
-void redbook_run_frame(unsigned input_state);
+/* A player. Everything it plays, shows and keeps track of is in here, so any number of them can run at once,
+ * each on its own thread, as long as they play different drives or images. */
+typedef struct redbook redbook_t;
+
+/* where a player sends each frame, data is passed back to both */
+typedef struct
+{
+   void (*video)(void *data, const uint32_t *buf, unsigned width, unsigned height, size_t pitch);
+   size_t (*audio)(void *data, const int16_t *buf, size_t frames);
+   void *data;
+} redbook_output_t;
+
+#define REDBOOK_PERF_START(rb, stage) perf_cb.perf_start(redbook_get_perf_counter(rb, stage))
+#define REDBOOK_PERF_STOP(rb, stage) perf_cb.perf_stop(redbook_get_perf_counter(rb, stage))
+
+/* Picks the fastest kernel of every module for this CPU. Players only read them, so this is called once,
+ * before the first player is created, and later calls do nothing. */
+void redbook_kernels_init(uint64_t cpu_features);
+
+redbook_t* redbook_new(int width, int height, const redbook_output_t *output);
+
+void redbook_free(redbook_t *rb);
+
+struct retro_perf_counter* redbook_get_perf_counter(redbook_t *rb, enum redbook_perf_stage stage);
+
+/* the last frame drawn, width * height pixels */
+const uint32_t* redbook_get_framebuffer(redbook_t *rb);
+
+bool redbook_load_game(redbook_t *rb, const char *path);
+
+void redbook_unload_game(redbook_t *rb);
+
+/* how often to look for disc changes, 0 to stop looking */
+void redbook_set_media_poll_interval(redbook_t *rb, unsigned interval_ms);
+
+/* Time since the previous frame as reported by the frontend, each frame then produces the audio that elapsed.
+ * 0 goes back to a fixed 1/60 s of audio per frame. */
+void redbook_set_frame_time(redbook_t *rb, retro_usec_t usec);
+
+/* the frame rate reported to the frontend, frames without frame times carry 1/fps s of audio */
+void redbook_set_fps(redbook_t *rb, unsigned fps);
+
+void redbook_set_meter_smoothing(redbook_t *rb, bool enabled);
+
+/* Track changes fade over this long with an equal-power curve, up to 10 s. 0 plays tracks back to back
+ * without any gap, as they are on the disc. */
+void redbook_set_crossfade(redbook_t *rb, unsigned ms);
+
+enum redbook_normalization
+{
+   REDBOOK_NORMALIZATION_DISABLED = 0,
+   REDBOOK_NORMALIZATION_TRACK,
+   REDBOOK_NORMALIZATION_ALBUM
+};
+
+/* Plays every track, or the whole disc, at the same integrated loudness. Discs are measured in the
+ * background the first time they are played, until then and for tracks not measured yet the level is
+ * left alone. */
+void redbook_set_normalization(redbook_t *rb, enum redbook_normalization normalization);
+
+enum redbook_silence
+{
+   REDBOOK_SILENCE_PLAY = 0,
+   REDBOOK_SILENCE_SHORTEN,
+   REDBOOK_SILENCE_SKIP
+};
+
+/* Shortening cuts every silence longer than a second down to a second as it is read. Skipping also
+ * leaves out the silence at the start and end of tracks, and silent tracks, once the disc was measured. */
+void redbook_set_silence(redbook_t *rb, enum redbook_silence silence);
+
+/* Plays at this speed, from 0.5 to 2, without changing the pitch. Tracks do not crossfade while the
+ * speed is not 1. */
+void redbook_set_speed(redbook_t *rb, double speed);
+
+/* the file disc measurements are kept in, empty to measure every disc again each time */
+void redbook_set_cache_path(redbook_t *rb, const char *path);
+
+/* The file every scanned track is kept in by its content, across all discs, empty for none. Tracks that
+ * are on a disc already scanned are logged when the scan finds them. */
+void redbook_set_index_path(redbook_t *rb, const char *path);
+
+/* Reads every disc once more when it is put in and logs whether each track reads the same as for others
+ * with the AccurateRip checksums. read_offset is the offset correction of the drive in frames, images
+ * are taken as already corrected. */
+void redbook_set_verify(redbook_t *rb, bool verify, int read_offset);
+
+/* the directory AccurateRip database files dBAR-*.bin are looked up in */
+void redbook_set_accuraterip_dir(redbook_t *rb, const char *dir);
+
+/* Rips every disc to WAV files once it was scanned, with the offset correction given to
+ * redbook_set_verify(). Tracks in the AccurateRip database are checked against it. */
+void redbook_set_rip(redbook_t *rb, bool rip);
+
+/* the directory rips are written to, a directory for each disc */
+void redbook_set_rip_dir(redbook_t *rb, const char *dir);
+
+/* Plays track from the given time into it. The audio read ahead is dropped, so the new position is
+ * heard after a single read from the drive. False if track is not an audio track or is shorter. */
+bool redbook_seek_msf(redbook_t *rb, unsigned char track, unsigned char min, unsigned char sec, unsigned char frame);
+
+/* moves to a point in the current track, 0 to 100 */
+bool redbook_seek_percent(redbook_t *rb, double percent);
+
+void redbook_run_frame(redbook_t *rb, unsigned input_state);
+
+#define REDBOOK_STATE_MAGIC "RBST"
+#define REDBOOK_STATE_VERSION 4
+
+/* Savestate. It is small and fixed in size so it can be taken every frame for rewind and runahead,
+ * and holds where playback is rather than any audio, which comes from the disc again after loading. */
+typedef struct
+{
+   char magic[4];
+   uint32_t version;
+   uint32_t disc_id;                 /* a state only loads with the disc it was saved with */
+   uint32_t byte_pos;                /* in track, 0 with track */
+   uint8_t track;                    /* 0 before playback started */
+   uint8_t paused;
+   uint8_t fade_track;               /* the outgoing track, 0 while no crossfade runs */
+   uint8_t stretch_track;            /* where the input held by the time-stretch starts, 0 while it holds none */
+   int32_t scan_speed;
+   uint32_t input_state;             /* of the last frame, so buttons held across the load are not pressed again */
+   uint64_t scan_hold_usec;
+   uint64_t audio_frames_remainder;  /* fraction of an audio frame carried to the next video frame */
+   uint64_t avg_left;
+   uint64_t avg_right;
+   double meter_left;
+   double meter_right;
+   uint32_t fade_byte_pos;           /* in fade_track */
+   uint32_t fade_pos;                /* frames into the crossfade */
+   uint32_t fade_len;
+   float gain;                       /* of normalization, reached at the end of the last frame */
+   uint32_t stretch_byte_pos;        /* in stretch_track */
+   uint32_t stretch_input_frames;    /* read again when loading, which leaves the reader at byte_pos */
+   uint32_t stretch_overlap;
+   uint32_t stretch_next;
+   uint32_t stretch_output_pos;
+   uint32_t stretch_output_frames;
+   uint32_t stretch_running;
+   double stretch_pos;
+} redbook_state_t;
+
+size_t redbook_serialize_size(redbook_t *rb);
+
+bool redbook_serialize(redbook_t *rb, void *data, size_t size);
+
+/* Fails if the state is from another disc. Playback moves to the saved position without reopening anything. */
+bool redbook_unserialize(redbook_t *rb, const void *data, size_t size);
 
 #endif /* REDBOOK_H__ */
@@ -0,0 +1,182 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <libretro.h>
+#include "silence.h"
+#include "simd.h"
+
+/* The kernels count samples rather than frames. The vector ones test a block of 32 samples at a time
+ * and leave the block that has sound in it to the C kernel, which finds the exact sample. */
+#define SILENCE_BLOCK_SAMPLES 32
+
+typedef size_t (*silence_kernel_t)(const int16_t *samples, size_t count, int16_t threshold);
+
+/* silent samples before the first loud one */
+static size_t silence_leading_c(const int16_t *samples, size_t count, int16_t threshold)
+{
+   size_t i;
+
+   for (i = 0; i < count; i++)
+      if (samples[i] > threshold || samples[i] < -threshold)
+         break;
+
+   return i;
+}
+
+/* silent samples after the last loud one */
+static size_t silence_trailing_c(const int16_t *samples, size_t count, int16_t threshold)
+{
+   size_t i;
+
+   for (i = count; i > 0; i--)
+      if (samples[i - 1] > threshold || samples[i - 1] < -threshold)
+         break;
+
+   return count - i;
+}
+
+#ifdef SIMD_HAVE_SSE2
+/* true if any of the 32 samples is louder than the threshold */
+static int silence_block_loud_sse2(const int16_t *samples, __m128i high, __m128i low)
+{
+   __m128i a = _mm_loadu_si128((const __m128i*)(samples + 0));
+   __m128i b = _mm_loadu_si128((const __m128i*)(samples + 8));
+   __m128i c = _mm_loadu_si128((const __m128i*)(samples + 16));
+   __m128i d = _mm_loadu_si128((const __m128i*)(samples + 24));
+   __m128i max = _mm_max_epi16(_mm_max_epi16(a, b), _mm_max_epi16(c, d));
+   __m128i min = _mm_min_epi16(_mm_min_epi16(a, b), _mm_min_epi16(c, d));
+
+   return _mm_movemask_epi8(_mm_or_si128(_mm_cmpgt_epi16(max, high), _mm_cmplt_epi16(min, low)));
+}
+
+static size_t silence_leading_sse2(const int16_t *samples, size_t count, int16_t threshold)
+{
+   __m128i high = _mm_set1_epi16(threshold);
+   __m128i low = _mm_set1_epi16((int16_t)-threshold);
+   size_t i;
+
+   for (i = 0; i + SILENCE_BLOCK_SAMPLES <= count; i += SILENCE_BLOCK_SAMPLES)
+      if (silence_block_loud_sse2(samples + i, high, low))
+         break;
+
+   return i + silence_leading_c(samples + i, count - i, threshold);
+}
+
+static size_t silence_trailing_sse2(const int16_t *samples, size_t count, int16_t threshold)
+{
+   __m128i high = _mm_set1_epi16(threshold);
+   __m128i low = _mm_set1_epi16((int16_t)-threshold);
+   size_t i;
+
+   for (i = count; i >= SILENCE_BLOCK_SAMPLES; i -= SILENCE_BLOCK_SAMPLES)
+      if (silence_block_loud_sse2(samples + i - SILENCE_BLOCK_SAMPLES, high, low))
+         break;
+
+   return (count - i) + silence_trailing_c(samples, i, threshold);
+}
+#endif
+
+#ifdef SIMD_HAVE_NEON
+static int silence_block_loud_neon(const int16_t *samples, int16x8_t high, int16x8_t low)
+{
+   int16x8_t a = vld1q_s16(samples + 0);
+   int16x8_t b = vld1q_s16(samples + 8);
+   int16x8_t c = vld1q_s16(samples + 16);
+   int16x8_t d = vld1q_s16(samples + 24);
+   int16x8_t max = vmaxq_s16(vmaxq_s16(a, b), vmaxq_s16(c, d));
+   int16x8_t min = vminq_s16(vminq_s16(a, b), vminq_s16(c, d));
+   uint16x8_t loud = vorrq_u16(vcgtq_s16(max, high), vcltq_s16(min, low));
+   uint16x4_t any = vorr_u16(vget_low_u16(loud), vget_high_u16(loud));
+
+   return vget_lane_u64(vreinterpret_u64_u16(any), 0) != 0;
+}
+
+static size_t silence_leading_neon(const int16_t *samples, size_t count, int16_t threshold)
+{
+   int16x8_t high = vdupq_n_s16(threshold);
+   int16x8_t low = vdupq_n_s16((int16_t)-threshold);
+   size_t i;
+
+   for (i = 0; i + SILENCE_BLOCK_SAMPLES <= count; i += SILENCE_BLOCK_SAMPLES)
+      if (silence_block_loud_neon(samples + i, high, low))
+         break;
+
+   return i + silence_leading_c(samples + i, count - i, threshold);
+}
+
+static size_t silence_trailing_neon(const int16_t *samples, size_t count, int16_t threshold)
+{
+   int16x8_t high = vdupq_n_s16(threshold);
+   int16x8_t low = vdupq_n_s16((int16_t)-threshold);
+   size_t i;
+
+   for (i = count; i >= SILENCE_BLOCK_SAMPLES; i -= SILENCE_BLOCK_SAMPLES)
+      if (silence_block_loud_neon(samples + i - SILENCE_BLOCK_SAMPLES, high, low))
+         break;
+
+   return (count - i) + silence_trailing_c(samples, i, threshold);
+}
+#endif
+
+static silence_kernel_t silence_leading_kernel = silence_leading_c;
+static silence_kernel_t silence_trailing_kernel = silence_trailing_c;
+static const char *silence_kernel_name = "C";
+
+void silence_init(uint64_t cpu_features)
+{
+   silence_kernel_t leading = silence_leading_c;
+   silence_kernel_t trailing = silence_trailing_c;
+   const char *name = "C";
+
+#ifdef SIMD_HAVE_SSE2
+   if (cpu_features & RETRO_SIMD_SSE2)
+   {
+      leading = silence_leading_sse2;
+      trailing = silence_trailing_sse2;
+      name = "SSE2";
+   }
+#endif
+
+#ifdef SIMD_HAVE_NEON
+   if (cpu_features & (RETRO_SIMD_NEON | RETRO_SIMD_ASIMD))
+   {
+      leading = silence_leading_neon;
+      trailing = silence_trailing_neon;
+      name = "NEON";
+   }
+#endif
+
+   (void)cpu_features;
+
+   silence_leading_kernel = leading;
+   silence_trailing_kernel = trailing;
+   silence_kernel_name = name;
+}
+
+const char* silence_get_kernel_name(void)
+{
+   return silence_kernel_name;
+}
+
+size_t silence_leading(const int16_t *samples, size_t frames, int16_t threshold)
+{
+   return silence_leading_kernel(samples, frames * 2, threshold) / 2;
+}
+
+size_t silence_trailing(const int16_t *samples, size_t frames, int16_t threshold)
+{
+   return silence_trailing_kernel(samples, frames * 2, threshold) / 2;
+}
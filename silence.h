@@ -0,0 +1,38 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef SILENCE_H__
+#define SILENCE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* samples no louder than this, about -60 dBFS, count as silence; dither and tape hiss stay below it */
+#define SILENCE_THRESHOLD 32
+
+/* Picks the fastest scanning kernel for the given RETRO_SIMD_* feature mask. */
+void silence_init(uint64_t cpu_features);
+
+const char* silence_get_kernel_name(void);
+
+/* Interleaved stereo frames at the start of samples before the first one with a sample louder than
+ * threshold, frames if all of them are silent. */
+size_t silence_leading(const int16_t *samples, size_t frames, int16_t threshold);
+
+/* The same at the end of samples, the frames after the last one with a sample louder than threshold. */
+size_t silence_trailing(const int16_t *samples, size_t frames, int16_t threshold);
+
+#endif /* SILENCE_H__ */
@@ -0,0 +1,70 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef SIMD_H__
+#define SIMD_H__
+
+#include <stdint.h>
+#include <math.h>
+#include <retro_inline.h>
+
+/* What the kernels can be built with. Which of them runs is picked at init from the RETRO_SIMD_*
+ * mask, since building with an instruction set does not mean the CPU has it. */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON) || defined(__aarch64__)
+#define SIMD_HAVE_NEON
+#include <arm_neon.h>
+#endif
+
+/* A sample worked out in float back to 16 bits, rounded to nearest and saturated. The vector versions
+ * below give the same result, apart from NEON rounding halves away from zero rather than to even. */
+static INLINE int16_t simd_to_int16(float v)
+{
+   long i = lrintf(v);
+
+   return (int16_t)(i < -32768 ? -32768 : (i > 32767 ? 32767 : i));
+}
+
+#ifdef SIMD_HAVE_SSE2
+/* 8 samples from two registers of 4 */
+static INLINE __m128i simd_to_int16_sse2(__m128 lo, __m128 hi)
+{
+   /* the conversion rounds like lrintf and the pack saturates */
+   return _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi));
+}
+#endif
+
+#ifdef SIMD_HAVE_NEON
+static INLINE int32x4_t simd_round_neon(float32x4_t v)
+{
+   /* the conversion truncates, so round half away from zero first */
+   float32x4_t half = vbslq_f32(vcltq_f32(v, vdupq_n_f32(0.0f)), vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f));
+
+   return vcvtq_s32_f32(vaddq_f32(v, half));
+}
+
+/* 8 samples from two registers of 4 */
+static INLINE int16x8_t simd_to_int16_neon(float32x4_t lo, float32x4_t hi)
+{
+   return vcombine_s16(vqmovn_s32(simd_round_neon(lo)), vqmovn_s32(simd_round_neon(hi)));
+}
+#endif
+
+#endif /* SIMD_H__ */
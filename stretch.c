@@ -0,0 +1,723 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <libretro.h>
+#include <retro_miscellaneous.h>
+#include "libretro-common/audio/dsp_filters/fft/fft.h"
+#include "stretch.h"
+#include "simd.h"
+
+/* Pieces are 1024 frames (23 ms) with a Hann window and overlap by half, so the output moves on by
+ * 512 frames a piece. Each piece may start up to 256 frames (5.8 ms) either side of where the speed
+ * puts it, which is enough to line up a period of anything above 86 Hz. */
+#define STRETCH_FRAME 1024
+#define STRETCH_HOP (STRETCH_FRAME / 2)
+#define STRETCH_SEEK 256
+#define STRETCH_LAGS (STRETCH_SEEK * 2 + 1)
+#define STRETCH_SEARCH (STRETCH_FRAME + STRETCH_SEEK * 2)
+
+/* the correlation of every offset at once, large enough that none of them wraps around */
+#define STRETCH_FFT_LOG2 11
+#define STRETCH_FFT_SIZE (1 << STRETCH_FFT_LOG2)
+
+/* more than a piece and the offsets around it need at any speed */
+#define STRETCH_INPUT_FRAMES 4096
+
+/* Offsets where the input is this much quieter than the loudest one are compared as if they were that
+ * loud. The energies are running sums, this keeps their rounding from making a near silent offset win. */
+#define STRETCH_ENERGY_FLOOR 1e-3f
+
+#define STRETCH_PI 3.14159265358979323846
+
+/* the offset in 0 to lags - 1 whose len samples of search are most like the template, given how much
+ * each one correlates with it. energy receives the energy of every offset. */
+typedef size_t (*stretch_match_t)(const float *corr, const float *search, float *energy, size_t len, size_t lags);
+
+/* Fades the first half of a piece in over the second half of the one before it. window is that of a
+ * whole piece, its first half is the fade in and its second half the fade out. */
+typedef void (*stretch_overlap_t)(int16_t *out, const int16_t *fall, const int16_t *rise, const float *window, size_t frames);
+
+struct stretch
+{
+   fft_t *fft;
+   fft_complex_t packed[STRETCH_FFT_SIZE];
+   fft_complex_t spectrum[STRETCH_FFT_SIZE];
+   float corr[STRETCH_FFT_SIZE];
+   float search[STRETCH_SEARCH];
+   float energy[STRETCH_LAGS];
+   float window[STRETCH_FRAME * 2];  /* per sample, both channels */
+
+   /* the first half of the last piece, played before the next one is made */
+   int16_t output[STRETCH_HOP * 2];
+   size_t output_pos;
+   size_t output_frames;
+
+   /* Everything else only points into the input, so reading it again restores the stretch. */
+   int16_t input[STRETCH_INPUT_FRAMES * 2];
+   size_t input_frames;
+   size_t overlap;                   /* where the input carried on from the piece before the last one */
+   size_t next;                      /* where the input carries on from the last piece */
+   double pos;                       /* where the speed puts the last piece */
+   bool running;
+};
+
+static size_t stretch_match_c(const float *corr, const float *search, float *energy, size_t len, size_t lags)
+{
+   float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+   float e;
+   float max;
+   float floor_energy;
+   float best_score = -FLT_MAX;
+   size_t best = 0;
+   size_t i;
+   size_t d;
+
+   /* summed in the same order as the vector kernels, so every kernel picks the same offset */
+   for (i = 0; i + 4 <= len; i += 4)
+   {
+      sum[0] += search[i + 0] * search[i + 0];
+      sum[1] += search[i + 1] * search[i + 1];
+      sum[2] += search[i + 2] * search[i + 2];
+      sum[3] += search[i + 3] * search[i + 3];
+   }
+
+   e = (sum[0] + sum[2]) + (sum[1] + sum[3]);
+
+   for (; i < len; i++)
+      e += search[i] * search[i];
+
+   energy[0] = max = e;
+
+   /* each offset gains the sample that enters its window and loses the one that leaves it */
+   for (d = 1; d + 4 <= lags; d += 4)
+   {
+      float d0 = search[d + len - 1] * search[d + len - 1] - search[d - 1] * search[d - 1];
+      float d1 = search[d + len + 0] * search[d + len + 0] - search[d + 0] * search[d + 0];
+      float d2 = search[d + len + 1] * search[d + len + 1] - search[d + 1] * search[d + 1];
+      float d3 = search[d + len + 2] * search[d + len + 2] - search[d + 2] * search[d + 2];
+
+      energy[d + 0] = e + d0;
+      energy[d + 1] = e + (d1 + d0);
+      energy[d + 2] = e + ((d2 + d1) + d0);
+      energy[d + 3] = e + ((d3 + d2) + (d1 + d0));
+
+      e = energy[d + 3];
+      max = MAX(max, MAX(MAX(energy[d + 0], energy[d + 1]), MAX(energy[d + 2], energy[d + 3])));
+   }
+
+   for (; d < lags; d++)
+   {
+      e += search[d + len - 1] * search[d + len - 1] - search[d - 1] * search[d - 1];
+      energy[d] = e;
+      max = MAX(max, e);
+   }
+
+   floor_energy = max * STRETCH_ENERGY_FLOOR + 1.0f;
+
+   /* the correlation squared over the energy, with its sign, so an inverted match never wins */
+   for (d = 0; d < lags; d++)
+   {
+      float score = corr[d] * fabsf(corr[d]) / MAX(energy[d], floor_energy);
+
+      if (score > best_score)
+      {
+         best_score = score;
+         best = d;
+      }
+   }
+
+   return best;
+}
+
+static void stretch_overlap_add_c(int16_t *out, const int16_t *fall, const int16_t *rise, const float *window, size_t frames)
+{
+   size_t samples = frames * 2;
+   size_t i;
+
+   for (i = 0; i < samples; i++)
+      out[i] = simd_to_int16(fall[i] * window[samples + i] + rise[i] * window[i]);
+}
+
+#ifdef SIMD_HAVE_SSE2
+static size_t stretch_match_sse2(const float *corr, const float *search, float *energy, size_t len, size_t lags)
+{
+   __m128 sum = _mm_setzero_ps();
+   __m128 e;
+   __m128 max;
+   __m128 floor_energy;
+   __m128 sign = _mm_set1_ps(-0.0f);
+   __m128 best_score = _mm_set1_ps(-FLT_MAX);
+   __m128i best_lag = _mm_setzero_si128();
+   __m128i lag = _mm_setr_epi32(0, 1, 2, 3);
+   __m128i four = _mm_set1_epi32(4);
+   float scores[4];
+   int lags_found[4];
+   float best_found = -FLT_MAX;
+   size_t best = 0;
+   size_t i;
+   size_t d;
+
+   for (i = 0; i + 4 <= len; i += 4)
+   {
+      __m128 s = _mm_loadu_ps(search + i);
+      sum = _mm_add_ps(sum, _mm_mul_ps(s, s));
+   }
+
+   sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+   sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 1, 1, 1)));
+
+   for (; i < len; i++)
+      sum = _mm_add_ss(sum, _mm_set_ss(search[i] * search[i]));
+
+   e = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(0, 0, 0, 0));
+   max = e;
+   _mm_store_ss(energy, e);
+
+   for (d = 1; d + 4 <= lags; d += 4)
+   {
+      __m128 enter = _mm_loadu_ps(search + d + len - 1);
+      __m128 leave = _mm_loadu_ps(search + d - 1);
+      __m128 delta = _mm_sub_ps(_mm_mul_ps(enter, enter), _mm_mul_ps(leave, leave));
+
+      /* running sum of the changes across the four offsets */
+      delta = _mm_add_ps(delta, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(delta), 4)));
+      delta = _mm_add_ps(delta, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(delta), 8)));
+
+      delta = _mm_add_ps(e, delta);
+      _mm_storeu_ps(energy + d, delta);
+
+      e = _mm_shuffle_ps(delta, delta, _MM_SHUFFLE(3, 3, 3, 3));
+      max = _mm_max_ps(max, delta);
+   }
+
+   max = _mm_max_ps(max, _mm_movehl_ps(max, max));
+   max = _mm_max_ss(max, _mm_shuffle_ps(max, max, _MM_SHUFFLE(1, 1, 1, 1)));
+
+   {
+      float e_last = _mm_cvtss_f32(e);
+      float max_last = _mm_cvtss_f32(max);
+
+      for (; d < lags; d++)
+      {
+         e_last += search[d + len - 1] * search[d + len - 1] - search[d - 1] * search[d - 1];
+         energy[d] = e_last;
+         max_last = MAX(max_last, e_last);
+      }
+
+      floor_energy = _mm_set1_ps(max_last * STRETCH_ENERGY_FLOOR + 1.0f);
+   }
+
+   for (d = 0; d + 4 <= lags; d += 4)
+   {
+      __m128 c = _mm_loadu_ps(corr + d);
+      __m128 score = _mm_div_ps(_mm_mul_ps(c, _mm_andnot_ps(sign, c)), _mm_max_ps(_mm_loadu_ps(energy + d), floor_energy));
+      __m128 better = _mm_cmpgt_ps(score, best_score);
+
+      best_score = _mm_or_ps(_mm_and_ps(better, score), _mm_andnot_ps(better, best_score));
+      best_lag = _mm_or_si128(_mm_and_si128(_mm_castps_si128(better), lag), _mm_andnot_si128(_mm_castps_si128(better), best_lag));
+      lag = _mm_add_epi32(lag, four);
+   }
+
+   _mm_storeu_ps(scores, best_score);
+   _mm_storeu_si128((__m128i*)lags_found, best_lag);
+
+   /* the first offset with the best score, like the C kernel */
+   for (i = 0; i < 4; i++)
+   {
+      if (scores[i] > best_found || (scores[i] == best_found && (size_t)lags_found[i] < best))
+      {
+         best_found = scores[i];
+         best = (size_t)lags_found[i];
+      }
+   }
+
+   for (; d < lags; d++)
+   {
+      float score = corr[d] * fabsf(corr[d]) / MAX(energy[d], _mm_cvtss_f32(floor_energy));
+
+      if (score > best_found)
+      {
+         best_found = score;
+         best = d;
+      }
+   }
+
+   return best;
+}
+
+static void stretch_overlap_add_sse2(int16_t *out, const int16_t *fall, const int16_t *rise, const float *window, size_t frames)
+{
+   size_t samples = frames * 2;
+   size_t i;
+
+   for (i = 0; i + 8 <= samples; i += 8)
+   {
+      __m128i f = _mm_loadu_si128((const __m128i*)(fall + i));
+      __m128i r = _mm_loadu_si128((const __m128i*)(rise + i));
+      __m128 f_lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(f, f), 16));
+      __m128 f_hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(f, f), 16));
+      __m128 r_lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(r, r), 16));
+      __m128 r_hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(r, r), 16));
+      __m128 lo = _mm_add_ps(_mm_mul_ps(f_lo, _mm_loadu_ps(window + samples + i)), _mm_mul_ps(r_lo, _mm_loadu_ps(window + i)));
+      __m128 hi = _mm_add_ps(_mm_mul_ps(f_hi, _mm_loadu_ps(window + samples + i + 4)), _mm_mul_ps(r_hi, _mm_loadu_ps(window + i + 4)));
+
+      _mm_storeu_si128((__m128i*)(out + i), simd_to_int16_sse2(lo, hi));
+   }
+
+   for (; i < samples; i++)
+      out[i] = simd_to_int16(fall[i] * window[samples + i] + rise[i] * window[i]);
+}
+#endif
+
+#ifdef SIMD_HAVE_NEON
+static size_t stretch_match_neon(const float *corr, const float *search, float *energy, size_t len, size_t lags)
+{
+   float32x4_t sum = vdupq_n_f32(0.0f);
+   float32x4_t zero = vdupq_n_f32(0.0f);
+   float32x4_t e;
+   float32x4_t max;
+   float32x4_t floor_energy;
+   float32x4_t best_score = vdupq_n_f32(-FLT_MAX);
+   uint32x4_t best_lag = vdupq_n_u32(0);
+   uint32x4_t lag;
+   uint32x4_t four = vdupq_n_u32(4);
+   static const uint32_t first_lags[4] = {0, 1, 2, 3};
+   float scores[4];
+   uint32_t lags_found[4];
+   float sums[4];
+   float best_found = -FLT_MAX;
+   float e_last;
+   float max_last;
+   size_t best = 0;
+   size_t i;
+   size_t d;
+
+   for (i = 0; i + 4 <= len; i += 4)
+   {
+      float32x4_t s = vld1q_f32(search + i);
+      sum = vaddq_f32(sum, vmulq_f32(s, s));
+   }
+
+   vst1q_f32(sums, sum);
+   e_last = (sums[0] + sums[2]) + (sums[1] + sums[3]);
+
+   for (; i < len; i++)
+      e_last += search[i] * search[i];
+
+   energy[0] = e_last;
+   e = vdupq_n_f32(e_last);
+   max = e;
+
+   for (d = 1; d + 4 <= lags; d += 4)
+   {
+      float32x4_t enter = vld1q_f32(search + d + len - 1);
+      float32x4_t leave = vld1q_f32(search + d - 1);
+      float32x4_t delta = vsubq_f32(vmulq_f32(enter, enter), vmulq_f32(leave, leave));
+
+      delta = vaddq_f32(delta, vextq_f32(zero, delta, 3));
+      delta = vaddq_f32(delta, vextq_f32(zero, delta, 2));
+
+      delta = vaddq_f32(e, delta);
+      vst1q_f32(energy + d, delta);
+
+      e = vdupq_n_f32(vgetq_lane_f32(delta, 3));
+      max = vmaxq_f32(max, delta);
+   }
+
+   vst1q_f32(sums, max);
+   e_last = vgetq_lane_f32(e, 0);
+   max_last = MAX(MAX(sums[0], sums[1]), MAX(sums[2], sums[3]));
+
+   for (; d < lags; d++)
+   {
+      e_last += search[d + len - 1] * search[d + len - 1] - search[d - 1] * search[d - 1];
+      energy[d] = e_last;
+      max_last = MAX(max_last, e_last);
+   }
+
+   floor_energy = vdupq_n_f32(max_last * STRETCH_ENERGY_FLOOR + 1.0f);
+   lag = vld1q_u32(first_lags);
+
+   for (d = 0; d + 4 <= lags; d += 4)
+   {
+      float32x4_t c = vld1q_f32(corr + d);
+      float32x4_t num = vmulq_f32(c, vabsq_f32(c));
+      float32x4_t den = vmaxq_f32(vld1q_f32(energy + d), floor_energy);
+      float32x4_t score;
+      uint32x4_t better;
+
+      /* there is no vector division on 32 bit ARM, so it is done a lane at a time */
+      score = vsetq_lane_f32(vgetq_lane_f32(num, 0) / vgetq_lane_f32(den, 0), num, 0);
+      score = vsetq_lane_f32(vgetq_lane_f32(num, 1) / vgetq_lane_f32(den, 1), score, 1);
+      score = vsetq_lane_f32(vgetq_lane_f32(num, 2) / vgetq_lane_f32(den, 2), score, 2);
+      score = vsetq_lane_f32(vgetq_lane_f32(num, 3) / vgetq_lane_f32(den, 3), score, 3);
+
+      better = vcgtq_f32(score, best_score);
+      best_score = vbslq_f32(better, score, best_score);
+      best_lag = vbslq_u32(better, lag, best_lag);
+      lag = vaddq_u32(lag, four);
+   }
+
+   vst1q_f32(scores, best_score);
+   vst1q_u32(lags_found, best_lag);
+
+   for (i = 0; i < 4; i++)
+   {
+      if (scores[i] > best_found || (scores[i] == best_found && lags_found[i] < best))
+      {
+         best_found = scores[i];
+         best = lags_found[i];
+      }
+   }
+
+   for (; d < lags; d++)
+   {
+      float score = corr[d] * fabsf(corr[d]) / MAX(energy[d], vgetq_lane_f32(floor_energy, 0));
+
+      if (score > best_found)
+      {
+         best_found = score;
+         best = d;
+      }
+   }
+
+   return best;
+}
+
+static void stretch_overlap_add_neon(int16_t *out, const int16_t *fall, const int16_t *rise, const float *window, size_t frames)
+{
+   size_t samples = frames * 2;
+   size_t i;
+
+   for (i = 0; i + 8 <= samples; i += 8)
+   {
+      int16x8_t f = vld1q_s16(fall + i);
+      int16x8_t r = vld1q_s16(rise + i);
+      float32x4_t lo = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(f))), vld1q_f32(window + samples + i));
+      float32x4_t hi = vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(f))), vld1q_f32(window + samples + i + 4));
+
+      lo = vmlaq_f32(lo, vcvtq_f32_s32(vmovl_s16(vget_low_s16(r))), vld1q_f32(window + i));
+      hi = vmlaq_f32(hi, vcvtq_f32_s32(vmovl_s16(vget_high_s16(r))), vld1q_f32(window + i + 4));
+
+      vst1q_s16(out + i, simd_to_int16_neon(lo, hi));
+   }
+
+   for (; i < samples; i++)
+      out[i] = simd_to_int16(fall[i] * window[samples + i] + rise[i] * window[i]);
+}
+#endif
+
+static stretch_match_t stretch_match = stretch_match_c;
+static stretch_overlap_t stretch_overlap_add = stretch_overlap_add_c;
+static const char *stretch_kernel_name = "C";
+
+void stretch_init(uint64_t cpu_features)
+{
+   stretch_match_t match = stretch_match_c;
+   stretch_overlap_t overlap_add = stretch_overlap_add_c;
+   const char *name = "C";
+
+#ifdef SIMD_HAVE_SSE2
+   if (cpu_features & RETRO_SIMD_SSE2)
+   {
+      match = stretch_match_sse2;
+      overlap_add = stretch_overlap_add_sse2;
+      name = "SSE2";
+   }
+#endif
+
+#ifdef SIMD_HAVE_NEON
+   if (cpu_features & (RETRO_SIMD_NEON | RETRO_SIMD_ASIMD))
+   {
+      match = stretch_match_neon;
+      overlap_add = stretch_overlap_add_neon;
+      name = "NEON";
+   }
+#endif
+
+   (void)cpu_features;
+
+   stretch_match = match;
+   stretch_overlap_add = overlap_add;
+   stretch_kernel_name = name;
+}
+
+const char* stretch_get_kernel_name(void)
+{
+   return stretch_kernel_name;
+}
+
+stretch_t* stretch_new(void)
+{
+   stretch_t *stretch = (stretch_t*)calloc(1, sizeof(*stretch));
+   size_t i;
+
+   if (!stretch)
+      return NULL;
+
+   stretch->fft = fft_new(STRETCH_FFT_LOG2);
+
+   if (!stretch->fft)
+   {
+      free(stretch);
+      return NULL;
+   }
+
+   /* periodic, so pieces half a piece apart add up to exactly 1 */
+   for (i = 0; i < STRETCH_FRAME; i++)
+   {
+      float w = (float)(0.5 - 0.5 * cos(2.0 * STRETCH_PI * i / STRETCH_FRAME));
+
+      stretch->window[i * 2 + 0] = w;
+      stretch->window[i * 2 + 1] = w;
+   }
+
+   return stretch;
+}
+
+void stretch_free(stretch_t *stretch)
+{
+   if (!stretch)
+      return;
+
+   fft_free(stretch->fft);
+   free(stretch);
+}
+
+void stretch_reset(stretch_t *stretch)
+{
+   stretch->output_pos = 0;
+   stretch->output_frames = 0;
+   stretch->input_frames = 0;
+   stretch->overlap = 0;
+   stretch->next = 0;
+   stretch->pos = 0.0;
+   stretch->running = false;
+}
+
+bool stretch_is_active(const stretch_t *stretch)
+{
+   return stretch->running || stretch->output_pos < stretch->output_frames;
+}
+
+/* reads until the input holds frames frames, false if read ran out first */
+static bool stretch_fill(stretch_t *stretch, size_t frames, stretch_read_t read, void *data)
+{
+   while (stretch->input_frames < frames)
+   {
+      size_t count = read(data, stretch->input + stretch->input_frames * 2, frames - stretch->input_frames);
+
+      if (!count)
+         return false;
+
+      stretch->input_frames += count;
+   }
+
+   return true;
+}
+
+/* Correlates the piece that would carry on from the last one with every offset of the search window at
+ * once. Both are real, so they go through one complex FFT as its real and imaginary parts. */
+static void stretch_correlate(stretch_t *stretch, size_t start)
+{
+   const int16_t *search = stretch->input + start * 2;
+   const int16_t *continuation = stretch->input + stretch->next * 2;
+   size_t i;
+
+   for (i = 0; i < STRETCH_FFT_SIZE; i++)
+   {
+      stretch->packed[i].real = i < STRETCH_SEARCH ? (float)(search[i * 2] + search[i * 2 + 1]) : 0.0f;
+      stretch->packed[i].imag = i < STRETCH_FRAME ? (float)(continuation[i * 2] + continuation[i * 2 + 1]) : 0.0f;
+
+      if (i < STRETCH_SEARCH)
+         stretch->search[i] = stretch->packed[i].real;
+   }
+
+   fft_process_forward_complex(stretch->fft, stretch->spectrum, stretch->packed, 1);
+
+   for (i = 0; i < STRETCH_FFT_SIZE; i++)
+   {
+      fft_complex_t z = stretch->spectrum[i];
+      fft_complex_t mirror = fft_complex_conj(stretch->spectrum[(STRETCH_FFT_SIZE - i) & (STRETCH_FFT_SIZE - 1)]);
+      fft_complex_t sum = fft_complex_add(z, mirror);
+      fft_complex_t diff = fft_complex_sub(z, mirror);
+      fft_complex_t s;
+      fft_complex_t t_conj;
+
+      /* the spectra of the search window and of the piece, the latter conjugated */
+      s.real = sum.real * 0.5f;
+      s.imag = sum.imag * 0.5f;
+      t_conj.real = diff.imag * 0.5f;
+      t_conj.imag = diff.real * 0.5f;
+
+      stretch->packed[i] = fft_complex_mul(s, t_conj);
+   }
+
+   fft_process_inverse(stretch->fft, stretch->corr, stretch->packed, 1);
+}
+
+/* makes the next piece, false if read ran out */
+static bool stretch_piece(stretch_t *stretch, double speed, stretch_read_t read, void *data)
+{
+   double pos;
+   size_t start;
+   size_t best;
+   size_t drop;
+
+   if (!stretch->running)
+   {
+      if (!stretch_fill(stretch, STRETCH_FRAME, read, data))
+         return false;
+
+      /* as if a piece that ends where the input starts had just been played, which the first piece
+       * then carries on from without a seam */
+      stretch->overlap = 0;
+      stretch->next = 0;
+      stretch->pos = -STRETCH_HOP;
+      stretch->running = true;
+   }
+
+   pos = stretch->pos + STRETCH_HOP * speed;
+   start = pos > STRETCH_SEEK ? (size_t)pos - STRETCH_SEEK : 0;
+
+   if (!stretch_fill(stretch, MAX(start + STRETCH_SEARCH, stretch->next + STRETCH_FRAME), read, data))
+      return false;
+
+   stretch_correlate(stretch, start);
+   best = start + stretch_match(stretch->corr, stretch->search, stretch->energy, STRETCH_FRAME, STRETCH_LAGS);
+
+   stretch_overlap_add(stretch->output, stretch->input + stretch->next * 2, stretch->input + best * 2, stretch->window, STRETCH_HOP);
+   stretch->output_pos = 0;
+   stretch->output_frames = STRETCH_HOP;
+
+   stretch->overlap = stretch->next;
+   stretch->next = best + STRETCH_HOP;
+   stretch->pos = pos;
+
+   /* The next piece is at least half a hop further on, so nothing before this is looked at again.
+    * The last piece and the one it overlaps are kept to make it again when the state is restored. */
+   drop = MIN(MIN(stretch->overlap, best), pos > 0.0 ? (size_t)pos : 0);
+
+   memmove(stretch->input, stretch->input + drop * 2, (stretch->input_frames - drop) * 2 * sizeof(int16_t));
+   stretch->input_frames -= drop;
+   stretch->overlap -= drop;
+   stretch->next -= drop;
+   stretch->pos -= drop;
+
+   return true;
+}
+
+size_t stretch_process(stretch_t *stretch, int16_t *out, size_t frames, double speed, stretch_read_t read, void *data)
+{
+   size_t done = 0;
+
+   speed = MIN(MAX(speed, STRETCH_MIN_SPEED), STRETCH_MAX_SPEED);
+
+   while (done < frames)
+   {
+      size_t count;
+
+      if (stretch->output_pos < stretch->output_frames)
+      {
+         count = MIN(frames - done, stretch->output_frames - stretch->output_pos);
+
+         memcpy(out + done * 2, stretch->output + stretch->output_pos * 2, count * 2 * sizeof(int16_t));
+
+         stretch->output_pos += count;
+         done += count;
+         continue;
+      }
+
+      if (speed != 1.0)
+      {
+         if (!stretch_piece(stretch, speed, read, data))
+            break;
+         continue;
+      }
+
+      if (!stretch->running)
+      {
+         done += read(data, out + done * 2, frames - done);
+         break;
+      }
+
+      /* The input after the last piece carries on from it exactly, so playing the rest of it as it is
+       * goes back to normal speed without a seam. Then the input is passed through. */
+      if (stretch->next < stretch->input_frames)
+      {
+         count = MIN(frames - done, stretch->input_frames - stretch->next);
+
+         memcpy(out + done * 2, stretch->input + stretch->next * 2, count * 2 * sizeof(int16_t));
+
+         stretch->next += count;
+         done += count;
+         continue;
+      }
+
+      stretch_reset(stretch);
+   }
+
+   return done;
+}
+
+void stretch_get_state(const stretch_t *stretch, stretch_state_t *state)
+{
+   state->input_frames = (uint32_t)stretch->input_frames;
+   state->overlap = (uint32_t)stretch->overlap;
+   state->next = (uint32_t)stretch->next;
+   state->output_pos = (uint32_t)stretch->output_pos;
+   state->output_frames = (uint32_t)stretch->output_frames;
+   state->pos = stretch->pos;
+   state->running = stretch->running;
+}
+
+bool stretch_set_state(stretch_t *stretch, const stretch_state_t *state, stretch_read_t read, void *data)
+{
+   stretch_reset(stretch);
+
+   if (state->input_frames > STRETCH_INPUT_FRAMES || state->next > state->input_frames || state->overlap > state->input_frames ||
+         state->output_pos > state->output_frames || (state->output_frames && state->output_frames != STRETCH_HOP) ||
+         !(state->pos >= -STRETCH_HOP && state->pos <= STRETCH_INPUT_FRAMES))
+      return false;
+
+   /* the last piece is made again if some of it is still to be played */
+   if (state->output_pos < state->output_frames &&
+         (state->next < STRETCH_HOP || state->overlap + STRETCH_HOP > state->input_frames))
+      return false;
+
+   if (!stretch_fill(stretch, state->input_frames, read, data))
+   {
+      stretch_reset(stretch);
+      return false;
+   }
+
+   stretch->overlap = state->overlap;
+   stretch->next = state->next;
+   stretch->output_pos = state->output_pos;
+   stretch->output_frames = state->output_frames;
+   stretch->pos = state->pos;
+   stretch->running = state->running;
+
+   if (stretch->output_pos < stretch->output_frames)
+      stretch_overlap_add(stretch->output, stretch->input + stretch->overlap * 2,
+            stretch->input + (stretch->next - STRETCH_HOP) * 2, stretch->window, STRETCH_HOP);
+
+   return true;
+}
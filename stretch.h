@@ -0,0 +1,73 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef STRETCH_H__
+#define STRETCH_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <boolean.h>
+
+/* Plays interleaved stereo audio faster or slower without changing its pitch (WSOLA). The output is
+ * made of overlapping windowed pieces of the input, each picked near where the speed puts it, at the
+ * offset whose audio best continues the previous piece. The work per output frame does not depend on the speed. */
+typedef struct stretch stretch_t;
+
+#define STRETCH_MIN_SPEED 0.5
+#define STRETCH_MAX_SPEED 2.0
+
+/* Where a stretch is, without any audio: restoring it reads the input_frames it held again. */
+typedef struct
+{
+   uint32_t input_frames;
+   uint32_t overlap;
+   uint32_t next;
+   uint32_t output_pos;
+   uint32_t output_frames;
+   double pos;
+   bool running;
+} stretch_state_t;
+
+/* supplies input frames, returns how many it had */
+typedef size_t (*stretch_read_t)(void *data, int16_t *buf, size_t frames);
+
+/* Picks the fastest kernels for the given RETRO_SIMD_* feature mask. */
+void stretch_init(uint64_t cpu_features);
+
+const char* stretch_get_kernel_name(void);
+
+stretch_t* stretch_new(void);
+
+void stretch_free(stretch_t *stretch);
+
+/* Drops the input held, for input that does not follow on from it. */
+void stretch_reset(stretch_t *stretch);
+
+/* true while input read earlier is still to be played */
+bool stretch_is_active(const stretch_t *stretch);
+
+/* Fills out with up to frames frames played at speed, taking the input from read. At 1.0 the input
+ * is passed through unchanged once what was held is played. Returns how many frames were made,
+ * less than frames only if read ran out. */
+size_t stretch_process(stretch_t *stretch, int16_t *out, size_t frames, double speed, stretch_read_t read, void *data);
+
+void stretch_get_state(const stretch_t *stretch, stretch_state_t *state);
+
+/* Reads the input again from where it started when the state was taken and carries on as the stretch
+ * did then. False, and the stretch is reset, if the state is not valid or read ran out. */
+bool stretch_set_state(stretch_t *stretch, const stretch_state_t *state, stretch_read_t read, void *data);
+
+#endif /* STRETCH_H__ */
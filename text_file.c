@@ -0,0 +1,95 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <streams/file_stream.h>
+#include <rthreads/rthreads.h>
+#include <features/features_cpu.h>
+#include <retro_atomic.h>
+#include <retro_miscellaneous.h>
+
+#include "text_file.h"
+
+static slock_t *text_file_lock_ptr = NULL;
+static volatile long text_file_tmp_count = 0;
+
+char* text_file_split_line(char *line)
+{
+   char *end = strchr(line, '\n');
+
+   if (!end)
+      return NULL;
+
+   *end = '\0';
+
+   return end + 1;
+}
+
+bool text_file_replace(const char *path, const char *data, size_t len)
+{
+   char tmp_path[PATH_MAX_LENGTH];
+
+   /* a name of its own, so writers that do not share the lock, like another process, never write the same one */
+   snprintf(tmp_path, sizeof(tmp_path), "%s.%llx-%lx.tmp", path,
+         (unsigned long long)cpu_features_get_time_usec(), (unsigned long)RETRO_ATOMIC_INC(&text_file_tmp_count));
+
+   if (!filestream_write_file(tmp_path, data, (int64_t)len))
+   {
+      filestream_delete(tmp_path);
+      return false;
+   }
+
+   /* Windows does not rename onto a file that exists */
+   if (filestream_rename(tmp_path, path) != 0)
+   {
+      filestream_delete(path);
+
+      if (filestream_rename(tmp_path, path) != 0)
+      {
+         filestream_delete(tmp_path);
+         return false;
+      }
+   }
+
+   return true;
+}
+
+/* made by whoever needs it first, one made at the same time by another thread is dropped */
+static slock_t* text_file_get_lock(void)
+{
+   slock_t *lock = (slock_t*)RETRO_ATOMIC_LOAD_PTR_ACQUIRE(&text_file_lock_ptr);
+
+   if (lock)
+      return lock;
+
+   lock = slock_new();
+
+   if (lock && !RETRO_ATOMIC_CAS_PTR(&text_file_lock_ptr, NULL, lock))
+      slock_free(lock);
+
+   return (slock_t*)RETRO_ATOMIC_LOAD_PTR_ACQUIRE(&text_file_lock_ptr);
+}
+
+void text_file_lock(void)
+{
+   slock_lock(text_file_get_lock());
+}
+
+void text_file_unlock(void)
+{
+   slock_unlock(text_file_get_lock());
+}
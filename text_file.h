@@ -0,0 +1,39 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef TEXT_FILE_H__
+#define TEXT_FILE_H__
+
+#include <stddef.h>
+#include <boolean.h>
+
+/* The line based text files the disc cache and the content index are kept in. Every player reads and
+ * rewrites them whole, so a change is made between text_file_lock() and text_file_unlock() to not
+ * lose what another player wrote in the meantime. */
+
+/* Ends line at its newline and returns the one after it, NULL after the last. */
+char* text_file_split_line(char *line);
+
+/* Replaces the file at path with len bytes of data. It is written next to it first, so a crash
+ * halfway through leaves the old file. */
+bool text_file_replace(const char *path, const char *data, size_t len);
+
+/* One lock for the process, held from reading a file to writing it back. */
+void text_file_lock(void);
+
+void text_file_unlock(void);
+
+#endif /* TEXT_FILE_H__ */
@@ -0,0 +1,362 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <streams/file_stream.h>
+#include <file/file_path.h>
+#include <compat/strl.h>
+#include <retro_miscellaneous.h>
+
+#include "track_index.h"
+#include "text_file.h"
+
+/* longest line written besides the fingerprint, which is 8 digits per sub-fingerprint more */
+#define TRACK_INDEX_LINE_BYTES 64
+
+/* entries of other content are only compared when they are within this many frames as long, 10 s */
+#define TRACK_INDEX_SIMILAR_FRAMES (44100 * 10)
+
+/* fingerprints closer than this are the same recording, unrelated audio is at about 0.5 */
+#define TRACK_INDEX_SIMILAR_DISTANCE 0.2f
+
+struct track_index
+{
+   track_index_entry_t *entries;
+   size_t count;
+   size_t capacity;
+   size_t *slots;          /* by CRC and length, the entry there plus one, 0 if the slot is free */
+   size_t num_slots;       /* a power of two, at least twice count */
+};
+
+/* the slot of the entry with this content, or the free one it goes in, probing on from its hash */
+static size_t track_index_slot(const size_t *slots, size_t num_slots, const track_index_entry_t *entries,
+      uint32_t crc, uint32_t frames)
+{
+   size_t mask = num_slots - 1;
+   size_t i = (size_t)(crc ^ (frames * 0x9E3779B1u)) & mask;
+
+   while (slots[i])
+   {
+      const track_index_entry_t *entry = &entries[slots[i] - 1];
+
+      if (entry->crc == crc && entry->frames == frames)
+         break;
+
+      i = (i + 1) & mask;
+   }
+
+   return i;
+}
+
+/* twice as many slots with every entry put back, false if memory ran out */
+static bool track_index_grow_slots(track_index_t *index)
+{
+   size_t num_slots = index->num_slots ? index->num_slots * 2 : 128;
+   size_t *slots = (size_t*)calloc(num_slots, sizeof(*slots));
+   size_t i;
+
+   if (!slots)
+      return false;
+
+   for (i = 0; i < index->count; i++)
+      slots[track_index_slot(slots, num_slots, index->entries, index->entries[i].crc, index->entries[i].frames)] = i + 1;
+
+   free(index->slots);
+   index->slots = slots;
+   index->num_slots = num_slots;
+
+   return true;
+}
+
+/* a new entry at the end, which must not have the content of another, NULL if memory ran out */
+static track_index_entry_t* track_index_append(track_index_t *index, uint32_t crc, uint32_t frames)
+{
+   track_index_entry_t *entry;
+
+   if ((index->count + 1) * 2 > index->num_slots && !track_index_grow_slots(index))
+      return NULL;
+
+   if (index->count == index->capacity)
+   {
+      size_t capacity = index->capacity ? index->capacity * 2 : 64;
+      track_index_entry_t *entries = (track_index_entry_t*)realloc(index->entries, capacity * sizeof(*entries));
+
+      if (!entries)
+         return NULL;
+
+      index->entries = entries;
+      index->capacity = capacity;
+   }
+
+   entry = &index->entries[index->count++];
+   memset(entry, 0, sizeof(*entry));
+   entry->crc = crc;
+   entry->frames = frames;
+
+   index->slots[track_index_slot(index->slots, index->num_slots, index->entries, crc, frames)] = index->count;
+
+   return entry;
+}
+
+static void track_index_parse_fingerprint(track_index_entry_t *entry, const char *value)
+{
+   entry->fingerprint_len = 0;
+
+   while (entry->fingerprint_len < FINGERPRINT_LEN && strlen(value) >= 8)
+   {
+      char digits[9];
+
+      memcpy(digits, value, 8);
+      digits[8] = '\0';
+
+      entry->fingerprint[entry->fingerprint_len++] = (uint32_t)strtoul(digits, NULL, 16);
+      value += 8;
+   }
+}
+
+track_index_t* track_index_load(const char *path)
+{
+   track_index_t *index = (track_index_t*)calloc(1, sizeof(*index));
+   track_index_entry_t *entry = NULL;
+   void *buf = NULL;
+   int64_t len = 0;
+   char *line;
+   char *next;
+
+   if (!index)
+      return NULL;
+
+   if (!path_is_valid(path) || !filestream_read_file(path, &buf, &len))
+      return index;
+
+   for (line = (char*)buf; line; line = next)
+   {
+      unsigned crc = 0;
+      unsigned frames = 0;
+      char name[16];
+      int value_pos = 0;
+      const char *value;
+
+      next = text_file_split_line(line);
+
+      if (sscanf(line, "%8x %u %15[^=]=%n", &crc, &frames, name, &value_pos) != 3 || !value_pos)
+         continue;
+
+      value = line + value_pos;
+
+      /* the lines of an entry are written together */
+      if (!entry || entry->crc != crc || entry->frames != frames)
+      {
+         entry = (track_index_entry_t*)track_index_find(index, crc, frames);
+
+         if (!entry && !(entry = track_index_append(index, crc, frames)))
+         {
+            track_index_free(index);
+            free(buf);
+            return NULL;
+         }
+      }
+
+      /* names that are not known here are from a newer version and left alone */
+      if (!strcmp(name, "disc"))
+      {
+         unsigned disc_id = 0;
+         unsigned track = 0;
+
+         if (sscanf(value, "%8x/%u", &disc_id, &track) == 2 && entry->num_discs < TRACK_INDEX_MAX_DISCS)
+         {
+            entry->discs[entry->num_discs].disc_id = disc_id;
+            entry->discs[entry->num_discs].track = (unsigned char)track;
+            entry->num_discs++;
+         }
+      }
+      else if (!strcmp(name, "loudness"))
+      {
+         entry->loudness.loudness = (float)atof(value);
+         entry->loudness.analyzed = true;
+      }
+      else if (!strcmp(name, "peak"))
+         entry->loudness.peak = (float)atof(value);
+      else if (!strcmp(name, "start"))
+      {
+         entry->audible.start = (uint32_t)strtoul(value, NULL, 10);
+         entry->audible.analyzed = true;
+      }
+      else if (!strcmp(name, "end"))
+         entry->audible.end = (uint32_t)strtoul(value, NULL, 10);
+      else if (!strcmp(name, "fingerprint"))
+         track_index_parse_fingerprint(entry, value);
+   }
+
+   free(buf);
+
+   return index;
+}
+
+void track_index_free(track_index_t *index)
+{
+   if (!index)
+      return;
+
+   free(index->entries);
+   free(index->slots);
+   free(index);
+}
+
+static size_t track_index_print(char *out, size_t size, const track_index_entry_t *entry)
+{
+   size_t len = 0;
+   unsigned i;
+
+   for (i = 0; i < entry->num_discs; i++)
+      len += (size_t)snprintf(out + len, size - len, "%08x %u disc=%08x/%u\n", (unsigned)entry->crc, (unsigned)entry->frames,
+            (unsigned)entry->discs[i].disc_id, (unsigned)entry->discs[i].track);
+
+   if (entry->loudness.analyzed)
+      len += (size_t)snprintf(out + len, size - len, "%08x %u loudness=%.2f\n%08x %u peak=%.5f\n",
+            (unsigned)entry->crc, (unsigned)entry->frames, entry->loudness.loudness,
+            (unsigned)entry->crc, (unsigned)entry->frames, entry->loudness.peak);
+
+   if (entry->audible.analyzed)
+      len += (size_t)snprintf(out + len, size - len, "%08x %u start=%u\n%08x %u end=%u\n",
+            (unsigned)entry->crc, (unsigned)entry->frames, (unsigned)entry->audible.start,
+            (unsigned)entry->crc, (unsigned)entry->frames, (unsigned)entry->audible.end);
+
+   if (entry->fingerprint_len)
+   {
+      len += (size_t)snprintf(out + len, size - len, "%08x %u fingerprint=", (unsigned)entry->crc, (unsigned)entry->frames);
+
+      for (i = 0; i < entry->fingerprint_len; i++)
+         len += (size_t)snprintf(out + len, size - len, "%08x", (unsigned)entry->fingerprint[i]);
+
+      len += strlcpy(out + len, "\n", size - len);
+   }
+
+   return len;
+}
+
+bool track_index_save(const track_index_t *index, const char *path)
+{
+   size_t size = index->count * ((TRACK_INDEX_MAX_DISCS + 5) * TRACK_INDEX_LINE_BYTES + FINGERPRINT_LEN * 8) + 1;
+   char *out = (char*)malloc(size);
+   size_t len = 0;
+   size_t i;
+   bool ok;
+
+   if (!out)
+      return false;
+
+   *out = '\0';
+
+   for (i = 0; i < index->count; i++)
+      len += track_index_print(out + len, size - len, &index->entries[i]);
+
+   ok = text_file_replace(path, out, len);
+
+   free(out);
+
+   return ok;
+}
+
+const track_index_entry_t* track_index_find(const track_index_t *index, uint32_t crc, uint32_t frames)
+{
+   size_t slot;
+
+   if (!index->num_slots)
+      return NULL;
+
+   slot = index->slots[track_index_slot(index->slots, index->num_slots, index->entries, crc, frames)];
+
+   return slot ? &index->entries[slot - 1] : NULL;
+}
+
+const track_index_entry_t* track_index_find_similar(const track_index_t *index, const track_index_entry_t *entry, float *distance)
+{
+   const track_index_entry_t *best = NULL;
+   float best_distance = TRACK_INDEX_SIMILAR_DISTANCE;
+   size_t i;
+
+   if (!entry->fingerprint_len)
+      return NULL;
+
+   for (i = 0; i < index->count; i++)
+   {
+      const track_index_entry_t *other = &index->entries[i];
+      float d;
+
+      if ((other->crc == entry->crc && other->frames == entry->frames) || !other->fingerprint_len ||
+            (other->frames > entry->frames ? other->frames - entry->frames : entry->frames - other->frames) > TRACK_INDEX_SIMILAR_FRAMES)
+         continue;
+
+      d = fingerprint_distance(entry->fingerprint, entry->fingerprint_len, other->fingerprint, other->fingerprint_len);
+
+      if (d < best_distance)
+      {
+         best_distance = d;
+         best = other;
+      }
+   }
+
+   if (best && distance)
+      *distance = best_distance;
+
+   return best;
+}
+
+bool track_index_add(track_index_t *index, const track_index_entry_t *entry, uint32_t disc_id, unsigned char track)
+{
+   track_index_entry_t *existing = (track_index_entry_t*)track_index_find(index, entry->crc, entry->frames);
+   unsigned i;
+
+   if (!existing)
+   {
+      if (!(existing = track_index_append(index, entry->crc, entry->frames)))
+         return false;
+
+      memcpy(existing, entry, sizeof(*existing));
+      existing->num_discs = 0;
+   }
+   else
+   {
+      /* the same audio measures the same, only what was not known yet is taken */
+      if (!existing->loudness.analyzed)
+         existing->loudness = entry->loudness;
+      if (!existing->audible.analyzed)
+         existing->audible = entry->audible;
+      if (!existing->fingerprint_len)
+      {
+         memcpy(existing->fingerprint, entry->fingerprint, sizeof(existing->fingerprint));
+         existing->fingerprint_len = entry->fingerprint_len;
+      }
+   }
+
+   for (i = 0; i < existing->num_discs; i++)
+   {
+      if (existing->discs[i].disc_id == disc_id && existing->discs[i].track == track)
+         return true;
+   }
+
+   if (existing->num_discs < TRACK_INDEX_MAX_DISCS)
+   {
+      existing->discs[existing->num_discs].disc_id = disc_id;
+      existing->discs[existing->num_discs].track = track;
+      existing->num_discs++;
+   }
+
+   return true;
+}
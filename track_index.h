@@ -0,0 +1,73 @@
+/*
+Copyright 2019 Brad Parker
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+#ifndef TRACK_INDEX_H__
+#define TRACK_INDEX_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <boolean.h>
+
+#include "disc_cache.h"
+#include "fingerprint.h"
+
+/* Every track scanned on any disc, by its content, kept in a text file next to the disc cache. Tracks
+ * with the same CRC-32 and length, which are most likely the same bit for bit, share a single entry
+ * listing all their discs. Every value is on a line of its own, "<crc> <frames> <name>=<value>". */
+typedef struct track_index track_index_t;
+
+/* discs listed per entry, later ones are still found by content but not listed */
+#define TRACK_INDEX_MAX_DISCS 16
+
+typedef struct
+{
+   uint32_t disc_id;
+   unsigned char track;
+} track_index_disc_t;
+
+typedef struct
+{
+   uint32_t crc;                              /* CRC-32 of the audio as it is on the disc */
+   uint32_t frames;
+   disc_cache_loudness_t loudness;
+   disc_cache_audible_t audible;
+   uint32_t fingerprint[FINGERPRINT_LEN];
+   unsigned fingerprint_len;
+   track_index_disc_t discs[TRACK_INDEX_MAX_DISCS];
+   unsigned num_discs;
+} track_index_entry_t;
+
+/* The index at path, empty if there is none yet. NULL if memory ran out. */
+track_index_t* track_index_load(const char *path);
+
+void track_index_free(track_index_t *index);
+
+/* Writes the whole index to path, which is swapped in whole. Whoever shares path with another player
+ * holds text_file_lock() from the load to the save. */
+bool track_index_save(const track_index_t *index, const char *path);
+
+/* the entry with this CRC and length, NULL if there is none */
+const track_index_entry_t* track_index_find(const track_index_t *index, uint32_t crc, uint32_t frames);
+
+/* The entry of other content that sounds most like entry, about as long and close enough to be the same
+ * recording, NULL if there is none. distance receives that of their fingerprints. */
+const track_index_entry_t* track_index_find_similar(const track_index_t *index, const track_index_entry_t *entry, float *distance);
+
+/* Adds entry, found as track of disc_id, or that disc to the entry that has its content. False if
+ * memory ran out. */
+bool track_index_add(track_index_t *index, const track_index_entry_t *entry, uint32_t disc_id, unsigned char track);
+
+#endif /* TRACK_INDEX_H__ */
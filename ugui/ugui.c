@@ -60,7 +60,7 @@
  void _UG_PutChar( char chr, UG_S16 x, UG_S16 y, UG_COLOR fc, UG_COLOR bc, const UG_FONT* font);
 
  /* Pointer to the gui */
-static UG_GUI* gui;
+static UG_THREAD_LOCAL UG_GUI* gui;
 
 #ifdef USE_FONT_4X6
 __UG_FONT_DATA unsigned char font_4x6[256][6]={
@@ -5629,7 +5629,7 @@ void _UG_HandleEvents( UG_WINDOW* wnd )
    UG_U16 i,objcnt;
    UG_OBJECT* obj;
    UG_U8 objstate;
-   static UG_MESSAGE msg;
+   static UG_THREAD_LOCAL UG_MESSAGE msg;
    msg.src = NULL;
 
    /* Handle window-related events */
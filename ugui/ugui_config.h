@@ -54,6 +54,13 @@ typedef signed long int       UG_S32;
 /* -------------------------------------------------------------------------------- */
 
 
+/* The selected GUI is per thread, so GUIs on different threads can draw at the same time */
+#if defined(_MSC_VER)
+#define UG_THREAD_LOCAL __declspec(thread)
+#else
+#define UG_THREAD_LOCAL __thread
+#endif
+
 /* Feature enablers */
 #define USE_PRERENDER_EVENT
 #define USE_POSTRENDER_EVENT
@@ -2,105 +2,150 @@
 #include <string/stdstring.h>
 #include <ugui.h>
 #include <stdio.h>
+#include "ugui_tools.h"
 
 #define UGUI_MAX_OBJECTS 3
 #define FONT FONT_8X8
 
-static UG_GUI gui;
-static UG_WINDOW gui_window;
-static UG_TEXTBOX gui_textbox;
-static UG_TEXTBOX gui_textbox_footer;
-static UG_OBJECT gui_objbuf_wnd[UGUI_MAX_OBJECTS];
-static unsigned *frame_buf = NULL;
-static int width = 0;
-static int height = 0;
-static char gui_message[4096] = {0};
-static char gui_footer[4096] = {0};
+struct gui
+{
+   UG_GUI ug;
+   UG_WINDOW window;
+   UG_TEXTBOX textbox;
+   UG_TEXTBOX textbox_footer;
+   UG_OBJECT objbuf_wnd[UGUI_MAX_OBJECTS];
+   unsigned *frame_buf;
+   int width;
+   int height;
+   char message[4096];
+   char footer[4096];
+};
+
+/* uGUI draws through a callback without a context, so it finds its frame buffer through the gui selected on this thread */
+static UG_THREAD_LOCAL gui_t *gui_selected = NULL;
+
+static void gui_select(gui_t *gui)
+{
+   gui_selected = gui;
+   UG_SelectGUI(&gui->ug);
+}
 
 static void gui_window_callback(UG_MESSAGE *msg)
 {
 }
 
-unsigned* gui_get_framebuffer(void)
+unsigned* gui_get_framebuffer(gui_t *gui)
 {
-   return frame_buf;
+   return gui->frame_buf;
 }
 
 /* uGUI callback that draws raw pixels onto our frame buffer */
 static void UserPixelSetFunction(UG_S16 x, UG_S16 y, UG_COLOR c)
 {
-   frame_buf[width * y + x] = c;
+   gui_selected->frame_buf[gui_selected->width * y + x] = c;
 }
 
-void gui_init(int w, int h, int bpp)
+gui_t* gui_new(int w, int h, int bpp)
 {
-   width = w;
-   height = h;
-   frame_buf = (unsigned*)calloc(width * height, bpp);
+   gui_t *gui = (gui_t*)calloc(1, sizeof(*gui));
+
+   if (!gui)
+      return NULL;
+
+   gui->width = w;
+   gui->height = h;
+   gui->frame_buf = (unsigned*)calloc(w * h, bpp);
+
+   if (!gui->frame_buf)
+   {
+      free(gui);
+      return NULL;
+   }
 
    /* init uGUI */
-   UG_Init(&gui, UserPixelSetFunction, width, height);
+   UG_Init(&gui->ug, UserPixelSetFunction, w, h);
+   gui_select(gui);
    UG_FontSelect(&FONT);
    UG_ConsoleSetBackcolor(0x1d1f21);
 
    /* create a single window with no buttons */
-   UG_WindowCreate(&gui_window, gui_objbuf_wnd, UGUI_MAX_OBJECTS, gui_window_callback);
-   UG_WindowSetForeColor(&gui_window, 0xc5c8c6);
-   UG_WindowSetBackColor(&gui_window, 0x1d1f21);
-   UG_WindowSetTitleColor(&gui_window, 0x5f819d);
+   UG_WindowCreate(&gui->window, gui->objbuf_wnd, UGUI_MAX_OBJECTS, gui_window_callback);
+   UG_WindowSetForeColor(&gui->window, 0xc5c8c6);
+   UG_WindowSetBackColor(&gui->window, 0x1d1f21);
+   UG_WindowSetTitleColor(&gui->window, 0x5f819d);
+
+   UG_WindowSetXStart(&gui->window, 0);
+   UG_WindowSetYStart(&gui->window, 0);
+   UG_WindowSetXEnd(&gui->window, w - 1);
+   UG_WindowSetYEnd(&gui->window, h - 1);
 
-   UG_WindowSetXStart(&gui_window, 0);
-   UG_WindowSetYStart(&gui_window, 0);
-   UG_WindowSetXEnd(&gui_window, width - 1);
-   UG_WindowSetYEnd(&gui_window, height - 1);
+   UG_TextboxCreate(&gui->window, &gui->textbox, TXB_ID_0, 0, 0, UG_WindowGetInnerWidth(&gui->window) - 1, UG_WindowGetInnerHeight(&gui->window) - 1);
+   UG_TextboxSetAlignment(&gui->window, TXB_ID_0, ALIGN_CENTER);
 
-   UG_TextboxCreate(&gui_window, &gui_textbox, TXB_ID_0, 0, 0, UG_WindowGetInnerWidth(&gui_window) - 1, UG_WindowGetInnerHeight(&gui_window) - 1);
-   UG_TextboxSetAlignment(&gui_window, TXB_ID_0, ALIGN_CENTER);
+   UG_TextboxCreate(&gui->window, &gui->textbox_footer, TXB_ID_1, 0, UG_WindowGetInnerHeight(&gui->window) - (FONT.char_height * 2), UG_WindowGetInnerWidth(&gui->window) - 1, UG_WindowGetInnerHeight(&gui->window) - 1);
+   UG_TextboxSetAlignment(&gui->window, TXB_ID_1, ALIGN_CENTER);
 
-   UG_TextboxCreate(&gui_window, &gui_textbox_footer, TXB_ID_1, 0, UG_WindowGetInnerHeight(&gui_window) - (FONT.char_height * 2), UG_WindowGetInnerWidth(&gui_window) - 1, UG_WindowGetInnerHeight(&gui_window) - 1);
-   UG_TextboxSetAlignment(&gui_window, TXB_ID_1, ALIGN_CENTER);
+   UG_WindowShow(&gui->window);
 
-   UG_WindowShow(&gui_window);
+   return gui;
 }
 
-void gui_set_message(const char *message)
+void gui_free(gui_t *gui)
 {
-   memset(gui_message, 0, sizeof(gui_message));
+   if (!gui)
+      return;
 
-   snprintf(gui_message, sizeof(gui_message), "%s", message);
+   if (gui_selected == gui)
+      gui_selected = NULL;
 
-   gui_message[sizeof(gui_message) - 1] = '\0';
+   free(gui->frame_buf);
+   free(gui);
+}
+
+void gui_set_message(gui_t *gui, const char *message)
+{
+   memset(gui->message, 0, sizeof(gui->message));
 
-   UG_TextboxSetText(&gui_window, TXB_ID_0, gui_message);
+   snprintf(gui->message, sizeof(gui->message), "%s", message);
+
+   gui->message[sizeof(gui->message) - 1] = '\0';
+
+   gui_select(gui);
+   UG_TextboxSetText(&gui->window, TXB_ID_0, gui->message);
 }
 
-void gui_set_footer(const char *message)
+void gui_set_footer(gui_t *gui, const char *message)
 {
-   memset(gui_footer, 0, sizeof(gui_footer));
+   memset(gui->footer, 0, sizeof(gui->footer));
 
-   snprintf(gui_footer, sizeof(gui_footer), "%s", message);
+   snprintf(gui->footer, sizeof(gui->footer), "%s", message);
 
-   gui_footer[sizeof(gui_footer) - 1] = '\0';
+   gui->footer[sizeof(gui->footer) - 1] = '\0';
 
-   UG_TextboxSetText(&gui_window, TXB_ID_1, gui_footer);
+   gui_select(gui);
+   UG_TextboxSetText(&gui->window, TXB_ID_1, gui->footer);
 }
 
-void gui_window_resize(int x, int y, int width, int height)
+void gui_window_resize(gui_t *gui, int x, int y, int width, int height)
 {
-   UG_WindowResize(&gui_window, x, y, width, height);
+   gui_select(gui);
+   UG_WindowResize(&gui->window, x, y, width, height);
 }
 
-void gui_set_window_title(const char *title)
+void gui_set_window_title(gui_t *gui, const char *title)
 {
-   UG_WindowSetTitleText(&gui_window, (char*)title);
-   UG_WindowSetTitleTextAlignment(&gui_window, ALIGN_CENTER);
+   gui_select(gui);
+   UG_WindowSetTitleText(&gui->window, (char*)title);
+   UG_WindowSetTitleTextAlignment(&gui->window, ALIGN_CENTER);
 }
 
-void gui_draw(void)
+void gui_draw(gui_t *gui)
 {
-   if (!string_is_empty(gui_message))
-      UG_TextboxSetText(&gui_window, TXB_ID_0, gui_message);
-   if (!string_is_empty(gui_footer))
-      UG_TextboxSetText(&gui_window, TXB_ID_1, gui_footer);
+   gui_select(gui);
+
+   if (!string_is_empty(gui->message))
+      UG_TextboxSetText(&gui->window, TXB_ID_0, gui->message);
+   if (!string_is_empty(gui->footer))
+      UG_TextboxSetText(&gui->window, TXB_ID_1, gui->footer);
    UG_Update();
 }
@@ -6,20 +6,26 @@ extern "C"
 {
 #endif
 
+/* A window with a message and a footer, drawn into its own frame buffer.
+ * Each gui_t is independent, different ones can be used from different threads. */
+typedef struct gui gui_t;
+
 /* bpp = bytes per pixel */
-void gui_init(int width, int height, int bpp);
+gui_t* gui_new(int width, int height, int bpp);
+
+void gui_free(gui_t *gui);
 
-void gui_draw(void);
+void gui_draw(gui_t *gui);
 
-void gui_set_window_title(const char *title);
+void gui_set_window_title(gui_t *gui, const char *title);
 
-void gui_set_message(const char *message);
+void gui_set_message(gui_t *gui, const char *message);
 
-void gui_set_footer(const char *message);
+void gui_set_footer(gui_t *gui, const char *message);
 
-void gui_window_resize(int x, int y, int width, int height);
+void gui_window_resize(gui_t *gui, int x, int y, int width, int height);
 
-unsigned* gui_get_framebuffer(void);
+unsigned* gui_get_framebuffer(gui_t *gui);
 
 #ifdef __cplusplus
 }